@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Asynchronous FW commands on top of the synchronous transports, see async.h.
+ *
+ * Workers take commands off a FIFO and run them through
+ * mlx5u_transport_cmd(), so stats and --record see them as usual. fwctl
+ * allows concurrent RPCs on one fd; the transports that can't overlap
+ * commands (daemon socket, replay cursors, simulator) serialize internally.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+#include "transport.h"
+#include "async.h"
+#include "sched.h"
+
+#define ASYNC_DEFAULT_WORKERS 4
+#define ASYNC_MAX_WORKERS 64
+
+struct async_req {
+	struct mlx5u_completion c;
+	int sched_class; /* of the submitter */
+	struct async_req *next;
+};
+
+struct async_list {
+	struct async_req *head;
+	struct async_req *tail;
+};
+
+struct mlx5u_async {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	struct async_list submitted;
+	struct async_list completed;
+	int inflight;
+	u64 next_token;
+	int stop;
+	int efd;
+	int nworkers;
+	pthread_t workers[];
+};
+
+static void list_push(struct async_list *l, struct async_req *req)
+{
+	req->next = NULL;
+	if (l->tail)
+		l->tail->next = req;
+	else
+		l->head = req;
+	l->tail = req;
+}
+
+static struct async_req *list_pop(struct async_list *l)
+{
+	struct async_req *req = l->head;
+
+	if (req) {
+		l->head = req->next;
+		if (!l->head)
+			l->tail = NULL;
+	}
+	return req;
+}
+
+static void list_free(struct async_list *l)
+{
+	struct async_req *req;
+
+	while ((req = list_pop(l)))
+		free(req);
+}
+
+static void efd_signal(int efd)
+{
+	u64 one = 1;
+
+	if (write(efd, &one, sizeof(one)) != sizeof(one))
+		dbg_msg(1, "async: eventfd write failed: %s\n", strerror(errno));
+}
+
+static void *async_worker(void *arg)
+{
+	struct mlx5u_async *as = arg;
+
+	for (;;) {
+		struct mlx5u_completion *c;
+		struct async_req *req;
+
+		pthread_mutex_lock(&as->lock);
+		while (!as->submitted.head && !as->stop)
+			pthread_cond_wait(&as->work, &as->lock);
+		req = list_pop(&as->submitted);
+		pthread_mutex_unlock(&as->lock);
+		if (!req)
+			break; /* stopping and drained */
+
+		c = &req->c;
+		mlx5u_sched_set_class(req->sched_class);
+		c->ret = mlx5u_transport_cmd(c->dev, c->in, c->inlen, c->out, c->outlen);
+		c->err = c->ret ? errno : 0;
+		if (!c->ret) {
+			c->status = MLX5_GET(mbox_out, c->out, status);
+			c->syndrome = MLX5_GET(mbox_out, c->out, syndrome);
+		}
+
+		pthread_mutex_lock(&as->lock);
+		list_push(&as->completed, req);
+		pthread_mutex_unlock(&as->lock);
+		efd_signal(as->efd);
+	}
+	return NULL;
+}
+
+struct mlx5u_async *mlx5u_async_create(int workers)
+{
+	struct mlx5u_async *as;
+	int err;
+
+	if (workers <= 0)
+		workers = ASYNC_DEFAULT_WORKERS;
+	if (workers > ASYNC_MAX_WORKERS)
+		workers = ASYNC_MAX_WORKERS;
+
+	as = calloc(1, sizeof(*as) + workers * sizeof(as->workers[0]));
+	if (!as)
+		return NULL;
+	as->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (as->efd < 0) {
+		err_msg("async: eventfd failed: %s\n", strerror(errno));
+		free(as);
+		return NULL;
+	}
+	pthread_mutex_init(&as->lock, NULL);
+	pthread_cond_init(&as->work, NULL);
+	as->next_token = 1;
+
+	for (; as->nworkers < workers; as->nworkers++) {
+		err = pthread_create(&as->workers[as->nworkers], NULL, async_worker, as);
+		if (err) {
+			err_msg("async: failed to start worker: %s\n", strerror(err));
+			mlx5u_async_destroy(as);
+			return NULL;
+		}
+	}
+	dbg_msg(2, "async: %d workers\n", as->nworkers);
+	return as;
+}
+
+void mlx5u_async_destroy(struct mlx5u_async *as)
+{
+	if (!as)
+		return;
+
+	pthread_mutex_lock(&as->lock);
+	as->stop = 1;
+	pthread_cond_broadcast(&as->work);
+	pthread_mutex_unlock(&as->lock);
+	for (int i = 0; i < as->nworkers; i++)
+		pthread_join(as->workers[i], NULL);
+
+	list_free(&as->submitted);
+	list_free(&as->completed);
+	close(as->efd);
+	pthread_cond_destroy(&as->work);
+	pthread_mutex_destroy(&as->lock);
+	free(as);
+}
+
+int mlx5u_async_fd(struct mlx5u_async *as)
+{
+	return as->efd;
+}
+
+u64 mlx5u_cmd_submit(struct mlx5u_async *as, struct mlx5u_dev *dev,
+		     void *in, size_t inlen, void *out, size_t outlen, void *ctx)
+{
+	struct async_req *req;
+	u64 token;
+
+	if (!dev || !in || !out) {
+		errno = EINVAL;
+		return 0;
+	}
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return 0;
+
+	req->c.dev = dev;
+	req->c.in = in;
+	req->c.inlen = inlen;
+	req->c.out = out;
+	req->c.outlen = outlen;
+	req->c.ctx = ctx;
+	req->sched_class = mlx5u_sched_get_class();
+
+	pthread_mutex_lock(&as->lock);
+	token = req->c.token = as->next_token++;
+	as->inflight++;
+	list_push(&as->submitted, req);
+	pthread_cond_signal(&as->work);
+	pthread_mutex_unlock(&as->lock);
+	return token;
+}
+
+int mlx5u_async_poll(struct mlx5u_async *as, struct mlx5u_completion *comps, int max)
+{
+	struct async_req *req;
+	int more, n = 0;
+	u64 cnt;
+
+	/* clear first: a completion queued after this re-arms the fd */
+	if (read(as->efd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+		dbg_msg(1, "async: eventfd read failed: %s\n", strerror(errno));
+
+	pthread_mutex_lock(&as->lock);
+	while (n < max && (req = list_pop(&as->completed))) {
+		comps[n++] = req->c;
+		free(req);
+	}
+	as->inflight -= n;
+	more = as->completed.head != NULL;
+	pthread_mutex_unlock(&as->lock);
+
+	/* keep the fd readable for what didn't fit in comps */
+	if (more)
+		efd_signal(as->efd);
+	return n;
+}
+
+int mlx5u_async_wait(struct mlx5u_async *as, struct mlx5u_completion *comps, int max,
+		     int timeout_ms)
+{
+	struct pollfd pfd = { .fd = as->efd, .events = POLLIN };
+	int n;
+
+	for (;;) {
+		n = mlx5u_async_poll(as, comps, max);
+		if (n || !mlx5u_async_inflight(as))
+			return n;
+
+		n = poll(&pfd, 1, timeout_ms);
+		if (n < 0 && errno != EINTR)
+			return -1;
+		if (!n)
+			return 0; /* timed out */
+	}
+}
+
+int mlx5u_async_inflight(struct mlx5u_async *as)
+{
+	int n;
+
+	pthread_mutex_lock(&as->lock);
+	n = as->inflight;
+	pthread_mutex_unlock(&as->lock);
+	return n;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_ASYNC_H__
+#define __MLX5CTL_ASYNC_H__
+
+#include <stddef.h>
+#include "ifcutil.h"
+
+/*
+ * Asynchronous FW commands.
+ *
+ * mlx5u_cmd_submit() queues a command and returns a token right away, a pool
+ * of worker threads runs the queued commands through the device transports
+ * (any number of devices) and the results land on a completion queue. The
+ * queue's eventfd (mlx5u_async_fd()) is readable while completions are
+ * pending, so an event loop can poll() it next to its other fds and decode
+ * responses while further commands are in flight.
+ *
+ * in and out must stay valid until the command's completion is reaped.
+ * Completions carry the raw result, nothing is printed on failure.
+ */
+
+struct mlx5u_async;
+struct mlx5u_dev;
+
+struct mlx5u_completion {
+	u64 token;
+	struct mlx5u_dev *dev;
+	void *in;
+	size_t inlen;
+	void *out;
+	size_t outlen;
+	void *ctx;    /* as passed to mlx5u_cmd_submit() */
+	int ret;      /* 0, or -1 if the transport failed */
+	int err;      /* errno when ret is -1 */
+	u8 status;    /* FW mailbox status when ret is 0 */
+	u32 syndrome;
+};
+
+/* workers <= 0 picks a default */
+struct mlx5u_async *mlx5u_async_create(int workers);
+/* Runs what was already submitted to completion, then frees everything */
+void mlx5u_async_destroy(struct mlx5u_async *as);
+int mlx5u_async_fd(struct mlx5u_async *as);
+
+/* Returns the command token, 0 with errno set on failure */
+u64 mlx5u_cmd_submit(struct mlx5u_async *as, struct mlx5u_dev *dev,
+		     void *in, size_t inlen, void *out, size_t outlen, void *ctx);
+
+/* Reap up to max completions, in completion order. poll never blocks. */
+int mlx5u_async_poll(struct mlx5u_async *as, struct mlx5u_completion *comps, int max);
+/* Blocks up to timeout_ms (-1: forever) for one, 0 if nothing is in flight */
+int mlx5u_async_wait(struct mlx5u_async *as, struct mlx5u_completion *comps, int max,
+		     int timeout_ms);
+/* Submitted and not yet reaped */
+int mlx5u_async_inflight(struct mlx5u_async *as);
+
+#endif /* __MLX5CTL_ASYNC_H__ */
@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * HCA capability cache, see capcache.h.
+ *
+ * The cache file holds a header line with the device key followed by the
+ * cached entries, each a "cap <type> <mode> <len>" line and len bytes of
+ * query_hca_cap_out. Anything that doesn't match the key is ignored and
+ * rewritten on close. Caps are never persisted while recording, a replay
+ * must see the same QUERY_HCA_CAP commands as the recorded run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <glob.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+#include "transport.h"
+#include "record.h"
+#include "capcache.h"
+
+#define CAPCACHE_VERSION 1
+#define CAPCACHE_TYPES 0x80 /* op_mod carries a 7 bit cap type */
+#define CAPCACHE_MAX_OUT (1 << 20)
+
+struct cap_entry {
+	void *out; /* query_hca_cap_out */
+	size_t outlen;
+};
+
+struct mlx5u_capcache {
+	struct cap_entry ent[CAPCACHE_TYPES][2];
+	int dirty;
+	char key[2 * DEV_NAME_MAX];
+	char path[PATH_MAX]; /* empty if not persisted */
+};
+
+static int persist;
+
+void mlx5u_capcache_persist(int enable)
+{
+	persist = enable;
+}
+
+static int read_line(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+	int ret = -1;
+
+	if (!f)
+		return -1;
+	if (fgets(buf, len, f)) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = buf[0] ? 0 : -1;
+	}
+	fclose(f);
+	return ret;
+}
+
+/* Running FW version as the RDMA device reports it, no FW command needed */
+static int fw_version(const char *sysdev, char *buf, size_t len)
+{
+	char pattern[PATH_MAX];
+	glob_t g;
+	int ret = -1, n;
+
+	/* a truncated pattern could match another device, no fw_ver then */
+	n = snprintf(pattern, sizeof(pattern), "%s/infiniband/*/fw_ver", sysdev);
+	if (n < 0 || n >= sizeof(pattern) || glob(pattern, 0, NULL, &g))
+		return -1;
+	if (g.gl_pathc)
+		ret = read_line(g.gl_pathv[0], buf, len);
+	globfree(&g);
+	return ret;
+}
+
+/* The PCI device of a char device transport, e.g. fwctl */
+static int sys_device(struct mlx5u_dev *dev, char *sysdev, struct stat *st)
+{
+	char path[PATH_MAX];
+
+	if (fstat(dev->fd, st) || !S_ISCHR(st->st_mode))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device",
+		 major(st->st_rdev), minor(st->st_rdev));
+	return realpath(path, sysdev) ? 0 : -1;
+}
+
+int mlx5u_fw_version(struct mlx5u_dev *dev, char *buf, size_t len)
+{
+	char sysdev[PATH_MAX];
+	struct stat st;
+
+	if (sys_device(dev, sysdev, &st))
+		return -1;
+	return fw_version(sysdev, buf, len);
+}
+
+static int cache_key(struct mlx5u_dev *dev, struct mlx5u_capcache *cc)
+{
+	char sysdev[PATH_MAX];
+	char fwver[64];
+	struct stat st;
+	const char *bdf;
+
+	if (sys_device(dev, sysdev, &st))
+		return -1;
+	bdf = basename(sysdev);
+	if (fw_version(sysdev, fwver, sizeof(fwver))) {
+		dbg_msg(1, "capcache: no FW version for %s, not persisted\n", bdf);
+		return -1;
+	}
+
+	snprintf(cc->key, sizeof(cc->key), "%s %s %lld.%09ld", bdf, fwver,
+		 (long long)st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+	snprintf(cc->path, sizeof(cc->path), "%s/mlx5ctl-caps-%s.%u",
+		 mlx5u_cache_dir(), bdf, (unsigned int)getuid());
+	return 0;
+}
+
+static int entry_set(struct mlx5u_capcache *cc, u16 type, u16 mode, void *out,
+		     size_t outlen)
+{
+	struct cap_entry *e;
+
+	if (type >= CAPCACHE_TYPES || mode > 1)
+		return -EINVAL;
+	e = &cc->ent[type][mode];
+	free(e->out);
+	e->out = out;
+	e->outlen = outlen;
+	return 0;
+}
+
+static void cache_load(struct mlx5u_capcache *cc)
+{
+	char line[sizeof(cc->key) + 64];
+	unsigned int type, mode;
+	struct stat st;
+	size_t outlen;
+	int version, key = 0, n = 0;
+	FILE *f;
+	int fd;
+
+	fd = open(cc->path, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1)
+		return;
+	if (fstat(fd, &st) || st.st_uid != getuid() || !(f = fdopen(fd, "r"))) {
+		close(fd);
+		return;
+	}
+
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "mlx5ctl-capcache %d %n", &version, &key) != 1 ||
+	    version != CAPCACHE_VERSION)
+		goto out;
+	line[strcspn(line, "\n")] = '\0';
+	if (strcmp(line + key, cc->key)) {
+		dbg_msg(1, "capcache: %s is stale\n", cc->path);
+		cc->dirty = 1; /* rewrite with the current key */
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		void *out;
+
+		if (sscanf(line, "cap %u %u %zu", &type, &mode, &outlen) != 3 ||
+		    type >= CAPCACHE_TYPES || mode > 1 ||
+		    outlen < MLX5_ST_SZ_BYTES(query_hca_cap_out) ||
+		    outlen > CAPCACHE_MAX_OUT)
+			break;
+		out = malloc(outlen);
+		if (!out)
+			break;
+		if (fread(out, 1, outlen, f) != outlen) {
+			free(out);
+			break;
+		}
+		entry_set(cc, type, mode, out, outlen);
+		n++;
+	}
+	dbg_msg(1, "capcache: %d caps loaded from %s\n", n, cc->path);
+out:
+	fclose(f);
+}
+
+static void cache_store(struct mlx5u_capcache *cc)
+{
+	char tmp[sizeof(cc->path) + 8];
+	FILE *f;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cc->path);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		dbg_msg(1, "capcache: can't write %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	fchmod(fd, 0644);
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	fprintf(f, "mlx5ctl-capcache %d %s\n", CAPCACHE_VERSION, cc->key);
+	for (int type = 0; type < CAPCACHE_TYPES; type++) {
+		for (int mode = 0; mode < 2; mode++) {
+			struct cap_entry *e = &cc->ent[type][mode];
+
+			if (!e->out)
+				continue;
+			fprintf(f, "cap %d %d %zu\n", type, mode, e->outlen);
+			fwrite(e->out, 1, e->outlen, f);
+		}
+	}
+
+	/* readers either see the old or the new file, never a partial one */
+	if (fclose(f) || rename(tmp, cc->path))
+		unlink(tmp);
+}
+
+static struct mlx5u_capcache *capcache_get(struct mlx5u_dev *dev)
+{
+	struct mlx5u_capcache *cc = dev->caps;
+
+	if (cc)
+		return cc;
+	cc = calloc(1, sizeof(*cc));
+	if (!cc)
+		return NULL;
+	dev->caps = cc;
+
+	if (persist && dev->fd >= 0 && !mlx5u_recording() && !cache_key(dev, cc))
+		cache_load(cc);
+	return cc;
+}
+
+static void *entry_cap(struct cap_entry *e, size_t *size)
+{
+	if (size)
+		*size = e->outlen - MLX5_BYTE_OFF(query_hca_cap_out, capability);
+	return MLX5_ADDR_OF(query_hca_cap_out, e->out, capability);
+}
+
+void *mlx5u_cap_peek(struct mlx5u_dev *dev, u16 type, u16 mode, size_t *size)
+{
+	struct mlx5u_capcache *cc = capcache_get(dev);
+	struct cap_entry *e;
+
+	if (!cc || type >= CAPCACHE_TYPES || mode > 1)
+		return NULL;
+	e = &cc->ent[type][mode];
+	return e->out ? entry_cap(e, size) : NULL;
+}
+
+size_t mlx5u_cap_out_size(struct mlx5u_dev *dev, u16 type)
+{
+	size_t outlen = MLX5_ST_SZ_BYTES(query_hca_cap_out);
+	const void *gen;
+
+	if (type != MLX5_CAP_DEBUG)
+		return outlen;
+	gen = mlx5u_cap_gen(dev);
+	if (gen)
+		outlen += MLX5_GET(cmd_hca_cap, gen, num_of_diagnostic_counters) *
+			  MLX5_ST_SZ_BYTES(diagnostic_cntr_layout);
+	return outlen;
+}
+
+int mlx5u_cap_put(struct mlx5u_dev *dev, u16 type, u16 mode, const void *out,
+		  size_t outlen)
+{
+	struct mlx5u_capcache *cc = capcache_get(dev);
+	void *copy;
+
+	if (!cc)
+		return -ENOMEM;
+	if (outlen < MLX5_ST_SZ_BYTES(query_hca_cap_out) || MLX5_GET(mbox_out, out, status))
+		return -EINVAL;
+	copy = malloc(outlen);
+	if (!copy)
+		return -ENOMEM;
+	memcpy(copy, out, outlen);
+	if (entry_set(cc, type, mode, copy, outlen)) {
+		free(copy);
+		return -EINVAL;
+	}
+	cc->dirty = 1;
+	return 0;
+}
+
+void *mlx5u_cap(struct mlx5u_dev *dev, u16 type, u16 mode, size_t *size)
+{
+	u8 in[MLX5_ST_SZ_BYTES(query_hca_cap_in)] = {};
+	struct mlx5u_capcache *cc;
+	void *cap;
+	size_t outlen;
+	void *out;
+	int err;
+
+	cap = mlx5u_cap_peek(dev, type, mode, size);
+	if (cap)
+		return cap;
+	cc = dev->caps;
+	if (!cc || type >= CAPCACHE_TYPES || mode > 1)
+		return NULL;
+
+	outlen = mlx5u_cap_out_size(dev, type);
+	out = calloc(1, outlen);
+	if (!out)
+		return NULL;
+
+	MLX5_SET(query_hca_cap_in, in, opcode, MLX5_CMD_OP_QUERY_HCA_CAP);
+	MLX5_SET(query_hca_cap_in, in, op_mod, (type << 1) | (mode & 0x01));
+	err = mlx5u_cmd(dev, in, sizeof(in), out, outlen);
+	if (err) {
+		err_msg("query_hca_cap(0x%x) %s failed: %d\n", type,
+			mode == HCA_CAP_OPMOD_GET_CUR ? "cur" : "max", err);
+		free(out);
+		return NULL;
+	}
+
+	entry_set(cc, type, mode, out, outlen);
+	cc->dirty = 1;
+	return entry_cap(&cc->ent[type][mode], size);
+}
+
+int mlx5u_cap_dev_freq(struct mlx5u_dev *dev)
+{
+	const void *gen = mlx5u_cap_gen(dev);
+
+	if (!gen)
+		return -1;
+	return MLX5_GET(cmd_hca_cap, gen, device_frequency_khz);
+}
+
+void mlx5u_capcache_free(struct mlx5u_dev *dev)
+{
+	struct mlx5u_capcache *cc = dev->caps;
+
+	if (!cc)
+		return;
+	if (cc->dirty && cc->path[0])
+		cache_store(cc);
+	for (int type = 0; type < CAPCACHE_TYPES; type++)
+		for (int mode = 0; mode < 2; mode++)
+			free(cc->ent[type][mode].out);
+	free(cc);
+	dev->caps = NULL;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_CAPCACHE_H__
+#define __MLX5CTL_CAPCACHE_H__
+
+#include <stddef.h>
+#include "ifcutil.h"
+
+struct mlx5u_dev;
+
+enum mlx5_cap_type {
+	MLX5_CAP_GENERAL = 0,
+	MLX5_CAP_ETHERNET_OFFLOADS,
+	MLX5_CAP_ODP,
+	MLX5_CAP_ATOMIC,
+	MLX5_CAP_ROCE,
+	MLX5_CAP_IPOIB_OFFLOADS,
+	MLX5_CAP_IPOIB_ENHANCED_OFFLOADS,
+	MLX5_CAP_FLOW_TABLE,
+	MLX5_CAP_ESWITCH_FLOW_TABLE,
+	MLX5_CAP_ESWITCH,
+	MLX5_CAP_QOS = 0xc,
+	MLX5_CAP_DEBUG,
+	MLX5_CAP_RESERVED_14,
+	MLX5_CAP_DEV_MEM,
+	MLX5_CAP_RESERVED_16,
+	MLX5_CAP_TLS,
+	MLX5_CAP_VDPA_EMULATION = 0x13,
+	MLX5_CAP_DEV_EVENT = 0x14,
+	MLX5_CAP_IPSEC,
+	MLX5_CAP_CRYPTO = 0x1a,
+	MLX5_CAP_MACSEC = 0x1f,
+	MLX5_CAP_GENERAL_2 = 0x20,
+	MLX5_CAP_PORT_SELECTION = 0x25,
+	MLX5_CAP_ADV_VIRTUALIZATION = 0x26,
+	/* NUM OF CAP Types */
+	MLX5_CAP_NUM
+};
+
+enum mlx5_cap_mode {
+	HCA_CAP_OPMOD_GET_MAX	= 0,
+	HCA_CAP_OPMOD_GET_CUR	= 1,
+};
+
+/*
+ * HCA capability cache.
+ *
+ * QUERY_HCA_CAP results are kept per device, per cap type and cur/max mode
+ * for the life of the struct mlx5u_dev, so the first user of a cap pays for
+ * the 4KB RPC and everybody after reads memory. Returned pointers are the
+ * capability layout (cmd_hca_cap, debug_capX, ...), valid until mlx5u_close().
+ * Like the mailbox arena, one thread per device.
+ *
+ * With mlx5u_capcache_persist() fwctl devices also keep their caps in a file
+ * next to the device index, keyed by the PCI device, its FW version and the
+ * fwctl node (recreated on driver reload, which may change cur caps).
+ */
+
+/* NULL and the error printed if the query fails */
+void *mlx5u_cap(struct mlx5u_dev *dev, u16 type, u16 mode, size_t *size);
+/* What is already cached, never issues a FW command */
+void *mlx5u_cap_peek(struct mlx5u_dev *dev, u16 type, u16 mode, size_t *size);
+/* Feed a query_hca_cap_out the caller got by other means, e.g. async */
+int mlx5u_cap_put(struct mlx5u_dev *dev, u16 type, u16 mode, const void *out,
+		  size_t outlen);
+/* query_hca_cap_out size for the cap type, debug caps grow with the counters */
+size_t mlx5u_cap_out_size(struct mlx5u_dev *dev, u16 type);
+
+static inline void *mlx5u_cap_gen(struct mlx5u_dev *dev)
+{
+	return mlx5u_cap(dev, MLX5_CAP_GENERAL, HCA_CAP_OPMOD_GET_CUR, NULL);
+}
+
+/* device_frequency_khz of the current general caps, negative on error */
+int mlx5u_cap_dev_freq(struct mlx5u_dev *dev);
+
+/* Running FW version from sysfs, -1 if the transport has no PCI device */
+int mlx5u_fw_version(struct mlx5u_dev *dev, char *buf, size_t len);
+
+void mlx5u_capcache_persist(int enable);
+/* Writes back new entries if persistent, called by mlx5u_close() */
+void mlx5u_capcache_free(struct mlx5u_dev *dev);
+
+#endif /* __MLX5CTL_CAPCACHE_H__ */
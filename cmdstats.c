@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+#include "cmdstats.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* open addressing, the tool issues a few dozen distinct commands at most */
+#define STATS_TABLE_SIZE 256
+
+static struct mlx5u_cmd_stats table[STATS_TABLE_SIZE];
+static u8 used[STATS_TABLE_SIZE];
+static int stats_enabled;
+/* commands complete on async workers too, see async.c */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define OP(name) { MLX5_CMD_OP_ ## name, #name }
+static const struct {
+	u16 opcode;
+	const char *name;
+} op_names[] = {
+	OP(QUERY_HCA_CAP),
+	OP(QUERY_ADAPTER),
+	OP(QUERY_PAGES),
+	OP(QUERY_ISSI),
+	OP(QUERY_VHCA_MIGRATION_STATE),
+	OP(CREATE_MKEY),
+	OP(QUERY_MKEY),
+	OP(DESTROY_MKEY),
+	OP(QUERY_SPECIAL_CONTEXTS),
+	OP(QUERY_EQ),
+	OP(QUERY_CQ),
+	OP(QUERY_QP),
+	OP(QUERY_SRQ),
+	OP(QUERY_XRC_SRQ),
+	OP(QUERY_DCT),
+	OP(QUERY_XRQ),
+	OP(QUERY_ESW_FUNCTIONS),
+	OP(QUERY_VPORT_STATE),
+	OP(QUERY_ESW_VPORT_CONTEXT),
+	OP(QUERY_VNIC_ENV),
+	OP(QUERY_VPORT_COUNTER),
+	OP(QUERY_Q_COUNTER),
+	OP(ALLOC_PD),
+	OP(DEALLOC_PD),
+	OP(ACCESS_REG),
+	OP(QUERY_MAD_DEMUX),
+	OP(QUERY_DIAGNOSTIC_PARAMS),
+	OP(SET_DIAGNOSTIC_PARAMS),
+	OP(QUERY_DIAGNOSTIC_COUNTERS),
+	OP(QUERY_CONG_STATUS),
+	OP(QUERY_CONG_PARAMS),
+	OP(QUERY_CONG_STATISTICS),
+	OP(QUERY_L2_TABLE_ENTRY),
+	OP(QUERY_WOL_ROL),
+	OP(QUERY_LAG),
+	OP(QUERY_TIR),
+	OP(QUERY_SQ),
+	OP(QUERY_RQ),
+	OP(QUERY_RMP),
+	OP(QUERY_TIS),
+	OP(QUERY_RQT),
+	OP(QUERY_PACKET_REFORMAT_CONTEXT),
+};
+#undef OP
+
+const char *mlx5u_cmd_opcode_str(u16 opcode)
+{
+	for (int i = 0; i < ARRAY_SIZE(op_names); i++)
+		if (op_names[i].opcode == opcode)
+			return op_names[i].name;
+	return "UNKNOWN";
+}
+
+void mlx5u_stats_enable(int enable)
+{
+	stats_enabled = enable;
+}
+
+int mlx5u_stats_enabled(void)
+{
+	return stats_enabled;
+}
+
+u64 mlx5u_stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int stats_hash(u16 opcode, u16 op_mod, u16 reg_id)
+{
+	u32 key = ((u32)opcode << 16 | op_mod) ^ ((u32)reg_id * 0x9e3779b1);
+
+	return (key ^ (key >> 15)) % STATS_TABLE_SIZE;
+}
+
+static struct mlx5u_cmd_stats *stats_lookup(u16 opcode, u16 op_mod, u16 reg_id, int create)
+{
+	unsigned int idx = stats_hash(opcode, op_mod, reg_id);
+
+	for (int i = 0; i < STATS_TABLE_SIZE; i++, idx = (idx + 1) % STATS_TABLE_SIZE) {
+		struct mlx5u_cmd_stats *st = &table[idx];
+
+		if (!used[idx]) {
+			if (!create)
+				return NULL;
+			used[idx] = 1;
+			st->opcode = opcode;
+			st->op_mod = op_mod;
+			st->reg_id = reg_id;
+			st->lat_min_ns = UINT64_MAX;
+			return st;
+		}
+		if (st->opcode == opcode && st->op_mod == op_mod && st->reg_id == reg_id)
+			return st;
+	}
+	return NULL; /* table full, drop */
+}
+
+static int lat_bucket(u64 ns)
+{
+	int b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	return b < MLX5U_STATS_LAT_BUCKETS ? b : MLX5U_STATS_LAT_BUCKETS - 1;
+}
+
+static void account_syndrome(struct mlx5u_cmd_stats *st, u8 status, u32 syndrome)
+{
+	int i;
+
+	for (i = 0; i < MLX5U_STATS_SYNDROMES && st->syndromes[i].count; i++) {
+		if (st->syndromes[i].syndrome == syndrome &&
+		    st->syndromes[i].status == status) {
+			st->syndromes[i].count++;
+			return;
+		}
+	}
+	if (i == MLX5U_STATS_SYNDROMES)
+		return; /* only the first few distinct syndromes are tracked */
+	st->syndromes[i].status = status;
+	st->syndromes[i].syndrome = syndrome;
+	st->syndromes[i].count = 1;
+}
+
+void mlx5u_stats_account(const void *in, size_t inlen, const void *out, size_t outlen,
+			 int ret, u64 lat_ns)
+{
+	u16 opcode = MLX5_GET(mbox_in, in, opcode);
+	u16 op_mod = MLX5_GET(mbox_in, in, op_mod);
+	struct mlx5u_cmd_stats *st;
+	u16 reg_id = 0;
+
+	if (opcode == MLX5_CMD_OP_ACCESS_REG && inlen >= MLX5_ST_SZ_BYTES(access_register_in))
+		reg_id = MLX5_GET(access_register_in, in, register_id);
+
+	pthread_mutex_lock(&stats_lock);
+	st = stats_lookup(opcode, op_mod, reg_id, 1);
+	if (!st)
+		goto out;
+
+	st->calls++;
+	st->bytes_in += inlen;
+	st->bytes_out += outlen;
+	if (ret)
+		st->ioctl_errors++;
+	else if (MLX5_GET(mbox_out, out, status)) {
+		st->fw_errors++;
+		account_syndrome(st, MLX5_GET(mbox_out, out, status),
+				 MLX5_GET(mbox_out, out, syndrome));
+	}
+
+	st->lat_sum_ns += lat_ns;
+	st->lat_hist[lat_bucket(lat_ns)]++;
+	if (lat_ns < st->lat_min_ns)
+		st->lat_min_ns = lat_ns;
+	if (lat_ns > st->lat_max_ns)
+		st->lat_max_ns = lat_ns;
+out:
+	pthread_mutex_unlock(&stats_lock);
+}
+
+int mlx5u_stats_get(u16 opcode, u16 op_mod, u16 reg_id, struct mlx5u_cmd_stats *stats)
+{
+	struct mlx5u_cmd_stats *st;
+	int ret = -1;
+
+	pthread_mutex_lock(&stats_lock);
+	st = stats_lookup(opcode, op_mod, reg_id, 0);
+	if (st) {
+		*stats = *st;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&stats_lock);
+	return ret;
+}
+
+/* cb runs with the stats locked and must not issue commands */
+int mlx5u_stats_foreach(int (*cb)(const struct mlx5u_cmd_stats *stats, void *arg), void *arg)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&stats_lock);
+	for (int i = 0; i < STATS_TABLE_SIZE && !ret; i++)
+		if (used[i])
+			ret = cb(&table[i], arg);
+	pthread_mutex_unlock(&stats_lock);
+	return ret;
+}
+
+/* Estimate of the pct (0..100) latency percentile, interpolated inside a log2 bucket */
+u64 mlx5u_stats_percentile(const struct mlx5u_cmd_stats *stats, double pct)
+{
+	double rank = stats->calls * pct / 100.0;
+	u64 seen = 0;
+
+	if (!stats->calls)
+		return 0;
+
+	for (int i = 0; i < MLX5U_STATS_LAT_BUCKETS; i++) {
+		u64 cnt = stats->lat_hist[i];
+		u64 lo, hi, val;
+
+		if (!cnt || seen + cnt < rank) {
+			seen += cnt;
+			continue;
+		}
+		lo = i ? 1ull << (i - 1) : 0;
+		hi = (1ull << i) - 1;
+		val = lo + (u64)((hi - lo) * ((rank - seen) / cnt));
+		if (val < stats->lat_min_ns)
+			val = stats->lat_min_ns;
+		if (val > stats->lat_max_ns)
+			val = stats->lat_max_ns;
+		return val;
+	}
+	return stats->lat_max_ns;
+}
+
+void mlx5u_stats_reset(void)
+{
+	pthread_mutex_lock(&stats_lock);
+	memset(table, 0, sizeof(table));
+	memset(used, 0, sizeof(used));
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static int stats_cmp(const void *a, const void *b)
+{
+	const struct mlx5u_cmd_stats *sa = a, *sb = b;
+
+	if (sa->opcode != sb->opcode)
+		return sa->opcode - sb->opcode;
+	if (sa->op_mod != sb->op_mod)
+		return sa->op_mod - sb->op_mod;
+	return sa->reg_id - sb->reg_id;
+}
+
+void mlx5u_stats_dump(FILE *f)
+{
+	struct mlx5u_cmd_stats sorted[STATS_TABLE_SIZE];
+	int n = 0;
+
+	pthread_mutex_lock(&stats_lock);
+	for (int i = 0; i < STATS_TABLE_SIZE; i++)
+		if (used[i])
+			sorted[n++] = table[i];
+	pthread_mutex_unlock(&stats_lock);
+	qsort(sorted, n, sizeof(sorted[0]), stats_cmp);
+
+	fprintf(f, "FW command statistics (latency in us):\n");
+	fprintf(f, "%-30s %6s %6s %8s %6s %6s %10s %10s %9s %9s %9s %9s %9s\n",
+		"opcode", "op_mod", "reg", "calls", "ioerr", "fwerr", "bytes_in", "bytes_out",
+		"avg", "p50", "p99", "p999", "max");
+	for (int i = 0; i < n; i++) {
+		struct mlx5u_cmd_stats *st = &sorted[i];
+		char reg[8] = "-";
+
+		if (st->opcode == MLX5_CMD_OP_ACCESS_REG)
+			snprintf(reg, sizeof(reg), "0x%x", st->reg_id);
+		fprintf(f, "%-23s(0x%03x) %6x %6s %8llu %6llu %6llu %10llu %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+			mlx5u_cmd_opcode_str(st->opcode), st->opcode, st->op_mod, reg,
+			(unsigned long long)st->calls, (unsigned long long)st->ioctl_errors,
+			(unsigned long long)st->fw_errors, (unsigned long long)st->bytes_in,
+			(unsigned long long)st->bytes_out,
+			st->calls ? st->lat_sum_ns / 1000.0 / st->calls : 0,
+			mlx5u_stats_percentile(st, 50) / 1000.0,
+			mlx5u_stats_percentile(st, 99) / 1000.0,
+			mlx5u_stats_percentile(st, 99.9) / 1000.0,
+			st->lat_max_ns / 1000.0);
+		for (int j = 0; j < MLX5U_STATS_SYNDROMES && st->syndromes[j].count; j++)
+			fprintf(f, "\tstatus 0x%x syndrome 0x%x: %llu\n", st->syndromes[j].status,
+				st->syndromes[j].syndrome,
+				(unsigned long long)st->syndromes[j].count);
+	}
+}
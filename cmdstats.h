@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_CMDSTATS_H__
+#define __MLX5CTL_CMDSTATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MLX5U_STATS_LAT_BUCKETS 64 /* log2(ns) buckets */
+#define MLX5U_STATS_SYNDROMES 4
+
+/*
+ * Accounting of every FW command issued through mlx5u_cmd(), one entry per
+ * opcode/op_mod, ACCESS_REG is further split by register id.
+ */
+struct mlx5u_cmd_stats {
+	uint16_t opcode;
+	uint16_t op_mod;
+	uint16_t reg_id; /* ACCESS_REG only */
+
+	uint64_t calls;
+	uint64_t ioctl_errors; /* transport failures */
+	uint64_t fw_errors;    /* mailbox status != 0 */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+
+	struct {
+		uint32_t syndrome;
+		uint8_t status;
+		uint64_t count;
+	} syndromes[MLX5U_STATS_SYNDROMES];
+
+	uint64_t lat_min_ns;
+	uint64_t lat_max_ns;
+	uint64_t lat_sum_ns;
+	uint64_t lat_hist[MLX5U_STATS_LAT_BUCKETS]; /* [i] counts ns in [2^(i-1), 2^i) */
+};
+
+void mlx5u_stats_enable(int enable);
+int mlx5u_stats_enabled(void);
+uint64_t mlx5u_stats_now_ns(void);
+void mlx5u_stats_account(const void *in, size_t inlen, const void *out, size_t outlen,
+			 int ret, uint64_t lat_ns);
+
+int mlx5u_stats_get(uint16_t opcode, uint16_t op_mod, uint16_t reg_id,
+		    struct mlx5u_cmd_stats *stats);
+int mlx5u_stats_foreach(int (*cb)(const struct mlx5u_cmd_stats *stats, void *arg),
+			void *arg);
+uint64_t mlx5u_stats_percentile(const struct mlx5u_cmd_stats *stats, double pct);
+const char *mlx5u_cmd_opcode_str(uint16_t opcode);
+void mlx5u_stats_dump(FILE *f);
+void mlx5u_stats_reset(void);
+
+#endif /* __MLX5CTL_CMDSTATS_H__ */
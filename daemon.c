@@ -0,0 +1,844 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * mlx5ctld: keep every fwctl device open and serve mlx5ctl commands over a
+ * local unix socket, so a query costs a socket round trip and the FW RPC
+ * instead of process startup plus device discovery.
+ *
+ * Wire format, all fields host endian (the socket is local):
+ *   request:  struct mlx5ctld_hdr (MLX5CTLD_MSG_EXEC, arg = argc)
+ *             followed by argc NUL terminated strings: <device> <command> [options]
+ *             the client stdout and stderr are passed along as SCM_RIGHTS
+ *   response: struct mlx5ctld_hdr (MLX5CTLD_MSG_DONE, arg = exit status)
+ *
+ * Command output never goes through the daemon, the worker writes straight
+ * into the client's stdout/stderr.
+ *
+ * The daemon: transport (mlx5ctl daemon:<device>[@<socket>] ...) runs the
+ * command in the client and only forwards FW commands, one at a time:
+ *   MLX5CTLD_MSG_OPEN: payload = device name
+ *                      reply payload = "ctldev\0mdev\0"
+ *   MLX5CTLD_MSG_RPC:  arg = output length, payload = command mailbox
+ *                      reply payload = u64 FW latency in ns + output mailbox
+ *   MLX5CTLD_MSG_INFO: reply payload = struct mlx5u_dev_info
+ * every one answered by MLX5CTLD_MSG_REPLY with arg = 0 or an errno.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+#include "cmdstats.h"
+#include "transport.h"
+#include "capcache.h"
+#include "hexdump.h"
+#include "json.h"
+
+#define MLX5CTLD_MAGIC		0x6d6c7835 /* "mlx5" */
+#define MLX5CTLD_VERSION	1
+#define MLX5CTLD_MAX_PAYLOAD	(64 * 1024)
+#define MLX5CTLD_MAX_RPC	(16 * 1024 * 1024)
+
+enum {
+	MLX5CTLD_MSG_EXEC = 1,
+	MLX5CTLD_MSG_DONE = 2,
+	MLX5CTLD_MSG_OPEN = 3,
+	MLX5CTLD_MSG_RPC = 4,
+	MLX5CTLD_MSG_INFO = 5,
+	MLX5CTLD_MSG_REPLY = 6,
+};
+
+enum {
+	MLX5CTLD_F_VERBOSE = 1 << 0,
+	MLX5CTLD_F_STATS = 1 << 1,
+	MLX5CTLD_F_HEX_OFFSET = 1 << 2,
+	MLX5CTLD_F_HEX_SQUEEZE = 1 << 3,
+	MLX5CTLD_F_JSON = 1 << 4,
+	MLX5CTLD_F_NDJSON = 1 << 5,
+};
+
+struct mlx5ctld_hdr {
+	u32 magic;
+	u8 version;
+	u8 type;
+	u16 flags;
+	u32 len; /* payload bytes following the header */
+	u32 arg; /* message specific */
+};
+
+static struct mlx5u_dev **devs;
+static int num_devs;
+static volatile sig_atomic_t stop;
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = read(fd, (char *)buf + done, len - done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = write(fd, (const char *)buf + done, len - done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static int send_hdr(int sock, struct mlx5ctld_hdr *hdr, int *fds, int nfds)
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))] = {};
+	struct iovec iov = { .iov_base = hdr, .iov_len = sizeof(*hdr) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	struct cmsghdr *cmsg;
+
+	if (nfds) {
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(*hdr))
+		return -1;
+	return 0;
+}
+
+static int recv_hdr(int sock, struct mlx5ctld_hdr *hdr, int *fds, int *nfds)
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))] = {};
+	struct iovec iov = { .iov_base = hdr, .iov_len = sizeof(*hdr) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	do {
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	if (n != sizeof(*hdr))
+		return -1;
+
+	*nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+	}
+
+	if (hdr->magic != MLX5CTLD_MAGIC || hdr->version != MLX5CTLD_VERSION) {
+		err_msg("mlx5ctld: bad message magic 0x%x version %d\n",
+			hdr->magic, hdr->version);
+		return -1;
+	}
+	return 0;
+}
+
+static struct mlx5u_dev *lookup_dev(const char *name)
+{
+	for (int i = 0; i < num_devs; i++)
+		if (mlx5u_dev_match(devs[i], name))
+			return devs[i];
+	return NULL;
+}
+
+static struct mlx5u_dev *lookup_or_open(const char *name)
+{
+	struct mlx5u_dev *dev = lookup_dev(name);
+
+	/* not one of the devices we scanned at startup, try the slow path */
+	return dev ? dev : mlx5u_open(name);
+}
+
+/* Runs in a forked worker with stdout/stderr already pointing at the client */
+static int run_request(int argc, char **argv, u16 flags)
+{
+	struct mlx5u_dev *dev;
+	int ret;
+
+	if (flags & MLX5CTLD_F_VERBOSE)
+		verbosity_level = 1;
+	if (flags & MLX5CTLD_F_STATS)
+		mlx5ctl_stats_on_exit();
+	hexdump_set_flags((flags & MLX5CTLD_F_HEX_OFFSET ? HEXDUMP_OFFSET : 0) |
+			  (flags & MLX5CTLD_F_HEX_SQUEEZE ? HEXDUMP_SQUEEZE : 0));
+	if (flags & (MLX5CTLD_F_JSON | MLX5CTLD_F_NDJSON)) {
+		json_set_mode(flags & MLX5CTLD_F_JSON ? JSON_ARRAY : JSON_LINES);
+		json_open();
+	}
+
+	if (mlx5ctl_is_multi_dev(argv[0]))
+		return mlx5ctl_exec_multi_open(argv[0], argc - 1, argv + 1, lookup_or_open);
+
+	dev = lookup_or_open(argv[0]);
+	if (!dev) {
+		err_msg("Failed to open device %s\n", argv[0]);
+		return 1;
+	}
+
+	ret = mlx5ctl_exec(dev, argc - 1, argv + 1);
+	return (ret > 0 ? ret : -ret);
+}
+
+static int handle_exec(int conn, struct mlx5ctld_hdr *req, int *fds, int nfds)
+{
+	struct mlx5ctld_hdr rsp = {
+		.magic = MLX5CTLD_MAGIC,
+		.version = MLX5CTLD_VERSION,
+		.type = MLX5CTLD_MSG_DONE,
+	};
+	char **argv = NULL;
+	char *payload, *p;
+	int wstatus;
+	pid_t pid;
+	int argc;
+
+	if (nfds != 2 || !req->arg || req->len > MLX5CTLD_MAX_PAYLOAD) {
+		err_msg("mlx5ctld: malformed exec request\n");
+		return -1;
+	}
+
+	payload = malloc(req->len + 1);
+	argv = calloc(req->arg + 1, sizeof(*argv));
+	if (!payload || !argv)
+		goto err;
+	if (read_full(conn, payload, req->len))
+		goto err;
+	payload[req->len] = '\0';
+
+	for (argc = 0, p = payload; argc < req->arg; argc++) {
+		if (p >= payload + req->len)
+			goto err;
+		argv[argc] = p;
+		p += strlen(p) + 1;
+	}
+
+	pid = fork();
+	if (pid < 0)
+		goto err;
+	if (pid == 0) {
+		close(conn);
+		if (dup2(fds[0], STDOUT_FILENO) < 0 || dup2(fds[1], STDERR_FILENO) < 0)
+			_exit(1);
+		exit(run_request(argc, argv, req->flags));
+	}
+
+	while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+		;
+	if (WIFEXITED(wstatus))
+		rsp.arg = WEXITSTATUS(wstatus);
+	else
+		rsp.arg = 128 + WTERMSIG(wstatus);
+
+	free(argv);
+	free(payload);
+	return send_hdr(conn, &rsp, NULL, 0);
+err:
+	free(argv);
+	free(payload);
+	return -1;
+}
+
+static int send_reply(int conn, u32 err, const void *p1, size_t l1,
+		      const void *p2, size_t l2)
+{
+	struct mlx5ctld_hdr rsp = {
+		.magic = MLX5CTLD_MAGIC,
+		.version = MLX5CTLD_VERSION,
+		.type = MLX5CTLD_MSG_REPLY,
+		.len = l1 + l2,
+		.arg = err,
+	};
+
+	if (send_hdr(conn, &rsp, NULL, 0) ||
+	    (l1 && write_full(conn, p1, l1)) || (l2 && write_full(conn, p2, l2)))
+		return -1;
+	return 0;
+}
+
+static void *read_payload(int conn, struct mlx5ctld_hdr *req, size_t max)
+{
+	char *payload;
+
+	if (req->len > max)
+		return NULL;
+	payload = malloc(req->len + 1);
+	if (!payload)
+		return NULL;
+	if (read_full(conn, payload, req->len)) {
+		free(payload);
+		return NULL;
+	}
+	payload[req->len] = '\0';
+	return payload;
+}
+
+static int handle_open(int conn, struct mlx5ctld_hdr *req, struct mlx5u_dev **dev)
+{
+	char names[2 * DEV_NAME_MAX];
+	char *name;
+	int len;
+
+	name = read_payload(conn, req, DEV_NAME_MAX);
+	if (!name)
+		return -1;
+	*dev = lookup_or_open(name);
+	free(name);
+	if (!*dev)
+		return send_reply(conn, ENODEV, NULL, 0, NULL, 0);
+
+	len = snprintf(names, sizeof(names), "%s%c%s", (*dev)->devname, '\0', (*dev)->mdev);
+	return send_reply(conn, 0, names, len + 1, NULL, 0);
+}
+
+/*
+ * Connection handlers are forked, so only what the daemon cached before the
+ * fork outlives a connection. The caps everybody asks for are queried once
+ * at startup and every worker answers them from memory.
+ */
+static void warm_caps(struct mlx5u_dev *dev)
+{
+	void *gen = mlx5u_cap_gen(dev);
+
+	if (gen && MLX5_GET(cmd_hca_cap, gen, debug))
+		mlx5u_cap(dev, MLX5_CAP_DEBUG, HCA_CAP_OPMOD_GET_CUR, NULL);
+}
+
+static int cached_cap(struct mlx5u_dev *dev, void *in, size_t inlen, void *out,
+		      size_t outlen)
+{
+	size_t off = MLX5_BYTE_OFF(query_hca_cap_out, capability);
+	u16 op_mod;
+	size_t size;
+	void *cap;
+
+	if (inlen < MLX5_ST_SZ_BYTES(query_hca_cap_in) ||
+	    MLX5_GET(mbox_in, in, opcode) != MLX5_CMD_OP_QUERY_HCA_CAP)
+		return -1;
+	op_mod = MLX5_GET(mbox_in, in, op_mod);
+	cap = mlx5u_cap_peek(dev, op_mod >> 1, op_mod & 0x1, &size);
+	if (!cap || outlen != off + size)
+		return -1;
+	memcpy(out + off, cap, size);
+	return 0;
+}
+
+static int handle_rpc(int conn, struct mlx5ctld_hdr *req, struct mlx5u_dev *dev)
+{
+	void *in, *out;
+	u64 start, lat;
+	int ret;
+
+	if (req->arg > MLX5CTLD_MAX_RPC)
+		return -1;
+	in = read_payload(conn, req, MLX5CTLD_MAX_RPC);
+	if (!in)
+		return -1;
+	if (!dev) {
+		free(in);
+		return send_reply(conn, ENODEV, NULL, 0, NULL, 0);
+	}
+	out = calloc(1, req->arg ? req->arg : 1);
+	if (!out) {
+		free(in);
+		return send_reply(conn, ENOMEM, NULL, 0, NULL, 0);
+	}
+
+	start = mlx5u_stats_now_ns();
+	ret = 0;
+	if (cached_cap(dev, in, req->len, out, req->arg))
+		ret = mlx5u_transport_cmd(dev, in, req->len, out, req->arg);
+	lat = mlx5u_stats_now_ns() - start;
+	if (ret)
+		ret = send_reply(conn, errno ? errno : EIO, NULL, 0, NULL, 0);
+	else
+		ret = send_reply(conn, 0, &lat, sizeof(lat), out, req->arg);
+	free(out);
+	free(in);
+	return ret;
+}
+
+static int handle_info(int conn, struct mlx5u_dev *dev)
+{
+	struct mlx5u_dev_info info;
+
+	if (!dev)
+		return send_reply(conn, ENODEV, NULL, 0, NULL, 0);
+	if (mlx5u_transport_info(dev, &info))
+		return send_reply(conn, errno ? errno : EIO, NULL, 0, NULL, 0);
+	return send_reply(conn, 0, &info, sizeof(info), NULL, 0);
+}
+
+/* Per connection process, serves requests until the client hangs up */
+static void handle_conn(int conn)
+{
+	struct mlx5u_dev *dev = NULL; /* opened by MLX5CTLD_MSG_OPEN */
+	struct mlx5ctld_hdr req;
+	int fds[2];
+	int nfds;
+
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!recv_hdr(conn, &req, fds, &nfds)) {
+		int err = -1;
+
+		switch (req.type) {
+		case MLX5CTLD_MSG_EXEC:
+			err = handle_exec(conn, &req, fds, nfds);
+			break;
+		case MLX5CTLD_MSG_OPEN:
+			err = handle_open(conn, &req, &dev);
+			break;
+		case MLX5CTLD_MSG_RPC:
+			err = handle_rpc(conn, &req, dev);
+			break;
+		case MLX5CTLD_MSG_INFO:
+			err = handle_info(conn, dev);
+			break;
+		default:
+			err_msg("mlx5ctld: unknown message type %d\n", req.type);
+			break;
+		}
+
+		for (int i = 0; i < nfds; i++)
+			close(fds[i]);
+		if (err)
+			break;
+	}
+	close(conn);
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	mode_t mask;
+	int sock, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		err_msg("socket path too long %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		err_msg("socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	unlink(path);
+	/* created 0600, no window where another user can connect */
+	mask = umask(0177);
+	err = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (err || listen(sock, 64)) {
+		err_msg("failed to listen on %s: %s\n", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static void daemon_help(void)
+{
+	fprintf(stdout, "Usage: mlx5ctl daemon [--socket=<path>]\n");
+	fprintf(stdout, "Keep all mlx5 fwctl devices open and serve commands on a unix socket\n");
+	fprintf(stdout, "\t--socket=<path> - listen socket, default %s\n", MLX5CTLD_SOCKET);
+	fprintf(stdout, "Clients: mlx5ctl --socket[=<path>] <device> <command> [options]\n");
+	fprintf(stdout, "         mlx5ctl daemon:<device>[@<path>] <command> [options]\n");
+}
+
+int mlx5ctld_main(int argc, char *argv[])
+{
+	const char *path = MLX5CTLD_SOCKET;
+	struct sigaction sa = {};
+	int sock;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--socket=", 9)) {
+			path = argv[i] + 9;
+		} else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "help")) {
+			daemon_help();
+			return 0;
+		} else {
+			err_msg("Unknown argument %s\n", argv[i]);
+			daemon_help();
+			return 1;
+		}
+	}
+
+	devs = mlx5u_open_all(&num_devs);
+	if (!devs)
+		info_msg("mlx5ctld: no fwctl devices found, will open on demand\n");
+	for (int i = 0; i < num_devs; i++) {
+		info_msg("mlx5ctld: serving %s\n", mlx5u_devname(devs[i]));
+		warm_caps(devs[i]);
+	}
+
+	sock = listen_on(path);
+	if (sock < 0)
+		return 1;
+
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* connection handlers are never waited for */
+	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = SA_NOCLDWAIT;
+	sigaction(SIGCHLD, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	info_msg("mlx5ctld: listening on %s\n", path);
+	fflush(stdout);
+
+	while (!stop) {
+		int conn = accept(sock, NULL, NULL);
+		pid_t pid;
+
+		if (conn < 0) {
+			if (errno == EINTR)
+				continue;
+			err_msg("accept failed: %s\n", strerror(errno));
+			break;
+		}
+
+		fflush(NULL);
+		pid = fork();
+		if (pid == 0) {
+			close(sock);
+			handle_conn(conn);
+			_exit(0);
+		}
+		if (pid < 0)
+			err_msg("fork failed: %s\n", strerror(errno));
+		close(conn);
+	}
+
+	info_msg("mlx5ctld: exiting\n");
+	close(sock);
+	unlink(path);
+	for (int i = 0; i < num_devs; i++)
+		mlx5u_close(devs[i]);
+	free(devs);
+	return 0;
+}
+
+/******************************************************************/
+/* client side */
+
+static int connect_to(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		err_msg("socket path too long %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		err_msg("failed to connect to mlx5ctld at %s: %s\n", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/* Forward "<device> <command> [options]" to the daemon, returns exit status */
+int mlx5ctld_exec(const char *sock_path, int argc, char *argv[])
+{
+	struct mlx5ctld_hdr hdr = {
+		.magic = MLX5CTLD_MAGIC,
+		.version = MLX5CTLD_VERSION,
+		.type = MLX5CTLD_MSG_EXEC,
+		.arg = argc,
+	};
+	int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+	char *payload;
+	size_t len = 0;
+	int nfds;
+	int sock;
+
+	for (int i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	if (len > MLX5CTLD_MAX_PAYLOAD) {
+		err_msg("command line too long\n");
+		return 1;
+	}
+
+	payload = malloc(len);
+	if (!payload)
+		return 1;
+	len = 0;
+	for (int i = 0; i < argc; i++) {
+		strcpy(payload + len, argv[i]);
+		len += strlen(argv[i]) + 1;
+	}
+	hdr.len = len;
+	if (verbosity_level)
+		hdr.flags |= MLX5CTLD_F_VERBOSE;
+	if (mlx5u_stats_enabled())
+		hdr.flags |= MLX5CTLD_F_STATS;
+	if (hexdump_get_flags() & HEXDUMP_OFFSET)
+		hdr.flags |= MLX5CTLD_F_HEX_OFFSET;
+	if (hexdump_get_flags() & HEXDUMP_SQUEEZE)
+		hdr.flags |= MLX5CTLD_F_HEX_SQUEEZE;
+	if (json_output == JSON_ARRAY)
+		hdr.flags |= MLX5CTLD_F_JSON;
+	else if (json_output == JSON_LINES)
+		hdr.flags |= MLX5CTLD_F_NDJSON;
+
+	sock = connect_to(sock_path);
+	if (sock < 0) {
+		free(payload);
+		return 1;
+	}
+
+	fflush(NULL);
+	if (send_hdr(sock, &hdr, fds, 2) || write_full(sock, payload, len) ||
+	    recv_hdr(sock, &hdr, fds, &nfds) || hdr.type != MLX5CTLD_MSG_DONE) {
+		err_msg("mlx5ctld request failed\n");
+		hdr.arg = 1;
+	}
+
+	free(payload);
+	close(sock);
+	return hdr.arg;
+}
+
+/******************************************************************/
+/* daemon: transport, FW commands go through the daemon's device */
+
+struct daemon_conn {
+	int sock;
+	pthread_mutex_t lock; /* one request/reply at a time on the socket */
+};
+
+static int daemon_call(struct daemon_conn *dc, u8 type, u32 arg, const void *payload,
+		       size_t len, struct mlx5ctld_hdr *rsp)
+{
+	struct mlx5ctld_hdr hdr = {
+		.magic = MLX5CTLD_MAGIC,
+		.version = MLX5CTLD_VERSION,
+		.type = type,
+		.len = len,
+		.arg = arg,
+	};
+	int fds[2], nfds;
+
+	if (send_hdr(dc->sock, &hdr, NULL, 0) || (len && write_full(dc->sock, payload, len)) ||
+	    recv_hdr(dc->sock, rsp, fds, &nfds) || rsp->type != MLX5CTLD_MSG_REPLY) {
+		err_msg("mlx5ctld request failed\n");
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/* Read up to len bytes of the remaining reply payload, drop the rest */
+static int daemon_read(struct daemon_conn *dc, u32 *left, void *buf, size_t len)
+{
+	char tmp[256];
+
+	if (len > *left)
+		len = *left;
+	if (len && read_full(dc->sock, buf, len))
+		return -1;
+	for (*left -= len; *left; ) {
+		size_t n = *left < sizeof(tmp) ? *left : sizeof(tmp);
+
+		if (read_full(dc->sock, tmp, n))
+			return -1;
+		*left -= n;
+	}
+	return 0;
+}
+
+static int __daemon_cmd(struct daemon_conn *dc, void *in, size_t inlen, void *out,
+			size_t outlen, u64 *lat_ns)
+{
+	struct mlx5ctld_hdr rsp;
+
+	if (inlen > MLX5CTLD_MAX_RPC || outlen > MLX5CTLD_MAX_RPC) {
+		errno = E2BIG;
+		return -1;
+	}
+	if (daemon_call(dc, MLX5CTLD_MSG_RPC, outlen, in, inlen, &rsp))
+		return -1;
+	if (rsp.arg) {
+		daemon_read(dc, &rsp.len, NULL, 0);
+		errno = rsp.arg;
+		return -1;
+	}
+	if (rsp.len < sizeof(*lat_ns) || read_full(dc->sock, lat_ns, sizeof(*lat_ns))) {
+		errno = EIO;
+		return -1;
+	}
+	rsp.len -= sizeof(*lat_ns);
+	memset(out, 0, outlen);
+	if (daemon_read(dc, &rsp.len, out, outlen)) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static int daemon_cmd(struct mlx5u_dev *dev, void *in, size_t inlen, void *out,
+		      size_t outlen, u64 *lat_ns)
+{
+	struct daemon_conn *dc = dev->priv;
+	int ret;
+
+	pthread_mutex_lock(&dc->lock);
+	ret = __daemon_cmd(dc, in, inlen, out, outlen, lat_ns);
+	pthread_mutex_unlock(&dc->lock);
+	return ret;
+}
+
+static int __daemon_info(struct daemon_conn *dc, struct mlx5u_dev_info *info)
+{
+	struct mlx5ctld_hdr rsp;
+
+	if (daemon_call(dc, MLX5CTLD_MSG_INFO, 0, NULL, 0, &rsp))
+		return -1;
+	if (rsp.arg) {
+		daemon_read(dc, &rsp.len, NULL, 0);
+		errno = rsp.arg;
+		return -1;
+	}
+	return daemon_read(dc, &rsp.len, info, sizeof(*info));
+}
+
+static int daemon_info(struct mlx5u_dev *dev, struct mlx5u_dev_info *info)
+{
+	struct daemon_conn *dc = dev->priv;
+	int ret;
+
+	pthread_mutex_lock(&dc->lock);
+	ret = __daemon_info(dc, info);
+	pthread_mutex_unlock(&dc->lock);
+	return ret;
+}
+
+/* umem is the address space of the daemon's process, can't be shared */
+static int daemon_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
+{
+	return -1;
+}
+
+static int daemon_umem_unreg(struct mlx5u_dev *dev, u32 umem_id)
+{
+	return -1;
+}
+
+static void daemon_close(struct mlx5u_dev *dev)
+{
+	struct daemon_conn *dc = dev->priv;
+
+	close(dc->sock);
+	pthread_mutex_destroy(&dc->lock);
+	free(dc);
+}
+
+static const struct mlx5u_transport_ops daemon_ops = {
+	.name = "daemon",
+	.cmd = daemon_cmd,
+	.info = daemon_info,
+	.umem_reg = daemon_umem_reg,
+	.umem_unreg = daemon_umem_unreg,
+	.close = daemon_close,
+};
+
+/* arg: <device>[@<socket path>] */
+int mlx5u_daemon_transport_open(struct mlx5u_dev *dev, const char *arg)
+{
+	const char *path = getenv("MLX5CTL_SOCKET") ?: MLX5CTLD_SOCKET;
+	char name[DEV_NAME_MAX];
+	struct mlx5ctld_hdr rsp;
+	struct daemon_conn *dc;
+	char names[2 * DEV_NAME_MAX] = {};
+	const char *at;
+
+	at = strchr(arg, '@');
+	snprintf(name, sizeof(name), "%.*s", at ? (int)(at - arg) : (int)strlen(arg), arg);
+	if (at)
+		path = at + 1;
+
+	dc = calloc(1, sizeof(*dc));
+	if (!dc)
+		return -1;
+	pthread_mutex_init(&dc->lock, NULL);
+	dc->sock = connect_to(path);
+	if (dc->sock < 0)
+		goto err;
+
+	if (daemon_call(dc, MLX5CTLD_MSG_OPEN, 0, name, strlen(name), &rsp))
+		goto err_close;
+	if (rsp.arg) {
+		err_msg("mlx5ctld at %s: device %s not found\n", path, name);
+		goto err_close;
+	}
+	if (daemon_read(dc, &rsp.len, names, sizeof(names) - 1))
+		goto err_close;
+
+	dev->ops = &daemon_ops;
+	dev->priv = dc;
+	snprintf(dev->devname, sizeof(dev->devname), "daemon:%.*s",
+		 (int)(sizeof(dev->devname) - strlen("daemon:") - 1), names);
+	snprintf(dev->mdev, sizeof(dev->mdev), "%s", names + strlen(names) + 1);
+	return 0;
+
+err_close:
+	close(dc->sock);
+err:
+	pthread_mutex_destroy(&dc->lock);
+	free(dc);
+	return -1;
+}
@@ -6,39 +6,18 @@
 #include <errno.h>
 #include <string.h>
 #include <getopt.h>
+#include <stdint.h>
 
 #include "mlx5ctlu.h"
 #include "ifcutil.h"
 #include "mlx5_ifc.h"
+#include "async.h"
+#include "capcache.h"
+#include "ifc_schema.h"
+#include "hexdump.h"
+#include "json.h"
 
-enum mlx5_cap_type {
-	MLX5_CAP_GENERAL = 0,
-	MLX5_CAP_ETHERNET_OFFLOADS,
-	MLX5_CAP_ODP,
-	MLX5_CAP_ATOMIC,
-	MLX5_CAP_ROCE,
-	MLX5_CAP_IPOIB_OFFLOADS,
-	MLX5_CAP_IPOIB_ENHANCED_OFFLOADS,
-	MLX5_CAP_FLOW_TABLE,
-	MLX5_CAP_ESWITCH_FLOW_TABLE,
-	MLX5_CAP_ESWITCH,
-	MLX5_CAP_QOS = 0xc,
-	MLX5_CAP_DEBUG,
-	MLX5_CAP_RESERVED_14,
-	MLX5_CAP_DEV_MEM,
-	MLX5_CAP_RESERVED_16,
-	MLX5_CAP_TLS,
-	MLX5_CAP_VDPA_EMULATION = 0x13,
-	MLX5_CAP_DEV_EVENT = 0x14,
-	MLX5_CAP_IPSEC,
-	MLX5_CAP_CRYPTO = 0x1a,
-	MLX5_CAP_MACSEC = 0x1f,
-	MLX5_CAP_GENERAL_2 = 0x20,
-	MLX5_CAP_PORT_SELECTION = 0x25,
-	MLX5_CAP_ADV_VIRTUALIZATION = 0x26,
-	/* NUM OF CAP Types */
-	MLX5_CAP_NUM
-};
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 typedef void (*printcap_t)(void *out);
 
@@ -46,13 +25,14 @@ struct cap_info {
 	enum mlx5_cap_type type;
 	const char *name;
 	printcap_t print;
+	const char *layout; /* mlx5_ifc layout for --decode, NULL if none */
 };
 
-#define DEFINE_CAP(_name) \
-	{ .type = MLX5_CAP_##_name, .name = #_name, .print = NULL }
+#define DEFINE_CAP(_name, _layout) \
+	{ .type = MLX5_CAP_##_name, .name = #_name, .print = NULL, .layout = _layout }
 
-#define DEFINE_CAP_PRINT(_name, _print) \
-	{ .type = MLX5_CAP_##_name, .name = #_name, .print = _print }
+#define DEFINE_CAP_PRINT(_name, _print, _layout) \
+	{ .type = MLX5_CAP_##_name, .name = #_name, .print = _print, .layout = _layout }
 
 /* pretty print functions implemented at the bottom of the file */
 static void print_hca_caps(void *hca_caps);
@@ -65,29 +45,29 @@ static void print_port_selection_caps(void *port_selection_cap);
 
 struct cap_info caps[] =
 {
-	DEFINE_CAP_PRINT(GENERAL, print_hca_caps),
-	DEFINE_CAP_PRINT(ETHERNET_OFFLOADS, print_eth_caps),
-	DEFINE_CAP_PRINT(ROCE, print_roce_cap),
-	DEFINE_CAP_PRINT(GENERAL_2, print_hca_caps2),
-	DEFINE_CAP_PRINT(PORT_SELECTION, print_port_selection_caps),
-	DEFINE_CAP_PRINT(ADV_VIRTUALIZATION, print_virtio_emulation_cap),
-	DEFINE_CAP_PRINT(DEBUG, print_debug_caps),
-
-	DEFINE_CAP(ODP),
-	DEFINE_CAP(ATOMIC),
-	DEFINE_CAP(IPOIB_OFFLOADS),
-	DEFINE_CAP(IPOIB_ENHANCED_OFFLOADS),
-	DEFINE_CAP(FLOW_TABLE),
-	DEFINE_CAP(ESWITCH_FLOW_TABLE),
-	DEFINE_CAP(ESWITCH),
-	DEFINE_CAP(QOS),
-	DEFINE_CAP(DEV_MEM),
-	DEFINE_CAP(TLS),
-	DEFINE_CAP(VDPA_EMULATION),
-	DEFINE_CAP(DEV_EVENT),
-	DEFINE_CAP(IPSEC),
-	DEFINE_CAP(CRYPTO),
-	DEFINE_CAP(MACSEC),
+	DEFINE_CAP_PRINT(GENERAL, print_hca_caps, "cmd_hca_cap"),
+	DEFINE_CAP_PRINT(ETHERNET_OFFLOADS, print_eth_caps, "per_protocol_networking_offload_caps"),
+	DEFINE_CAP_PRINT(ROCE, print_roce_cap, "roce_cap"),
+	DEFINE_CAP_PRINT(GENERAL_2, print_hca_caps2, "cmd_hca_cap_2"),
+	DEFINE_CAP_PRINT(PORT_SELECTION, print_port_selection_caps, "port_selection_cap"),
+	DEFINE_CAP_PRINT(ADV_VIRTUALIZATION, print_virtio_emulation_cap, "adv_virtualization_cap"),
+	DEFINE_CAP_PRINT(DEBUG, print_debug_caps, "debug_cap"),
+
+	DEFINE_CAP(ODP, "odp_cap"),
+	DEFINE_CAP(ATOMIC, "atomic_caps"),
+	DEFINE_CAP(IPOIB_OFFLOADS, "per_protocol_networking_offload_caps"),
+	DEFINE_CAP(IPOIB_ENHANCED_OFFLOADS, "per_protocol_networking_offload_caps"),
+	DEFINE_CAP(FLOW_TABLE, "flow_table_nic_cap"),
+	DEFINE_CAP(ESWITCH_FLOW_TABLE, "flow_table_eswitch_cap"),
+	DEFINE_CAP(ESWITCH, "e_switch_cap"),
+	DEFINE_CAP(QOS, "qos_cap"),
+	DEFINE_CAP(DEV_MEM, "device_mem_cap"),
+	DEFINE_CAP(TLS, "tls_cap"),
+	DEFINE_CAP(VDPA_EMULATION, "virtio_emulation_cap"),
+	DEFINE_CAP(DEV_EVENT, "device_event_cap"),
+	DEFINE_CAP(IPSEC, "ipsec_cap"),
+	DEFINE_CAP(CRYPTO, NULL),
+	DEFINE_CAP(MACSEC, "macsec_cap"),
 };
 
 
@@ -114,29 +94,44 @@ static printcap_t get_cap_print(int cap_type)
 	return NULL;
 }
 
-enum mlx5_cap_mode {
-	HCA_CAP_OPMOD_GET_MAX	= 0,
-	HCA_CAP_OPMOD_GET_CUR	= 1,
-};
+static const char *get_cap_name(int cap_type)
+{
+	for (int i = 0; i < sizeof(caps) / sizeof(caps[0]); i++)
+		if (caps[i].type == cap_type)
+			return caps[i].name;
+	return NULL;
+}
+
+static const struct ifc_layout *get_cap_layout(int cap_type)
+{
+	for (int i = 0; i < sizeof(caps) / sizeof(caps[0]); i++)
+		if (caps[i].type == cap_type && caps[i].layout)
+			return ifc_layout_find(caps[i].layout);
+	return NULL;
+}
 
 enum pr_format {
 	PR_HEX = 'H',
 	PR_BIN = 'B',
 	PR_PRETTY = 'P',
+	PR_DECODE = 'D',
 };
 
 static int cap_type = -1;
 static int cap_mode = HCA_CAP_OPMOD_GET_CUR;
 static int pr_format = PR_HEX;
+static const char *fields;
 
 static void help() {
-	fprintf(stdout, "mlx5ctl <device> cap --id=<cap_type> --mode=[cur|max] -[B|H|P]\n");
+	fprintf(stdout, "mlx5ctl <device> cap --id=<cap_type> --mode=[cur|max] -[B|H|P|D]\n");
 	fprintf(stdout, "Query device capabilities, outputs PRM struct of the specific cap type\n");
 	fprintf(stdout, "\t--id=<cap_type> - cap type id or name\n");
 	fprintf(stdout, "\t--mode=[cur|max] - cap mode\n");
 	fprintf(stdout, "\t-B - binary output\n");
 	fprintf(stdout, "\t-H - hex output\n");
 	fprintf(stdout, "\t-P - pretty output\n");
+	fprintf(stdout, "\t-D - decode every field of the cap layout\n");
+	fprintf(stdout, "\t--fields=<f1,f2.sub,..> - print only these fields of the cap\n");
 	fprintf(stdout, "\t-h - help\n");
 	print_cap_types();
 }
@@ -149,13 +144,15 @@ static void parse_args(int argc, char *argv[])
 		{"bin", no_argument, 0, 'B'},
 		{"hex", no_argument, 0, 'H'},
 		{"pretty", no_argument, 0, 'P'},
+		{"decode", no_argument, 0, 'D'},
+		{"fields", required_argument, 0, 'f'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 	int option_index = 0;
 	int c;
 
-	while ((c = getopt_long(argc, argv, "i:m:BHPh", long_options, &option_index)) != -1)
+	while ((c = getopt_long(argc, argv, "i:m:BHPDf:h", long_options, &option_index)) != -1)
 	{
 		switch (c) {
 		case 'i':
@@ -177,8 +174,12 @@ static void parse_args(int argc, char *argv[])
 		case 'B':
 		case 'H':
 		case 'P':
+		case 'D':
 			pr_format = c;
 			break;
+		case 'f':
+			fields = optarg;
+			break;
 		case 'h':
 			help();
 			exit(0);
@@ -191,104 +192,245 @@ static void parse_args(int argc, char *argv[])
 	}
 }
 
-static void *query_caps(struct mlx5u_dev *dev, u16 opmod, void *out)
+/* --json: a record per cap, the fields of print() in a "fields" object */
+static void cap_rec_begin(int type)
 {
-	int out_sz = MLX5_ST_SZ_BYTES(query_hca_cap_out);
-	u8 in[MLX5_ST_SZ_BYTES(query_hca_cap_in)] = {};
-	int err;
-
-	MLX5_SET(query_hca_cap_in, in, opcode, MLX5_CMD_OP_QUERY_HCA_CAP);
-	MLX5_SET(query_hca_cap_in, in, op_mod, opmod);
-	err = mlx5u_cmd(dev, in, sizeof(in), out, out_sz);
-	if (err || MLX5_GET(mbox_out, out, status)) {
-		int cap_type = MLX5_GET(mbox_in, in, op_mod) >> 1;
-
-		fprintf(stderr, "query cap (0x%x) failed opcode 0x%x opmod 0x%x\n",
-			cap_type,
-		        MLX5_GET(mbox_in, in, opcode), MLX5_GET(mbox_in, in, op_mod));
-		fprintf(stderr, "status: 0x%x\n", MLX5_GET(mbox_out, out, status));
-		fprintf(stderr, "syndrome: 0x%x\n", MLX5_GET(mbox_out, out, syndrome));
-		return NULL;
-	}
+	const char *name = get_cap_name(type);
 
-	return MLX5_ADDR_OF(query_hca_cap_out, out, capability);
+	json_rec_begin();
+	if (name)
+		json_str("cap", name);
+	json_uint("type", type);
+	json_str("mode", cap_mode ? "cur" : "max");
 }
 
-int do_devcap(struct mlx5u_dev *dev, int argc, char *argv[])
+static void print_cap_pretty(printcap_t print, void *cap)
+{
+	if (json_output)
+		json_obj_begin("fields");
+	print(cap);
+	if (json_output)
+		json_obj_end();
+}
+
+static void print_query_caps_err(void *in, void *out)
+{
+	int cap_type = MLX5_GET(mbox_in, in, op_mod) >> 1;
+
+	fprintf(stderr, "query cap (0x%x) failed opcode 0x%x opmod 0x%x\n",
+		cap_type,
+	        MLX5_GET(mbox_in, in, opcode), MLX5_GET(mbox_in, in, op_mod));
+	fprintf(stderr, "status: 0x%x\n", MLX5_GET(mbox_out, out, status));
+	fprintf(stderr, "syndrome: 0x%x\n", MLX5_GET(mbox_out, out, syndrome));
+}
+
+/*
+ * All caps with a pretty print function. The queries go out together on the
+ * async queue and are printed in table order as they come back, so the FW
+ * round trips overlap instead of adding up.
+ */
+static int print_all_caps(struct mlx5u_dev *dev)
 {
 	int out_sz = MLX5_ST_SZ_BYTES(query_hca_cap_out);
-	void *out;
+	int in_sz = MLX5_ST_SZ_BYTES(query_hca_cap_in);
+	int ncaps = ARRAY_SIZE(caps);
+	struct mlx5u_completion comps[8];
+	struct mlx5u_async *as;
+	u8 *ins, *outs, *done;
+	int next = 0, err = 0;
+	int nprint = 0;
+
+	for (int i = 0; i < ncaps; i++)
+		nprint += caps[i].print != NULL;
+
+	ins = calloc(ncaps, in_sz);
+	outs = calloc(ncaps, out_sz);
+	/* 0: in flight, 1: done, 2: transport failed, 3: cached */
+	done = calloc(ncaps, 1);
+	as = mlx5u_async_create(nprint);
+	if (!ins || !outs || !done || !as) {
+		err = ENOMEM;
+		goto out;
+	}
 
-	out = malloc(out_sz);
-	if (!out)
-		return ENOMEM;
+	for (int i = 0; i < ncaps; i++) {
+		void *in = ins + i * in_sz;
 
-	memset(out, 0, out_sz);
+		if (!caps[i].print) {
+			done[i] = 1;
+			continue;
+		}
+		if (mlx5u_cap_peek(dev, caps[i].type, cap_mode & 0x01, NULL)) {
+			done[i] = 3;
+			continue;
+		}
+		MLX5_SET(query_hca_cap_in, in, opcode, MLX5_CMD_OP_QUERY_HCA_CAP);
+		MLX5_SET(query_hca_cap_in, in, op_mod, (caps[i].type << 1) | (cap_mode & 0x01));
+		if (!mlx5u_cmd_submit(as, dev, in, in_sz, outs + i * out_sz, out_sz,
+				      (void *)(uintptr_t)i)) {
+			err = errno;
+			err_msg("failed to submit query cap %s: %s\n", caps[i].name, strerror(err));
+			goto out;
+		}
+	}
 
-	parse_args(argc, argv);
+	while (next < ncaps) {
+		int n = mlx5u_async_wait(as, comps, ARRAY_SIZE(comps), -1);
 
-	if (cap_type >= 0) {
-		u16 op_mod = (cap_type << 1) | (cap_mode & 0x01);
-		void *cap = query_caps(dev, op_mod, out);
+		if (n < 0)
+			break;
+		for (int j = 0; j < n; j++) {
+			int i = (uintptr_t)comps[j].ctx;
 
-		if (!cap)
-			return 1;
+			done[i] = comps[j].ret ? 2 : 1;
+			if (comps[j].ret)
+				err_msg("MLX5CTL_IOCTL_CMDRPC failed: %d errno(%d): %s\n",
+					comps[j].ret, comps[j].err, strerror(comps[j].err));
+		}
 
-		switch (pr_format)
-		{
-		case PR_PRETTY: {
-			printcap_t print = get_cap_print(cap_type);
-			if (print) {
-				print(cap);
-				return 0;
+		for (; next < ncaps && done[next]; next++) {
+			void *out = outs + next * out_sz;
+
+			void *cap;
+
+			if (!caps[next].print)
+				continue;
+			if (done[next] == 3) {
+				cap = mlx5u_cap_peek(dev, caps[next].type, cap_mode & 0x01, NULL);
+			} else if (done[next] == 2 || MLX5_GET(mbox_out, out, status)) {
+				print_query_caps_err(ins + next * in_sz, out);
+				continue;
+			} else {
+				cap = MLX5_ADDR_OF(query_hca_cap_out, out, capability);
+				/* debug caps are longer, the counters follow */
+				if (caps[next].type != MLX5_CAP_DEBUG)
+					mlx5u_cap_put(dev, caps[next].type, cap_mode & 0x01,
+						      out, out_sz);
 			}
-			fprintf(stderr, "No pretty print function for cap type %d\n", cap_type);
-			fallthrough;
+			if (json_output) {
+				cap_rec_begin(caps[next].type);
+				print_cap_pretty(caps[next].print, cap);
+				json_rec_end();
+				continue;
+			}
+			fprintf(stdout, "MLX5_CAP_%s: (0x%x) (%s)\n", caps[next].name,
+				caps[next].type, cap_mode ? "cur" : "max");
+			caps[next].print(cap);
 		}
-		case PR_HEX:
-			hexdump(cap, MLX5_ST_SZ_BYTES(cmd_hca_cap));
-			break;
-		case PR_BIN:
-			fwrite(cap, sizeof(unsigned char), MLX5_ST_SZ_BYTES(cmd_hca_cap), stdout);
-			break;
-		default:
-			fprintf(stderr, "Invalid print format %c\n", pr_format);
-			return 1;
+	}
 
+out:
+	/* waits for whatever is still in flight before in/out go away */
+	mlx5u_async_destroy(as);
+	free(done);
+	free(outs);
+	free(ins);
+	return err;
+}
+
+static int print_cap(void *cap, size_t size)
+{
+	const struct ifc_layout *layout;
+
+	switch (pr_format)
+	{
+	case PR_PRETTY: {
+		printcap_t print = get_cap_print(cap_type);
+		if (print) {
+			print_cap_pretty(print, cap);
+			return 0;
 		}
-		return 0;
+		fallthrough;
 	}
+	case PR_DECODE:
+		layout = get_cap_layout(cap_type);
+		if (layout) {
+			ifc_decode(stdout, layout, cap, size);
+			return 0;
+		}
+		fprintf(stderr, "No layout to decode cap type %d\n", cap_type);
+		fallthrough;
+	case PR_HEX:
+		hexdump(cap, MLX5_ST_SZ_BYTES(cmd_hca_cap));
+		break;
+	case PR_BIN:
+		bindump(cap, MLX5_ST_SZ_BYTES(cmd_hca_cap));
+		break;
+	default:
+		fprintf(stderr, "Invalid print format %c\n", pr_format);
+		return 1;
 
-	/* print all caps that has pretty print function */
-	for (int i = 0; i < sizeof(caps) / sizeof(caps[0]); i++) {
-		if (!caps[i].print)
-			continue;
+	}
+	return 0;
+}
 
-		u16 opmod = (caps[i].type << 1) | (cap_mode & 0x01);
-		void *cap = query_caps(dev, opmod, out);
+int do_devcap(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	parse_args(argc, argv);
 
-		if (!cap)
-			continue;
-		fprintf(stdout, "MLX5_CAP_%s: (0x%x) (%s)\n", caps[i].name,
-			caps[i].type, cap_mode ? "cur" : "max");
-		caps[i].print(cap);
+	if (fields && cap_type < 0) {
+		fprintf(stderr, "--fields needs a cap --id\n");
+		return 1;
 	}
 
-	free(out);
-	return 0;
+	if (cap_type >= 0) {
+		const struct ifc_layout *layout;
+		struct ifc_select *sel = NULL;
+		size_t size;
+		void *cap;
+		int err = 0;
+
+		if (fields) {
+			layout = get_cap_layout(cap_type);
+			if (!layout) {
+				fprintf(stderr, "No layout for the fields of cap type %d\n", cap_type);
+				return 1;
+			}
+			sel = ifc_select_parse(layout, fields);
+			if (!sel)
+				return 1;
+		}
+
+		cap = mlx5u_cap(dev, cap_type, cap_mode & 0x01, &size);
+		if (!cap) {
+			ifc_select_free(sel);
+			return 1;
+		}
+		if (json_output)
+			cap_rec_begin(cap_type);
+		if (sel)
+			ifc_select_print(stdout, sel, cap, size);
+		else
+			err = print_cap(cap, size);
+		if (json_output)
+			json_rec_end();
+		ifc_select_free(sel);
+		return err;
+	}
+
+	return print_all_caps(dev);
 }
 
 /* ==================================================================== */
 /* Pretty print functions for specific caps */
 
+/* One field of a pretty printed cap, name is a literal */
+#define print_cap_fld(name, fmt, val) \
+	do { \
+		if (json_output) \
+			json_uint(name, val); \
+		else \
+			printf("\t" name ": " fmt "\n", val); \
+	} while (0)
+
 static void print_hca_caps(void *hca_caps)
 {
 #define MLX5_CAP_GEN(cap) MLX5_GET(cmd_hca_cap, hca_caps, cap)
 #define MLX5_CAP_GEN64(cap) MLX5_GET64(cmd_hca_cap, hca_caps, cap)
 #undef printcap
 #undef printcap64
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_GEN(cap))
-#define printcap64(cap) printf("\t" #cap ": 0x%lx\n", MLX5_CAP_GEN64(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_GEN(cap))
+#define printcap64(cap) print_cap_fld(#cap, "0x%lx", MLX5_CAP_GEN64(cap))
 	printcap(shared_object_to_user_object_allowed);
 	printcap(vhca_resource_manager);
 	printcap(hca_cap_2);
@@ -519,8 +661,8 @@ static void print_hca_caps2(void *hca_caps2)
 #define MLX5_CAP_GEN2_64(cap) MLX5_GET64(cmd_hca_cap_2, hca_caps2, cap)
 #undef printcap
 #undef printcap64
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_GEN2(cap))
-#define printcap64(cap) printf("\t" #cap ": 0x%lx\n", MLX5_CAP_GEN2_64(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_GEN2(cap))
+#define printcap64(cap) print_cap_fld(#cap, "0x%lx", MLX5_CAP_GEN2_64(cap))
 	printcap(max_reformat_insert_size);
 	printcap(max_reformat_insert_offset);
 	printcap(max_reformat_remove_size);
@@ -537,7 +679,7 @@ static void print_eth_caps(void *ethernet_offlods)
 #define MLX5_CAP_ETH(cap) \
 	MLX5_GET(per_protocol_networking_offload_caps, ethernet_offlods, cap)
 #undef  printcap
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_ETH(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_ETH(cap))
 
 	printcap(csum_cap);
 	printcap(vlan_cap);
@@ -590,8 +732,8 @@ static void print_virtio_emulation_cap(void *virtio_cap)
 	MLX5_GET64(virtio_emulation_cap, virtio_cap, cap)
 #undef  printcap
 #undef  printcap64
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_VIRTIO(cap))
-#define printcap64(cap) printf("\t" #cap ": %ld\n", MLX5_CAP_VIRTIO64(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_VIRTIO(cap))
+#define printcap64(cap) print_cap_fld(#cap, "%ld", MLX5_CAP_VIRTIO64(cap))
 
 	printcap(desc_tunnel_offload_type);
 	printcap(eth_frame_offload_type);
@@ -618,7 +760,7 @@ static void print_roce_cap(void *roce_cap)
 #define MLX5_CAP_ROCE(cap) \
 	MLX5_GET(roce_cap, roce_cap, cap)
 #undef  printcap
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_ROCE(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_ROCE(cap))
 
 	printcap(roce_apm);
 	printcap(sw_r_roce_src_udp_port);
@@ -638,7 +780,7 @@ static void print_debug_caps(void *debug_cap)
 #define MLX5_CAP_DEBUG(cap) \
 	MLX5_GET(debug_cap, debug_cap, cap)
 #undef  printcap
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_DEBUG(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_DEBUG(cap))
 
 	printcap(core_dump_general);
 	printcap(core_dump_qp);
@@ -658,7 +800,7 @@ static void print_port_selection_caps(void *port_selection_cap)
 #define MLX5_CAP_PORT_SELECTION(cap) \
 	MLX5_GET(port_selection_cap, port_selection_cap, cap)
 #undef  printcap
-#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_PORT_SELECTION(cap))
+#define printcap(cap) print_cap_fld(#cap, "%d", MLX5_CAP_PORT_SELECTION(cap))
 
 	printcap(port_select_flow_table);
 	printcap(port_select_flow_table_bypass);
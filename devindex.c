@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Device index: name -> mlx5 fwctl device.
+ *
+ * Resolving a user supplied name (fwctl0, 0000:08:00.0, 08:00.0, eth2,
+ * pci0000:00/0000:00:0a.0, numa:1) used to glob /sys/class/fwctl and
+ * readlink/realpath every entry on each open. The result of one walk is now
+ * hashed by every name a device is known by and persisted in a small text
+ * file under a runtime dir so short lived invocations skip the walk too.
+ *
+ * sysfs doesn't generate inotify events, so staleness is detected instead:
+ * the cache header carries the boot id and the number of /sys/class/fwctl
+ * entries, every fwctlN in the cache must still have the parent device
+ * recorded for it, and the caller validates the char device it opened
+ * against the major:minor and parent device recorded here (see
+ * find_dev()). fwctl minors are reused, a driver reload can bind the same
+ * fwctlN names to other devices. A miss rebuilds from sysfs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+
+#define DEVINDEX_VERSION 1
+#define DEVINDEX_FILE "devindex"
+#define KEY_STRS_PER_DEV (sizeof(((struct mlx5ctl_dev *)0)->bdf) + DEV_NAME_MAX)
+
+struct index_key {
+	const char *key;
+	int dev; /* index into devs[] */
+};
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mlx5ctl_dev *devs;
+static int ndevs;
+static struct index_key *keys;
+static unsigned int keys_size; /* power of 2 */
+static char *key_strs; /* backing storage for derived keys */
+static int loaded;
+static int force_rescan;
+
+static u32 fnv1a(const char *s)
+{
+	u32 h = 2166136261u;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void key_add(const char *key, int dev)
+{
+	unsigned int idx;
+
+	if (!key[0])
+		return;
+
+	for (idx = fnv1a(key) & (keys_size - 1); keys[idx].key;
+	     idx = (idx + 1) & (keys_size - 1))
+		if (!strcmp(keys[idx].key, key))
+			return; /* first device wins, e.g. same netdev name */
+	keys[idx].key = key;
+	keys[idx].dev = dev;
+}
+
+static int key_find(const char *key)
+{
+	unsigned int idx;
+
+	if (!keys)
+		return -1;
+	for (idx = fnv1a(key) & (keys_size - 1); keys[idx].key;
+	     idx = (idx + 1) & (keys_size - 1))
+		if (!strcmp(keys[idx].key, key))
+			return keys[idx].dev;
+	return -1;
+}
+
+static void index_free(void)
+{
+	free(keys);
+	free(key_strs);
+	free(devs);
+	keys = NULL;
+	key_strs = NULL;
+	devs = NULL;
+	ndevs = 0;
+	loaded = 0;
+}
+
+/* name, path, sysfs path, bdf with and without domain, every netdev */
+static int index_build(void)
+{
+	unsigned int nkeys = 0;
+
+	for (int i = 0; i < ndevs; i++) {
+		nkeys += 5;
+		for (char *c = devs[i].netdevs; *c; c++)
+			nkeys += *c == ',';
+		nkeys += devs[i].netdevs[0] != '\0';
+	}
+
+	for (keys_size = 16; keys_size < 2 * nkeys; keys_size <<= 1)
+		;
+	keys = calloc(keys_size, sizeof(*keys));
+	/* short bdfs and split netdev lists need storage of their own */
+	key_strs = calloc(ndevs ? ndevs : 1, KEY_STRS_PER_DEV);
+	if (!keys || !key_strs)
+		return -1;
+
+	for (int i = 0; i < ndevs; i++) {
+		struct mlx5ctl_dev *d = &devs[i];
+		char *short_bdf = key_strs + i * KEY_STRS_PER_DEV;
+		char *netdevs = short_bdf + sizeof(d->bdf);
+		char *save = NULL;
+
+		key_add(strrchr(d->ctldev, '/') + 1, i);
+		key_add(d->ctldev, i);
+		key_add(d->mdev, i);
+		key_add(d->bdf, i);
+		/* 0000:08:00.0 -> 08:00.0 */
+		if (strlen(d->bdf) > 5 && d->bdf[4] == ':') {
+			snprintf(short_bdf, sizeof(d->bdf), "%s", d->bdf + 5);
+			key_add(short_bdf, i);
+		}
+
+		snprintf(netdevs, sizeof(d->netdevs), "%s", d->netdevs);
+		for (char *tok = strtok_r(netdevs, ",", &save); tok;
+		     tok = strtok_r(NULL, ",", &save))
+			key_add(tok, i);
+	}
+	return 0;
+}
+
+const char *mlx5u_cache_dir(void)
+{
+	const char *dir = getenv("MLX5CTL_CACHE_DIR");
+
+	if (dir && dir[0])
+		return dir;
+	if (!mkdir("/run/mlx5ctl", 0755) || errno == EEXIST) {
+		if (!access("/run/mlx5ctl", W_OK))
+			return "/run/mlx5ctl";
+	}
+	dir = getenv("XDG_RUNTIME_DIR");
+	if (dir && dir[0])
+		return dir;
+	return "/tmp";
+}
+
+static void cache_path(char *path, size_t len)
+{
+	snprintf(path, len, "%s/mlx5ctl-%s.%u", mlx5u_cache_dir(), DEVINDEX_FILE,
+		 (unsigned int)getuid());
+}
+
+static void boot_id(char *buf, size_t len)
+{
+	FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+
+	snprintf(buf, len, "-");
+	if (!f)
+		return;
+	if (!fgets(buf, len, f))
+		snprintf(buf, len, "-");
+	buf[strcspn(buf, "\n")] = '\0';
+	fclose(f);
+}
+
+/* Cheap: a single readdir, no per device readlink/realpath */
+static int fwctl_entries(void)
+{
+	DIR *dir = opendir("/sys/class/fwctl");
+	struct dirent *de;
+	int n = 0;
+
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir)))
+		n += de->d_name[0] != '.';
+	closedir(dir);
+	return n;
+}
+
+/* One realpath per device, not the full parse of a sysfs walk */
+static int cache_dev_valid(struct mlx5ctl_dev *d)
+{
+	char sysfs[PATH_MAX], mdev[DEV_NAME_MAX];
+	const char *name = strrchr(d->ctldev, '/');
+	int n;
+
+	if (!name)
+		return 0;
+	n = snprintf(sysfs, sizeof(sysfs), "/sys/class/fwctl/%s", name + 1);
+	if (n < 0 || n >= sizeof(sysfs))
+		return 0;
+	return !mlx5u_sysfs_mdev(sysfs, mdev, sizeof(mdev)) && !strcmp(mdev, d->mdev);
+}
+
+static int cache_load(const char *path)
+{
+	char line[4 * DEV_NAME_MAX];
+	char bid[64], file_bid[64];
+	int version, entries, n;
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) || st.st_uid != getuid() || !(f = fdopen(fd, "r"))) {
+		close(fd);
+		return -1;
+	}
+
+	boot_id(bid, sizeof(bid));
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "mlx5ctl-devindex %d %63s %d %d", &version, file_bid,
+		   &entries, &n) != 4 ||
+	    version != DEVINDEX_VERSION || strcmp(bid, file_bid) ||
+	    entries != fwctl_entries() || n <= 0 || n > entries)
+		goto err;
+
+	devs = calloc(n, sizeof(*devs));
+	if (!devs)
+		goto err;
+	for (ndevs = 0; ndevs < n; ndevs++) {
+		struct mlx5ctl_dev *d = &devs[ndevs];
+
+		if (!fgets(line, sizeof(line), f) ||
+		    sscanf(line, "%127s %127s %15s %127s %d %u %u", d->ctldev,
+			   d->mdev, d->bdf, d->netdevs, &d->numa_node, &d->major,
+			   &d->minor) != 7)
+			goto err;
+		if (!strcmp(d->bdf, "-"))
+			d->bdf[0] = '\0';
+		if (!strcmp(d->netdevs, "-"))
+			d->netdevs[0] = '\0';
+		if (!cache_dev_valid(d)) {
+			dbg_msg(2, "device index: %s moved from %s\n", d->ctldev, d->mdev);
+			goto err;
+		}
+	}
+	fclose(f);
+	dbg_msg(2, "device index loaded from %s, %d devices\n", path, ndevs);
+	return 0;
+
+err:
+	free(devs);
+	devs = NULL;
+	ndevs = 0;
+	fclose(f);
+	return -1;
+}
+
+static void cache_store(const char *path, int entries)
+{
+	char tmp[PATH_MAX];
+	char bid[64];
+	FILE *f;
+	int fd, n;
+
+	n = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if (n < 0 || n >= sizeof(tmp))
+		return;
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		dbg_msg(2, "can't write device index %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	fchmod(fd, 0644);
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	boot_id(bid, sizeof(bid));
+	fprintf(f, "mlx5ctl-devindex %d %s %d %d\n", DEVINDEX_VERSION, bid,
+		entries, ndevs);
+	for (int i = 0; i < ndevs; i++)
+		fprintf(f, "%s %s %s %s %d %u %u\n", devs[i].ctldev, devs[i].mdev,
+			devs[i].bdf[0] ? devs[i].bdf : "-",
+			devs[i].netdevs[0] ? devs[i].netdevs : "-",
+			devs[i].numa_node, devs[i].major, devs[i].minor);
+
+	/* readers either see the old or the new file, never a partial one */
+	if (fclose(f) || rename(tmp, path))
+		unlink(tmp);
+}
+
+static int index_load(void)
+{
+	char path[PATH_MAX];
+
+	if (loaded && !force_rescan)
+		return 0;
+	index_free();
+
+	cache_path(path, sizeof(path));
+	if (force_rescan || cache_load(path)) {
+		int entries = fwctl_entries();
+
+		devs = mlx5u_sysfs_scan(&ndevs);
+		dbg_msg(2, "device index rebuilt from sysfs, %d devices\n", ndevs);
+		if (ndevs)
+			cache_store(path, entries);
+	}
+	force_rescan = 0;
+
+	if (index_build()) {
+		index_free();
+		return -1;
+	}
+	loaded = 1;
+	return 0;
+}
+
+/* numa:N selects the first device on that node */
+static int numa_find(const char *name)
+{
+	char *end;
+	long node;
+
+	if (strncmp(name, "numa:", 5))
+		return -1;
+	node = strtol(name + 5, &end, 10);
+	if (*end || end == name + 5)
+		return -1;
+	for (int i = 0; i < ndevs; i++)
+		if (devs[i].numa_node == node)
+			return i;
+	return -1;
+}
+
+int mlx5u_devindex_lookup(const char *name, struct mlx5ctl_dev *dev)
+{
+	int idx = -1;
+
+	pthread_mutex_lock(&index_lock);
+	if (!index_load()) {
+		idx = key_find(name);
+		if (idx < 0)
+			idx = numa_find(name);
+		if (idx >= 0)
+			*dev = devs[idx];
+	}
+	pthread_mutex_unlock(&index_lock);
+	return idx < 0 ? -1 : 0;
+}
+
+/* Returns a copy of all devices in scan order, caller frees */
+struct mlx5ctl_dev *mlx5u_devindex_list(int *count)
+{
+	struct mlx5ctl_dev *list = NULL;
+
+	*count = 0;
+	pthread_mutex_lock(&index_lock);
+	if (!index_load() && ndevs) {
+		list = malloc(ndevs * sizeof(*list));
+		if (list) {
+			memcpy(list, devs, ndevs * sizeof(*list));
+			*count = ndevs;
+		}
+	}
+	pthread_mutex_unlock(&index_lock);
+	return list;
+}
+
+/* Next lookup walks sysfs again and refreshes the cache file */
+void mlx5u_devindex_invalidate(void)
+{
+	pthread_mutex_lock(&index_lock);
+	force_rescan = 1;
+	pthread_mutex_unlock(&index_lock);
+}
@@ -0,0 +1,654 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * diagcnt analyze, see diag_analyze.h.
+ *
+ * Blocks decode on their own but their 32 bit time stamps don't, so a
+ * first pass walks the block headers in order, reads only the first
+ * sample_id and time stamp of each and unwraps it by the samples since
+ * the previous block. From there on every block has its absolute tick
+ * count, a range starts anywhere and the threads share nothing but the
+ * read only mapping and the block index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "diag_capture.h"
+#include "diag_stats.h"
+#include "diag_analyze.h"
+#include "json.h"
+
+/* windows * counters of each thread, past that --window is too small */
+#define ANALYZE_MAX_WIN_CNT (1 << 24)
+
+struct an_block {
+	struct diag_cap_block b;
+	u64 ticks; /* of the first row */
+};
+
+enum {
+	AN_GAP_OVERRUN,
+	AN_GAP_RESYNC,
+};
+
+struct an_gap {
+	u64 ns;
+	u32 lost;
+	u16 sid;
+	u16 type;
+};
+
+struct an_gaps {
+	struct an_gap *gap;
+	u32 n;
+	u32 max;
+};
+
+/* Sums over the pairs of consecutive samples ending in the window */
+struct an_win {
+	double dv;
+	u64 dt;
+};
+
+struct an_counter {
+	struct diag_moments value;
+	struct diag_moments rate; /* per second */
+	struct diag_qsketch rate_q;
+	u64 first_v;
+	u64 last_v;
+};
+
+struct analyze;
+
+struct an_range {
+	struct analyze *a;
+	u32 first;
+	u32 end;
+	int err;
+	int have; /* any rows, the first_ and last_ fields are set */
+	u64 rows;
+	u64 lost;
+	u16 first_sid;
+	u16 last_sid;
+	u64 first_ns;
+	u64 last_ns;
+	struct an_gaps gaps;
+	struct an_win *win; /* [window][counter] */
+	struct an_counter cnt[];
+};
+
+struct analyze {
+	struct diag_cap_file *f;
+	int ncnt;
+	u32 freq_khz;
+	u64 period_ticks;
+	struct an_block *blk;
+	u32 nblk;
+	u64 t0; /* ticks of the first row */
+	u64 window_ns;
+	u32 nwin;
+};
+
+static u64 an_ns(struct analyze *a, u64 ticks)
+{
+	if (ticks < a->t0)
+		return 0;
+	return (unsigned __int128)(ticks - a->t0) * 1000000 / a->freq_khz;
+}
+
+static u32 an_window(struct analyze *a, u64 ns)
+{
+	u64 w = ns / a->window_ns;
+
+	return w < a->nwin ? w : a->nwin - 1;
+}
+
+static int gap_add(struct an_gaps *g, u16 type, u64 ns, u16 sid, u32 lost)
+{
+	if (g->n == g->max) {
+		u32 max = g->max ? 2 * g->max : 16;
+		struct an_gap *gap = realloc(g->gap, max * sizeof(*gap));
+
+		if (!gap)
+			return -ENOMEM;
+		g->gap = gap;
+		g->max = max;
+	}
+	g->gap[g->n++] = (struct an_gap) {
+		.ns = ns, .lost = lost, .sid = sid, .type = type,
+	};
+	return 0;
+}
+
+/* The block index, with the unwrapped tick count of every block */
+static int an_index(struct analyze *a)
+{
+	struct diag_cap_block b;
+	u32 max = 0, ts;
+	size_t off = 0;
+	u16 sid;
+	int err;
+
+	while (!(err = diag_cap_next(a->f, &off, &b))) {
+		struct an_block *blk;
+
+		if (a->nblk == max) {
+			max = max ? 2 * max : 1024;
+			blk = realloc(a->blk, max * sizeof(*blk));
+			if (!blk)
+				return -ENOMEM;
+			a->blk = blk;
+		}
+		if (diag_cap_first(&b, &sid, &ts)) {
+			off = b.off;
+			err = -EINVAL;
+			break;
+		}
+		blk = &a->blk[a->nblk];
+		blk->b = b;
+		if (!a->nblk) {
+			blk->ticks = ts;
+			a->t0 = ts;
+		} else {
+			struct an_block *prev = blk - 1;
+
+			blk->ticks = diag_ts_unwrap(prev->ticks + ((u64)prev->b.rows + b.lost) *
+						    a->period_ticks, ts);
+		}
+		a->nblk++;
+	}
+	if (err < 0) {
+		err_msg("bad capture block at offset %zu, analyzing the %u blocks before it\n",
+			off, a->nblk);
+		if (!a->nblk)
+			return err;
+	}
+	return 0;
+}
+
+static struct an_range *range_alloc(struct analyze *a)
+{
+	struct an_range *r;
+
+	r = calloc(1, sizeof(*r) + a->ncnt * sizeof(r->cnt[0]));
+	if (!r)
+		return NULL;
+	r->a = a;
+	if (a->nwin) {
+		r->win = calloc((size_t)a->nwin * a->ncnt, sizeof(*r->win));
+		if (!r->win) {
+			free(r);
+			return NULL;
+		}
+	}
+	return r;
+}
+
+static void range_free(struct an_range *r)
+{
+	if (!r)
+		return;
+	free(r->gaps.gap);
+	free(r->win);
+	free(r);
+}
+
+/* The pair of samples of counter c, pv at pns and v at ns, across ranges */
+static void add_rate(struct an_range *r, int c, u64 pv, u64 pns, u64 v, u64 ns)
+{
+	struct an_counter *cnt = &r->cnt[c];
+	double rate;
+
+	/* a counter that went back was cleared, no rate across that */
+	if (v < pv || ns <= pns)
+		return;
+	rate = (v - pv) * 1e9 / (ns - pns);
+	diag_moments_add(&cnt->rate, rate);
+	diag_qs_add(&cnt->rate_q, rate < 0x1p64 ? (u64)(rate + 0.5) : ~0ull);
+	if (r->win) {
+		struct an_win *w = &r->win[(size_t)an_window(r->a, ns) * r->a->ncnt + c];
+
+		w->dv += v - pv;
+		w->dt += ns - pns;
+	}
+}
+
+/* Per row, shared by the counters, and the arrays a counter is reduced from */
+struct an_scratch {
+	u64 ns[DIAG_CAP_BLOCK_ROWS];
+	double inv_dt[DIAG_CAP_BLOCK_ROWS]; /* 1e9 / ns since the row before, 0 if none */
+	u32 win[DIAG_CAP_BLOCK_ROWS];
+	double value[DIAG_CAP_BLOCK_ROWS];
+	double rate[DIAG_CAP_BLOCK_ROWS];
+};
+
+static int range_gaps(struct an_range *r, const struct diag_cap_block *b,
+		      const struct diag_cap_rows *rows, const u64 *ns)
+{
+	int err = 0;
+
+	if (b->lost)
+		err = gap_add(&r->gaps, AN_GAP_OVERRUN, ns[0], rows->sid[0], b->lost);
+	else if (r->have && rows->sid[0] != (u16)(r->last_sid + 1))
+		err = gap_add(&r->gaps, AN_GAP_RESYNC, ns[0], rows->sid[0], 0);
+	for (u32 i = 1; !err && i < b->rows; i++)
+		if (rows->sid[i] != (u16)(rows->sid[i - 1] + 1))
+			err = gap_add(&r->gaps, AN_GAP_RESYNC, ns[i], rows->sid[i], 0);
+	return err;
+}
+
+static int range_block(struct an_range *r, const struct an_block *blk,
+		       struct diag_cap_rows *rows, struct an_scratch *sc)
+{
+	struct analyze *a = r->a;
+	const struct diag_cap_block *b = &blk->b;
+	u64 ticks = blk->ticks, pns = r->last_ns;
+	int err;
+
+	err = diag_cap_decode(a->f, b, rows);
+	if (err)
+		return err;
+
+	for (u32 i = 0; i < b->rows; i++) {
+		if (i)
+			ticks += (u32)(rows->ts[i] - rows->ts[i - 1]);
+		sc->ns[i] = an_ns(a, ticks);
+		sc->inv_dt[i] = (i || r->have) && sc->ns[i] > pns ? 1e9 / (sc->ns[i] - pns) : 0;
+		if (r->win)
+			sc->win[i] = an_window(a, sc->ns[i]);
+		pns = sc->ns[i];
+	}
+	err = range_gaps(r, b, rows, sc->ns);
+	if (err)
+		return err;
+
+	for (int c = 0; c < a->ncnt; c++) {
+		struct an_counter *cnt = &r->cnt[c];
+		const u64 *v = diag_cap_val(rows, c);
+		u64 pv = r->have ? cnt->last_v : v[0];
+		u32 nrate = 0;
+
+		for (u32 i = 0; i < b->rows; i++) {
+			double rate;
+
+			sc->value[i] = v[i];
+			/* a counter that went back was cleared, no rate across that */
+			if (!sc->inv_dt[i] || v[i] < pv) {
+				pv = v[i];
+				continue;
+			}
+			rate = (v[i] - pv) * sc->inv_dt[i];
+			sc->rate[nrate++] = rate;
+			diag_qs_add(&cnt->rate_q, rate < 0x1p64 ? (u64)(rate + 0.5) : ~0ull);
+			if (r->win) {
+				struct an_win *w = &r->win[(size_t)sc->win[i] * a->ncnt + c];
+
+				w->dv += v[i] - pv;
+				w->dt += i ? sc->ns[i] - sc->ns[i - 1] : sc->ns[0] - r->last_ns;
+			}
+			pv = v[i];
+		}
+		diag_moments_add_array(&cnt->value, sc->value, b->rows);
+		diag_moments_add_array(&cnt->rate, sc->rate, nrate);
+		if (!r->have)
+			cnt->first_v = v[0];
+		cnt->last_v = v[b->rows - 1];
+	}
+
+	if (!r->have) {
+		r->first_sid = rows->sid[0];
+		r->first_ns = sc->ns[0];
+		r->have = 1;
+	}
+	r->last_sid = rows->sid[b->rows - 1];
+	r->last_ns = sc->ns[b->rows - 1];
+	r->rows += b->rows;
+	r->lost += b->lost;
+	return 0;
+}
+
+/* Start reading the range in, each thread reads its own part of the file */
+static void range_prefetch(struct an_range *r)
+{
+	const struct diag_cap_file *f = r->a->f;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = r->a->blk[r->first].b.off & ~(page - 1);
+	const struct diag_cap_block *last = &r->a->blk[r->end - 1].b;
+	size_t end = last->data + last->len - f->map;
+
+	madvise((void *)(f->map + start), end - start, MADV_WILLNEED);
+}
+
+static void *range_thread(void *arg)
+{
+	struct an_range *r = arg;
+	struct diag_cap_rows *rows = diag_cap_rows_alloc(r->a->f);
+	struct an_scratch *sc = malloc(sizeof(*sc));
+
+	if (!rows || !sc) {
+		r->err = -ENOMEM;
+		goto out;
+	}
+	range_prefetch(r);
+	for (u32 i = r->first; i < r->end; i++) {
+		r->err = range_block(r, &r->a->blk[i], rows, sc);
+		if (r->err) {
+			if (r->err == -EINVAL)
+				err_msg("bad capture block at offset %zu\n", r->a->blk[i].b.off);
+			break;
+		}
+	}
+out:
+	free(sc);
+	free(rows);
+	return NULL;
+}
+
+/* Add r, the range right after m, to m */
+static int range_merge(struct an_range *m, struct an_range *r)
+{
+	struct analyze *a = m->a;
+	int err = 0;
+
+	if (!r->have)
+		return 0;
+	if (!m->have) {
+		m->first_sid = r->first_sid;
+		m->first_ns = r->first_ns;
+	} else {
+		for (int c = 0; c < a->ncnt; c++)
+			add_rate(m, c, m->cnt[c].last_v, m->last_ns, r->cnt[c].first_v,
+				 r->first_ns);
+		/* r didn't know its first row follows one, unless it was an overrun */
+		if (r->first_sid != (u16)(m->last_sid + 1) &&
+		    (!r->gaps.n || r->gaps.gap[0].ns != r->first_ns))
+			err = gap_add(&m->gaps, AN_GAP_RESYNC, r->first_ns, r->first_sid, 0);
+	}
+	for (u32 i = 0; !err && i < r->gaps.n; i++)
+		err = gap_add(&m->gaps, r->gaps.gap[i].type, r->gaps.gap[i].ns,
+			      r->gaps.gap[i].sid, r->gaps.gap[i].lost);
+
+	for (int c = 0; c < a->ncnt; c++) {
+		struct an_counter *mc = &m->cnt[c], *rc = &r->cnt[c];
+
+		if (!m->have)
+			mc->first_v = rc->first_v;
+		mc->last_v = rc->last_v;
+		diag_moments_merge(&mc->value, &rc->value);
+		diag_moments_merge(&mc->rate, &rc->rate);
+		diag_qs_merge(&mc->rate_q, &rc->rate_q);
+	}
+	for (size_t i = 0; m->win && i < (size_t)a->nwin * a->ncnt; i++) {
+		m->win[i].dv += r->win[i].dv;
+		m->win[i].dt += r->win[i].dt;
+	}
+	m->last_sid = r->last_sid;
+	m->last_ns = r->last_ns;
+	m->rows += r->rows;
+	m->lost += r->lost;
+	m->have = 1;
+	return err;
+}
+
+/* Contiguous ranges of about the same number of bytes */
+static u32 split(struct analyze *a, struct an_range **rng, int jobs)
+{
+	size_t total = 0, done = 0;
+	u32 n = 0, i = 0;
+
+	for (u32 k = 0; k < a->nblk; k++)
+		total += a->blk[k].b.len;
+	while (i < a->nblk) {
+		rng[n]->first = i;
+		while (i < a->nblk && (n == jobs - 1 || done < total / jobs * (n + 1)))
+			done += a->blk[i++].b.len;
+		if (i == rng[n]->first)
+			done += a->blk[i++].b.len;
+		rng[n]->end = i;
+		n++;
+	}
+	return n;
+}
+
+/* Power of 2 buckets of the sketch, the sub-buckets added up */
+static void print_hist(const struct diag_qsketch *q)
+{
+	if (json_output)
+		json_arr_begin("histogram");
+	else
+		printf("\t\thistogram:\n");
+	for (int i = 0; i < DIAG_QS_BUCKETS; ) {
+		u64 lo = diag_qs_lower(i), hi, n = 0;
+		int e = lo ? 63 - __builtin_clzll(lo) : -1;
+
+		hi = e < 0 ? 1 : e < 63 ? 2ull << e : ~0ull;
+		for (; i < DIAG_QS_BUCKETS && diag_qs_lower(i) < hi && diag_qs_lower(i) >= lo; i++)
+			n += q->bucket[i];
+		if (!n)
+			continue;
+		if (json_output) {
+			json_obj_begin(NULL);
+			json_uint("lo", lo);
+			json_uint("hi", hi);
+			json_uint("count", n);
+			json_obj_end();
+		} else {
+			printf("\t\t\t[%llu, %llu): %llu\n", (unsigned long long)lo,
+			       (unsigned long long)hi, (unsigned long long)n);
+		}
+	}
+	if (json_output)
+		json_arr_end();
+}
+
+static void print_gap(const struct an_gap *g)
+{
+	const char *what = g->type == AN_GAP_OVERRUN ? "overrun" : "lost sync";
+
+	if (json_output) {
+		json_rec_begin();
+		json_str("event", what);
+		json_uint("time_ns", g->ns);
+		json_uint("lost", g->lost);
+		json_uint("sample_id", g->sid);
+		json_rec_end();
+		return;
+	}
+	printf("\t%s at %.3f ms, %u samples lost before sample_id %u\n", what,
+	       g->ns / 1e6, g->lost, g->sid);
+}
+
+static void print_result(struct analyze *a, struct an_range *m, const struct diag_analyze_opts *o)
+{
+	const struct diag_cap_file_hdr *hdr = a->f->hdr;
+	u64 period_ns = a->period_ticks * 1000000 / a->freq_khz;
+	u32 overruns = 0;
+
+	for (u32 i = 0; i < m->gaps.n; i++)
+		overruns += m->gaps.gap[i].type == AN_GAP_OVERRUN;
+
+	if (json_output) {
+		json_rec_begin();
+		json_str("capture_dev", hdr->dev);
+		json_strn("fw_version", hdr->fw_version, sizeof(hdr->fw_version));
+		json_uint("counters", a->ncnt);
+		json_uint("period_ns", period_ns);
+		json_uint("samples", m->rows);
+		json_uint("duration_ns", m->last_ns - m->first_ns);
+		json_uint("overruns", overruns);
+		json_uint("lost", m->lost);
+		json_uint("resyncs", m->gaps.n - overruns);
+		json_rec_end();
+	} else {
+		printf("%s FW %s, %d counters, sample period %llu ns\n", hdr->dev,
+		       hdr->fw_version[0] ? hdr->fw_version : "unknown", a->ncnt,
+		       (unsigned long long)period_ns);
+		printf("%llu samples over %.3f ms, %u overruns, %llu samples lost, %u resyncs\n",
+		       (unsigned long long)m->rows, (m->last_ns - m->first_ns) / 1e6,
+		       overruns, (unsigned long long)m->lost, m->gaps.n - overruns);
+	}
+	for (u32 i = 0; i < m->gaps.n; i++)
+		print_gap(&m->gaps.gap[i]);
+
+	for (int c = 0; c < a->ncnt; c++) {
+		struct an_counter *cnt = &m->cnt[c];
+
+		if (json_output) {
+			json_rec_begin();
+			json_uint("counter_id", hdr->counter_id[c]);
+			json_uint("samples", cnt->value.n);
+		} else {
+			printf("counter_id: 0x%04x\n", hdr->counter_id[c]);
+		}
+		diag_stats_print_moments("value", &cnt->value, NULL);
+		if (cnt->rate.n) {
+			diag_stats_print_moments("rate", &cnt->rate, &cnt->rate_q);
+			if (o->hist)
+				print_hist(&cnt->rate_q);
+		}
+		if (json_output)
+			json_rec_end();
+	}
+
+	if (!m->win)
+		return;
+	if (!json_output)
+		printf("rate per window of %.3f ms:\n", a->window_ns / 1e6);
+	for (u32 w = 0; w < a->nwin; w++) {
+		if (!json_output)
+			printf("\t%.3f ms:", (double)w * a->window_ns / 1e6);
+		for (int c = 0; c < a->ncnt; c++) {
+			struct an_win *win = &m->win[(size_t)w * a->ncnt + c];
+			double rate = win->dt ? win->dv * 1e9 / win->dt : 0;
+
+			if (!json_output) {
+				printf(" 0x%04x %.6g", hdr->counter_id[c], rate);
+				continue;
+			}
+			if (!win->dt)
+				continue;
+			json_rec_begin();
+			json_uint("window", w);
+			json_uint("start_ns", w * a->window_ns);
+			json_uint("counter_id", hdr->counter_id[c]);
+			json_double("rate", rate);
+			json_rec_end();
+		}
+		if (!json_output)
+			printf("\n");
+	}
+}
+
+static u64 mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int diag_analyze(const char *path, const struct diag_analyze_opts *o)
+{
+	struct an_range **rng = NULL;
+	struct analyze a = {};
+	pthread_t *tid = NULL;
+	u64 start = mono_ns();
+	int jobs = o->jobs;
+	u32 nrng = 0;
+	int err;
+
+	a.f = diag_cap_open(path);
+	if (!a.f)
+		return EINVAL;
+	a.ncnt = a.f->hdr->ncnt;
+	a.freq_khz = a.f->hdr->dev_freq_khz;
+	a.period_ticks = 1ull << a.f->hdr->log_sample_period;
+	a.window_ns = o->window_ns;
+
+	err = an_index(&a);
+	if (err)
+		goto out;
+	if (!a.nblk) {
+		info_msg("%s has no samples\n", path);
+		goto out;
+	}
+	if (a.window_ns) {
+		const struct an_block *last = &a.blk[a.nblk - 1];
+		u64 end = an_ns(&a, last->ticks + last->b.rows * a.period_ticks);
+
+		a.nwin = end / a.window_ns + 1;
+		if ((u64)a.nwin * a.ncnt > ANALYZE_MAX_WIN_CNT) {
+			err_msg("--window of %llu ns makes too many windows\n",
+				(unsigned long long)a.window_ns);
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > a.nblk)
+		jobs = a.nblk;
+	if (jobs < 1)
+		jobs = 1;
+	rng = calloc(jobs, sizeof(*rng));
+	tid = calloc(jobs, sizeof(*tid));
+	if (!rng || !tid) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (int i = 0; i < jobs; i++) {
+		rng[i] = range_alloc(&a);
+		if (!rng[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+	nrng = split(&a, rng, jobs);
+
+	for (u32 i = 0; i < nrng; i++) {
+		err = -pthread_create(&tid[i], NULL, range_thread, rng[i]);
+		if (err) {
+			err_msg("failed to start analyze thread: %s\n", strerror(-err));
+			nrng = i;
+			break;
+		}
+	}
+	for (u32 i = 0; i < nrng; i++)
+		pthread_join(tid[i], NULL);
+	if (err)
+		goto out;
+
+	for (u32 i = 0; i < nrng; i++) {
+		if (!err)
+			err = rng[i]->err;
+		if (!err && i)
+			err = range_merge(rng[0], rng[i]);
+	}
+	if (err)
+		goto out;
+	print_result(&a, rng[0], o);
+	fflush(stdout);
+	json_flush();
+	fprintf(stderr, "diagcnt analyze: %u blocks, %zu bytes on %u threads in %.3f ms\n",
+		a.nblk, a.f->len, nrng, (mono_ns() - start) / 1e6);
+
+out:
+	for (int i = 0; rng && i < jobs; i++)
+		range_free(rng[i]);
+	free(rng);
+	free(tid);
+	free(a.blk);
+	diag_cap_close(a.f);
+	return err < 0 ? -err : err;
+}
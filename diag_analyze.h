@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_DIAG_ANALYZE_H__
+#define __MLX5CTL_DIAG_ANALYZE_H__
+
+#include "ifcutil.h"
+
+/*
+ * Offline analysis of a diagnostic counters capture, diagcnt analyze.
+ *
+ * The capture is mmap()ed and its blocks split into one contiguous range
+ * per thread. Each thread decodes its range and reduces it on its own: the
+ * value and rate statistics and rate quantiles per counter, the mean rate
+ * per counter in every window of device time, and the gaps (overruns and
+ * lost sync) with their time. The ranges are merged in order at the end,
+ * adding up the sketches and windows and filling in the rate and gap
+ * across each range boundary, so the result doesn't depend on the number
+ * of threads, up to floating point rounding.
+ */
+
+struct diag_analyze_opts {
+	int jobs;      /* threads, 0 for one per CPU */
+	u64 window_ns; /* of the rate time series, 0 for none */
+	int hist;      /* print the rate histograms */
+};
+
+int diag_analyze(const char *path, const struct diag_analyze_opts *opts);
+
+#endif /* __MLX5CTL_DIAG_ANALYZE_H__ */
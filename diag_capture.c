@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Diagnostic counters capture file, see diag_capture.h.
+ *
+ * The writer keeps a block of rows by column and encodes it when it is
+ * full, at a gap and at the end. Counters mostly move by a similar amount
+ * every sample, so the value deltas take 1-3 bytes where the PRM entry
+ * takes 16 and dump --bin 32, and the sample_id and time stamp columns
+ * take a byte or two per row for all the counters together.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "diag_cnt.h"
+#include "diag_capture.h"
+
+#define DIAG_CAP_HDR_ALIGN 8
+/* zigzag of a 64 bit delta is 10 bytes at most, of the 16 bit sample_id 3 */
+#define VARINT_MAX 10
+
+struct diag_cap_writer {
+	FILE *f;
+	int ncnt;
+	u64 bytes;
+	/* the block in progress */
+	u32 rows;
+	u32 lost;
+	struct diag_cap_rows *blk;
+	u8 *enc;
+};
+
+static size_t hdr_len(int ncnt)
+{
+	size_t len = sizeof(struct diag_cap_file_hdr) + ncnt * sizeof(u16);
+
+	return (len + DIAG_CAP_HDR_ALIGN - 1) & ~(size_t)(DIAG_CAP_HDR_ALIGN - 1);
+}
+
+static struct diag_cap_rows *rows_alloc(int ncnt)
+{
+	return calloc(1, sizeof(struct diag_cap_rows) +
+			 (size_t)ncnt * DIAG_CAP_BLOCK_ROWS * sizeof(u64));
+}
+
+static u8 *put_varint(u8 *p, u64 v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static u8 *put_delta(u8 *p, int64_t d)
+{
+	return put_varint(p, (u64)d << 1 ^ (u64)(d >> 63));
+}
+
+struct diag_cap_writer *diag_cap_writer_create(FILE *f, struct diag_cap_file_hdr *hdr)
+{
+	struct diag_cap_writer *w;
+	size_t len = hdr_len(hdr->ncnt);
+	u8 *buf = NULL;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->f = f;
+	w->ncnt = hdr->ncnt;
+	w->blk = rows_alloc(w->ncnt);
+	w->enc = malloc((size_t)DIAG_CAP_BLOCK_ROWS * (2 + w->ncnt) * VARINT_MAX);
+	if (!w->blk || !w->enc)
+		goto err;
+
+	memcpy(hdr->magic, DIAG_CAP_MAGIC, sizeof(hdr->magic));
+	hdr->version = DIAG_CAP_VERSION;
+	hdr->hdr_len = len;
+	/* the padding after the counter ids is written from a zeroed copy */
+	buf = calloc(1, len);
+	if (!buf)
+		goto err;
+	memcpy(buf, hdr, sizeof(*hdr) + hdr->ncnt * sizeof(u16));
+	if (fwrite(buf, 1, len, f) != len) {
+		err_msg("capture: header write failed: %s\n", strerror(errno));
+		goto err;
+	}
+	free(buf);
+	w->bytes = len;
+	return w;
+
+err:
+	free(buf);
+	free(w->enc);
+	free(w->blk);
+	free(w);
+	return NULL;
+}
+
+int diag_cap_flush(struct diag_cap_writer *w)
+{
+	struct diag_cap_block_hdr bh = {
+		.magic = DIAG_CAP_BLOCK_MAGIC,
+		.rows = w->rows,
+		.lost = w->lost,
+	};
+	int64_t prev_delta = 0;
+	u8 *p = w->enc;
+	u32 prev_ts = 0;
+	u16 prev_sid = 0;
+
+	if (!w->rows)
+		return 0;
+	for (u32 r = 0; r < w->rows; r++) {
+		p = put_delta(p, (int16_t)(w->blk->sid[r] - prev_sid));
+		prev_sid = w->blk->sid[r];
+	}
+	for (u32 r = 0; r < w->rows; r++) {
+		int64_t delta = (int32_t)(w->blk->ts[r] - prev_ts);
+
+		p = put_delta(p, delta - prev_delta);
+		prev_ts = w->blk->ts[r];
+		prev_delta = delta;
+	}
+	for (int c = 0; c < w->ncnt; c++) {
+		const u64 *v = diag_cap_val(w->blk, c);
+		u64 prev = 0;
+
+		for (u32 r = 0; r < w->rows; r++) {
+			p = put_delta(p, (int64_t)(v[r] - prev));
+			prev = v[r];
+		}
+	}
+
+	bh.len = p - w->enc;
+	w->rows = 0;
+	w->lost = 0;
+	if (fwrite(&bh, sizeof(bh), 1, w->f) != 1 ||
+	    fwrite(w->enc, 1, bh.len, w->f) != bh.len) {
+		err_msg("capture: write failed: %s\n", strerror(errno));
+		return -EIO;
+	}
+	w->bytes += sizeof(bh) + bh.len;
+	return 0;
+}
+
+int diag_cap_row(struct diag_cap_writer *w, const void *row, u32 lost)
+{
+	const u8 *entry = row;
+	int err;
+
+	/* lost applies to the first row of a block */
+	if (lost && w->rows) {
+		err = diag_cap_flush(w);
+		if (err)
+			return err;
+	}
+	if (!w->rows)
+		w->lost = lost;
+
+	w->blk->sid[w->rows] = MLX5_GET(diagnostic_cntr_struct, entry, sample_id);
+	w->blk->ts[w->rows] = MLX5_GET(diagnostic_cntr_struct, entry, time_stamp_31_0);
+	for (int c = 0; c < w->ncnt; c++, entry += MLX5_ST_SZ_BYTES(diagnostic_cntr_struct))
+		diag_cap_val(w->blk, c)[w->rows] =
+			(u64)MLX5_GET(diagnostic_cntr_struct, entry, counter_value_h) << 32 |
+			MLX5_GET(diagnostic_cntr_struct, entry, counter_value_l);
+
+	if (++w->rows == DIAG_CAP_BLOCK_ROWS)
+		return diag_cap_flush(w);
+	return 0;
+}
+
+u64 diag_cap_bytes(struct diag_cap_writer *w)
+{
+	return w->bytes;
+}
+
+void diag_cap_writer_free(struct diag_cap_writer *w)
+{
+	if (!w)
+		return;
+	diag_cap_flush(w);
+	free(w->enc);
+	free(w->blk);
+	free(w);
+}
+
+/* ------------------------------------------------------------------ */
+/* reader */
+
+struct diag_cap_file *diag_cap_open(const char *path)
+{
+	const struct diag_cap_file_hdr *hdr;
+	struct diag_cap_file *f;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		err_msg("failed to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		err_msg("%s is not a diag counters capture\n", path);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		err_msg("failed to map %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	hdr = map;
+	if (memcmp(hdr->magic, DIAG_CAP_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->hdr_len < hdr_len(hdr->ncnt) || hdr->hdr_len > st.st_size) {
+		err_msg("%s is not a diag counters capture\n", path);
+		goto err;
+	}
+	if (hdr->version != DIAG_CAP_VERSION) {
+		err_msg("%s: capture version %u, this mlx5ctl reads %u\n", path,
+			hdr->version, DIAG_CAP_VERSION);
+		goto err;
+	}
+	if (!hdr->ncnt || !hdr->dev_freq_khz) {
+		err_msg("%s: no counters or device frequency in the capture\n", path);
+		goto err;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		goto err;
+	f->map = map;
+	f->len = st.st_size;
+	f->hdr = hdr;
+	return f;
+
+err:
+	munmap(map, st.st_size);
+	return NULL;
+}
+
+void diag_cap_close(struct diag_cap_file *f)
+{
+	if (!f)
+		return;
+	munmap((void *)f->map, f->len);
+	free(f);
+}
+
+struct varint_reader {
+	const u8 *p;
+	const u8 *end;
+	int err;
+};
+
+static int64_t get_delta(struct varint_reader *vr)
+{
+	u64 v = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		u8 byte;
+
+		if (vr->p == vr->end)
+			break;
+		byte = *vr->p++;
+		v |= (u64)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return (int64_t)(v >> 1 ^ -(v & 1));
+	}
+	vr->err = -EINVAL;
+	return 0;
+}
+
+int diag_cap_next(const struct diag_cap_file *f, size_t *off, struct diag_cap_block *b)
+{
+	struct diag_cap_block_hdr bh;
+
+	if (*off < f->hdr->hdr_len)
+		*off = f->hdr->hdr_len;
+	if (*off == f->len)
+		return 1;
+	if (f->len - *off < sizeof(bh))
+		return -EINVAL;
+	memcpy(&bh, f->map + *off, sizeof(bh));
+	if (bh.magic != DIAG_CAP_BLOCK_MAGIC || bh.len > f->len - *off - sizeof(bh) ||
+	    !bh.rows || bh.rows > DIAG_CAP_BLOCK_ROWS)
+		return -EINVAL;
+
+	b->off = *off;
+	b->rows = bh.rows;
+	b->lost = bh.lost;
+	b->data = f->map + *off + sizeof(bh);
+	b->len = bh.len;
+	*off += sizeof(bh) + bh.len;
+	return 0;
+}
+
+/* Only the first varint of each of the two columns is needed */
+int diag_cap_first(const struct diag_cap_block *b, u16 *sid, u32 *ts)
+{
+	struct varint_reader vr = { .p = b->data, .end = b->data + b->len };
+
+	*sid = get_delta(&vr);
+	for (u32 r = 1; r < b->rows && vr.p < vr.end; r++)
+		while (vr.p < vr.end && *vr.p++ & 0x80)
+			;
+	*ts = get_delta(&vr);
+	return vr.err;
+}
+
+struct diag_cap_rows *diag_cap_rows_alloc(const struct diag_cap_file *f)
+{
+	return rows_alloc(f->hdr->ncnt);
+}
+
+int diag_cap_decode(const struct diag_cap_file *f, const struct diag_cap_block *b,
+		    struct diag_cap_rows *rows)
+{
+	struct varint_reader vr = { .p = b->data, .end = b->data + b->len };
+	int64_t delta = 0;
+	u32 ts = 0;
+	u16 sid = 0;
+
+	for (u32 r = 0; r < b->rows; r++) {
+		sid += get_delta(&vr);
+		rows->sid[r] = sid;
+	}
+	for (u32 r = 0; r < b->rows; r++) {
+		delta += get_delta(&vr);
+		ts += delta;
+		rows->ts[r] = ts;
+	}
+	for (int c = 0; c < f->hdr->ncnt; c++) {
+		u64 *val = diag_cap_val(rows, c);
+		u64 v = 0;
+
+		for (u32 r = 0; r < b->rows; r++) {
+			v += get_delta(&vr);
+			val[r] = v;
+		}
+	}
+	if (vr.err || vr.p != vr.end)
+		return -EINVAL;
+	return 0;
+}
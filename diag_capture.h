@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_DIAG_CAPTURE_H__
+#define __MLX5CTL_DIAG_CAPTURE_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "ifcutil.h"
+
+/*
+ * Diagnostic counters capture file, written by diagcnt stream --capture.
+ *
+ * A file header with what is needed to read the samples back without the
+ * device: its name and FW version, the device frequency, sample period,
+ * buffer size and the ids of the enabled counters. Then blocks of up to
+ * DIAG_CAP_BLOCK_ROWS consecutive rows, stored by column: the sample_ids,
+ * the time stamps, then the values of each counter in counter_id order.
+ * Each column is a run of zigzag LEB128 varints of the difference to the
+ * previous row, the first row to 0, so a block decodes on its own. Time
+ * stamps are the difference of the time stamp deltas, 0 at a steady
+ * sample period. A block starts after a gap, lost is the number of
+ * samples missing before its first row.
+ *
+ * Both headers are host endian, a file is read on the kind of host that
+ * wrote it, as record files are.
+ */
+#define DIAG_CAP_MAGIC "MLX5DCAP"
+#define DIAG_CAP_VERSION 1
+#define DIAG_CAP_BLOCK_MAGIC 0x4b4c4244 /* "DBLK" */
+#define DIAG_CAP_BLOCK_ROWS 4096
+
+struct diag_cap_file_hdr {
+	char magic[8];
+	u16 version;
+	u16 ncnt;
+	u32 hdr_len;      /* with the counter ids and padding, blocks follow */
+	u32 dev_freq_khz;
+	u8 log_sample_period;
+	u8 log_num_of_samples;
+	u16 reserved;
+	u64 start_ns;     /* CLOCK_REALTIME when the capture started */
+	char dev[64];
+	char fw_version[64]; /* empty if the transport can't tell */
+	u16 counter_id[];
+};
+
+struct diag_cap_block_hdr {
+	u32 magic;
+	u32 len;  /* of the columns that follow */
+	u32 rows;
+	u32 lost;
+};
+
+/* A block by column, as the writer keeps it and the reader decodes it */
+struct diag_cap_rows {
+	u16 sid[DIAG_CAP_BLOCK_ROWS];
+	u32 ts[DIAG_CAP_BLOCK_ROWS];
+	u64 val[]; /* DIAG_CAP_BLOCK_ROWS of each counter */
+};
+
+static inline u64 *diag_cap_val(struct diag_cap_rows *rows, int counter)
+{
+	return rows->val + (size_t)counter * DIAG_CAP_BLOCK_ROWS;
+}
+
+/* Writer */
+
+struct diag_cap_writer;
+
+/* hdr with ncnt counter ids, the rest of it is filled in and written to f */
+struct diag_cap_writer *diag_cap_writer_create(FILE *f, struct diag_cap_file_hdr *hdr);
+/* A row of ncnt diagnostic_cntr_struct, lost samples missing before it */
+int diag_cap_row(struct diag_cap_writer *w, const void *row, u32 lost);
+/* Write out the rows so far as a block */
+int diag_cap_flush(struct diag_cap_writer *w);
+/* Bytes written to the file */
+u64 diag_cap_bytes(struct diag_cap_writer *w);
+void diag_cap_writer_free(struct diag_cap_writer *w);
+
+/* Reader */
+
+struct diag_cap_file {
+	const u8 *map;
+	size_t len;
+	const struct diag_cap_file_hdr *hdr;
+};
+
+struct diag_cap_block {
+	size_t off; /* of the block header in the file */
+	u32 rows;
+	u32 lost;
+	const u8 *data;
+	u32 len;
+};
+
+/* mmap()ed read only, the header checked, NULL and an error printed if bad */
+struct diag_cap_file *diag_cap_open(const char *path);
+void diag_cap_close(struct diag_cap_file *f);
+/* The block at *off and *off past it: 0, 1 at the end, -EINVAL if bad */
+int diag_cap_next(const struct diag_cap_file *f, size_t *off, struct diag_cap_block *b);
+/* The sample_id and time stamp of the first row, without decoding the rest */
+int diag_cap_first(const struct diag_cap_block *b, u16 *sid, u32 *ts);
+/* free() it */
+struct diag_cap_rows *diag_cap_rows_alloc(const struct diag_cap_file *f);
+int diag_cap_decode(const struct diag_cap_file *f, const struct diag_cap_block *b,
+		    struct diag_cap_rows *rows);
+
+#endif /* __MLX5CTL_DIAG_CAPTURE_H__ */
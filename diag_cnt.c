@@ -6,76 +6,36 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "mlx5ctlu.h"
 #include "ifcutil.h"
 #include "mlx5_ifc.h"
+#include "diag_cnt.h"
+#include "capcache.h"
+#include "sched.h"
+#include "json.h"
+#include "ring.h"
+#include "diag_stats.h"
+#include "diag_capture.h"
+#include "diag_analyze.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 static char *help_cmd;
-static int get_dev_freq(struct mlx5u_dev *dev);
-
-enum mlx5_cap_type {
-	MLX5_CAP_GENERAL = 0,
-	MLX5_CAP_DEBUG = 13,
-};
-
-enum mlx5_cap_mode {
-	HCA_CAP_OPMOD_GET_MAX	= 0,
-	HCA_CAP_OPMOD_GET_CUR	= 1,
-};
-
-static int query_devcap(struct mlx5u_dev *dev, enum mlx5_cap_type type,
-			void *out, unsigned int out_sz)
-{
-	u16 opmod = (type << 1) | (HCA_CAP_OPMOD_GET_CUR & 0x01);
-	u8 in[MLX5_ST_SZ_BYTES(query_hca_cap_in)] = {};
-	int err;
-
-	MLX5_SET(query_hca_cap_in, in, opcode, MLX5_CMD_OP_QUERY_HCA_CAP);
-	MLX5_SET(query_hca_cap_in, in, op_mod, opmod);
-	err = mlx5u_cmd(dev, in, sizeof(in), out, out_sz);
-	if (err) {
-		err_msg("query_hca_cap(%d) failed: %d\n", type, err);
-		return err;
-	}
-
-	return 0;
-}
-
-/* this is private prm, mlx5_ifc has a different version of this */
-struct mlx5_ifc_debug_capX_bits {
-	u8         core_dump_general[0x1];
-	u8         core_dump_qp[0x1];
-	u8         reserved_at_2[0x7];
-	u8         resource_dump[0x1];
-	u8         reserved_at_a[0xe];
-	u8         log_max_samples[0x8];
-	u8         single[0x1];
-	u8         repetitive[0x1];
-	/*The below field OFED name was health_mon_rx_activity and Upstream
-	 *          * stall_detect, for now i take the upstream one*/
-	u8         stall_detect[0x1];
-	u8         reserved_at_23[0x15];
-	u8         log_min_sample_period[0x8];
-	u8         reserved_at_40[0x1c0];
-	struct mlx5_ifc_diagnostic_cntr_layout_bits diagnostic_counter[0];
-};
 
 static int mlx5_diag_cnt_query_param(struct mlx5u_dev *dev, int num_cnt);
 static int mlx5_diag_cnt_query_cap(struct mlx5u_dev *dev)
 {
-	u8 out[MLX5_ST_SZ_BYTES(query_hca_cap_out)] = {};
-	int out_sz = sizeof(out);
 	void *capptr;
-	int err;
 	int dev_freq;
 
-	err = query_devcap(dev, MLX5_CAP_GENERAL, out, out_sz);
-	if (err)
-		return err;
-	capptr = MLX5_ADDR_OF(query_hca_cap_out, out, capability);
+	capptr = mlx5u_cap_gen(dev);
+	if (!capptr)
+		return EIO;
 #define MLX5_CAP_GEN(cap) MLX5_GET(cmd_hca_cap, capptr, cap)
 //#define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_GEN(cap))
 //	printcap(debug);
@@ -88,20 +48,39 @@ static int mlx5_diag_cnt_query_cap(struct mlx5u_dev *dev)
 
 	u16 num_counters = MLX5_CAP_GEN(num_of_diagnostic_counters);
 
-	out_sz = MLX5_ST_SZ_BYTES(query_hca_cap_out) +
-		 num_counters *
-		 MLX5_ST_SZ_BYTES(diagnostic_cntr_layout);
-	void *out2 = malloc(out_sz);
-	if (!out2)
-		return ENOMEM;
+	capptr = mlx5u_cap(dev, MLX5_CAP_DEBUG, HCA_CAP_OPMOD_GET_CUR, NULL);
+	if (!capptr)
+		return EIO;
+	dev_freq = mlx5u_cap_dev_freq(dev);
+	if (dev_freq < 0) {
+		err_msg("Can't get device frequency.\n");
+		return dev_freq;
+	}
+#define MLX5_CAP_DEBUG(cap) MLX5_GET(debug_capX, capptr, cap)
+	if (json_output) {
+		json_rec_begin();
+		json_uint("num_of_diagnostic_counters", num_counters);
+		json_uint("single", MLX5_CAP_DEBUG(single));
+		json_uint("repetitive", MLX5_CAP_DEBUG(repetitive));
+		json_uint("log_max_samples", MLX5_CAP_DEBUG(log_max_samples));
+		json_uint("log_min_sample_period", MLX5_CAP_DEBUG(log_min_sample_period));
+		json_uint("dev_freq_khz", dev_freq);
+		json_arr_begin("counters");
+		for (int i = 0; i < num_counters; i++) {
+			void *cntr = MLX5_ADDR_OF(debug_capX, capptr, diagnostic_counter[i]);
+
+			json_obj_begin(NULL);
+			json_uint("counter_id", MLX5_GET(diagnostic_cntr_layout, cntr, counter_id));
+			json_uint("sync", MLX5_GET(diagnostic_cntr_layout, cntr, sync));
+			json_obj_end();
+		}
+		json_arr_end();
+		json_rec_end();
+		return 0;
+	}
 
-	err = query_devcap(dev, MLX5_CAP_DEBUG, out2, out_sz);
-	if (err)
-		return err;
-	capptr = MLX5_ADDR_OF(query_hca_cap_out, out2, capability);
 	printf("diag counters:\n\tnum_of_diagnostic_counters: %d\n", num_counters);
 	//printf("diag counters CAP:\n");
-#define MLX5_CAP_DEBUG(cap) MLX5_GET(debug_capX, capptr, cap)
 #undef  printcap
 #define printcap(cap) printf("\t" #cap ": %d\n", MLX5_CAP_DEBUG(cap))
 	printcap(single);
@@ -109,11 +88,6 @@ static int mlx5_diag_cnt_query_cap(struct mlx5u_dev *dev)
 	printcap(log_max_samples);
 	printcap(log_min_sample_period);
 
-	dev_freq = get_dev_freq(dev);
-	if (dev_freq < 0) {
-		err_msg("Can't get device frequency.\n");
-		return dev_freq;
-	}
 	printf("\tdev_freq: %d kHz\n", dev_freq);
 #if 1
 	for (int i = 0; i < num_counters; i++) {
@@ -128,58 +102,13 @@ static int mlx5_diag_cnt_query_cap(struct mlx5u_dev *dev)
 	return 0;
 }
 
-struct mlx5_ifc_counter_id_bits {
-	u8         reserved_at_0[0x10];
-	u8         counter_id[0x10];
-};
-
-struct mlx5_ifc_diagnostic_params_context_bits {
-	u8         num_of_counters[0x10];
-	u8         reserved_at_10[0x8];
-	u8         log_num_of_samples[0x8];
-
-	u8         single[0x1];
-	u8         repetitive[0x1];
-	u8         sync[0x1];
-	u8         clear[0x1];
-	u8         on_demand[0x1];
-	u8         enable[0x1];
-	u8         reserved_at_26[0x12];
-	u8         log_sample_period[0x8];
-
-	u8         reserved_at_40[0x80];
-
-	struct mlx5_ifc_counter_id_bits counter_id[0];
-};
-
-struct mlx5_ifc_query_diagnostic_params_in_bits {
-	u8         opcode[0x10];
-	u8         reserved_at_10[0x10];
-
-	u8         reserved_at_20[0x10];
-	u8         op_mod[0x10];
-
-	u8         reserved_at_40[0x40];
-};
-
-struct mlx5_ifc_query_diagnostic_params_out_bits {
-	u8         status[0x8];
-	u8         reserved_at_8[0x18];
-
-	u8         syndrome[0x20];
-
-	struct mlx5_ifc_diagnostic_params_context_bits diagnostic_params_context;
-};
-
-static int mlx5_diag_cnt_query_param(struct mlx5u_dev *dev, int num_cnt)
+/* The params context with room for num_cnt counter ids, free() it */
+static int query_params(struct mlx5u_dev *dev, int num_cnt, u8 **outp)
 {
 	u8 in[MLX5_ST_SZ_BYTES(query_diagnostic_params_in)] = {};
-	void *cnt_id;
-	u16 out_sz;
-	void *ctx;
-	int err;
+	size_t out_sz;
 	u8 *out;
-	int i;
+	int err;
 
 	out_sz = MLX5_ST_SZ_BYTES(query_diagnostic_params_out) +
 		 num_cnt * MLX5_ST_SZ_BYTES(counter_id);
@@ -196,8 +125,44 @@ static int mlx5_diag_cnt_query_param(struct mlx5u_dev *dev, int num_cnt)
 		free(out);
 		return err;
 	}
+	*outp = out;
+	return 0;
+}
+
+static int mlx5_diag_cnt_query_param(struct mlx5u_dev *dev, int num_cnt)
+{
+	void *cnt_id;
+	void *ctx;
+	int err;
+	u8 *out;
+	int i;
+
+	err = query_params(dev, num_cnt, &out);
+	if (err)
+		return err;
 
 	ctx = MLX5_ADDR_OF(query_diagnostic_params_out, out, diagnostic_params_context);
+	if (json_output) {
+#define jsoncap(cap) json_uint(#cap, MLX5_GET(diagnostic_params_context, ctx, cap))
+		json_rec_begin();
+		jsoncap(sync);
+		jsoncap(clear);
+		jsoncap(enable);
+		jsoncap(single);
+		jsoncap(repetitive);
+		jsoncap(on_demand);
+		jsoncap(log_num_of_samples);
+		jsoncap(log_sample_period);
+		json_arr_begin("counter_id");
+		for (i = 0; i < num_cnt; i++) {
+			cnt_id = MLX5_ADDR_OF(diagnostic_params_context, ctx, counter_id[i]);
+			json_uint(NULL, MLX5_GET(counter_id, cnt_id, counter_id));
+		}
+		json_arr_end();
+		json_rec_end();
+		free(out);
+		return 0;
+	}
 	printf("diag params:\n");
 #undef  printcap
 #define printcap(cap) printf("\t" #cap ": %d\n", MLX5_GET(diagnostic_params_context, ctx, cap))
@@ -215,28 +180,10 @@ static int mlx5_diag_cnt_query_param(struct mlx5u_dev *dev, int num_cnt)
 		cnt_id = MLX5_ADDR_OF(diagnostic_params_context, ctx, counter_id[i]);
 		printf("\tcounter[%d]: 0x%x\n", i, MLX5_GET(counter_id, cnt_id, counter_id));
 	}
+	free(out);
 	return 0;
 }
 
-struct mlx5_ifc_set_diagnostic_params_in_bits {
-	u8         opcode[0x10];
-	u8         reserved_at_10[0x10];
-
-	u8         reserved_at_20[0x10];
-	u8         op_mod[0x10];
-
-	struct mlx5_ifc_diagnostic_params_context_bits diagnostic_params_context;
-};
-
-struct mlx5_ifc_set_diagnostic_params_out_bits {
-	u8         status[0x8];
-	u8         reserved_at_8[0x18];
-
-	u8         syndrome[0x20];
-
-	u8         reserved_at_40[0x40];
-};
-
 struct set_diag_params {
 	int log_num_of_samples;
 	u16 single:1;
@@ -301,7 +248,12 @@ static int do_param(struct mlx5u_dev *dev, int argc, char *argv[])
 
 	if (argc > 1)
 		num_cnt = atoi(argv[1]);
-	printf("query diag counter params with %d counters\n", num_cnt);
+	if (num_cnt < 0 || num_cnt > 0xffff) {
+		err_msg("invalid number of counters %d\n", num_cnt);
+		return EINVAL;
+	}
+	if (!json_output)
+		printf("query diag counter params with %d counters\n", num_cnt);
 	return mlx5_diag_cnt_query_param(dev, num_cnt);
 }
 
@@ -336,19 +288,6 @@ static int parse_flags(char *flags, struct set_diag_params *params) {
 	return ret;
 }
 
-static int get_dev_freq(struct mlx5u_dev *dev)
-{
-	u8 out[MLX5_ST_SZ_BYTES(query_hca_cap_out)] = {};
-	void *capptr;
-	int err;
-
-	err = query_devcap(dev, MLX5_CAP_GENERAL, out, sizeof(out));
-	if (err)
-		return err;
-	capptr = MLX5_ADDR_OF(query_hca_cap_out, out, capability);
-	return  MLX5_GET(cmd_hca_cap, capptr, device_frequency_khz);
-}
-
 static double sample_period_to_us(struct mlx5u_dev *dev, int log_sample_period, int dev_freq)
 {
 	return (1 << log_sample_period) * 1000.0 / dev_freq;
@@ -393,13 +332,15 @@ static int do_set(struct mlx5u_dev *dev, int argc, char *argv[])
 		tok = strtok(NULL, ",");
 	}
 
-	dev_freq = get_dev_freq(dev);
+	dev_freq = mlx5u_cap_dev_freq(dev);
 	if (dev_freq < 0) {
 		err_msg("Can't get device frequency.\n");
 		return dev_freq;
 	}
 
 	params.enable = 1;
+	if (json_output)
+		goto set;
 	printf("setting params:\n");
 	printf("\tsingle: %d (0x%x)\n", params.single, params.single);
 	printf("\trepetitive: %d (0x%x)\n", params.repetitive, params.repetitive);
@@ -415,50 +356,100 @@ static int do_set(struct mlx5u_dev *dev, int argc, char *argv[])
 	printf("\tcounter_id:\n");
 	for (i = 0; i < params.num_of_counters; i++)
 		printf("\t\t[%d] = %d (0x%x)\n", i, params.counter_id[i], params.counter_id[i]);
+set:
 	err = mlx5_diag_cnt_set_param(dev, &params);
-	free(params.counter_id);
 	if (err) {
+		free(params.counter_id);
 		err_msg("set diagnostic params failed, %d\n", err);
 		return err;
+	}
+	if (json_output) {
+		/* what was set, as diagcnt param reports it */
+		json_rec_begin();
+		json_uint("sync", params.sync);
+		json_uint("clear", params.clear);
+		json_uint("enable", params.enable);
+		json_uint("single", params.single);
+		json_uint("repetitive", params.repetitive);
+		json_uint("on_demand", params.on_demand);
+		json_uint("log_num_of_samples", params.log_num_of_samples);
+		json_uint("log_sample_period", params.log_sample_period);
+		json_double("sample_period_us",
+			    sample_period_to_us(dev, params.log_sample_period, dev_freq));
+		json_uint("dev_freq_khz", dev_freq);
+		json_arr_begin("counter_id");
+		for (i = 0; i < params.num_of_counters; i++)
+			json_uint(NULL, params.counter_id[i]);
+		json_arr_end();
+		json_rec_end();
 	} else {
 		printf("set diagnostic params succeeded\n");
-		return 0;
 	}
+	free(params.counter_id);
+	return 0;
 }
 
-static int query_diag_counters(struct mlx5u_dev *dev, int print_lines,
-				int sample_index, int bin_output);
+static int query_diag_counters(struct mlx5u_dev *dev, u32 print_lines,
+				u32 sample_index, int bin_output);
 static int do_dump(struct mlx5u_dev *dev, int argc, char *argv[])
 {
-	int print_lines = 1;
-	int sample_index = 0;
+	u32 print_lines = 1;
+	u32 sample_index = 0;
 	int bin_output = 0;
+	int pos = 0;
 
 	if (argc > 1 && !strcmp(argv[1], "help")) {
 		printf("Usage: %s [num lines] [sample index] [--bin]\n", argv[0]);
 		return 0;
 	}
 
-	if (argc > 1)
-		print_lines = atoi(argv[1]);
-	if (argc > 2)
-		sample_index = atoi(argv[2]);
-	if (argc > 3 && !strcmp(argv[3], "--bin"))
-		bin_output = 1;
-	else
-		printf("query diag counters: %d lines, starting with sample_index %d\n", print_lines, sample_index);
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--bin")) {
+			bin_output = !json_output;
+		} else if (!strncmp(argv[i], "--", 2)) {
+			err_msg("unknown option %s\n", argv[i]);
+			return EINVAL;
+		} else if (pos == 0) {
+			print_lines = strtoul(argv[i], NULL, 0);
+			pos++;
+		} else if (pos == 1) {
+			sample_index = strtoul(argv[i], NULL, 0);
+			pos++;
+		} else {
+			err_msg("unexpected argument %s\n", argv[i]);
+			return EINVAL;
+		}
+	}
+	if (!bin_output && !json_output)
+		printf("query diag counters: %u lines, starting with sample_index %u\n", print_lines, sample_index);
 
+	mlx5u_sched_set_class(MLX5U_SCHED_POLL);
 	return query_diag_counters(dev, print_lines, sample_index, bin_output);
 }
 
+static int do_stream(struct mlx5u_dev *dev, int argc, char *argv[]);
+static int do_read(struct mlx5u_dev *dev, int argc, char *argv[]);
+static int do_analyze(struct mlx5u_dev *dev, int argc, char *argv[]);
+static int do_mux(struct mlx5u_dev *dev, int argc, char *argv[]);
+static int do_plan(struct mlx5u_dev *dev, int argc, char *argv[]);
+
 static int do_disable(struct mlx5u_dev *dev, int argc, char *argv[])
 {
 	struct set_diag_params params = {};
+	int err;
 
 	params.clear = 1;
 	params.enable = 0;
-	printf("disabling diag counters and clearing HW buffer\n");
-	return mlx5_diag_cnt_set_param(dev, &params);
+	if (!json_output)
+		printf("disabling diag counters and clearing HW buffer\n");
+	err = mlx5_diag_cnt_set_param(dev, &params);
+	if (!err && json_output) {
+		json_rec_begin();
+		json_uint("clear", params.clear);
+		json_uint("enable", params.enable);
+		json_rec_end();
+	}
+	return err;
 }
 
 static int do_cap(struct mlx5u_dev *dev, int argc, char *argv[])
@@ -472,9 +463,14 @@ static const cmd commands[] = {
 	{ "cap", do_cap, "show diag counters cap" },
 	{ "help", do_help, "show this help" },
 	{ "set",   do_set, "set param" },
+	{ "plan", do_plan, "pick set params and stream interval for a resolution"},
 	{ "disable", do_disable, "disable diag counters" },
 	{ "param", do_param, "query param"},
 	{ "dump", do_dump, "dump samples"},
+	{ "stream", do_stream, "stream samples until stopped"},
+	{ "mux", do_mux, "count more counters than sampled at once, in turns"},
+	{ "read", do_read, "print the samples of a stream --capture file"},
+	{ "analyze", do_analyze, "statistics of a stream --capture file"},
 	{ 0 }
 };
 
@@ -498,85 +494,1380 @@ int do_diag_cnt(struct mlx5u_dev *dev, int argc, char *argv[])
 	return err;
 }
 
-struct mlx5_ifc_diagnostic_cntr_struct_bits {
-	u8         counter_id[0x10];
-	u8         sample_id[0x10];
+/* A full 64 bit value, the high dword starts at bit 32 */
+static u64 diag_cnt_value(void *diag_cnt)
+{
+	return (u64)MLX5_GET(diagnostic_cntr_struct, diag_cnt, counter_value_h) << 32 |
+	       MLX5_GET(diagnostic_cntr_struct, diag_cnt, counter_value_l);
+}
+
+static void print_sample(void *diag_cnt, int bin_output)
+{
+	u32 counter_id = MLX5_GET(diagnostic_cntr_struct, diag_cnt, counter_id);
+	u32 sample_id = MLX5_GET(diagnostic_cntr_struct, diag_cnt, sample_id);
+	u32 time_stamp = MLX5_GET(diagnostic_cntr_struct, diag_cnt, time_stamp_31_0);
+	u64 counter_value = diag_cnt_value(diag_cnt);
+	u64 printout[4];
+
+	if (json_output) {
+		json_rec_begin();
+		json_uint("counter_id", counter_id);
+		json_uint("sample_id", sample_id);
+		json_uint("time_stamp", time_stamp);
+		json_uint("counter_value", counter_value);
+		json_rec_end();
+	} else if (bin_output) {
+		printout[0] = (u64)counter_id;
+		printout[1] = (u64)sample_id;
+		printout[2] = (u64)time_stamp;
+		printout[3] = counter_value;
+		fwrite(printout, sizeof(printout[0]), 4, stdout);
+	} else {
+		fprintf(stdout, "counter_id: 0x%04x, sample_id: %010d, time_stamp: %010u counter_value: %llu\n",
+			counter_id, sample_id, time_stamp, (unsigned long long)counter_value);
+	}
+}
+
+/*
+ * num_of_samples and sample_index are 16 bits: a dump reaches the first 64K
+ * entries of the HW buffer, and stays within the buffer, no query wraps
+ * around its end. A query returns at most 0xffff entries, a dump of all
+ * 0x10000 takes a second query for the last one.
+ */
+#define DIAG_QUERY_MAX_ENTRIES 0xffff
+#define DIAG_QUERY_MAX_INDEX 0xffff
+
+static int dump_query(struct mlx5u_dev *dev, u32 index, u32 lines, u8 *out)
+{
+	u8 in[MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_in)] = {};
 
-	u8         time_stamp_31_0[0x20];
+	MLX5_SET(query_diagnostic_cntrs_in, in, opcode, MLX5_CMD_OP_QUERY_DIAGNOSTIC_COUNTERS);
+	MLX5_SET(query_diagnostic_cntrs_in, in, num_of_samples, lines);
+	MLX5_SET(query_diagnostic_cntrs_in, in, sample_index, index);
 
-	u8         counter_value_h[0x20];
+	return mlx5u_cmd(dev, in, sizeof(in), out,
+			 MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out) +
+			 (size_t)lines * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct)) ? -EIO : 0;
+}
 
-	u8         counter_value_l[0x20];
-};
+/* Entries in the HW buffer, 0 if unknown */
+static u32 diag_buf_entries(struct mlx5u_dev *dev)
+{
+	u32 entries = 0;
+	void *ctx;
+	u8 *out;
 
-struct mlx5_ifc_query_diagnostic_cntrs_in_bits {
-	u8         opcode[0x10];
-	u8         reserved_at_10[0x10];
+	if (query_params(dev, 0, &out))
+		return 0;
+	ctx = MLX5_ADDR_OF(query_diagnostic_params_out, out, diagnostic_params_context);
+	if (MLX5_GET(diagnostic_params_context, ctx, enable))
+		entries = MLX5_GET(diagnostic_params_context, ctx, num_of_counters) <<
+			  MLX5_GET(diagnostic_params_context, ctx, log_num_of_samples);
+	free(out);
+	return entries;
+}
 
-	u8         reserved_at_20[0x10];
-	u8         op_mod[0x10];
+static int query_diag_counters(struct mlx5u_dev *dev, u32 print_lines,
+				u32 sample_index, int bin_output)
+{
+	u64 end = (u64)sample_index + print_lines;
+	u32 buf_entries, lines;
+	size_t out_sz;
+	int err = 0;
+	u8 *out;
 
-	u8         num_of_samples[0x10];
-	u8         sample_index[0x10];
+	if (!print_lines)
+		return 0;
+	if (end > DIAG_QUERY_MAX_INDEX + 1ull) {
+		err_msg("sample index %u + %u lines is past the %u entries a query can address\n",
+			sample_index, print_lines, DIAG_QUERY_MAX_INDEX + 1);
+		return EINVAL;
+	}
+	buf_entries = diag_buf_entries(dev);
+	if (!buf_entries && print_lines > DIAG_QUERY_MAX_ENTRIES) {
+		err_msg("can't tell the HW buffer size, diag counters are not enabled\n");
+		return EINVAL;
+	}
+	if (buf_entries && end > buf_entries) {
+		err_msg("sample index %u + %u lines is past the %u entries of the HW buffer\n",
+			sample_index, print_lines, buf_entries);
+		return EINVAL;
+	}
 
-	u8         reserved_at_60[0x20];
-};
+	lines = min(print_lines, (u32)DIAG_QUERY_MAX_ENTRIES);
+	out_sz = MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out) +
+		 (size_t)lines * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct);
+	out = calloc(1, out_sz);
+	if (!out)
+		return -ENOMEM;
 
-struct mlx5_ifc_query_diagnostic_cntrs_out_bits {
-	u8         status[0x8];
-	u8         reserved_at_8[0x18];
+	//dump samples:
+	for (u32 done = 0; done < print_lines && !err; done += lines) {
+		lines = min(print_lines - done, (u32)DIAG_QUERY_MAX_ENTRIES);
+		err = dump_query(dev, sample_index + done, lines, out);
+		for (u32 i = 0; i < lines && !err; i++)
+			print_sample(MLX5_ADDR_OF(query_diagnostic_cntrs_out, out, diag_counter[i]),
+				     bin_output);
+	}
+	free(out);
+	return err;
+}
 
-	u8         syndrome[0x20];
+/* ------------------------------------------------------------------ */
+/* stream */
+
+/*
+ * The HW buffer holds 2^log_num_of_samples rows of one entry per enabled
+ * counter and is written as a ring, a row is overwritten by the sample one
+ * ring later. The stream reads the ring from row 0 on and follows the
+ * sample_id of the rows:
+ *  - the expected sample_id: a new sample, printed
+ *  - the sample_id of one ring earlier: not written yet, caught up
+ *  - a later sample_id: the device lapped the reader, an overrun, the
+ *    samples in between were overwritten before they were read
+ *  - anything else: the reader is more than 32K samples behind and lost
+ *    track of the 16 bit sample_id, it picks up from this row
+ * A row of all zeros was never written, a row with mixed sample_ids is
+ * being written, both are not ready.
+ *
+ * Each query covers the samples produced since the newest one read, going
+ * by the sample period, up to the end of the ring and the mailbox size. A
+ * query that came back all new is followed right away, one that came back
+ * short means the stream caught up and sleeps --interval.
+ *
+ * The queries run on a poller thread that does nothing else: it queries
+ * straight into the slots of a ring of batches, checks the sample_ids and
+ * commits the batch. The calling thread formats and writes the batches, so
+ * a slow output delays only the writer. When the writer falls --ring
+ * batches behind the poller skips queries rather than waiting, the samples
+ * stay in the device buffer until the next one and show up as an overrun
+ * if the device wraps over them.
+ */
+
+#define STREAM_RING_SLOTS 32
+
+enum {
+	STREAM_EV_NONE,
+	STREAM_EV_OVERRUN,
+	STREAM_EV_RESYNC,
+};
 
-	u8         reserved_at_40[0x40];
+/* A ring slot: the query mailbox and what the poller found in it */
+struct stream_batch {
+	u32 rows;  /* new rows at the start of out */
+	u32 event; /* before the first row */
+	u32 lost;
+	u32 sid;   /* of the first row */
+	u8 out[];
+};
 
-	struct mlx5_ifc_diagnostic_cntr_struct_bits diag_counter[0];
+struct diag_stream {
+	struct mlx5u_dev *dev;
+	struct mlx5u_ring *ring;
+	struct diag_stats *stats; /* --summary */
+	struct diag_cap_writer *cap; /* --capture */
+	int ncnt;
+	u32 nsamples;     /* rows in the ring */
+	u64 period_ns;
+	u32 max_rows;     /* per query */
+	u64 interval_ns;
+	u64 count;
+	u64 duration_ms;
+	int err;
+	int cap_err;
+	/* poller */
+	u32 next_row;
+	u16 next_sid;
+	int synced;
+	u64 head_ns;      /* estimated host time of the newest row read */
+	int caught_up;
+	u64 samples;
+	u64 queries;
+	u64 skipped;
+	u64 overruns;
+	u64 lost;
+	u64 resyncs;
 };
 
-static int query_diag_counters(struct mlx5u_dev *dev, int print_lines,
-				int sample_index, int bin_output)
+static volatile sig_atomic_t stream_stop;
+
+static void stream_on_signal(int sig)
+{
+	stream_stop = 1;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* A signal ends the sleep */
+static void sleep_ns(u64 ns)
+{
+	u64 t = now_ns() + ns;
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void *batch_entry(struct diag_stream *s, struct stream_batch *b, u32 row, int c)
+{
+	return MLX5_ADDR_OF(query_diagnostic_cntrs_out, b->out, diag_counter[row * s->ncnt + c]);
+}
+
+/*
+ * Rows of the batch that are new, in order, 0 when caught up. A batch
+ * holds one run of consecutive samples, an overrun past the first row
+ * ends it and starts the next one.
+ */
+static u32 stream_scan(struct diag_stream *s, struct stream_batch *b, u32 rows)
+{
+	u32 r;
+
+	b->event = STREAM_EV_NONE;
+	for (r = 0; r < rows; r++) {
+		void *row = batch_entry(s, b, r, 0);
+		u16 sid = MLX5_GET(diagnostic_cntr_struct, row, sample_id);
+		u16 d = sid - s->next_sid;
+
+		if (!MLX5_GET(diagnostic_cntr_struct, row, counter_id))
+			break;
+		for (int c = 1; c < s->ncnt; c++)
+			if (MLX5_GET(diagnostic_cntr_struct, batch_entry(s, b, r, c),
+				     sample_id) != sid)
+				goto out;
+
+		if (s->synced && d) {
+			if (d == (u16)-s->nsamples || r)
+				break;
+			if ((int16_t)d > 0) {
+				b->event = STREAM_EV_OVERRUN;
+				b->lost = d;
+				s->overruns++;
+				s->lost += d;
+			} else {
+				b->event = STREAM_EV_RESYNC;
+				b->lost = 0;
+				s->resyncs++;
+			}
+		}
+		if (!r)
+			b->sid = sid;
+		s->synced = 1;
+		s->next_sid = sid + 1;
+	}
+out:
+	b->rows = r;
+	s->samples += r;
+	return r;
+}
+
+/* Rows expected since the newest one read, at least one */
+static u32 stream_rows(struct diag_stream *s)
+{
+	u64 rows = s->max_rows;
+
+	if (s->caught_up)
+		rows = (now_ns() - s->head_ns) / s->period_ns + 1;
+	rows = min(rows, (u64)s->max_rows);
+	if (s->count)
+		rows = min(rows, s->count - s->samples);
+	return min(rows, (u64)(s->nsamples - s->next_row));
+}
+
+static int stream_query(struct diag_stream *s, struct stream_batch *b, u32 rows)
 {
 	u8 in[MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_in)] = {};
-	u16 out_sz;
-	u8 *out;
+	size_t out_sz = MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out) +
+			rows * s->ncnt * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct);
+
+	/* rows the device never wrote stay zero */
+	memset(b->out, 0, out_sz);
+	MLX5_SET(query_diagnostic_cntrs_in, in, opcode, MLX5_CMD_OP_QUERY_DIAGNOSTIC_COUNTERS);
+	MLX5_SET(query_diagnostic_cntrs_in, in, num_of_samples, rows * s->ncnt);
+	MLX5_SET(query_diagnostic_cntrs_in, in, sample_index, s->next_row * s->ncnt);
+	s->queries++;
+	return mlx5u_cmd(s->dev, in, sizeof(in), b->out, out_sz);
+}
+
+static void *stream_poller(void *arg)
+{
+	struct diag_stream *s = arg;
+	u64 start = now_ns();
+
+	mlx5u_sched_set_class(MLX5U_SCHED_POLL);
+	while (!stream_stop) {
+		struct stream_batch *b = mlx5u_ring_reserve(s->ring);
+		u32 rows, new;
+
+		if (!b) {
+			s->skipped++;
+			sleep_ns(s->interval_ns);
+			continue;
+		}
+		rows = stream_rows(s);
+		s->err = stream_query(s, b, rows);
+		if (s->err) {
+			err_msg("query diagnostic counters failed, %d\n", s->err);
+			break;
+		}
+		new = stream_scan(s, b, rows);
+		if (new)
+			mlx5u_ring_commit(s->ring);
+		s->next_row = (s->next_row + new) % s->nsamples;
+		/*
+		 * Short of rows: the newest row was produced about now. A full
+		 * query may have left more behind, the head moves by what was
+		 * read and the next query follows right away.
+		 */
+		if (new < rows) {
+			s->head_ns = now_ns();
+			s->caught_up = 1;
+		} else {
+			s->head_ns += new * s->period_ns;
+		}
+
+		if (s->count && s->samples >= s->count)
+			break;
+		if (s->duration_ms && now_ns() - start >= s->duration_ms * 1000000ull)
+			break;
+		if (new < rows)
+			sleep_ns(s->interval_ns);
+	}
+	mlx5u_ring_close(s->ring);
+	return NULL;
+}
+
+static void stream_report(const char *what, u32 lost, u16 sid)
+{
+	if (json_output) {
+		json_rec_begin();
+		json_str("event", what);
+		json_uint("lost", lost);
+		json_uint("sample_id", sid);
+		json_rec_end();
+	}
+	fprintf(stderr, "diagcnt: %s, %u samples lost before sample_id %u\n",
+		what, lost, sid);
+}
+
+static void stream_write(struct diag_stream *s, int bin_output)
+{
+	struct stream_batch *b;
+
+	while ((b = mlx5u_ring_wait(s->ring))) {
+		if (b->event == STREAM_EV_OVERRUN)
+			stream_report("overrun", b->lost, b->sid);
+		else if (b->event == STREAM_EV_RESYNC)
+			stream_report("lost sync", 0, b->sid);
+		for (u32 r = 0; r < b->rows; r++) {
+			u32 lost = !r && b->event == STREAM_EV_OVERRUN ? b->lost : 0;
+
+			if (s->stats) {
+				diag_stats_row(s->stats, batch_entry(s, b, r, 0), lost);
+				continue;
+			}
+			if (s->cap) {
+				/* a failed write stops the stream, the rest is dropped */
+				if (!s->cap_err &&
+				    diag_cap_row(s->cap, batch_entry(s, b, r, 0), lost)) {
+					s->cap_err = EIO;
+					stream_stop = 1;
+				}
+				continue;
+			}
+			for (int c = 0; c < s->ncnt; c++)
+				print_sample(batch_entry(s, b, r, c), bin_output);
+		}
+		mlx5u_ring_release(s->ring);
+		/* write out when idle, not per batch */
+		if (!mlx5u_ring_peek(s->ring)) {
+			fflush(stdout);
+			json_flush();
+		}
+	}
+}
+
+/* The capture file header of the current params, with the counter ids */
+static struct diag_cap_file_hdr *capture_hdr(struct mlx5u_dev *dev, int ncnt, int dev_freq)
+{
+	struct diag_cap_file_hdr *hdr;
+	struct timespec ts;
+	void *ctx;
+	u8 *params;
+
+	if (query_params(dev, ncnt, &params))
+		return NULL;
+	ctx = MLX5_ADDR_OF(query_diagnostic_params_out, params, diagnostic_params_context);
+	hdr = calloc(1, sizeof(*hdr) + ncnt * sizeof(hdr->counter_id[0]));
+	if (!hdr) {
+		free(params);
+		return NULL;
+	}
+	hdr->ncnt = ncnt;
+	hdr->dev_freq_khz = dev_freq;
+	hdr->log_sample_period = MLX5_GET(diagnostic_params_context, ctx, log_sample_period);
+	hdr->log_num_of_samples = MLX5_GET(diagnostic_params_context, ctx, log_num_of_samples);
+	for (int i = 0; i < ncnt; i++)
+		hdr->counter_id[i] = MLX5_GET(counter_id,
+					      MLX5_ADDR_OF(diagnostic_params_context, ctx,
+							   counter_id[i]),
+					      counter_id);
+	free(params);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr->start_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	snprintf(hdr->dev, sizeof(hdr->dev), "%s", mlx5u_devname(dev));
+	if (mlx5u_fw_version(dev, hdr->fw_version, sizeof(hdr->fw_version)))
+		hdr->fw_version[0] = '\0';
+	return hdr;
+}
+
+static void stream_help(const char *cmd)
+{
+	printf("Usage: %s [--out=<file>] [--count=<n>] [--duration=<ms>] [--interval=<us>] [--ring=<n>] [--bin] [--summary[=<ms>]] [--capture]\n", cmd);
+	printf("\t--out=<file> - write the samples to file instead of stdout\n");
+	printf("\t--count=<n> - stop after n samples (rows of all counters), default until interrupted\n");
+	printf("\t--duration=<ms> - stop after ms milliseconds\n");
+	printf("\t--interval=<us> - sleep between queries once caught up, default a quarter of the ring\n");
+	printf("\t--ring=<n> - queries buffered between the poller and the writer, default %d\n",
+	       STREAM_RING_SLOTS);
+	printf("\t--bin - binary records, as dump --bin\n");
+	printf("\t--summary[=<ms>] - per counter statistics of every ms of device time instead of the samples, default one summary at the end\n");
+	printf("\t--capture - compact capture file, see diagcnt read\n");
+}
+
+static int do_stream(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"out", required_argument, 0, 'o'},
+		{"count", required_argument, 0, 'c'},
+		{"duration", required_argument, 0, 'd'},
+		{"interval", required_argument, 0, 't'},
+		{"ring", required_argument, 0, 'r'},
+		{"bin", no_argument, 0, 'B'},
+		{"summary", optional_argument, 0, 's'},
+		{"capture", no_argument, 0, 'C'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct diag_stream s = { .dev = dev };
+	struct diag_cap_file_hdr *cap_hdr = NULL;
+	long long summary_ms = -1;
+	struct mlx5u_ring_stats rst;
+	const char *out_file = NULL;
+	long long interval_us = -1;
+	int nslots = STREAM_RING_SLOTS;
+	struct sigaction sa = {};
+	sigset_t sigs, oldsigs;
+	int bin_output = 0;
+	int capture = 0;
+	pthread_t poller;
+	int log_samples, log_period;
+	int dev_freq;
+	void *ctx;
+	u8 *params;
+	int err, c;
+
+	if (argc > 1 && !strcmp(argv[1], "help")) {
+		stream_help(argv[0]);
+		return 0;
+	}
+	while ((c = getopt_long(argc, argv, "o:c:d:t:r:Bs::Ch", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'c':
+			s.count = strtoull(optarg, NULL, 0);
+			break;
+		case 'd':
+			s.duration_ms = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			interval_us = strtoll(optarg, NULL, 0);
+			break;
+		case 'r':
+			nslots = strtol(optarg, NULL, 0);
+			break;
+		case 'B':
+			bin_output = !json_output;
+			break;
+		case 's':
+			summary_ms = optarg ? strtoll(optarg, NULL, 0) : 0;
+			break;
+		case 'C':
+			capture = 1;
+			break;
+		case 'h':
+			stream_help(argv[0]);
+			return 0;
+		default:
+			stream_help(argv[0]);
+			return EINVAL;
+		}
+	}
+	if (nslots < 1) {
+		err_msg("Invalid --ring\n");
+		return EINVAL;
+	}
+	if (capture && (summary_ms >= 0 || bin_output || json_output)) {
+		err_msg("--capture is its own format, no --summary, --bin or JSON\n");
+		return EINVAL;
+	}
+
+	err = query_params(dev, 0, &params);
+	if (err)
+		return err;
+	ctx = MLX5_ADDR_OF(query_diagnostic_params_out, params, diagnostic_params_context);
+	s.ncnt = MLX5_GET(diagnostic_params_context, ctx, num_of_counters);
+	log_samples = MLX5_GET(diagnostic_params_context, ctx, log_num_of_samples);
+	log_period = MLX5_GET(diagnostic_params_context, ctx, log_sample_period);
+	s.period_ns = (1ull << log_period) * 1000000ull;
+	if (!MLX5_GET(diagnostic_params_context, ctx, enable) || !s.ncnt) {
+		err_msg("diag counters are not enabled, see diagcnt set\n");
+		free(params);
+		return EINVAL;
+	}
+	free(params);
+	/* sample_ids one ring apart must differ in 16 bits */
+	if (log_samples > 15) {
+		err_msg("stream needs log_num_of_samples <= 15, got %d\n", log_samples);
+		return EINVAL;
+	}
+
+	dev_freq = mlx5u_cap_dev_freq(dev);
+	if (dev_freq <= 0) {
+		err_msg("Can't get device frequency.\n");
+		return EIO;
+	}
+	s.period_ns /= dev_freq;
+	if (!s.period_ns)
+		s.period_ns = 1;
+	s.nsamples = 1u << log_samples;
+	s.max_rows = min((u32)(DIAG_QUERY_MAX_ENTRIES / s.ncnt), s.nsamples);
+	if (!s.max_rows) {
+		err_msg("%d counters don't fit a query\n", s.ncnt);
+		return EINVAL;
+	}
+	s.interval_ns = interval_us >= 0 ? interval_us * 1000ull : s.nsamples * s.period_ns / 4;
+
+	if (capture) {
+		cap_hdr = capture_hdr(dev, s.ncnt, dev_freq);
+		if (!cap_hdr)
+			return EIO;
+	}
+
+	if (summary_ms >= 0) {
+		s.stats = diag_stats_create(s.ncnt, dev_freq, log_period, summary_ms * 1000000ull);
+		if (!s.stats)
+			return ENOMEM;
+	}
+	s.ring = mlx5u_ring_create(nslots, sizeof(struct stream_batch) +
+				   MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out) +
+				   s.max_rows * s.ncnt * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct));
+	if (!s.ring) {
+		diag_stats_free(s.stats);
+		free(cap_hdr);
+		return ENOMEM;
+	}
+	if (out_file && !freopen(out_file, "w", stdout)) {
+		err = errno;
+		err_msg("can't open %s: %s\n", out_file, strerror(err));
+		goto err_ring;
+	}
+	if (cap_hdr) {
+		s.cap = diag_cap_writer_create(stdout, cap_hdr);
+		if (!s.cap) {
+			err = EIO;
+			goto err_ring;
+		}
+	}
+
+	sa.sa_handler = stream_on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	fprintf(stderr, "diagcnt stream: %d counters, %u samples ring, sample period %llu ns, interval %llu us\n",
+		s.ncnt, s.nsamples, (unsigned long long)s.period_ns,
+		(unsigned long long)(s.interval_ns / 1000));
+	err = pthread_create(&poller, NULL, stream_poller, &s);
+	if (err) {
+		err_msg("failed to start the poller: %s\n", strerror(err));
+		diag_cap_writer_free(s.cap);
+		goto err_ring;
+	}
+	/* signals go to the poller, they cut its sleep short */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	stream_write(&s, bin_output);
+	pthread_join(poller, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	if (s.stats) {
+		diag_stats_flush(s.stats);
+		diag_stats_free(s.stats);
+	}
+	if (s.cap) {
+		if (!s.cap_err && diag_cap_flush(s.cap))
+			s.cap_err = EIO;
+		if (s.samples)
+			fprintf(stderr, "diagcnt stream: capture %llu bytes, %.2f bytes per sample, %.1fx smaller than --bin\n",
+				(unsigned long long)diag_cap_bytes(s.cap),
+				(double)diag_cap_bytes(s.cap) / (s.samples * s.ncnt),
+				(double)s.samples * s.ncnt * 4 * sizeof(u64) /
+				diag_cap_bytes(s.cap));
+		diag_cap_writer_free(s.cap);
+		free(cap_hdr);
+	}
+	fflush(stdout);
+	json_flush();
+
+	mlx5u_ring_get_stats(s.ring, &rst);
+	fprintf(stderr, "diagcnt stream: %llu samples in %llu queries, %llu overruns, %llu samples lost, %llu resyncs\n",
+		(unsigned long long)s.samples, (unsigned long long)s.queries,
+		(unsigned long long)s.overruns, (unsigned long long)s.lost,
+		(unsigned long long)s.resyncs);
+	fprintf(stderr, "diagcnt stream: ring %u slots, %u max used, %.1f mean used, %llu queries skipped on a full ring\n",
+		rst.nslots, rst.max_used,
+		rst.committed ? (double)rst.sum_used / rst.committed : 0.0,
+		(unsigned long long)s.skipped);
+	mlx5u_ring_free(s.ring);
+	return s.err ? s.err : s.cap_err;
+
+err_ring:
+	mlx5u_ring_free(s.ring);
+	diag_stats_free(s.stats);
+	free(cap_hdr);
+	return err;
+}
+
+/* ------------------------------------------------------------------ */
+/* read */
+
+static int do_read(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	u8 entry[MLX5_ST_SZ_BYTES(diagnostic_cntr_struct)] = {};
+	const struct diag_cap_file_hdr *hdr;
+	struct diag_cap_rows *rows;
+	struct diag_cap_file *f;
+	struct diag_cap_block b;
+	u64 samples = 0, lost = 0;
+	int bin_output = 0;
+	size_t off = 0;
 	int err;
-	static u64 printout[4];
 
-	out_sz = MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out) +
-		 print_lines * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct);
+	if (argc < 2 || !strcmp(argv[1], "help")) {
+		printf("Usage: %s <file> [--bin]\n", argv[0]);
+		return argc < 2 ? EINVAL : 0;
+	}
+	if (argc > 2 && !strcmp(argv[2], "--bin"))
+		bin_output = !json_output;
 
-	out = malloc(out_sz);
-	if (!out)
+	f = diag_cap_open(argv[1]);
+	if (!f)
+		return EINVAL;
+	hdr = f->hdr;
+	fprintf(stderr, "diagcnt read: %s FW %s, %u counters, log_sample_period %u, log_num_of_samples %u, %u kHz\n",
+		hdr->dev, hdr->fw_version[0] ? hdr->fw_version : "unknown", hdr->ncnt,
+		hdr->log_sample_period, hdr->log_num_of_samples, hdr->dev_freq_khz);
+
+	rows = diag_cap_rows_alloc(f);
+	if (!rows) {
+		diag_cap_close(f);
+		return ENOMEM;
+	}
+	while (!(err = diag_cap_next(f, &off, &b))) {
+		err = diag_cap_decode(f, &b, rows);
+		if (err) {
+			off = b.off;
+			break;
+		}
+		if (b.lost)
+			stream_report("overrun", b.lost, rows->sid[0]);
+		for (u32 r = 0; r < b.rows; r++) {
+			MLX5_SET(diagnostic_cntr_struct, entry, sample_id, rows->sid[r]);
+			MLX5_SET(diagnostic_cntr_struct, entry, time_stamp_31_0, rows->ts[r]);
+			for (int c = 0; c < hdr->ncnt; c++) {
+				u64 v = diag_cap_val(rows, c)[r];
+
+				MLX5_SET(diagnostic_cntr_struct, entry, counter_id,
+					 hdr->counter_id[c]);
+				MLX5_SET(diagnostic_cntr_struct, entry, counter_value_h, v >> 32);
+				MLX5_SET(diagnostic_cntr_struct, entry, counter_value_l,
+					 v & 0xffffffff);
+				print_sample(entry, bin_output);
+			}
+		}
+		samples += b.rows;
+		lost += b.lost;
+	}
+	if (err < 0)
+		err_msg("%s: bad block at offset %zu\n", argv[1], off);
+	fflush(stdout);
+	json_flush();
+	fprintf(stderr, "diagcnt read: %llu samples, %llu lost\n",
+		(unsigned long long)samples, (unsigned long long)lost);
+	free(rows);
+	diag_cap_close(f);
+	return err < 0 ? EINVAL : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* analyze */
+
+static void analyze_help(const char *cmd)
+{
+	printf("Usage: %s <file> [--jobs=<n>] [--window=<ms>] [--hist]\n", cmd);
+	printf("\t--jobs=<n> - threads, default one per CPU\n");
+	printf("\t--window=<ms> - mean rate of each counter every ms of device time, default 1000, 0 for none\n");
+	printf("\t--hist - rate histograms, power of 2 buckets\n");
+}
+
+static int do_analyze(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"jobs", required_argument, 0, 'j'},
+		{"window", required_argument, 0, 'w'},
+		{"hist", no_argument, 0, 'H'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct diag_analyze_opts o = { .window_ns = 1000000000ull };
+	double window_ms;
+	int c;
+
+	if (argc > 1 && !strcmp(argv[1], "help")) {
+		analyze_help(argv[0]);
+		return 0;
+	}
+	while ((c = getopt_long(argc, argv, "j:w:Hh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'j':
+			o.jobs = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			window_ms = strtod(optarg, NULL);
+			if (window_ms < 0) {
+				err_msg("Invalid --window\n");
+				return EINVAL;
+			}
+			o.window_ns = window_ms * 1e6;
+			break;
+		case 'H':
+			o.hist = 1;
+			break;
+		case 'h':
+			analyze_help(argv[0]);
+			return 0;
+		default:
+			analyze_help(argv[0]);
+			return EINVAL;
+		}
+	}
+	if (optind >= argc) {
+		analyze_help(argv[0]);
+		return EINVAL;
+	}
+	return diag_analyze(argv[optind], &o);
+}
+
+/* ------------------------------------------------------------------ */
+/* mux */
+
+/*
+ * More counters than the device samples at once: the counters are split
+ * into groups that take turns, a slice each. A slice programs its group
+ * with clear and single sampling, sized so that the samples outlast the
+ * slice, and reads the buffer back at the end of it. The value delta from
+ * the first to the last sample is the count of the slice, their distance
+ * in sample periods the time the group ran. As perf does for multiplexed
+ * events, the estimate of a counter over the whole run is its count scaled
+ * by the time all the groups ran over the time its own group did.
+ */
+
+#define MUX_DEFAULT_GROUP 8
+#define MUX_DEFAULT_SLICE_MS 100
+#define MUX_MAX_LOG_SAMPLES 12
+#define MUX_MAX_LOG_PERIOD 40
+
+struct mux_counter {
+	u16 id;
+	u32 slices;
+	u64 count;
+	u64 running_ticks;
+};
+
+struct diag_mux {
+	struct mlx5u_dev *dev;
+	int ncnt;
+	int group;
+	int log_samples;
+	int log_period;
+	u64 slice_ns;
+	u64 enabled_ticks;
+	u64 slices;
+	u8 *out;
+	size_t out_sz;
+	struct mux_counter *cnt;
+};
+
+/* The counter ids of the debug caps */
+static int mux_catalog(struct mlx5u_dev *dev, struct mux_counter **cntp)
+{
+	struct mux_counter *cnt;
+	void *gen, *dbg;
+	int n;
+
+	gen = mlx5u_cap_gen(dev);
+	if (!gen)
+		return -EIO;
+	n = MLX5_GET(cmd_hca_cap, gen, num_of_diagnostic_counters);
+	dbg = mlx5u_cap(dev, MLX5_CAP_DEBUG, HCA_CAP_OPMOD_GET_CUR, NULL);
+	if (!dbg)
+		return -EIO;
+	cnt = calloc(n, sizeof(*cnt));
+	if (!cnt)
 		return -ENOMEM;
+	for (int i = 0; i < n; i++)
+		cnt[i].id = MLX5_GET(diagnostic_cntr_layout,
+				     MLX5_ADDR_OF(debug_capX, dbg, diagnostic_counter[i]),
+				     counter_id);
+	*cntp = cnt;
+	return n;
+}
 
-	MLX5_SET(query_diagnostic_cntrs_in, in, opcode, MLX5_CMD_OP_QUERY_DIAGNOSTIC_COUNTERS);
-	MLX5_SET(query_diagnostic_cntrs_in, in, num_of_samples, print_lines);
-	MLX5_SET(query_diagnostic_cntrs_in, in, sample_index, sample_index);
+static int mux_parse(char *list, struct mux_counter **cntp)
+{
+	struct mux_counter *cnt;
+	int n = 1, i = 0;
+	char *tok;
+
+	for (char *p = list; *p; p++)
+		n += *p == ',';
+	cnt = calloc(n, sizeof(*cnt));
+	if (!cnt)
+		return -ENOMEM;
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ","))
+		cnt[i++].id = strtoul(tok, NULL, 0);
+	*cntp = cnt;
+	return i;
+}
 
-	err = mlx5u_cmd(dev, in, sizeof(in), out, out_sz);
+static void *mux_entry(struct diag_mux *m, int n, u32 row, int c)
+{
+	return MLX5_ADDR_OF(query_diagnostic_cntrs_out, m->out, diag_counter[row * n + c]);
+}
+
+/* Rows sampled since the clear, in order, each with all of the group */
+static u32 mux_rows(struct diag_mux *m, struct mux_counter *grp, int n)
+{
+	u32 r;
+
+	for (r = 0; r < (1u << m->log_samples); r++)
+		for (int c = 0; c < n; c++) {
+			void *e = mux_entry(m, n, r, c);
+
+			if (MLX5_GET(diagnostic_cntr_struct, e, counter_id) != grp[c].id ||
+			    MLX5_GET(diagnostic_cntr_struct, e, sample_id) != (r & 0xffff))
+				return r;
+		}
+	return r;
+}
+
+static int mux_slice(struct diag_mux *m, struct mux_counter *grp, int n)
+{
+	u8 in[MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_in)] = {};
+	struct set_diag_params params = {
+		.log_num_of_samples = m->log_samples,
+		.single = 1,
+		.clear = 1,
+		.enable = 1,
+		.log_sample_period = m->log_period,
+		.num_of_counters = n,
+	};
+	u32 ids[n];
+	u64 ticks;
+	u32 rows;
+	int err;
+
+	for (int c = 0; c < n; c++)
+		ids[c] = grp[c].id;
+	params.counter_id = ids;
+	err = mlx5_diag_cnt_set_param(m->dev, &params);
 	if (err)
-		goto out;
+		return err;
+	sleep_ns(m->slice_ns);
 
-	//dump samples:
-	for (int i = 0; i < print_lines; i++) {
-		void *diag_cnt = MLX5_ADDR_OF(query_diagnostic_cntrs_out, out, diag_counter[i]);
-		u32 counter_id = MLX5_GET(diagnostic_cntr_struct, diag_cnt, counter_id);
-		u32 sample_id = MLX5_GET(diagnostic_cntr_struct, diag_cnt, sample_id);
-		u32 time_stamp = MLX5_GET(diagnostic_cntr_struct, diag_cnt, time_stamp_31_0);
-		unsigned long counter_value = MLX5_GET(diagnostic_cntr_struct, diag_cnt, counter_value_h) << 31 |
-					      MLX5_GET(diagnostic_cntr_struct, diag_cnt, counter_value_l);
-		if (bin_output) {
-			printout[0] = (u64)counter_id;
-			printout[1] = (u64)sample_id;
-			printout[2] = (u64)time_stamp;
-			printout[3] = (u64)counter_value;
-			fwrite(printout, sizeof(printout[0]), 4, stdout);
-		} else {
-			fprintf(stdout, "counter_id: 0x%04x, sample_id: %010d, time_stamp: %010u counter_value: %lu\n",
-				counter_id, sample_id, time_stamp, counter_value);
+	memset(m->out, 0, m->out_sz);
+	MLX5_SET(query_diagnostic_cntrs_in, in, opcode, MLX5_CMD_OP_QUERY_DIAGNOSTIC_COUNTERS);
+	MLX5_SET(query_diagnostic_cntrs_in, in, num_of_samples, n << m->log_samples);
+	MLX5_SET(query_diagnostic_cntrs_in, in, sample_index, 0);
+	err = mlx5u_cmd(m->dev, in, sizeof(in), m->out, m->out_sz);
+	if (err) {
+		err_msg("query diagnostic counters failed, %d\n", err);
+		return err;
+	}
+
+	rows = mux_rows(m, grp, n);
+	m->slices++;
+	if (rows < 2) {
+		dbg_msg(1, "mux: group of 0x%x: %u samples in the slice, not counted\n",
+			grp[0].id, rows);
+		return 0;
+	}
+	ticks = (u64)(rows - 1) << m->log_period;
+	m->enabled_ticks += ticks;
+	for (int c = 0; c < n; c++) {
+		u64 first = diag_cnt_value(mux_entry(m, n, 0, c));
+		u64 last = diag_cnt_value(mux_entry(m, n, rows - 1, c));
+
+		/* a counter that went back wrapped, its slice doesn't count */
+		if (last < first)
+			continue;
+		grp[c].count += last - first;
+		grp[c].running_ticks += ticks;
+		grp[c].slices++;
+	}
+	return 0;
+}
+
+static void mux_print(struct diag_mux *m, int dev_freq)
+{
+	double enabled_ns = m->enabled_ticks * 1e6 / dev_freq;
+
+	if (!json_output)
+		printf("%llu slices of %.3f ms, %d counters in groups of %d, %.3f ms sampled\n",
+		       (unsigned long long)m->slices, m->slice_ns / 1e6, m->ncnt, m->group,
+		       enabled_ns / 1e6);
+	for (int i = 0; i < m->ncnt; i++) {
+		struct mux_counter *c = &m->cnt[i];
+		double running_ns = c->running_ticks * 1e6 / dev_freq;
+		double estimate = c->running_ticks ?
+				  (double)c->count * m->enabled_ticks / c->running_ticks : 0;
+		double rate = running_ns ? c->count * 1e9 / running_ns : 0;
+
+		if (json_output) {
+			json_rec_begin();
+			json_uint("counter_id", c->id);
+			json_uint("group", i / m->group);
+			json_uint("slices", c->slices);
+			json_uint("count", c->count);
+			json_uint("running_ns", running_ns);
+			json_uint("enabled_ns", enabled_ns);
+			json_double("estimate", estimate);
+			json_double("rate", rate);
+			json_rec_end();
+			continue;
+		}
+		printf("\tcounter_id: 0x%04x estimate %.6g rate %.6g/s count %llu (%.2f%% of the time, %u slices)\n",
+		       c->id, estimate, rate, (unsigned long long)c->count,
+		       m->enabled_ticks ? 100.0 * c->running_ticks / m->enabled_ticks : 0,
+		       c->slices);
+	}
+}
+
+static void mux_help(const char *cmd)
+{
+	printf("Usage: %s [--group=<n>] [--slice=<ms>] [--rounds=<n>] [--duration=<ms>] [--log-samples=<n>] [--period=<log>] <all|counter id1,counter id2,...>\n", cmd);
+	printf("\t--group=<n> - counters sampled at once, default %d\n", MUX_DEFAULT_GROUP);
+	printf("\t--slice=<ms> - time each group runs in its turn, default %d\n", MUX_DEFAULT_SLICE_MS);
+	printf("\t--rounds=<n> - turns of every group, default 1 or until --duration, 0 until interrupted\n");
+	printf("\t--duration=<ms> - stop after ms milliseconds\n");
+	printf("\t--log-samples=<n> - log_num_of_samples, default as many as fit a query, up to the cap\n");
+	printf("\t--period=<log> - log_sample_period, default the shortest whose samples outlast a slice\n");
+}
+
+static int do_mux(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"group", required_argument, 0, 'g'},
+		{"slice", required_argument, 0, 's'},
+		{"rounds", required_argument, 0, 'r'},
+		{"duration", required_argument, 0, 'd'},
+		{"log-samples", required_argument, 0, 'n'},
+		{"period", required_argument, 0, 'p'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct diag_mux m = {
+		.dev = dev,
+		.group = MUX_DEFAULT_GROUP,
+		.slice_ns = MUX_DEFAULT_SLICE_MS * 1000000ull,
+	};
+	struct set_diag_params off = { .clear = 1 };
+	struct sigaction sa = {};
+	u64 rounds = 1, duration_ms = 0, start;
+	int log_max, log_min, dev_freq;
+	int rounds_set = 0, log_samples_set = 0, log_period_set = 0;
+	void *dbg;
+	int err = 0, c;
+
+	if (argc > 1 && !strcmp(argv[1], "help")) {
+		mux_help(argv[0]);
+		return 0;
+	}
+	while ((c = getopt_long(argc, argv, "g:s:r:d:n:p:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'g':
+			m.group = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			m.slice_ns = strtod(optarg, NULL) * 1e6;
+			break;
+		case 'r':
+			rounds = strtoull(optarg, NULL, 0);
+			rounds_set = 1;
+			break;
+		case 'd':
+			duration_ms = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			m.log_samples = strtol(optarg, NULL, 0);
+			log_samples_set = 1;
+			break;
+		case 'p':
+			m.log_period = strtol(optarg, NULL, 0);
+			log_period_set = 1;
+			break;
+		case 'h':
+			mux_help(argv[0]);
+			return 0;
+		default:
+			mux_help(argv[0]);
+			return EINVAL;
 		}
 	}
+	if (optind >= argc || m.group < 1 || !m.slice_ns) {
+		mux_help(argv[0]);
+		return EINVAL;
+	}
+	if (duration_ms && !rounds_set)
+		rounds = 0;
+
+	dev_freq = mlx5u_cap_dev_freq(dev);
+	dbg = mlx5u_cap(dev, MLX5_CAP_DEBUG, HCA_CAP_OPMOD_GET_CUR, NULL);
+	if (dev_freq <= 0 || !dbg) {
+		err_msg("Can't get device frequency and debug caps.\n");
+		return EIO;
+	}
+	log_max = MLX5_GET(debug_capX, dbg, log_max_samples);
+	log_min = MLX5_GET(debug_capX, dbg, log_min_sample_period);
+	if (log_samples_set && (m.log_samples < 1 || m.log_samples > log_max)) {
+		err_msg("--log-samples must be 1..%d, log_max_samples of the device\n", log_max);
+		return EINVAL;
+	}
+	if (log_period_set &&
+	    (m.log_period < log_min || m.log_period > MUX_MAX_LOG_PERIOD)) {
+		err_msg("--period must be %d..%d, from log_min_sample_period of the device\n",
+			log_min, MUX_MAX_LOG_PERIOD);
+		return EINVAL;
+	}
+
+	m.ncnt = !strcmp(argv[optind], "all") ? mux_catalog(dev, &m.cnt) :
+						mux_parse(argv[optind], &m.cnt);
+	if (m.ncnt <= 0) {
+		err_msg("no counters to multiplex\n");
+		return m.ncnt ? -m.ncnt : EINVAL;
+	}
+	if (m.group > m.ncnt)
+		m.group = m.ncnt;
+
+	/* the whole buffer of a group comes back in one query */
+	if (!log_samples_set) {
+		m.log_samples = min(log_max, MUX_MAX_LOG_SAMPLES);
+		while (m.log_samples > 1 && ((u64)m.group << m.log_samples) > DIAG_QUERY_MAX_ENTRIES)
+			m.log_samples--;
+	}
+	if (((u64)m.group << m.log_samples) > DIAG_QUERY_MAX_ENTRIES) {
+		err_msg("%d counters of 2^%d samples don't fit a query\n", m.group, m.log_samples);
+		err = EINVAL;
+		goto out;
+	}
+	/* single sampling: it must not end before the slice does */
+	if (!log_period_set) {
+		u64 ticks = m.slice_ns * dev_freq / 1000000;
+
+		m.log_period = log_min;
+		while (m.log_period < MUX_MAX_LOG_PERIOD && ((1ull << m.log_samples) - 1) << m.log_period < ticks)
+			m.log_period++;
+	}
+
+	m.out_sz = MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out) +
+		   (m.group << m.log_samples) * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct);
+	m.out = malloc(m.out_sz);
+	if (!m.out) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	sa.sa_handler = stream_on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	fprintf(stderr, "diagcnt mux: %d counters, %d groups, slice %.3f ms, log_num_of_samples %d, log_sample_period %d\n",
+		m.ncnt, (m.ncnt + m.group - 1) / m.group, m.slice_ns / 1e6, m.log_samples,
+		m.log_period);
+
+	start = now_ns();
+	for (u64 round = 0; !err && !stream_stop && (!rounds || round < rounds); round++) {
+		for (int g = 0; !err && !stream_stop && g < m.ncnt; g += m.group)
+			err = mux_slice(&m, &m.cnt[g], min(m.group, m.ncnt - g));
+		if (duration_ms && now_ns() - start >= duration_ms * 1000000ull)
+			break;
+	}
+	/* leave the device as diagcnt disable would */
+	if (mlx5_diag_cnt_set_param(dev, &off) && !err)
+		err = EIO;
+	if (m.slices)
+		mux_print(&m, dev_freq);
+	fflush(stdout);
+	json_flush();
+
 out:
-	free(out);
+	free(m.out);
+	free(m.cnt);
 	return err;
 }
+
+/* ------------------------------------------------------------------ */
+/* plan */
+
+/*
+ * Set params from what is wanted instead of raw logs: the sample period is
+ * the longest power of 2 device ticks within the resolution, no shorter
+ * than log_min_sample_period. The buffer is the smallest that holds
+ * PLAN_DRAIN_RINGS drain intervals, so that a late poll still finds its
+ * samples, up to log_max_samples and what stream can follow. If that is
+ * not enough the drain interval is shortened to fit. A capture that fits
+ * the buffer as a whole is single sampling and a dump at the end.
+ */
+
+#define PLAN_DEFAULT_RESOLUTION_US 10
+#define PLAN_DEFAULT_DRAIN_MS 10
+#define PLAN_DRAIN_RINGS 4
+#define PLAN_MAX_LOG_SAMPLES 15 /* as stream */
+#define PLAN_MAX_LOG_PERIOD 40
+
+struct diag_plan {
+	/* asked for */
+	u64 resolution_ns;
+	u64 duration_ns;
+	u64 drain_ns;
+	int ncnt;
+	/* picked */
+	int log_period;
+	int log_samples;
+	int single;
+	u64 period_ns;
+	u64 ring_ns;
+	u64 interval_ns;
+};
+
+static double plan_ns(int log_ticks, int dev_freq)
+{
+	return (double)(1ull << log_ticks) * 1000000 / dev_freq;
+}
+
+static int diag_plan(struct diag_plan *p, int log_min, int log_max, int dev_freq)
+{
+	int max_samples = min(log_max, PLAN_MAX_LOG_SAMPLES);
+
+	p->log_period = log_min;
+	while (p->log_period < PLAN_MAX_LOG_PERIOD &&
+	       plan_ns(p->log_period + 1, dev_freq) <= p->resolution_ns)
+		p->log_period++;
+	if (plan_ns(p->log_period, dev_freq) > p->resolution_ns)
+		info_msg("plan: resolution %.3f us is below the minimal sample period %.3f us\n",
+			 p->resolution_ns / 1e3, plan_ns(log_min, dev_freq) / 1e3);
+	p->period_ns = plan_ns(p->log_period, dev_freq);
+	if (!p->period_ns)
+		p->period_ns = 1;
+
+	/* all of it in the buffer, read once at the end */
+	if (p->duration_ns) {
+		u64 rows = p->duration_ns / p->period_ns + 1;
+
+		for (p->log_samples = 1; p->log_samples < max_samples &&
+		     (1ull << p->log_samples) < rows; p->log_samples++)
+			;
+		if ((1ull << p->log_samples) >= rows &&
+		    ((u64)p->ncnt << p->log_samples) <= DIAG_QUERY_MAX_ENTRIES) {
+			p->single = 1;
+			p->ring_ns = p->period_ns << p->log_samples;
+			p->interval_ns = 0;
+			return 0;
+		}
+	}
+
+	for (p->log_samples = 1; p->log_samples < max_samples &&
+	     (p->period_ns << p->log_samples) < PLAN_DRAIN_RINGS * p->drain_ns;
+	     p->log_samples++)
+		;
+	p->ring_ns = p->period_ns << p->log_samples;
+	p->interval_ns = min(p->drain_ns, p->ring_ns / PLAN_DRAIN_RINGS);
+	if (!p->interval_ns) {
+		err_msg("plan: a %d samples buffer lasts %llu ns, too short to drain\n",
+			1 << p->log_samples, (unsigned long long)p->ring_ns);
+		return -EINVAL;
+	}
+	if (p->interval_ns < p->drain_ns)
+		info_msg("plan: a %d samples buffer lasts %.3f ms, drain interval shortened to %.3f ms\n",
+			 1 << p->log_samples, p->ring_ns / 1e6, p->interval_ns / 1e6);
+	return 0;
+}
+
+static void plan_print(struct diag_plan *p, int log_min, int log_max, int dev_freq)
+{
+	u64 rate = p->ncnt * MLX5_ST_SZ_BYTES(diagnostic_cntr_struct) * 1000000000ull /
+		   p->period_ns;
+
+	if (json_output) {
+		json_rec_begin();
+		json_uint("dev_freq_khz", dev_freq);
+		json_uint("log_min_sample_period", log_min);
+		json_uint("log_max_samples", log_max);
+		json_uint("log_sample_period", p->log_period);
+		json_uint("log_num_of_samples", p->log_samples);
+		json_uint("single", p->single);
+		json_uint("dump_entries", p->single ? (u64)p->ncnt << p->log_samples : 0);
+		json_uint("sample_period_ns", p->period_ns);
+		json_uint("buffer_ns", p->ring_ns);
+		json_uint("interval_ns", p->interval_ns);
+		json_uint("bytes_per_sec", rate);
+		json_rec_end();
+		return;
+	}
+	printf("dev_freq %d kHz, log_min_sample_period %d, log_max_samples %d\n",
+	       dev_freq, log_min, log_max);
+	printf("\tlog_sample_period: %d (%.3f us)\n", p->log_period, p->period_ns / 1e3);
+	printf("\tlog_num_of_samples: %d (buffer of %.3f ms)\n", p->log_samples,
+	       p->ring_ns / 1e6);
+	if (p->single) {
+		printf("\tsingle sampling, the capture fits the buffer: set -cs, dump %llu after %.3f ms\n",
+		       (unsigned long long)p->ncnt << p->log_samples, p->ring_ns / 1e6);
+		return;
+	}
+	printf("\trepetitive sampling: set -cr, stream --interval=%llu, %.1f KB/s of %d counters\n",
+	       (unsigned long long)(p->interval_ns / 1000), rate / 1e3, p->ncnt);
+}
+
+static void plan_help(const char *cmd)
+{
+	printf("Usage: %s [--resolution=<us>] [--duration=<ms>] [--drain=<ms>] [--counters=<n>] [counter id1,counter id2,...]\n", cmd);
+	printf("\t--resolution=<us> - longest sample period wanted, default %d\n",
+	       PLAN_DEFAULT_RESOLUTION_US);
+	printf("\t--duration=<ms> - capture length, single sampling if it fits the buffer, default until stopped\n");
+	printf("\t--drain=<ms> - time between stream queries, default %d\n", PLAN_DEFAULT_DRAIN_MS);
+	printf("\t--counters=<n> - number of counters, default 1 or the ids given\n");
+	printf("\tcounter ids - set the params picked for them, with clear\n");
+}
+
+static int do_plan(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"resolution", required_argument, 0, 'r'},
+		{"duration", required_argument, 0, 'd'},
+		{"drain", required_argument, 0, 'i'},
+		{"counters", required_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct diag_plan p = {
+		.resolution_ns = PLAN_DEFAULT_RESOLUTION_US * 1000ull,
+		.drain_ns = PLAN_DEFAULT_DRAIN_MS * 1000000ull,
+		.ncnt = 1,
+	};
+	struct set_diag_params params = {};
+	struct mux_counter *ids = NULL;
+	int log_min, log_max, dev_freq;
+	void *dbg;
+	int err, c;
+
+	if (argc > 1 && !strcmp(argv[1], "help")) {
+		plan_help(argv[0]);
+		return 0;
+	}
+	while ((c = getopt_long(argc, argv, "r:d:i:n:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			p.resolution_ns = strtod(optarg, NULL) * 1e3;
+			break;
+		case 'd':
+			p.duration_ns = strtod(optarg, NULL) * 1e6;
+			break;
+		case 'i':
+			p.drain_ns = strtod(optarg, NULL) * 1e6;
+			break;
+		case 'n':
+			p.ncnt = strtol(optarg, NULL, 0);
+			break;
+		case 'h':
+			plan_help(argv[0]);
+			return 0;
+		default:
+			plan_help(argv[0]);
+			return EINVAL;
+		}
+	}
+	if (optind < argc) {
+		p.ncnt = mux_parse(argv[optind], &ids);
+		if (p.ncnt < 0)
+			return -p.ncnt;
+	}
+	if (p.ncnt < 1 || p.ncnt > DIAG_QUERY_MAX_ENTRIES || !p.resolution_ns || !p.drain_ns) {
+		plan_help(argv[0]);
+		free(ids);
+		return EINVAL;
+	}
+
+	dev_freq = mlx5u_cap_dev_freq(dev);
+	dbg = mlx5u_cap(dev, MLX5_CAP_DEBUG, HCA_CAP_OPMOD_GET_CUR, NULL);
+	if (dev_freq <= 0 || !dbg) {
+		err_msg("Can't get device frequency and debug caps.\n");
+		free(ids);
+		return EIO;
+	}
+	log_max = MLX5_GET(debug_capX, dbg, log_max_samples);
+	log_min = MLX5_GET(debug_capX, dbg, log_min_sample_period);
+
+	err = diag_plan(&p, log_min, log_max, dev_freq);
+	if (err) {
+		free(ids);
+		return -err;
+	}
+	plan_print(&p, log_min, log_max, dev_freq);
+	fflush(stdout);
+	json_flush();
+	if (!ids)
+		return 0;
+
+	params.log_num_of_samples = p.log_samples;
+	params.log_sample_period = p.log_period;
+	params.single = p.single;
+	params.repetitive = !p.single;
+	params.clear = 1;
+	params.enable = 1;
+	params.num_of_counters = p.ncnt;
+	params.counter_id = malloc(p.ncnt * sizeof(u32));
+	if (!params.counter_id) {
+		free(ids);
+		return ENOMEM;
+	}
+	for (int i = 0; i < p.ncnt; i++)
+		params.counter_id[i] = ids[i].id;
+	err = mlx5_diag_cnt_set_param(dev, &params);
+	free(params.counter_id);
+	free(ids);
+	if (err)
+		return err;
+	if (!json_output)
+		printf("set diagnostic params succeeded\n");
+	return 0;
+}
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_DIAG_CNT_H__
+#define __MLX5CTL_DIAG_CNT_H__
+
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+
+/* Diagnostic counters PRM layouts, shared by diag_cnt.c and the simulator */
+
+/* this is private prm, mlx5_ifc has a different version of this */
+struct mlx5_ifc_debug_capX_bits {
+	u8         core_dump_general[0x1];
+	u8         core_dump_qp[0x1];
+	u8         reserved_at_2[0x7];
+	u8         resource_dump[0x1];
+	u8         reserved_at_a[0xe];
+	u8         log_max_samples[0x8];
+	u8         single[0x1];
+	u8         repetitive[0x1];
+	/*The below field OFED name was health_mon_rx_activity and Upstream
+	 *          * stall_detect, for now i take the upstream one*/
+	u8         stall_detect[0x1];
+	u8         reserved_at_23[0x15];
+	u8         log_min_sample_period[0x8];
+	u8         reserved_at_40[0x1c0];
+	struct mlx5_ifc_diagnostic_cntr_layout_bits diagnostic_counter[0];
+};
+
+struct mlx5_ifc_counter_id_bits {
+	u8         reserved_at_0[0x10];
+	u8         counter_id[0x10];
+};
+
+struct mlx5_ifc_diagnostic_params_context_bits {
+	u8         num_of_counters[0x10];
+	u8         reserved_at_10[0x8];
+	u8         log_num_of_samples[0x8];
+
+	u8         single[0x1];
+	u8         repetitive[0x1];
+	u8         sync[0x1];
+	u8         clear[0x1];
+	u8         on_demand[0x1];
+	u8         enable[0x1];
+	u8         reserved_at_26[0x12];
+	u8         log_sample_period[0x8];
+
+	u8         reserved_at_40[0x80];
+
+	struct mlx5_ifc_counter_id_bits counter_id[0];
+};
+
+struct mlx5_ifc_query_diagnostic_params_in_bits {
+	u8         opcode[0x10];
+	u8         reserved_at_10[0x10];
+
+	u8         reserved_at_20[0x10];
+	u8         op_mod[0x10];
+
+	u8         reserved_at_40[0x40];
+};
+
+struct mlx5_ifc_query_diagnostic_params_out_bits {
+	u8         status[0x8];
+	u8         reserved_at_8[0x18];
+
+	u8         syndrome[0x20];
+
+	struct mlx5_ifc_diagnostic_params_context_bits diagnostic_params_context;
+};
+
+struct mlx5_ifc_set_diagnostic_params_in_bits {
+	u8         opcode[0x10];
+	u8         reserved_at_10[0x10];
+
+	u8         reserved_at_20[0x10];
+	u8         op_mod[0x10];
+
+	struct mlx5_ifc_diagnostic_params_context_bits diagnostic_params_context;
+};
+
+struct mlx5_ifc_set_diagnostic_params_out_bits {
+	u8         status[0x8];
+	u8         reserved_at_8[0x18];
+
+	u8         syndrome[0x20];
+
+	u8         reserved_at_40[0x40];
+};
+
+struct mlx5_ifc_diagnostic_cntr_struct_bits {
+	u8         counter_id[0x10];
+	u8         sample_id[0x10];
+
+	u8         time_stamp_31_0[0x20];
+
+	u8         counter_value_h[0x20];
+
+	u8         counter_value_l[0x20];
+};
+
+struct mlx5_ifc_query_diagnostic_cntrs_in_bits {
+	u8         opcode[0x10];
+	u8         reserved_at_10[0x10];
+
+	u8         reserved_at_20[0x10];
+	u8         op_mod[0x10];
+
+	u8         num_of_samples[0x10];
+	u8         sample_index[0x10];
+
+	u8         reserved_at_60[0x20];
+};
+
+struct mlx5_ifc_query_diagnostic_cntrs_out_bits {
+	u8         status[0x8];
+	u8         reserved_at_8[0x18];
+
+	u8         syndrome[0x20];
+
+	u8         reserved_at_40[0x40];
+
+	struct mlx5_ifc_diagnostic_cntr_struct_bits diag_counter[0];
+};
+
+#endif /* __MLX5CTL_DIAG_CNT_H__ */
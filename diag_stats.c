@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Diagnostic counter sample reduction, see diag_stats.h.
+ *
+ * Everything is one pass and constant memory per counter: mean and
+ * variance by Welford's update, quantiles from a log-linear histogram with
+ * 16 buckets per power of 2, so a quantile is within 1/16 of the true
+ * value. A window is printed and reset when the first row past its end
+ * comes in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "diag_cnt.h"
+#include "diag_stats.h"
+#include "json.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define QS_SUB_BITS DIAG_QS_SUB_BITS
+#define QS_SUB (1 << QS_SUB_BITS)
+#define QS_BUCKETS DIAG_QS_BUCKETS
+
+struct counter_stats {
+	u16 counter_id;
+	int have_prev;
+	u64 prev_value;
+	u64 prev_ns;
+	struct diag_moments value;
+	struct diag_moments rate; /* per second */
+	struct diag_qsketch rate_q;
+};
+
+struct diag_stats {
+	int ncnt;
+	u32 dev_freq_khz;
+	u64 period_ticks;
+	u64 window_ns;
+	/* device time */
+	int started;
+	u64 ticks;
+	u64 first_ns;
+	/* the window in progress */
+	u64 window;
+	u64 rows;
+	u64 lost;
+	u64 start_ns;
+	u64 end_ns;
+	struct counter_stats cnt[];
+};
+
+int diag_qs_index(u64 v)
+{
+	int e;
+
+	if (v < QS_SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return QS_SUB + (e - QS_SUB_BITS) * QS_SUB +
+	       ((v >> (e - QS_SUB_BITS)) & (QS_SUB - 1));
+}
+
+u64 diag_qs_lower(int i)
+{
+	int e;
+
+	if (i < QS_SUB)
+		return i;
+	e = (i - QS_SUB) / QS_SUB + QS_SUB_BITS;
+	return (u64)(QS_SUB + (i - QS_SUB) % QS_SUB) << (e - QS_SUB_BITS);
+}
+
+/* The middle of bucket i */
+static double qs_value(int i)
+{
+	if (i < QS_SUB)
+		return i;
+	return diag_qs_lower(i) +
+	       ((1ull << ((i - QS_SUB) / QS_SUB)) - 1) / 2.0;
+}
+
+void diag_qs_add(struct diag_qsketch *q, u64 v)
+{
+	q->bucket[diag_qs_index(v)]++;
+	q->n++;
+}
+
+void diag_qs_merge(struct diag_qsketch *q, const struct diag_qsketch *o)
+{
+	for (int i = 0; i < QS_BUCKETS; i++)
+		q->bucket[i] += o->bucket[i];
+	q->n += o->n;
+}
+
+static double qs_quantile(const struct diag_qsketch *q, double p)
+{
+	u64 rank = p * (q->n - 1), seen = 0;
+
+	for (int i = 0; i < QS_BUCKETS; i++) {
+		seen += q->bucket[i];
+		if (seen > rank)
+			return qs_value(i);
+	}
+	return NAN;
+}
+
+void diag_moments_add(struct diag_moments *m, double v)
+{
+	double d = v - m->mean;
+
+	if (!m->n || v < m->min)
+		m->min = v;
+	if (!m->n || v > m->max)
+		m->max = v;
+	m->n++;
+	m->mean += d / m->n;
+	m->m2 += d * (v - m->mean);
+}
+
+/*
+ * Two passes over the array, then merged: no division per value, and four
+ * sums so that the additions don't wait on each other.
+ */
+void diag_moments_add_array(struct diag_moments *m, const double *v, size_t n)
+{
+	struct diag_moments a = { .n = n };
+	double sum[4] = {}, m2[4] = {};
+	double min, max;
+	size_t i;
+
+	if (!n)
+		return;
+	min = max = v[0];
+	for (i = 0; i + 4 <= n; i += 4)
+		for (int k = 0; k < 4; k++) {
+			sum[k] += v[i + k];
+			min = v[i + k] < min ? v[i + k] : min;
+			max = v[i + k] > max ? v[i + k] : max;
+		}
+	for (; i < n; i++) {
+		sum[0] += v[i];
+		min = v[i] < min ? v[i] : min;
+		max = v[i] > max ? v[i] : max;
+	}
+	a.mean = (sum[0] + sum[1] + sum[2] + sum[3]) / n;
+	for (i = 0; i + 4 <= n; i += 4)
+		for (int k = 0; k < 4; k++)
+			m2[k] += (v[i + k] - a.mean) * (v[i + k] - a.mean);
+	for (; i < n; i++)
+		m2[0] += (v[i] - a.mean) * (v[i] - a.mean);
+	a.m2 = m2[0] + m2[1] + m2[2] + m2[3];
+	a.min = min;
+	a.max = max;
+	diag_moments_merge(m, &a);
+}
+
+/* Chan et al.'s pairwise update, the same result as adding o's values */
+void diag_moments_merge(struct diag_moments *m, const struct diag_moments *o)
+{
+	double d = o->mean - m->mean;
+	u64 n = m->n + o->n;
+
+	if (!o->n)
+		return;
+	if (!m->n) {
+		*m = *o;
+		return;
+	}
+	m->mean += d * o->n / n;
+	m->m2 += o->m2 + d * d * ((double)m->n * o->n / n);
+	m->min = fmin(m->min, o->min);
+	m->max = fmax(m->max, o->max);
+	m->n = n;
+}
+
+static double moments_stddev(const struct diag_moments *m)
+{
+	return m->n > 1 ? sqrt(m->m2 / (m->n - 1)) : 0;
+}
+
+struct diag_stats *diag_stats_create(int ncnt, u32 dev_freq_khz, int period_log,
+				     u64 window_ns)
+{
+	struct diag_stats *st;
+
+	if (!dev_freq_khz)
+		return NULL;
+	st = calloc(1, sizeof(*st) + ncnt * sizeof(st->cnt[0]));
+	if (!st)
+		return NULL;
+	st->ncnt = ncnt;
+	st->dev_freq_khz = dev_freq_khz;
+	st->period_ticks = 1ull << period_log;
+	st->window_ns = window_ns;
+	return st;
+}
+
+void diag_stats_free(struct diag_stats *st)
+{
+	free(st);
+}
+
+u64 diag_ts_unwrap(u64 expect, u32 ts)
+{
+	u64 t = (expect & ~0xffffffffull) | ts;
+
+	if (t > expect && t - expect > 0x80000000ull && t >= 0x100000000ull)
+		t -= 0x100000000ull;
+	else if (t < expect && expect - t > 0x80000000ull)
+		t += 0x100000000ull;
+	return t;
+}
+
+/* Where the sample should be by the number of periods since the last one */
+static u64 unwrap_ts(struct diag_stats *st, u32 ts, u32 lost)
+{
+	if (!st->started) {
+		st->started = 1;
+		st->ticks = ts;
+		return st->ticks;
+	}
+	st->ticks = diag_ts_unwrap(st->ticks + (lost + 1ull) * st->period_ticks, ts);
+	return st->ticks;
+}
+
+static u64 ticks_to_ns(struct diag_stats *st, u64 ticks)
+{
+	/* 128 bit, ticks * 10^6 overflows past ~5 hours at 1GHz */
+	return (unsigned __int128)ticks * 1000000 / st->dev_freq_khz;
+}
+
+static const struct {
+	const char *name;
+	double p;
+} quantiles[] = {
+	{ "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 },
+};
+
+/* A quantile within the range seen, a bucket middle may lie past it */
+static double quantile(const struct diag_moments *m, const struct diag_qsketch *q,
+		       double p)
+{
+	return fmin(fmax(qs_quantile(q, p), m->min), m->max);
+}
+
+void diag_stats_print_moments(const char *key, const struct diag_moments *m,
+			      const struct diag_qsketch *q)
+{
+	if (json_output) {
+		json_obj_begin(key);
+		json_double("min", m->min);
+		json_double("max", m->max);
+		json_double("mean", m->mean);
+		json_double("stddev", moments_stddev(m));
+		for (int i = 0; q && i < ARRAY_SIZE(quantiles); i++)
+			json_double(quantiles[i].name, quantile(m, q, quantiles[i].p));
+		json_obj_end();
+		return;
+	}
+	printf("\t\t%s: min %.6g max %.6g mean %.6g stddev %.6g", key, m->min, m->max,
+	       m->mean, moments_stddev(m));
+	for (int i = 0; q && i < ARRAY_SIZE(quantiles); i++)
+		printf(" %s %.6g", quantiles[i].name, quantile(m, q, quantiles[i].p));
+	printf("\n");
+}
+
+static void print_counter(struct diag_stats *st, struct counter_stats *c)
+{
+	if (json_output) {
+		json_rec_begin();
+		json_uint("window", st->window);
+		json_uint("start_ns", st->start_ns - st->first_ns);
+		json_uint("end_ns", st->end_ns - st->first_ns);
+		json_uint("samples", st->rows);
+		json_uint("lost", st->lost);
+		json_uint("counter_id", c->counter_id);
+	} else {
+		printf("\tcounter_id: 0x%04x\n", c->counter_id);
+	}
+	diag_stats_print_moments("value", &c->value, NULL);
+	if (c->rate.n)
+		diag_stats_print_moments("rate", &c->rate, &c->rate_q);
+	if (json_output)
+		json_rec_end();
+}
+
+void diag_stats_flush(struct diag_stats *st)
+{
+	if (!st->rows)
+		return;
+	if (!json_output)
+		printf("window %llu: %.3f ms at %.3f ms, %llu samples, %llu lost\n",
+		       (unsigned long long)st->window,
+		       (st->end_ns - st->start_ns) / 1e6,
+		       (st->start_ns - st->first_ns) / 1e6,
+		       (unsigned long long)st->rows, (unsigned long long)st->lost);
+	for (int i = 0; i < st->ncnt; i++) {
+		struct counter_stats *c = &st->cnt[i];
+
+		print_counter(st, c);
+		memset(&c->value, 0, sizeof(c->value));
+		memset(&c->rate, 0, sizeof(c->rate));
+		memset(&c->rate_q, 0, sizeof(c->rate_q));
+	}
+	st->rows = 0;
+	st->lost = 0;
+}
+
+void diag_stats_row(struct diag_stats *st, const void *row, u32 lost)
+{
+	const u8 *entry = row;
+	u32 ts = MLX5_GET(diagnostic_cntr_struct, entry, time_stamp_31_0);
+	int first = !st->started;
+	u64 ns = ticks_to_ns(st, unwrap_ts(st, ts, lost));
+	u64 window;
+
+	if (first)
+		st->first_ns = ns;
+	window = st->window_ns ? (ns - st->first_ns) / st->window_ns : 0;
+	if (window != st->window) {
+		diag_stats_flush(st);
+		st->window = window;
+	}
+	if (!st->rows)
+		st->start_ns = ns;
+	st->end_ns = ns;
+	st->rows++;
+	st->lost += lost;
+
+	for (int i = 0; i < st->ncnt; i++, entry += MLX5_ST_SZ_BYTES(diagnostic_cntr_struct)) {
+		struct counter_stats *c = &st->cnt[i];
+		u64 v = (u64)MLX5_GET(diagnostic_cntr_struct, entry, counter_value_h) << 32 |
+			MLX5_GET(diagnostic_cntr_struct, entry, counter_value_l);
+
+		c->counter_id = MLX5_GET(diagnostic_cntr_struct, entry, counter_id);
+		diag_moments_add(&c->value, v);
+		/* a counter that went back was cleared, no rate across that */
+		if (c->have_prev && v >= c->prev_value && ns > c->prev_ns) {
+			double rate = (v - c->prev_value) * 1e9 / (ns - c->prev_ns);
+
+			diag_moments_add(&c->rate, rate);
+			diag_qs_add(&c->rate_q, rate < 0x1p64 ? (u64)(rate + 0.5) : ~0ull);
+		}
+		c->have_prev = 1;
+		c->prev_value = v;
+		c->prev_ns = ns;
+	}
+}
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_DIAG_STATS_H__
+#define __MLX5CTL_DIAG_STATS_H__
+
+#include "ifcutil.h"
+
+/*
+ * Diagnostic counter sample reduction, for diagcnt stream --summary.
+ *
+ * Rows of samples (one diagnostic_cntr_struct per enabled counter) go in,
+ * per counter summaries of fixed windows of device time come out: the
+ * min/max/mean/stddev of the counter values and of their rates, and
+ * quantiles of the rate. The 32 bit time_stamp is unwrapped to 64 bits
+ * and converted to ns by the device frequency, a rate is the value delta
+ * of two consecutive rows over their time delta, so it also spans a gap
+ * of lost samples.
+ */
+
+struct diag_stats;
+
+/*
+ * The building blocks, mergeable so that diagcnt analyze can reduce parts
+ * of a capture on threads of their own and add them up.
+ */
+
+/* Count, mean and sum of squared deviations by Welford's update, min, max */
+struct diag_moments {
+	u64 n;
+	double mean;
+	double m2;
+	double min;
+	double max;
+};
+
+void diag_moments_add(struct diag_moments *m, double v);
+void diag_moments_merge(struct diag_moments *m, const struct diag_moments *o);
+void diag_moments_add_array(struct diag_moments *m, const double *v, size_t n);
+
+/* Log-linear histogram, values below 16 have a bucket each, then 16 per power of 2 */
+#define DIAG_QS_SUB_BITS 4
+#define DIAG_QS_BUCKETS ((1 << DIAG_QS_SUB_BITS) + (64 - DIAG_QS_SUB_BITS) * (1 << DIAG_QS_SUB_BITS))
+
+struct diag_qsketch {
+	u64 n;
+	u64 bucket[DIAG_QS_BUCKETS];
+};
+
+void diag_qs_add(struct diag_qsketch *q, u64 v);
+void diag_qs_merge(struct diag_qsketch *q, const struct diag_qsketch *o);
+int diag_qs_index(u64 v);
+/* The smallest value of bucket i */
+u64 diag_qs_lower(int i);
+
+/* The tick count of ts, taken from the 2^32 tick lap nearest to expect */
+u64 diag_ts_unwrap(u64 expect, u32 ts);
+
+/* min/max/mean/stddev as key, and quantiles of q if not NULL */
+void diag_stats_print_moments(const char *key, const struct diag_moments *m,
+			      const struct diag_qsketch *q);
+
+/*
+ * period_log: log_sample_period in device ticks, to unwrap the time stamp
+ * across gaps. window_ns 0 is one window over the whole run.
+ */
+struct diag_stats *diag_stats_create(int ncnt, u32 dev_freq_khz, int period_log,
+				     u64 window_ns);
+void diag_stats_free(struct diag_stats *st);
+
+/* A row of ncnt entries, lost is the number of samples missing before it */
+void diag_stats_row(struct diag_stats *st, const void *row, u32 lost);
+/* Print the window in progress, if it has samples */
+void diag_stats_flush(struct diag_stats *st);
+
+#endif /* __MLX5CTL_DIAG_STATS_H__ */
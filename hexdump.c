@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Buffered hex and binary output, see hexdump.h.
+ *
+ * Core dumps and full resource dumps are several MB. Each byte is two
+ * characters out of a 256 entry pair table, whole lines go into a 64KB
+ * buffer and the buffer goes out with one write(), so a dump costs a write
+ * per ~1300 lines instead of stdio calls per byte.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "hexdump.h"
+#include "json.h"
+
+#define HEXDUMP_BUF (64 * 1024)
+#define HEXDUMP_LINE 16
+/* "xxxxxxxx: " + "xx " per byte + '\n', + the '\n' ending the dump */
+#define HEXDUMP_LINE_MAX (10 + 3 * HEXDUMP_LINE + 2)
+
+#define HEX_ROW(h) \
+	h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+	h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+
+static const char hex_pairs[] =
+	HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+	HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+	HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b")
+	HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+static int hexdump_flags;
+
+void hexdump_set_flags(int flags)
+{
+	hexdump_flags = flags;
+}
+
+int hexdump_get_flags(void)
+{
+	return hexdump_flags;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err_msg("write to stdout failed: %s\n", strerror(errno));
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static inline char *put_hex(char *p, u8 b)
+{
+	memcpy(p, &hex_pairs[2 * b], 2);
+	return p + 2;
+}
+
+char *hex_encode(char *dst, const void *src, size_t len)
+{
+	const u8 *p = src;
+
+	for (size_t i = 0; i < len; i++)
+		dst = put_hex(dst, p[i]);
+	return dst;
+}
+
+static char *hex_line(char *p, const u8 *data, int n, u32 off, int flags)
+{
+	if (flags & HEXDUMP_OFFSET) {
+		p = put_hex(p, off >> 24);
+		p = put_hex(p, off >> 16);
+		p = put_hex(p, off >> 8);
+		p = put_hex(p, off);
+		*p++ = ':';
+		*p++ = ' ';
+	}
+	for (int i = 0; i < n; i++) {
+		p = put_hex(p, data[i]);
+		*p++ = ' ';
+	}
+	if (n == HEXDUMP_LINE)
+		*p++ = '\n';
+	return p;
+}
+
+static int zero_line(const u8 *data)
+{
+	static const u8 zero[HEXDUMP_LINE];
+
+	return !memcmp(data, zero, HEXDUMP_LINE);
+}
+
+void hexdump(const void *data, int size)
+{
+	const u8 *bytes = data;
+	int flags = hexdump_flags;
+	int fd = fileno(stdout);
+	int prev_zero = 0, starred = 0;
+	char buf[HEXDUMP_BUF];
+	char *p = buf;
+
+	if (json_output) {
+		json_hex("data", data, size > 0 ? size : 0);
+		return;
+	}
+
+	fflush(stdout);
+	for (int off = 0; off < size; off += HEXDUMP_LINE) {
+		int n = min(size - off, HEXDUMP_LINE);
+
+		if (p - buf > HEXDUMP_BUF - HEXDUMP_LINE_MAX) {
+			if (write_all(fd, buf, p - buf))
+				return;
+			p = buf;
+		}
+		if (flags & HEXDUMP_SQUEEZE && n == HEXDUMP_LINE) {
+			int zero = zero_line(bytes + off);
+
+			if (zero && prev_zero) {
+				if (!starred) {
+					*p++ = '*';
+					*p++ = '\n';
+				}
+				starred = 1;
+				continue;
+			}
+			prev_zero = zero;
+			starred = 0;
+		}
+		p = hex_line(p, bytes + off, n, off, flags);
+	}
+	*p++ = '\n';
+	write_all(fd, buf, p - buf);
+}
+
+void bindump(const void *data, size_t size)
+{
+	if (json_output)
+		json_hex("data", data, size);
+	else
+		out_write(data, size);
+}
+
+int out_write(const void *buf, size_t len)
+{
+	fflush(stdout);
+	return write_all(fileno(stdout), buf, len);
+}
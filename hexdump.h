@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_HEXDUMP_H__
+#define __MLX5CTL_HEXDUMP_H__
+
+#include <stddef.h>
+
+/*
+ * Hex and binary output of FW payloads: rscdump segments, core dumps,
+ * obj/reg/cap -B. Lines are formatted into a large buffer and written to
+ * the stdout fd directly, stdio is flushed first so the output stays in
+ * order with the printf()s around it.
+ *
+ * A hexdump line is 16 "xx " bytes and a newline, the last line may be
+ * shorter, and a newline ends the dump.
+ */
+
+enum {
+	HEXDUMP_OFFSET = 1 << 0,  /* --hex-offset: "%08x: " byte offset column */
+	HEXDUMP_SQUEEZE = 1 << 1, /* --hex-squeeze: a run of all-zero lines is one "*" */
+};
+
+void hexdump_set_flags(int flags);
+int hexdump_get_flags(void);
+
+/*
+ * With --json/--ndjson both print the payload as the "data" hex string of
+ * the current record instead.
+ */
+void hexdump(const void *data, int size);
+/* Raw bytes to stdout */
+void bindump(const void *data, size_t size);
+
+/* Flush stdio and write() len bytes to the stdout fd, -1 on error */
+int out_write(const void *buf, size_t len);
+/* 2 * len hex characters of src at dst, not terminated, returns the end */
+char *hex_encode(char *dst, const void *src, size_t len);
+
+#endif /* __MLX5CTL_HEXDUMP_H__ */
@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Schema driven decoder of mlx5_ifc layouts, see ifc_schema.h.
+ *
+ * The walk follows the generated field table, which is in layout order, so
+ * a payload is read front to back once, each field with a single big endian
+ * load instead of a MLX5_GET expansion per field. --fields paths are looked
+ * up through the generated perfect hash, one probe per path component.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "ifc_schema.h"
+#include "json.h"
+
+#define IFC_PATH_MAX 256
+
+static int layout_cmp(const void *key, const void *elem)
+{
+	const struct ifc_layout *l = elem;
+
+	return strcmp(key, ifc_str(l->name));
+}
+
+const struct ifc_layout *ifc_layout_find(const char *name)
+{
+	return bsearch(name, ifc_layouts, ifc_nlayouts, sizeof(ifc_layouts[0]),
+		       layout_cmp);
+}
+
+static u32 load_be32(const u8 *p)
+{
+	return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
+
+/* Spanning two dwords at most, wider fields are bytes to the decoder */
+u64 ifc_get(const void *buf, u32 bit_off, u32 bit_sz)
+{
+	const u8 *p = (const u8 *)buf + bit_off / 32 * 4;
+	u32 shift = bit_off % 32;
+	u64 v;
+
+	if (shift + bit_sz <= 32) {
+		v = load_be32(p) >> (32 - shift - bit_sz);
+		return bit_sz == 32 ? v : v & ((1u << bit_sz) - 1);
+	}
+	v = (u64)load_be32(p) << 32 | load_be32(p + 4);
+	return v << shift >> (64 - bit_sz);
+}
+
+struct decoder {
+	FILE *f;
+	const u8 *buf;
+	u64 bits; /* of buf */
+	char path[IFC_PATH_MAX];
+};
+
+static void print_bytes(struct decoder *d, u32 bit_off, u32 bit_sz)
+{
+	const u8 *p = d->buf + bit_off / 8;
+
+	if (json_output) {
+		json_hex(d->path, p, bit_sz / 8);
+		return;
+	}
+	fprintf(d->f, "\t%s: 0x", d->path);
+	for (u32 i = 0; i < bit_sz / 8; i++)
+		fprintf(d->f, "%02x", p[i]);
+	fputc('\n', d->f);
+}
+
+static void print_scalar(struct decoder *d, u32 bit_off, u32 bit_sz)
+{
+	if (bit_sz > 64 || (bit_off % 32) + bit_sz > 64)
+		print_bytes(d, bit_off, bit_sz);
+	else if (json_output)
+		json_uint(d->path, ifc_get(d->buf, bit_off, bit_sz));
+	else if (bit_sz > 32)
+		fprintf(d->f, "\t%s: 0x%llx\n", d->path,
+			(unsigned long long)ifc_get(d->buf, bit_off, bit_sz));
+	else
+		fprintf(d->f, "\t%s: %llu\n", d->path,
+			(unsigned long long)ifc_get(d->buf, bit_off, bit_sz));
+}
+
+static void decode_layout(struct decoder *d, const struct ifc_layout *l, u64 base,
+			  size_t plen);
+
+/* count elements of bit_sz at off, named path + name */
+static void decode_elems(struct decoder *d, const char *name, u64 off, u32 bit_sz,
+			 u32 count, u16 layout, size_t plen)
+{
+	int array = count != 1;
+	size_t len;
+
+	if (!bit_sz || off >= d->bits)
+		return;
+	if (!count) /* flexible array, runs to the end of the payload */
+		count = (d->bits - off) / bit_sz;
+
+	if (layout == IFC_SCALAR && bit_sz == 8 && array) {
+		/* byte arrays: addresses, GIDs, strings */
+		if (off + 8ull * count > d->bits)
+			count = (d->bits - off) / 8;
+		snprintf(d->path + plen, sizeof(d->path) - plen, "%s%s",
+			 plen && *name ? "." : "", name);
+		print_bytes(d, off, 8 * count);
+		d->path[plen] = '\0';
+		return;
+	}
+
+	for (u32 i = 0; i < count; i++, off += bit_sz) {
+		if (off + (layout == IFC_SCALAR ? bit_sz : 1) > d->bits)
+			break;
+		len = plen;
+		if (!array)
+			len += snprintf(d->path + len, sizeof(d->path) - len, "%s%s",
+					len && *name ? "." : "", name);
+		else
+			len += snprintf(d->path + len, sizeof(d->path) - len, "%s%s[%u]",
+					len && *name ? "." : "", name, i);
+		if (len >= sizeof(d->path))
+			len = sizeof(d->path) - 1;
+
+		if (layout == IFC_SCALAR)
+			print_scalar(d, off, bit_sz);
+		else
+			decode_layout(d, &ifc_layouts[layout], off, len);
+		d->path[plen] = '\0';
+	}
+}
+
+static void decode_layout(struct decoder *d, const struct ifc_layout *l, u64 base,
+			  size_t plen)
+{
+	const struct ifc_field *fld = &ifc_fields[l->first];
+
+	for (int i = 0; i < l->nfields; i++, fld++)
+		decode_elems(d, ifc_str(fld->name), base + fld->bit_off, fld->bit_sz,
+			     fld->count, fld->layout, plen);
+}
+
+void ifc_decode(FILE *f, const struct ifc_layout *l, const void *buf, size_t len)
+{
+	struct decoder d = {
+		.f = f,
+		.buf = buf,
+		.bits = (u64)len * 8,
+	};
+
+	if (json_output)
+		json_obj_begin("fields");
+	decode_layout(&d, l, 0, 0);
+	if (json_output)
+		json_obj_end();
+}
+
+/* ------------------------------------------------------------------ */
+/* --fields */
+
+#define FNV_BASIS 0x811c9dc5u
+#define FNV_PRIME 0x01000193u
+
+/* Same as fnv_hash() in gen_ifc_schema.py */
+static u32 ifc_hash(u32 seed, u32 layout, const char *name, size_t len)
+{
+	u32 h = FNV_BASIS ^ seed;
+
+	h = (h ^ (layout & 0xff)) * FNV_PRIME;
+	h = (h ^ (layout >> 8)) * FNV_PRIME;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (u8)name[i]) * FNV_PRIME;
+	return h;
+}
+
+static const struct ifc_field *field_lookup(const struct ifc_layout *l, const char *name,
+					    size_t len, u32 *bit_off)
+{
+	u32 li = l - ifc_layouts;
+	u32 disp = ifc_hash_disp[ifc_hash(0, li, name, len) % ifc_hash_nbuckets];
+	u32 fi = ifc_hash_slot[ifc_hash(disp, li, name, len) % ifc_hash_nslots];
+	const struct ifc_field *fld;
+
+	if (fi != IFC_NO_FIELD && fi >= l->first && fi < l->first + l->nfields) {
+		fld = &ifc_fields[fi];
+		if (!strncmp(ifc_str(fld->name), name, len) && !ifc_str(fld->name)[len]) {
+			*bit_off += fld->bit_off;
+			return fld;
+		}
+	}
+
+	/* members of anonymous unions are reached as members of l */
+	fld = &ifc_fields[l->first];
+	for (int i = 0; i < l->nfields; i++, fld++) {
+		const struct ifc_field *inner;
+		u32 off = *bit_off + fld->bit_off;
+
+		if (*ifc_str(fld->name) || fld->layout == IFC_SCALAR)
+			continue;
+		inner = field_lookup(&ifc_layouts[fld->layout], name, len, &off);
+		if (inner) {
+			*bit_off = off;
+			return inner;
+		}
+	}
+	return NULL;
+}
+
+struct ifc_sel {
+	char path[IFC_PATH_MAX];
+	u32 bit_off;
+	u32 bit_sz;
+	u32 count;
+	u16 layout;
+};
+
+struct ifc_select {
+	int n;
+	struct ifc_sel sel[];
+};
+
+static int sel_resolve(const struct ifc_layout *l, const char *path, size_t plen,
+		       struct ifc_sel *sel)
+{
+	const char *p = path, *end = path + plen;
+	const struct ifc_field *fld = NULL;
+
+	if (plen >= sizeof(sel->path))
+		return -1;
+	memcpy(sel->path, path, plen);
+	sel->path[plen] = '\0';
+	sel->bit_off = 0;
+
+	while (p < end) {
+		size_t len = strcspn(p, ".[,");
+		unsigned long idx;
+		char *e;
+
+		if (p + len > end)
+			len = end - p;
+		if (!l || !len)
+			return -1;
+		fld = field_lookup(l, p, len, &sel->bit_off);
+		if (!fld)
+			return -1;
+		sel->bit_sz = fld->bit_sz;
+		sel->count = fld->count;
+		sel->layout = fld->layout;
+		p += len;
+
+		if (p < end && *p == '[') {
+			idx = strtoul(p + 1, &e, 0);
+			if (*e != ']' || (fld->count && idx >= fld->count))
+				return -1;
+			sel->bit_off += idx * fld->bit_sz;
+			sel->count = 1;
+			p = e + 1;
+		}
+		l = sel->count == 1 && sel->layout != IFC_SCALAR ?
+			&ifc_layouts[sel->layout] : NULL;
+		if (p < end && *p++ != '.')
+			return -1;
+	}
+	return fld ? 0 : -1;
+}
+
+struct ifc_select *ifc_select_parse(const struct ifc_layout *l, const char *list)
+{
+	struct ifc_select *s;
+	const char *p;
+	int n = 1;
+
+	for (p = list; *p; p++)
+		n += *p == ',';
+	s = calloc(1, sizeof(*s) + n * sizeof(s->sel[0]));
+	if (!s)
+		return NULL;
+
+	for (p = list; *p; ) {
+		size_t len = strcspn(p, ",");
+
+		if (len && sel_resolve(l, p, len, &s->sel[s->n])) {
+			err_msg("no field %.*s in %s\n", (int)len, p, ifc_str(l->name));
+			free(s);
+			return NULL;
+		}
+		s->n += len != 0;
+		p += len + (p[len] == ',');
+	}
+	return s;
+}
+
+void ifc_select_print(FILE *f, const struct ifc_select *s, const void *buf, size_t len)
+{
+	struct decoder d = {
+		.f = f,
+		.buf = buf,
+		.bits = (u64)len * 8,
+	};
+
+	if (json_output)
+		json_obj_begin("fields");
+	for (int i = 0; i < s->n; i++) {
+		const struct ifc_sel *sel = &s->sel[i];
+		size_t plen = strlen(sel->path);
+
+		memcpy(d.path, sel->path, plen + 1);
+		decode_elems(&d, "", sel->bit_off, sel->bit_sz, sel->count, sel->layout, plen);
+	}
+	if (json_output)
+		json_obj_end();
+}
+
+void ifc_select_free(struct ifc_select *sel)
+{
+	free(sel);
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_IFC_SCHEMA_H__
+#define __MLX5CTL_IFC_SCHEMA_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "ifcutil.h"
+
+/*
+ * Field schema of every mlx5_ifc_<name>_bits layout, generated at build time
+ * by scripts/gen_ifc_schema.py into ifc_schema.c. Offsets and widths are in
+ * bits, the same units as the _bits structs. Reserved fields are left out.
+ * Inline unions and structs are layouts of their own named
+ * "<parent>.<member>".
+ */
+
+#define IFC_SCALAR 0xffff /* ifc_field.layout of a plain field */
+#define IFC_UNION 0x1
+#define IFC_NO_FIELD 0xffffffff
+
+struct ifc_field {
+	u32 name;    /* ifc_strtab offset, "" for an anonymous union */
+	u32 bit_off; /* in the enclosing layout */
+	u32 bit_sz;  /* of one element */
+	u16 count;   /* array elements, 1 for a plain field, 0 flexible array */
+	u16 layout;  /* ifc_layouts index of a nested layout or IFC_SCALAR */
+};
+
+struct ifc_layout {
+	u32 name;    /* ifc_strtab offset */
+	u32 bit_sz;
+	u32 first;   /* ifc_fields index */
+	u16 nfields;
+	u16 flags;
+};
+
+extern const char ifc_strtab[];
+extern const struct ifc_field ifc_fields[];
+extern const struct ifc_layout ifc_layouts[]; /* sorted by name */
+extern const unsigned int ifc_nlayouts;
+
+/* Perfect hash of (layout index, field name) to the ifc_fields index */
+extern const u16 ifc_hash_disp[];
+extern const u32 ifc_hash_slot[];
+extern const unsigned int ifc_hash_nbuckets;
+extern const unsigned int ifc_hash_nslots;
+
+static inline const char *ifc_str(u32 off)
+{
+	return ifc_strtab + off;
+}
+
+/* e.g. "cmd_hca_cap", "ptys_reg", "query_qp_out"; NULL if unknown */
+const struct ifc_layout *ifc_layout_find(const char *name);
+
+/* Big endian field of up to 64 bits at bit_off, as MLX5_GET/MLX5_GET64 */
+u64 ifc_get(const void *buf, u32 bit_off, u32 bit_sz);
+
+/*
+ * Print every field of l in buf, one "\t<path>: <value>" line each, in
+ * layout order and without looking at a field twice. Nested fields get
+ * dotted paths, array elements [i]. Unions print each of their members.
+ * Fields past len are left out, a trailing flexible array runs to len.
+ * With --json the fields are a "fields" object of the current record.
+ */
+void ifc_decode(FILE *f, const struct ifc_layout *l, const void *buf, size_t len);
+
+/*
+ * --fields: a comma separated list of field paths of a layout, e.g.
+ * "log_max_qp,qpc.state,gid[1]", resolved once through the perfect hash.
+ * Printing reads just the selected bits, a selected struct or array prints
+ * all it holds as ifc_decode() would.
+ */
+struct ifc_select;
+
+/* NULL with the bad path printed if a field doesn't exist */
+struct ifc_select *ifc_select_parse(const struct ifc_layout *l, const char *list);
+void ifc_select_print(FILE *f, const struct ifc_select *sel, const void *buf, size_t len);
+void ifc_select_free(struct ifc_select *sel);
+
+#endif /* __MLX5CTL_IFC_SCHEMA_H__ */
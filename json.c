@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Streaming JSON writer, see json.h.
+ *
+ * Output is built in a static buffer and written out when the next token
+ * might not fit. The nesting is tracked as a count of items per level for
+ * the commas, there is no tree and nothing to free. Strings are escaped to
+ * plain ASCII, FW strings aren't guaranteed to be UTF-8 so bytes above 0x7e
+ * are \u00xx.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "hexdump.h"
+#include "json.h"
+
+#define JSON_BUF (64 * 1024)
+#define JSON_DEPTH 16
+/* a number or an escaped character with the punctuation around it */
+#define JSON_TOKEN_MAX 32
+
+int json_output;
+
+static struct {
+	char buf[JSON_BUF];
+	size_t len;
+	int depth;
+	u32 items[JSON_DEPTH];
+	u64 nrecs;
+	int open;
+	const char *dev;
+} jw;
+
+void json_set_mode(int mode)
+{
+	json_output = mode;
+}
+
+static void json_finish(void)
+{
+	if (json_output == JSON_ARRAY && (jw.nrecs || jw.open)) {
+		if (jw.len + 4 > JSON_BUF)
+			json_flush();
+		memcpy(jw.buf + jw.len, jw.nrecs ? "\n]\n" : "[]\n", 3);
+		jw.len += 3;
+	}
+	json_flush();
+}
+
+void json_open(void)
+{
+	if (!jw.open)
+		atexit(json_finish);
+	jw.open = 1;
+}
+
+void json_set_dev(const char *dev)
+{
+	jw.dev = dev;
+}
+
+void json_flush(void)
+{
+	if (jw.len)
+		out_write(jw.buf, jw.len);
+	jw.len = 0;
+}
+
+static inline void reserve(size_t n)
+{
+	if (jw.len + n > JSON_BUF)
+		json_flush();
+}
+
+static inline void put(char c)
+{
+	jw.buf[jw.len++] = c;
+}
+
+static void put_raw(const char *s, size_t n)
+{
+	while (n) {
+		size_t len = min(n, JSON_BUF - jw.len);
+
+		if (!len) {
+			json_flush();
+			continue;
+		}
+		memcpy(jw.buf + jw.len, s, len);
+		jw.len += len;
+		s += len;
+		n -= len;
+	}
+}
+
+static void put_string(const char *s, size_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	reserve(1);
+	put('"');
+	for (size_t i = 0; i < n && s[i]; i++) {
+		unsigned char c = s[i];
+
+		reserve(6);
+		if (c == '"' || c == '\\') {
+			put('\\');
+			put(c);
+		} else if (c == '\n') {
+			put('\\');
+			put('n');
+		} else if (c == '\t') {
+			put('\\');
+			put('t');
+		} else if (c < 0x20 || c > 0x7e) {
+			memcpy(jw.buf + jw.len, "\\u00", 4);
+			jw.len += 4;
+			put(hex[c >> 4]);
+			put(hex[c & 0xf]);
+		} else {
+			put(c);
+		}
+	}
+	reserve(1);
+	put('"');
+}
+
+/* The comma before an item and its key */
+static void put_key(const char *key)
+{
+	reserve(1);
+	if (jw.items[jw.depth]++)
+		put(',');
+	if (key) {
+		put_string(key, strlen(key));
+		reserve(1);
+		put(':');
+	}
+}
+
+static void put_u64(u64 v)
+{
+	char tmp[20];
+	int i = sizeof(tmp);
+
+	do {
+		tmp[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	reserve(sizeof(tmp) - i);
+	memcpy(jw.buf + jw.len, tmp + i, sizeof(tmp) - i);
+	jw.len += sizeof(tmp) - i;
+}
+
+static void open_level(char c)
+{
+	reserve(1);
+	put(c);
+	if (jw.depth < JSON_DEPTH - 1)
+		jw.depth++;
+	jw.items[jw.depth] = 0;
+}
+
+static void close_level(char c)
+{
+	reserve(1);
+	put(c);
+	if (jw.depth)
+		jw.depth--;
+}
+
+void json_rec_begin(void)
+{
+	reserve(JSON_TOKEN_MAX);
+	if (json_output == JSON_ARRAY) {
+		put(jw.nrecs ? ',' : '[');
+		put('\n');
+	}
+	jw.nrecs++;
+	jw.depth = 0;
+	jw.items[0] = 0;
+	open_level('{');
+	if (jw.dev)
+		json_str("dev", jw.dev);
+}
+
+void json_rec_end(void)
+{
+	close_level('}');
+	jw.depth = 0;
+	if (json_output == JSON_LINES) {
+		reserve(1);
+		put('\n');
+	}
+}
+
+void json_obj_begin(const char *key)
+{
+	put_key(key);
+	open_level('{');
+}
+
+void json_obj_end(void)
+{
+	close_level('}');
+}
+
+void json_arr_begin(const char *key)
+{
+	put_key(key);
+	open_level('[');
+}
+
+void json_arr_end(void)
+{
+	close_level(']');
+}
+
+void json_uint(const char *key, u64 v)
+{
+	put_key(key);
+	put_u64(v);
+}
+
+void json_int(const char *key, long long v)
+{
+	put_key(key);
+	if (v < 0) {
+		reserve(1);
+		put('-');
+		put_u64(-(u64)v);
+	} else {
+		put_u64(v);
+	}
+}
+
+void json_double(const char *key, double v)
+{
+	char tmp[JSON_TOKEN_MAX];
+	int n;
+
+	put_key(key);
+	if (isfinite(v))
+		n = snprintf(tmp, sizeof(tmp), "%.15g", v);
+	else
+		n = snprintf(tmp, sizeof(tmp), "null");
+	reserve(n);
+	memcpy(jw.buf + jw.len, tmp, n);
+	jw.len += n;
+}
+
+void json_str(const char *key, const char *s)
+{
+	put_key(key);
+	put_string(s, strlen(s));
+}
+
+void json_strn(const char *key, const char *s, size_t n)
+{
+	put_key(key);
+	put_string(s, n);
+}
+
+void json_hex(const char *key, const void *buf, size_t len)
+{
+	const u8 *p = buf;
+
+	put_key(key);
+	reserve(1);
+	put('"');
+	while (len) {
+		size_t n = min(len, (JSON_BUF - jw.len) / 2);
+
+		if (!n) {
+			json_flush();
+			continue;
+		}
+		hex_encode(jw.buf + jw.len, p, n);
+		jw.len += 2 * n;
+		p += n;
+		len -= n;
+	}
+	reserve(1);
+	put('"');
+}
+
+void json_splice(const char *lines, size_t len)
+{
+	const char *end = lines + len;
+
+	while (lines < end) {
+		const char *nl = memchr(lines, '\n', end - lines);
+		size_t n = (nl ? nl : end) - lines;
+
+		if (n) {
+			reserve(2);
+			if (json_output == JSON_ARRAY) {
+				put(jw.nrecs ? ',' : '[');
+				put('\n');
+			}
+			jw.nrecs++;
+			put_raw(lines, n);
+			if (json_output == JSON_LINES) {
+				reserve(1);
+				put('\n');
+			}
+		}
+		lines += n + 1;
+	}
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_JSON_H__
+#define __MLX5CTL_JSON_H__
+
+#include <stddef.h>
+#include "ifcutil.h"
+
+/*
+ * --json / --ndjson output.
+ *
+ * Commands emit records, one JSON object per cap, register sample, object,
+ * counter sample or dump segment. --ndjson prints one record per line,
+ * --json one array of all records. Every record starts with the "dev" it
+ * came from. Payload fields go into a "fields" object keyed by their
+ * mlx5_ifc path (e.g. "qpc.state"), raw payloads into a "data" hex string.
+ * -B/--bin make no difference, the payload is still hex.
+ *
+ * The writer streams into a fixed buffer flushed with write(), it allocates
+ * nothing and never holds more than the buffer, a multi MB "data" goes out
+ * in buffer sized pieces. It isn't thread safe, records are written by the
+ * main thread only.
+ */
+
+enum {
+	JSON_OFF,
+	JSON_ARRAY, /* --json */
+	JSON_LINES, /* --ndjson */
+};
+
+/* The mode is json_output in mlx5ctlu.h, info_msg() goes to stderr with it */
+void json_set_mode(int mode);
+/* This process owns the output: --json brackets are closed at exit */
+void json_open(void);
+/* "dev" of the records that follow */
+void json_set_dev(const char *dev);
+
+void json_rec_begin(void);
+void json_rec_end(void);
+/* Write out what is buffered, for records that must be seen right away */
+void json_flush(void);
+
+/* key is NULL for the elements of an array */
+void json_obj_begin(const char *key);
+void json_obj_end(void);
+void json_arr_begin(const char *key);
+void json_arr_end(void);
+
+void json_uint(const char *key, u64 v);
+void json_int(const char *key, long long v);
+/* null if not finite */
+void json_double(const char *key, double v);
+void json_str(const char *key, const char *s);
+/* At most n bytes of s, up to a NUL, e.g. fixed size FW strings */
+void json_strn(const char *key, const char *s, size_t n);
+/* Lower case hex string of len bytes */
+void json_hex(const char *key, const void *buf, size_t len);
+
+/* Records printed by another mlx5ctl in --ndjson, one per line */
+void json_splice(const char *lines, size_t len);
+
+#endif /* __MLX5CTL_JSON_H__ */
@@ -21,43 +21,80 @@
 
 #include "mlx5ctlu.h"
 #include "ifcutil.h"
+#include "cmdstats.h"
+#include "record.h"
+#include "transport.h"
+#include "capcache.h"
+#include "sched.h"
+#include "json.h"
 
 #include "uapi/fwctl/fwctl.h"
 #include "uapi/fwctl/mlx5.h"
 
-#define DEV_PATH_MAX 256
-#define DEV_NAME_MAX 64
+static const struct mlx5u_transport_ops fwctl_ops;
 
-struct mlx5u_dev {
-	char devname[DEV_NAME_MAX];
+static int read_sysfs_str(int dirfd, const char *file, char *buf, size_t len)
+{
+	ssize_t n;
 	int fd;
-};
 
-struct mlx5ctl_dev {
-	char ctldev[DEV_NAME_MAX];
-	char mdev[DEV_NAME_MAX];
-};
+	fd = openat(dirfd, file, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
 
-static char *realpathat(int dirfd, const char *path, char *resolved_path)
+static void get_netdevs(const char *sysfs_dev, char *buf, size_t len)
 {
-	int curfd;
-	char *ret = NULL;
+	glob_t glob_result;
+	char pattern[PATH_MAX];
+	size_t off = 0;
+	int n;
 
-	curfd = open(".", O_DIRECTORY);
-	if (curfd == -1)
-		return NULL;
-	if (fchdir(dirfd))
-		goto out;
-	ret = realpath(path, resolved_path);
-out:
-	fchdir(curfd);
-	close(curfd);
-	return ret;
+	buf[0] = '\0';
+	n = snprintf(pattern, sizeof(pattern), "%s/net/*", sysfs_dev);
+	if (n < 0 || n >= sizeof(pattern) || glob(pattern, 0, NULL, &glob_result))
+		return;
+
+	for (unsigned int i = 0; i < glob_result.gl_pathc; i++) {
+		const char *name = strrchr(glob_result.gl_pathv[i], '/') + 1;
+
+		n = snprintf(buf + off, len - off, "%s%s", off ? "," : "", name);
+
+		if (n < 0 || off + n >= len)
+			break;
+		off += n;
+	}
+	globfree(&glob_result);
 }
 
-static int check_fwctl(const char *sysfs_path, struct mlx5ctl_dev *dev)
+/* The parent device of a fwctl sysfs entry, as in struct mlx5ctl_dev mdev */
+int mlx5u_sysfs_mdev(const char *sysfs_path, char *mdev, size_t len)
 {
+	char path[PATH_MAX];
 	char tmp[PATH_MAX];
+	int n;
+
+	n = snprintf(path, sizeof(path), "%s/device", sysfs_path);
+	if (n < 0 || n >= sizeof(path) || !realpath(path, tmp))
+		return -1;
+	if (strstr(tmp, "/sys/devices/") != tmp)
+		return -1;
+	n = snprintf(mdev, len, "%s", tmp + strlen("/sys/devices/"));
+	return n < 0 || n >= len ? -1 : 0;
+}
+
+/* Parse a /sys/class/fwctl/fwctlN (or /sys/dev/char/M:m) entry if it is an mlx5 one */
+int mlx5u_sysfs_parse(const char *sysfs_path, struct mlx5ctl_dev *dev)
+{
+	char tmp[PATH_MAX];
+	char path[PATH_MAX];
 	int sysfs_fd;
 	ssize_t ret;
 
@@ -74,28 +111,34 @@ static int check_fwctl(const char *sysfs_path, struct mlx5ctl_dev *dev)
 		ret = -1;
 		goto out_close;
 	}
+	tmp[ret] = '\0';
 	if (!strstr(tmp, "drivers/mlx5_core")) {
 		ret = -1;
 		goto out_close;
 	}
 
-	if (!realpathat(sysfs_fd, "device", tmp)) {
+	/* the class dir itself is a symlink, its target basename is the fwctl name */
+	if (!realpath(sysfs_path, path)) {
 		ret = -1;
 		goto out_close;
 	}
-	if (strstr(tmp, "/sys/devices/") != tmp) {
+	snprintf(dev->ctldev, sizeof(dev->ctldev), "/dev/fwctl/%s", basename(path));
+
+	if (mlx5u_sysfs_mdev(sysfs_path, dev->mdev, sizeof(dev->mdev))) {
 		ret = -1;
 		goto out_close;
 	}
+	snprintf(tmp, sizeof(tmp), "/sys/devices/%s", dev->mdev);
+	snprintf(dev->bdf, sizeof(dev->bdf), "%s", strrchr(tmp, '/') + 1);
+	get_netdevs(tmp, dev->netdevs, sizeof(dev->netdevs));
 
-	/*
-	 * FIXME we should load the dev file to know the char dev major/minor,
-	 * this is just a guess
-	 */
-	snprintf(dev->ctldev, sizeof(dev->ctldev), "/dev/fwctl/%s",
-		 sysfs_path + strlen("/sys/class/fwctl/"));
-	snprintf(dev->mdev, sizeof(dev->mdev), "%s",
-		 tmp + strlen("/sys/devices/"));
+	dev->numa_node = -1;
+	if (!read_sysfs_str(sysfs_fd, "device/numa_node", path, sizeof(path)))
+		dev->numa_node = atoi(path);
+
+	if (read_sysfs_str(sysfs_fd, "dev", path, sizeof(path)) ||
+	    sscanf(path, "%u:%u", &dev->major, &dev->minor) != 2)
+		dev->major = dev->minor = 0;
 
 	ret = 0;
 out_close:
@@ -103,22 +146,25 @@ out_close:
 	return ret;
 }
 
-static struct mlx5ctl_dev *_scan_ctl_devs(int *count)
+/* Walk sysfs for all mlx5 fwctl devices, prefer mlx5u_scan_devs() which is cached */
+struct mlx5ctl_dev *mlx5u_sysfs_scan(int *count)
 {
 	struct mlx5ctl_dev *devs;
 	glob_t glob_result;
 	int ret;
 
+	*count = 0;
 	ret = glob("/sys/class/fwctl/*", GLOB_TILDE, NULL, &glob_result);
+	if (ret == GLOB_NOMATCH)
+		return NULL;
 	if (ret != 0) {
 		err_msg("Error while searching for files: %d\n", ret);
 		return NULL;
 	}
 
-	*count = 0;
 	devs = calloc(glob_result.gl_pathc, sizeof(struct mlx5ctl_dev));
-	for (unsigned int i = 0; i < glob_result.gl_pathc; ++i) {
-		if (check_fwctl(glob_result.gl_pathv[i], &devs[*count]))
+	for (unsigned int i = 0; devs && i < glob_result.gl_pathc; ++i) {
+		if (mlx5u_sysfs_parse(glob_result.gl_pathv[i], &devs[*count]))
 			continue;
 		(*count)++;
 	}
@@ -141,17 +187,43 @@ static int is_a_number(const char *str)
 	return 1;
 }
 
+/*
+ * The index may be stale, make sure the node we opened is the one it
+ * described. fwctl minors are reused, so after a rebind the same
+ * major:minor can be another device: the parent device of the node must
+ * be the one in the index too.
+ */
+static int dev_matches_index(int fd, struct mlx5ctl_dev *desc)
+{
+	char sysfs[64], mdev[DEV_NAME_MAX];
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return 0;
+	if ((desc->major || desc->minor) &&
+	    (major(st.st_rdev) != desc->major || minor(st.st_rdev) != desc->minor))
+		return 0;
+	snprintf(sysfs, sizeof(sysfs), "/sys/dev/char/%u:%u", major(st.st_rdev),
+		 minor(st.st_rdev));
+	if (mlx5u_sysfs_mdev(sysfs, mdev, sizeof(mdev)))
+		return 0;
+	return !strcmp(mdev, desc->mdev);
+}
+
 /*
  * Open a fwctl by name. Name can be
  *  - A number meaning /dev/fwctl/fwctl[XX]
  *  - A fwctl name /dev/fwctl/[fwctlXX]
  *  - A sysfs device name pci0000:00/0000:00:0a.0
+ *  - A PCI name 0000:0a:00.0 or 0a:00.0
+ *  - A netdev name
+ *  - numa:<node>, the first device on that NUMA node
  */
 static int find_dev(const char *str, struct mlx5u_dev *dev)
 {
-	struct mlx5ctl_dev *devs;
-	int count, i;
+	struct mlx5ctl_dev desc;
 
+	dev->mdev[0] = '\0';
 	if (is_a_number(str)) {
 		snprintf(dev->devname, sizeof(dev->devname),
 			 "/dev/fwctl/fwctl%s", str);
@@ -165,54 +237,96 @@ static int find_dev(const char *str, struct mlx5u_dev *dev)
 	if (dev->fd != -1)
 		return 0;
 
-	devs = _scan_ctl_devs(&count);
-	if (devs == NULL)
-		return -1;
-
-	for (i = 0; i < count; i++) {
-		/* FIXME match a short form PCI name too */
-		if (strcmp(devs[i].mdev, str) != 0)
+	for (int retry = 0; retry < 2; retry++) {
+		if (retry)
+			mlx5u_devindex_invalidate();
+		if (mlx5u_devindex_lookup(str, &desc))
 			continue;
 
-		snprintf(dev->devname, sizeof(dev->devname), "%s",
-			 devs[i].ctldev);
+		snprintf(dev->devname, sizeof(dev->devname), "%s", desc.ctldev);
+		snprintf(dev->mdev, sizeof(dev->mdev), "%s", desc.mdev);
 		dev->fd = open(dev->devname, O_RDWR);
-		if (dev->fd != -1) {
-			free(devs);
+		if (dev->fd == -1)
+			continue;
+		if (dev_matches_index(dev->fd, &desc))
 			return 0;
-		}
+		close(dev->fd);
 	}
 
-	free(devs);
 	return -1;
 }
 
 /******************************************************************/
 /* mlx5u API implementation */
 
+struct mlx5ctl_dev *mlx5u_scan_devs(int *count)
+{
+	return mlx5u_devindex_list(count);
+}
+
 int mlx5u_lsdevs(void) {
 	int count;
-	struct mlx5ctl_dev *devs = _scan_ctl_devs(&count);
+	struct mlx5ctl_dev *devs = mlx5u_scan_devs(&count);
 
 	if (devs == NULL)
 		return 0;
 
 	printf("Found %d mlx5ctl devices:\n", count);
 	for (int i = 0; i < count; i++)
-		printf("%s %s\n", devs[i].ctldev, devs[i].mdev);
+		printf("%s %s %s numa %d\n", devs[i].ctldev, devs[i].mdev,
+		       devs[i].netdevs[0] ? devs[i].netdevs : "-", devs[i].numa_node);
 
 	free(devs);
 	return 0;
 }
 
+static const struct mlx5u_transport transports[] = {
+	{ "replay:", mlx5u_replay_transport_open },
+	{ "daemon:", mlx5u_daemon_transport_open },
+	{ "sim:", mlx5u_sim_transport_open },
+};
+
+static void record_dev(struct mlx5u_dev *dev)
+{
+	char names[2 * DEV_NAME_MAX];
+	int len;
+
+	len = snprintf(names, sizeof(names), "%s%c%s", dev->devname, '\0', dev->mdev);
+	mlx5u_record(MLX5U_REC_DEV, NULL, 0, names, len + 1, 0, 0);
+}
+
+static const struct mlx5u_transport *find_transport(const char *name)
+{
+	for (int i = 0; i < sizeof(transports) / sizeof(transports[0]); i++)
+		if (!strncmp(name, transports[i].prefix, strlen(transports[i].prefix)))
+			return &transports[i];
+	return NULL;
+}
+
+int mlx5u_transport_name(const char *name)
+{
+	return find_transport(name) != NULL;
+}
+
 struct mlx5u_dev *mlx5u_open(const char *name)
 {
+	const struct mlx5u_transport *t = find_transport(name);
         struct mlx5u_dev *dev;
 
-	dev = malloc(sizeof(*dev));
+	dev = calloc(1, sizeof(*dev));
 	if (!dev)
 		return NULL;
 
+	if (t) {
+		dev->fd = -1;
+		if (t->open(dev, name + strlen(t->prefix))) {
+			free(dev);
+			return NULL;
+		}
+		dbg_msg(1, "opened %s via %s transport\n", dev->devname, dev->ops->name);
+		return dev;
+	}
+
 	dbg_msg(1, "looking for dev %s\n", name);
 	if (find_dev(name, dev)) {
 		err_msg("device %s not found\n", name);
@@ -220,78 +334,208 @@ struct mlx5u_dev *mlx5u_open(const char *name)
 		free(dev);
 		return NULL;
 	}
+	dev->ops = &fwctl_ops;
 	dbg_msg(1, "opened %s descriptor fd(%d)\n", dev->devname, dev->fd);
+	if (mlx5u_recording())
+		record_dev(dev);
 	return dev;
 }
 
+/* Open every mlx5 fwctl device in the system, used by the daemon */
+struct mlx5u_dev **mlx5u_open_all(int *count)
+{
+	struct mlx5u_dev **devs;
+	struct mlx5ctl_dev *ctl;
+	int nctl;
+
+	*count = 0;
+	ctl = mlx5u_scan_devs(&nctl);
+	if (!ctl)
+		return NULL;
+
+	devs = calloc(nctl, sizeof(*devs));
+	if (!devs) {
+		free(ctl);
+		return NULL;
+	}
+
+	for (int i = 0; i < nctl; i++) {
+		struct mlx5u_dev *dev = calloc(1, sizeof(*dev));
+
+		if (!dev)
+			break;
+		snprintf(dev->devname, sizeof(dev->devname), "%s", ctl[i].ctldev);
+		snprintf(dev->mdev, sizeof(dev->mdev), "%s", ctl[i].mdev);
+		dev->ops = &fwctl_ops;
+		dev->fd = open(dev->devname, O_RDWR);
+		if (dev->fd == -1) {
+			err_msg("failed to open %s: %s\n", dev->devname, strerror(errno));
+			free(dev);
+			continue;
+		}
+		dbg_msg(1, "opened %s descriptor fd(%d)\n", dev->devname, dev->fd);
+		if (mlx5u_recording())
+			record_dev(dev);
+		devs[(*count)++] = dev;
+	}
+
+	free(ctl);
+	if (*count == 0) {
+		free(devs);
+		return NULL;
+	}
+	return devs;
+}
+
+/* Check if name refers to dev, accepts the same forms as mlx5u_open() */
+int mlx5u_dev_match(struct mlx5u_dev *dev, const char *name)
+{
+	char tmp[DEV_NAME_MAX];
+
+	if (is_a_number(name)) {
+		snprintf(tmp, sizeof(tmp), "/dev/fwctl/fwctl%s", name);
+		if (!strcmp(dev->devname, tmp))
+			return 1;
+	}
+
+	snprintf(tmp, sizeof(tmp), "/dev/fwctl/%s", name);
+	if (!strcmp(dev->devname, tmp) || !strcmp(dev->devname, name))
+		return 1;
+
+	return dev->mdev[0] && !strcmp(dev->mdev, name);
+}
+
+const char *mlx5u_devname(struct mlx5u_dev *dev)
+{
+	return dev->devname;
+}
+
 void mlx5u_close(struct mlx5u_dev *dev)
 {
 	dbg_msg(1, "closing %s descriptor fd(%d)\n", dev->devname, dev->fd);
-	close(dev->fd);
+	mlx5u_capcache_free(dev);
+	mlx5u_sched_free(dev);
+	if (!dev->base)
+		dev->ops->close(dev);
+	free(dev->mbox.in);
+	free(dev->mbox.out);
 	free(dev);
 }
 
+int mlx5u_transport_info(struct mlx5u_dev *dev, struct mlx5u_dev_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->desc.numa_node = -1;
+	return dev->ops->info(dev, info);
+}
+
+static void devinfo_json(struct mlx5u_dev *dev, struct mlx5u_dev_info *info)
+{
+	char netdevs[DEV_NAME_MAX];
+	char *save = NULL;
+
+	json_rec_begin();
+	json_str("ctldev", dev->devname);
+	if (dev->ops != &fwctl_ops) {
+		json_str("transport", dev->ops->name);
+		if (info->desc.ctldev[0])
+			json_str("backing_ctldev", info->desc.ctldev);
+	}
+	json_str("parent_dev", info->desc.mdev[0] ? info->desc.mdev : dev->mdev);
+	json_arr_begin("netdevs");
+	snprintf(netdevs, sizeof(netdevs), "%s", info->desc.netdevs);
+	for (char *tok = strtok_r(netdevs, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save))
+		json_str(NULL, tok);
+	json_arr_end();
+	json_int("numa_node", info->desc.numa_node);
+	json_uint("uctx_uid", info->uid);
+	json_uint("uctx_caps", info->uctx_caps);
+	json_int("pid", getpid());
+	json_int("fd", dev->fd);
+	json_rec_end();
+}
+
 int mlx5u_devinfo(struct mlx5u_dev *dev)
 {
-	struct fwctl_info_mlx5 info_mlx5 = {};
-	struct fwctl_info info = {
-		.size = sizeof(info),
-		.device_data_len = sizeof(info_mlx5),
-		.out_device_data = (uintptr_t)&info_mlx5,
-	};
-	struct mlx5ctl_dev dev_desc = {};
-	char sysfs_dev[PATH_MAX];
-	int fd = dev->fd;
-	struct stat st;
+	struct mlx5u_dev_info info;
 	int ret;
 
-	ret = ioctl(fd, FWCTL_INFO, &info);
+	ret = mlx5u_transport_info(dev, &info);
+	if (mlx5u_recording()) {
+		struct fwctl_info_mlx5 info_mlx5 = {
+			.uid = info.uid,
+			.uctx_caps = info.uctx_caps,
+		};
+
+		mlx5u_record(MLX5U_REC_INFO, NULL, 0, &info_mlx5, sizeof(info_mlx5),
+			     ret ? errno : 0, 0);
+	}
 	if (ret) {
-		err_msg("ioctl failed: %d errno(%d): %s\n", ret, errno,
+		err_msg("failed to get device info: errno(%d): %s\n", errno,
 			strerror(errno));
 		return ret;
 	}
 
-	if (info.out_device_type != FWCTL_DEVICE_TYPE_MLX5) {
-		err_msg("Not a MLX5 device");
-		return -1;
-	}
-
-	if (fstat(fd, &st)) {
-		return -1;
-	}
-
-	snprintf(sysfs_dev, sizeof(sysfs_dev), "/sys/dev/char/%u:%u",
-		 major(st.st_rdev), minor(st.st_rdev));
-	if (check_fwctl(sysfs_dev, &dev_desc)) {
-		err_msg("Problem parsing sysfs");
-		return -1;
+	if (json_output) {
+		devinfo_json(dev, &info);
+		return 0;
 	}
 
 	printf("ctldev: %s\n", dev->devname);
-	printf("Parent dev: %s\n", dev_desc.mdev);
-	printf("UCTX UID: %d\n", info_mlx5.uid);
-	printf("UCTX CAP: 0x%x\n", info_mlx5.uctx_caps);
+	if (dev->ops != &fwctl_ops) {
+		printf("Transport: %s\n", dev->ops->name);
+		if (info.desc.ctldev[0])
+			printf("Backing ctldev: %s\n", info.desc.ctldev);
+	}
+	printf("Parent dev: %s\n", info.desc.mdev[0] ? info.desc.mdev : dev->mdev);
+	printf("Netdevs: %s\n", info.desc.netdevs[0] ? info.desc.netdevs : "-");
+	printf("NUMA node: %d\n", info.desc.numa_node);
+	printf("UCTX UID: %d\n", info.uid);
+	printf("UCTX CAP: 0x%x\n", info.uctx_caps);
 /*	printf("DEV UCTX CAP: 0x%x\n", info.dev_uctx_cap);
 	printf("USER CAP: 0x%x\n", info.ucap);
 */
-	printf("Current PID: %d FD %d\n", getpid(), fd);
+	printf("Current PID: %d FD %d\n", getpid(), dev->fd);
 	return 0;
 }
 
+int mlx5u_transport_cmd(struct mlx5u_dev *dev, void *in, size_t inlen,
+			void *out, size_t outlen)
+{
+	int sched = dev->ops->scheduled && mlx5u_sched_enabled();
+	int timed = mlx5u_stats_enabled() || mlx5u_recording();
+	u64 start = 0, lat = 0;
+	int ret, err;
+
+	/* back-pressure: EBUSY before anything reached the FW */
+	if (sched && mlx5u_sched_acquire(dev))
+		return -1;
+
+	if (timed)
+		start = mlx5u_stats_now_ns();
+
+	ret = dev->ops->cmd(dev, in, inlen, out, outlen, &lat);
+	err = ret ? errno : 0;
+	if (sched)
+		mlx5u_sched_release(dev);
+
+	if (timed && !lat)
+		lat = mlx5u_stats_now_ns() - start;
+	if (mlx5u_recording())
+		mlx5u_record(MLX5U_REC_RPC, in, inlen, out, outlen, err, lat);
+	if (mlx5u_stats_enabled())
+		mlx5u_stats_account(in, inlen, out, outlen, ret, lat);
+
+	errno = err;
+	return ret;
+}
+
 int mlx5u_cmd(struct mlx5u_dev *dev, void *in, size_t inlen, void *out, size_t outlen)
 {
-	struct fwctl_rpc rpc = {
-		.size = sizeof(rpc),
-		.in = (uintptr_t)in,
-		.in_len = inlen,
-		.out = (uintptr_t)out,
-		.out_len = outlen,
-	};
 	int ret;
 
-
-	ret = ioctl(dev->fd, FWCTL_RPC, &rpc);
+	ret = mlx5u_transport_cmd(dev, in, inlen, out, outlen);
 	if (ret) {
 		err_msg("MLX5CTL_IOCTL_CMDRPC failed: %d errno(%d): %s\n", ret, errno, strerror(errno));
 		return ret;
@@ -308,8 +552,117 @@ int mlx5u_cmd(struct mlx5u_dev *dev, void *in, size_t inlen, void *out, size_t o
 	return ret;
 }
 
-#if 0
+#define MBOX_MIN_SIZE 256
+
+static int mbox_grow(void **buf, size_t *cap, size_t len)
+{
+	size_t new_cap = *cap ? *cap : MBOX_MIN_SIZE;
+	void *p;
+
+	if (len <= *cap)
+		return 0;
+	while (new_cap < len)
+		new_cap *= 2;
+	p = realloc(*buf, new_cap);
+	if (!p)
+		return -ENOMEM;
+	*buf = p;
+	*cap = new_cap;
+	return 0;
+}
+
+void *mlx5u_mbox_get(struct mlx5u_dev *dev, size_t inlen, size_t outlen, void **out)
+{
+	struct mlx5u_mbox *mbox = &dev->mbox;
+
+	if (mbox_grow(&mbox->in, &mbox->in_cap, inlen) ||
+	    mbox_grow(&mbox->out, &mbox->out_cap, outlen)) {
+		err_msg("Failed to allocate command mailbox in %zu out %zu\n", inlen, outlen);
+		return NULL;
+	}
+	mbox->inlen = inlen;
+	mbox->outlen = outlen;
+	memset(mbox->in, 0, inlen);
+	memset(mbox->out, 0, outlen);
+	*out = mbox->out;
+	return mbox->in;
+}
+
+int mlx5u_mbox_exec(struct mlx5u_dev *dev)
+{
+	struct mlx5u_mbox *mbox = &dev->mbox;
+
+	return mlx5u_cmd(dev, mbox->in, mbox->inlen, mbox->out, mbox->outlen);
+}
+
 int mlx5u_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
+{
+	return dev->ops->umem_reg(dev, addr, len);
+}
+
+int mlx5u_umem_unreg(struct mlx5u_dev *dev, __uint32_t umem_id)
+{
+	return dev->ops->umem_unreg(dev, umem_id);
+}
+
+/******************************************************************/
+/* fwctl ioctl transport */
+
+static int fwctl_cmd(struct mlx5u_dev *dev, void *in, size_t inlen, void *out,
+		     size_t outlen, u64 *lat_ns)
+{
+	struct fwctl_rpc rpc = {
+		.size = sizeof(rpc),
+		.in = (uintptr_t)in,
+		.in_len = inlen,
+		.out = (uintptr_t)out,
+		.out_len = outlen,
+	};
+
+	return ioctl(dev->fd, FWCTL_RPC, &rpc);
+}
+
+static int fwctl_info(struct mlx5u_dev *dev, struct mlx5u_dev_info *dev_info)
+{
+	struct fwctl_info_mlx5 info_mlx5 = {};
+	struct fwctl_info info = {
+		.size = sizeof(info),
+		.device_data_len = sizeof(info_mlx5),
+		.out_device_data = (uintptr_t)&info_mlx5,
+	};
+	char sysfs_dev[PATH_MAX];
+	int fd = dev->fd;
+	struct stat st;
+	int ret;
+
+	ret = ioctl(fd, FWCTL_INFO, &info);
+	if (ret)
+		return ret;
+
+	if (info.out_device_type != FWCTL_DEVICE_TYPE_MLX5) {
+		err_msg("Not a MLX5 device");
+		errno = ENODEV;
+		return -1;
+	}
+	dev_info->uid = info_mlx5.uid;
+	dev_info->uctx_caps = info_mlx5.uctx_caps;
+
+	if (fstat(fd, &st)) {
+		return -1;
+	}
+
+	snprintf(sysfs_dev, sizeof(sysfs_dev), "/sys/dev/char/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+	if (mlx5u_sysfs_parse(sysfs_dev, &dev_info->desc)) {
+		err_msg("Problem parsing sysfs");
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+#if 0
+static int fwctl_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
 {
 	struct mlx5ctl_umem_reg umem = {};
 	int fd = dev->fd;
@@ -327,7 +680,7 @@ int mlx5u_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
 	return umem.umem_id;
 }
 
-int mlx5u_umem_unreg(struct mlx5u_dev *dev, __uint32_t umem_id)
+static int fwctl_umem_unreg(struct mlx5u_dev *dev, u32 umem_id)
 {
 	struct mlx5ctl_umem_unreg umem = {};
 	int fd = dev->fd;
@@ -343,12 +696,35 @@ int mlx5u_umem_unreg(struct mlx5u_dev *dev, __uint32_t umem_id)
 	return 0;
 }
 #else
-int mlx5u_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
+static int fwctl_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
 {
 	return -1;
 }
-int mlx5u_umem_unreg(struct mlx5u_dev *dev, __uint32_t umem_id)
+static int fwctl_umem_unreg(struct mlx5u_dev *dev, u32 umem_id)
 {
 	return -1;
 }
 #endif
+
+static void fwctl_close(struct mlx5u_dev *dev)
+{
+	close(dev->fd);
+}
+
+/* Every open of the node is a FW context of its own */
+static int fwctl_dup(struct mlx5u_dev *dev, struct mlx5u_dev *ctx)
+{
+	ctx->fd = open(dev->devname, O_RDWR);
+	return ctx->fd == -1 ? -1 : 0;
+}
+
+static const struct mlx5u_transport_ops fwctl_ops = {
+	.name = "fwctl",
+	.scheduled = 1,
+	.cmd = fwctl_cmd,
+	.info = fwctl_info,
+	.umem_reg = fwctl_umem_reg,
+	.umem_unreg = fwctl_umem_unreg,
+	.close = fwctl_close,
+	.dup = fwctl_dup,
+};
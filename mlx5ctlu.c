@@ -10,7 +10,14 @@
 
 #include <stdio.h>
 #include <glob.h>
+#include <libgen.h>
 #include "mlx5ctlu.h"
+#include "cmdstats.h"
+#include "record.h"
+#include "capcache.h"
+#include "sched.h"
+#include "hexdump.h"
+#include "json.h"
 
 // Define the global verbosity level
 int verbosity_level = 0;
@@ -49,10 +56,27 @@ int cmd_select(struct mlx5u_dev *dev, const cmd *cmds, int argc, char **argv)
 	return -1;
 }
 
+int mlx5ctl_exec(struct mlx5u_dev *dev, int argc, char **argv)
+{
+	json_set_dev(mlx5u_devname(dev));
+	return cmd_select(dev, commands, argc, argv);
+}
+
 static int do_help(struct mlx5u_dev *dev, int argc, char *argv[])
 {
 	fprintf(stdout, "Usage: %s <mlx5 pci device> <command> [options]\n", help_cmd);
 	fprintf(stdout, "Verbosity: %s -v <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "All devices in parallel: %s <all|glob|dev1,dev2,..> <command> [options]\n", help_cmd);
+	fprintf(stdout, "FW command statistics: %s --stats <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "Rate limit FW commands: %s --sched=rate=<rps>[,burst=<n>][,inflight=<n>][,max_wait=<ms>] <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "Keep device caps in a cache file: %s --capcache <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "Hex dumps with byte offsets, zero lines collapsed: %s [--hex-offset] [--hex-squeeze] <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "JSON records, one array or one per line: %s --json|--ndjson <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "Record FW commands: %s --record=<file> <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "Replay recorded FW commands: %s replay:<file> <command> [options]\n", help_cmd);
+	fprintf(stdout, "FW simulator: %s sim:[lat=<us>,err=<%%>,rsc_size=<bytes>,..] <command> [options]\n", help_cmd);
+	fprintf(stdout, "Via daemon: %s --socket[=<path>] <mlx5 pci device> <command> [options]\n", help_cmd);
+	fprintf(stdout, "Daemon: %s daemon [--socket=<path>]\n", help_cmd);
 	fprintf(stdout, "Commands:\n");
 	for (const cmd *cmd = commands; cmd->name; cmd++)
 		fprintf(stdout, "\t%s: %s\n", cmd->name, cmd->desc);
@@ -80,28 +104,97 @@ static int do_sleep(struct mlx5u_dev *dev, int argc, char *argv[])
 	return 0;
 }
 
+static void stats_dump_atexit(void)
+{
+	fflush(stdout);
+	mlx5u_stats_dump(stderr);
+	mlx5u_sched_dump(stderr);
+}
+
+/* --stats: commands may exit() on their own, dump from an exit handler */
+void mlx5ctl_stats_on_exit(void)
+{
+	mlx5u_stats_enable(1);
+	atexit(stats_dump_atexit);
+}
+
 int main(int argc, char *argv[])
 {
+	const char *sock_path = NULL;
+	const char *record = NULL;
 	struct mlx5u_dev *dev;
 	int ret;
 
 	help_cmd = argv[0];
+	/* in the environment so mlx5ctld and everything it forks pick it up */
+	if (getenv("MLX5CTL_SCHED") && mlx5u_sched_config(getenv("MLX5CTL_SCHED")))
+		return 1;
+	if (!strcmp(basename(argv[0]), "mlx5ctld"))
+		return mlx5ctld_main(argc, argv);
+
 	if (argc < 2 || !strcmp(argv[1], "-h") ||
 	    !strcmp(argv[1], "--help") || !strcmp(argv[1], "help"))
 		return do_help(NULL, argc, argv);
 
-	if (!strcmp(argv[1], "-v")) {
-		verbosity_level = 1;
-		argc -= 1;
-		argv += 1;
+	if (!strcmp(argv[1], "daemon"))
+		return mlx5ctld_main(argc - 1, argv + 1);
+
+	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+		if (!strcmp(argv[1], "-v")) {
+			verbosity_level = 1;
+		} else if (!strcmp(argv[1], "--stats")) {
+			mlx5ctl_stats_on_exit();
+		} else if (!strncmp(argv[1], "--sched=", 8)) {
+			if (mlx5u_sched_config(argv[1] + 8))
+				return 1;
+		} else if (!strcmp(argv[1], "--capcache")) {
+			mlx5u_capcache_persist(1);
+		} else if (!strcmp(argv[1], "--hex-offset")) {
+			hexdump_set_flags(hexdump_get_flags() | HEXDUMP_OFFSET);
+		} else if (!strcmp(argv[1], "--hex-squeeze")) {
+			hexdump_set_flags(hexdump_get_flags() | HEXDUMP_SQUEEZE);
+		} else if (!strcmp(argv[1], "--json")) {
+			json_set_mode(JSON_ARRAY);
+		} else if (!strcmp(argv[1], "--ndjson")) {
+			json_set_mode(JSON_LINES);
+		} else if (!strcmp(argv[1], "--socket")) {
+			sock_path = getenv("MLX5CTL_SOCKET") ?: MLX5CTLD_SOCKET;
+		} else if (!strncmp(argv[1], "--socket=", 9)) {
+			sock_path = argv[1] + 9;
+		} else if (!strncmp(argv[1], "--record=", 9)) {
+			record = argv[1] + 9;
+		} else {
+			err_msg("Unknown option %s\n", argv[1]);
+			do_help(NULL, argc, argv);
+			return 1;
+		}
 	}
 
+	if (argc < 2)
+		return do_help(NULL, argc, argv);
+
+	if (sock_path && record) {
+		err_msg("--record is not supported with --socket, FW commands run in the daemon\n");
+		return 1;
+	}
+	if (record && mlx5u_record_open(record))
+		return 1;
+
+	if (sock_path)
+		return mlx5ctld_exec(sock_path, argc - 1, argv + 1);
+
+	/* the daemon's worker writes the records with --socket */
+	if (json_output)
+		json_open();
+	if (mlx5ctl_is_multi_dev(argv[1]))
+		return mlx5ctl_exec_multi(argv[1], argc - 2, argv + 2);
+
 	dev = mlx5u_open(argv[1]);
 	if (!dev) {
 		err_msg("Failed to open device %s\n", argv[1]);
 		return 1;
 	}
-	ret = cmd_select(dev, commands, argc - 2, argv + 2);
+	ret = mlx5ctl_exec(dev, argc - 2, argv + 2);
 	mlx5u_close(dev);
 	return (ret > 0 ? ret : -ret);
 }
@@ -9,15 +9,18 @@
 #define err_msg(fmt, ...) \
 	fprintf(stderr, "Error : " fmt, ##__VA_ARGS__)
 
+/* --json/--ndjson, see json.h: stdout carries JSON records only */
+extern int json_output;
+
 #define info_msg(fmt, ...) \
-	fprintf(stdout, "INFO : " fmt,  ##__VA_ARGS__)
+	fprintf(json_output ? stderr : stdout, "INFO : " fmt,  ##__VA_ARGS__)
 
 extern int verbosity_level;
 
 #define dbg_msg(verbosity, fmt, ...) \
 	do { \
 		if (verbosity <= verbosity_level) { \
-			fprintf(stdout, "[DEBUG] (%s:%d %s) "fmt , __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
+			fprintf(json_output ? stderr : stdout, "[DEBUG] (%s:%d %s) "fmt , __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
 		} \
 	} while (0)
 
@@ -27,6 +30,18 @@ extern int verbosity_level;
 #define fallthrough
 #endif
 
+#define DEV_NAME_MAX 128
+
+/* an mlx5 fwctl device as found in sysfs */
+struct mlx5ctl_dev {
+	char ctldev[DEV_NAME_MAX];  /* /dev/fwctl/fwctlN */
+	char mdev[DEV_NAME_MAX];    /* parent device sysfs path */
+	char bdf[16];               /* 0000:08:00.0 */
+	char netdevs[DEV_NAME_MAX]; /* comma separated, may be empty */
+	int numa_node;
+	unsigned int major, minor;  /* of the fwctl char device */
+};
+
 struct mlx5u_dev;
 typedef struct cmd {
 	const char *name;
@@ -35,14 +50,50 @@ typedef struct cmd {
 } cmd;
 
 struct mlx5u_dev *mlx5u_open(const char *devname);
+struct mlx5u_dev **mlx5u_open_all(int *count);
 void mlx5u_close(struct mlx5u_dev *dev);
+int mlx5u_dev_match(struct mlx5u_dev *dev, const char *name);
+const char *mlx5u_devname(struct mlx5u_dev *dev);
 int mlx5u_devinfo(struct mlx5u_dev *dev);
 int mlx5u_lsdevs(void);
+struct mlx5ctl_dev *mlx5u_scan_devs(int *count);
+
+/* sysfs walk and the cached device index on top of it, see devindex.c */
+int mlx5u_sysfs_parse(const char *sysfs_path, struct mlx5ctl_dev *dev);
+int mlx5u_sysfs_mdev(const char *sysfs_path, char *mdev, size_t len);
+struct mlx5ctl_dev *mlx5u_sysfs_scan(int *count);
+int mlx5u_devindex_lookup(const char *name, struct mlx5ctl_dev *dev);
+struct mlx5ctl_dev *mlx5u_devindex_list(int *count);
+void mlx5u_devindex_invalidate(void);
+/* runtime dir for the device index and other per boot caches */
+const char *mlx5u_cache_dir(void);
 
 int mlx5u_cmd(struct mlx5u_dev *dev, void *in, size_t inlen, void *out, size_t outlen);
+/*
+ * Per device mailbox arena for the synchronous command path: get returns the
+ * zeroed inbox (out gets the outbox), build the command in place and exec it.
+ * Buffers only grow, so a steady polling loop does no allocations. Valid until
+ * the next get on the device, not for commands in flight on other threads.
+ */
+void *mlx5u_mbox_get(struct mlx5u_dev *dev, size_t inlen, size_t outlen, void **out);
+int mlx5u_mbox_exec(struct mlx5u_dev *dev);
 int mlx5u_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len);
 int mlx5u_umem_unreg(struct mlx5u_dev *dev, __uint32_t umem_id);
 int cmd_select(struct mlx5u_dev *dev, const cmd *cmds, int argc, char **argv);
+int mlx5ctl_exec(struct mlx5u_dev *dev, int argc, char **argv);
+void mlx5ctl_stats_on_exit(void);
+
+/* run a command on several devices in parallel, see multidev.c */
+int mlx5ctl_is_multi_dev(const char *selector);
+int mlx5ctl_exec_multi(const char *selector, int argc, char *argv[]);
+int mlx5ctl_exec_multi_open(const char *selector, int argc, char *argv[],
+			    struct mlx5u_dev *(*open_dev)(const char *name));
+
+/* mlx5ctld: persistent daemon serving commands over a unix socket */
+#define MLX5CTLD_SOCKET "/run/mlx5ctld.sock"
+
+int mlx5ctld_main(int argc, char *argv[]);
+int mlx5ctld_exec(const char *sock_path, int argc, char *argv[]);
 
 int do_devcap(struct mlx5u_dev *dev, int argc, char *argv[]);
 int do_reg(struct mlx5u_dev *dev, int argc, char *argv[]);
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Fan a command out to several devices at once:
+ *   mlx5ctl all cap -P
+ *   mlx5ctl 'fwctl[0-3]' reg --id=PTYS
+ *   mlx5ctl fwctl0,0000:08:00.1 diagcnt cap
+ *   mlx5ctl 'eth*',numa:1 info
+ *
+ * Every device gets its own worker whose stdout and stderr are collected
+ * into separate buffers, output is emitted in device scan order once all
+ * workers are done, so it doesn't depend on which device answered first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <libgen.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mlx5ctlu.h"
+#include "transport.h"
+#include "json.h"
+
+struct dev_worker {
+	struct mlx5ctl_dev desc;
+	pid_t pid;
+	int out_fd;
+	int err_fd;
+	char *out;
+	size_t out_len;
+	char *err;
+	size_t err_len;
+	int status;
+};
+
+int mlx5ctl_is_multi_dev(const char *selector)
+{
+	/* transport options are comma separated too */
+	if (mlx5u_transport_name(selector))
+		return 0;
+	return !strcmp(selector, "all") || strpbrk(selector, "*?[,") != NULL;
+}
+
+static int match_netdev(const char *pattern, struct mlx5ctl_dev *desc)
+{
+	char netdevs[DEV_NAME_MAX];
+	char *save = NULL;
+
+	snprintf(netdevs, sizeof(netdevs), "%s", desc->netdevs);
+	for (char *tok = strtok_r(netdevs, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save))
+		if (!fnmatch(pattern, tok, 0))
+			return 1;
+	return 0;
+}
+
+static int match_one(const char *pattern, struct mlx5ctl_dev *desc)
+{
+	char ctldev[DEV_NAME_MAX], mdev[DEV_NAME_MAX];
+	char num[DEV_NAME_MAX + 8];
+	char *end;
+
+	if (!strcmp(pattern, "all"))
+		return 1;
+	if (!strncmp(pattern, "numa:", 5)) {
+		long node = strtol(pattern + 5, &end, 10);
+
+		return !*end && end != pattern + 5 && desc->numa_node == node;
+	}
+
+	snprintf(ctldev, sizeof(ctldev), "%s", desc->ctldev);
+	snprintf(mdev, sizeof(mdev), "%s", desc->mdev);
+	snprintf(num, sizeof(num), "fwctl%s", pattern);
+
+	return !fnmatch(pattern, desc->ctldev, 0) ||
+	       !fnmatch(pattern, basename(ctldev), 0) ||
+	       !fnmatch(num, basename(ctldev), 0) ||
+	       !fnmatch(pattern, desc->mdev, 0) ||
+	       !fnmatch(pattern, basename(mdev), 0) ||
+	       (strlen(desc->bdf) > 5 && !fnmatch(pattern, desc->bdf + 5, 0)) ||
+	       match_netdev(pattern, desc);
+}
+
+static int match_selector(const char *selector, struct mlx5ctl_dev *desc)
+{
+	char *sel = strdup(selector);
+	char *save = NULL;
+	int match = 0;
+
+	if (!sel)
+		return 0;
+	for (char *tok = strtok_r(sel, ",", &save); tok && !match;
+	     tok = strtok_r(NULL, ",", &save))
+		match = match_one(tok, desc);
+	free(sel);
+	return match;
+}
+
+static void run_worker(struct dev_worker *w, int out_pipe[2], int err_pipe[2],
+		       int argc, char *argv[],
+		       struct mlx5u_dev *(*open_dev)(const char *name))
+{
+	struct mlx5u_dev *dev;
+	int ret;
+
+	close(out_pipe[0]);
+	close(err_pipe[0]);
+	if (dup2(out_pipe[1], STDOUT_FILENO) < 0 || dup2(err_pipe[1], STDERR_FILENO) < 0)
+		_exit(1);
+	close(out_pipe[1]);
+	close(err_pipe[1]);
+	/* the parent puts the records of all devices into one array */
+	if (json_output == JSON_ARRAY)
+		json_set_mode(JSON_LINES);
+
+	dev = open_dev(w->desc.ctldev);
+	if (!dev) {
+		err_msg("Failed to open device %s\n", w->desc.ctldev);
+		exit(1);
+	}
+	ret = mlx5ctl_exec(dev, argc, argv);
+	exit(ret > 0 ? ret : -ret);
+}
+
+static int append(char **buf, size_t *len, int fd)
+{
+	char tmp[16 * 1024];
+	ssize_t n;
+	char *nbuf;
+
+	n = read(fd, tmp, sizeof(tmp));
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN ? 1 : -1;
+	if (n == 0)
+		return 0;
+
+	nbuf = realloc(*buf, *len + n);
+	if (!nbuf)
+		return -1;
+	memcpy(nbuf + *len, tmp, n);
+	*buf = nbuf;
+	*len += n;
+	return 1;
+}
+
+/* Drain all worker pipes until every worker closed both of its ends */
+static void collect(struct dev_worker *workers, int n)
+{
+	struct pollfd *pfds = calloc(2 * n, sizeof(*pfds));
+	int open_fds = 0;
+
+	if (!pfds)
+		return;
+
+	for (int i = 0; i < n; i++) {
+		pfds[2 * i].fd = workers[i].out_fd;
+		pfds[2 * i + 1].fd = workers[i].err_fd;
+		pfds[2 * i].events = pfds[2 * i + 1].events = POLLIN;
+		open_fds += (workers[i].out_fd >= 0) + (workers[i].err_fd >= 0);
+	}
+
+	while (open_fds > 0) {
+		if (poll(pfds, 2 * n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < 2 * n; i++) {
+			struct dev_worker *w = &workers[i / 2];
+			int ret;
+
+			if (pfds[i].fd < 0 || !pfds[i].revents)
+				continue;
+			if (i % 2)
+				ret = append(&w->err, &w->err_len, pfds[i].fd);
+			else
+				ret = append(&w->out, &w->out_len, pfds[i].fd);
+			if (ret <= 0) {
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				open_fds--;
+			}
+		}
+	}
+	free(pfds);
+}
+
+static struct mlx5u_dev *default_open(const char *name)
+{
+	return mlx5u_open(name);
+}
+
+int mlx5ctl_exec_multi_open(const char *selector, int argc, char *argv[],
+			    struct mlx5u_dev *(*open_dev)(const char *name))
+{
+	struct dev_worker *workers;
+	struct mlx5ctl_dev *descs;
+	int ndescs, n = 0;
+	int ret = 0;
+
+	descs = mlx5u_scan_devs(&ndescs);
+	if (!descs) {
+		err_msg("no mlx5 fwctl devices found\n");
+		return 1;
+	}
+
+	workers = calloc(ndescs, sizeof(*workers));
+	if (!workers) {
+		free(descs);
+		return 1;
+	}
+
+	fflush(NULL);
+	for (int i = 0; i < ndescs; i++) {
+		struct dev_worker *w = &workers[n];
+		int out_pipe[2], err_pipe[2];
+
+		if (!match_selector(selector, &descs[i]))
+			continue;
+
+		w->desc = descs[i];
+		w->out_fd = w->err_fd = -1;
+		if (pipe(out_pipe)) {
+			err_msg("pipe failed: %s\n", strerror(errno));
+			break;
+		}
+		if (pipe(err_pipe)) {
+			err_msg("pipe failed: %s\n", strerror(errno));
+			close(out_pipe[0]);
+			close(out_pipe[1]);
+			break;
+		}
+
+		w->pid = fork();
+		if (w->pid == 0) {
+			/* don't hold on to the read ends of earlier workers */
+			for (int j = 0; j < n; j++) {
+				close(workers[j].out_fd);
+				close(workers[j].err_fd);
+			}
+			run_worker(w, out_pipe, err_pipe, argc, argv, open_dev);
+		}
+		close(out_pipe[1]);
+		close(err_pipe[1]);
+		if (w->pid < 0) {
+			err_msg("fork failed: %s\n", strerror(errno));
+			close(out_pipe[0]);
+			close(err_pipe[0]);
+			break;
+		}
+		w->out_fd = out_pipe[0];
+		w->err_fd = err_pipe[0];
+		n++;
+	}
+
+	if (!n && ndescs)
+		err_msg("no device matches \"%s\"\n", selector);
+
+	collect(workers, n);
+
+	for (int i = 0; i < n; i++) {
+		struct dev_worker *w = &workers[i];
+		int wstatus;
+
+		while (waitpid(w->pid, &wstatus, 0) < 0 && errno == EINTR)
+			;
+		w->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+
+		if (json_output) {
+			/* records carry their "dev", no headers */
+			json_splice(w->out, w->out_len);
+			json_flush();
+		} else {
+			fprintf(stdout, "==> %s (%s) <==\n", w->desc.ctldev, w->desc.mdev);
+			fflush(stdout);
+			if (w->out_len)
+				fwrite(w->out, 1, w->out_len, stdout);
+			fflush(stdout);
+		}
+		if (w->err_len)
+			fwrite(w->err, 1, w->err_len, stderr);
+		if (w->status)
+			err_msg("%s: exited with status %d\n", w->desc.ctldev, w->status);
+		if (w->status > ret)
+			ret = w->status;
+		free(w->out);
+		free(w->err);
+	}
+
+	free(workers);
+	free(descs);
+	return n ? ret : 1;
+}
+
+int mlx5ctl_exec_multi(const char *selector, int argc, char *argv[])
+{
+	return mlx5ctl_exec_multi_open(selector, argc, argv, default_open);
+}
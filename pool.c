@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Device context pool, see pool.h.
+ *
+ * Contexts are checked out from a free stack under the pool lock. The pool
+ * counts the jobs each context ran in mlx5u_pool_run() and prints them with
+ * -d, which shows how the work spread over the FW contexts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mlx5ctlu.h"
+#include "transport.h"
+#include "pool.h"
+#include "sched.h"
+
+#define POOL_MAX_CTX 64
+
+struct mlx5u_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t freed;
+	int n;
+	int nfree;
+	struct mlx5u_dev *free[POOL_MAX_CTX];
+	struct mlx5u_dev *ctx[POOL_MAX_CTX];
+	u64 jobs[POOL_MAX_CTX];
+};
+
+static struct mlx5u_dev *ctx_open(struct mlx5u_dev *dev)
+{
+	struct mlx5u_dev *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx)
+		return NULL;
+	memcpy(ctx->devname, dev->devname, sizeof(ctx->devname));
+	memcpy(ctx->mdev, dev->mdev, sizeof(ctx->mdev));
+	ctx->ops = dev->ops;
+	ctx->fd = -1;
+	if (!dev->ops->dup) {
+		ctx->priv = dev->priv;
+		ctx->base = dev;
+		return ctx;
+	}
+	if (dev->ops->dup(dev, ctx)) {
+		err_msg("pool: failed to open another context of %s: %s\n",
+			dev->devname, strerror(errno));
+		free(ctx);
+		return NULL;
+	}
+	dbg_msg(1, "pool: opened %s descriptor fd(%d)\n", ctx->devname, ctx->fd);
+	return ctx;
+}
+
+struct mlx5u_pool *mlx5u_pool_create(struct mlx5u_dev *dev, int n)
+{
+	struct mlx5u_pool *pool;
+
+	if (n < 1)
+		n = 1;
+	if (n > POOL_MAX_CTX)
+		n = POOL_MAX_CTX;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->freed, NULL);
+
+	pool->ctx[pool->n++] = dev;
+	while (pool->n < n) {
+		struct mlx5u_dev *ctx = ctx_open(dev);
+
+		if (!ctx)
+			break; /* fewer contexts, still a working pool */
+		pool->ctx[pool->n++] = ctx;
+	}
+	for (int i = pool->n - 1; i >= 0; i--)
+		pool->free[pool->nfree++] = pool->ctx[i];
+
+	dbg_msg(1, "pool: %d contexts of %s (%s)\n", pool->n, dev->devname,
+		dev->ops->dup ? "independent" : "shared transport");
+	return pool;
+}
+
+void mlx5u_pool_destroy(struct mlx5u_pool *pool)
+{
+	if (!pool)
+		return;
+
+	for (int i = 0; i < pool->n; i++) {
+		dbg_msg(1, "pool: context %d ran %llu jobs\n", i,
+			(unsigned long long)pool->jobs[i]);
+		if (i) /* the first one is the caller's */
+			mlx5u_close(pool->ctx[i]);
+	}
+	pthread_cond_destroy(&pool->freed);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int mlx5u_pool_size(struct mlx5u_pool *pool)
+{
+	return pool->n;
+}
+
+struct mlx5u_dev *mlx5u_pool_get(struct mlx5u_pool *pool)
+{
+	struct mlx5u_dev *ctx;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->nfree)
+		pthread_cond_wait(&pool->freed, &pool->lock);
+	ctx = pool->free[--pool->nfree];
+	pthread_mutex_unlock(&pool->lock);
+	return ctx;
+}
+
+void mlx5u_pool_put(struct mlx5u_pool *pool, struct mlx5u_dev *ctx)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->free[pool->nfree++] = ctx;
+	pthread_cond_signal(&pool->freed);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+struct pool_run {
+	struct mlx5u_pool *pool;
+	mlx5u_pool_job fn;
+	void *arg;
+	int njobs;
+	int next;
+	int err;
+	int sched_class;
+};
+
+static int ctx_index(struct mlx5u_pool *pool, struct mlx5u_dev *ctx)
+{
+	for (int i = 0; i < pool->n; i++)
+		if (pool->ctx[i] == ctx)
+			return i;
+	return 0;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool_run *run = arg;
+	struct mlx5u_pool *pool = run->pool;
+	struct mlx5u_dev *ctx;
+	u64 done = 0;
+	int job, ret;
+
+	mlx5u_sched_set_class(run->sched_class);
+	ctx = mlx5u_pool_get(pool);
+	for (;;) {
+		job = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+		if (job >= run->njobs)
+			break;
+		ret = run->fn(ctx, job, run->arg);
+		if (ret < 0) {
+			int none = 0;
+
+			__atomic_compare_exchange_n(&run->err, &none, ret, 0,
+						    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		}
+		done++;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->jobs[ctx_index(pool, ctx)] += done;
+	pthread_mutex_unlock(&pool->lock);
+	mlx5u_pool_put(pool, ctx);
+	return NULL;
+}
+
+int mlx5u_pool_run(struct mlx5u_pool *pool, int njobs, mlx5u_pool_job fn, void *arg)
+{
+	struct pool_run run = {
+		.pool = pool,
+		.fn = fn,
+		.arg = arg,
+		.njobs = njobs,
+		.sched_class = mlx5u_sched_get_class(),
+	};
+	pthread_t threads[POOL_MAX_CTX];
+	int nthreads = 0, err;
+
+	if (njobs <= 0)
+		return 0;
+
+	for (int i = 0; i < pool->n - 1 && i < njobs - 1; i++) {
+		err = pthread_create(&threads[nthreads], NULL, pool_worker, &run);
+		if (err) {
+			dbg_msg(1, "pool: failed to start worker: %s\n", strerror(err));
+			break;
+		}
+		nthreads++;
+	}
+	/* the caller takes a context too, so the run progresses even without threads */
+	pool_worker(&run);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	return run.err;
+}
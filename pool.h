@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_POOL_H__
+#define __MLX5CTL_POOL_H__
+
+/*
+ * Device context pool.
+ *
+ * A struct mlx5u_dev is one fwctl fd, i.e. one FW UID, with one mailbox
+ * arena and used by one thread at a time. A pool holds n contexts of the same
+ * device: the dev it was created from plus n - 1 fwctl fds opened on the same
+ * node, so bulk work can keep several commands in flight, each thread with a
+ * context of its own. Transports without independent contexts (sim, replay,
+ * daemon) get contexts sharing the transport and its serialization, only the
+ * mailbox arena and caches are per context.
+ */
+
+struct mlx5u_pool;
+struct mlx5u_dev;
+
+/* n <= 1 is a pool of dev alone, dev must outlive the pool */
+struct mlx5u_pool *mlx5u_pool_create(struct mlx5u_dev *dev, int n);
+/* Closes the contexts the pool opened, none may be checked out */
+void mlx5u_pool_destroy(struct mlx5u_pool *pool);
+int mlx5u_pool_size(struct mlx5u_pool *pool);
+
+/* Blocks until a context is free, thread safe */
+struct mlx5u_dev *mlx5u_pool_get(struct mlx5u_pool *pool);
+void mlx5u_pool_put(struct mlx5u_pool *pool, struct mlx5u_dev *ctx);
+
+/*
+ * Run fn for jobs 0..njobs-1 on one thread per context, in no particular
+ * order. Workers take the caller's sched class. Returns 0, or the first
+ * negative value fn returned, the remaining jobs still run.
+ */
+typedef int (*mlx5u_pool_job)(struct mlx5u_dev *ctx, int job, void *arg);
+int mlx5u_pool_run(struct mlx5u_pool *pool, int njobs, mlx5u_pool_job fn, void *arg);
+
+#endif /* __MLX5CTL_POOL_H__ */
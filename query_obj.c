@@ -11,19 +11,33 @@
 #include "mlx5ctlu.h"
 #include "ifcutil.h"
 #include "mlx5_ifc.h"
+#include "transport.h"
+#include "pool.h"
+#include "sched.h"
+#include "ifc_schema.h"
+#include "hexdump.h"
+#include "json.h"
 
 static char *obj_name = NULL;
-static unsigned int obj_id = 0;
+static unsigned int obj_first = 0;
+static unsigned int obj_last = 0;
 static unsigned int op_mod = 0;
 static unsigned	int bin_format = 0;
+static const struct ifc_layout *decode_layout;
+static const char *fields;
+static struct ifc_select *field_sel;
+static int jobs = 1;
 
 static void print_query_funcs(void);
 
 static void help(void)
 {
-	fprintf(stdout, "Usage: mlx5ctl <device> obj <obj_name> --id=<obj_id> [--op_mod=op_mod] [--bin]\n");
+	fprintf(stdout, "Usage: mlx5ctl <device> obj <obj_name> --id=<obj_id>[-<last_id>] [--op_mod=op_mod] [--bin|--decode|--fields=<f1,f2.sub,..>] [--jobs=<n>]\n");
 	fprintf(stdout, "executes PRM command query_<obj_name>_in\n");
 	fprintf(stdout, "hex dumps query_<obj_name>_out, unless [--bin|-B], then binary dump\n");
+	fprintf(stdout, "or [--decode|-D], every field of query_<obj_name>_out, or only the --fields\n");
+	fprintf(stdout, "an id range sweeps every id in it, objects that don't exist are skipped\n");
+	fprintf(stdout, "--jobs=<n> queries with n threads, each on its own FW context of the device\n");
 	fprintf(stdout, "Supported obj_names:\n");
 	print_query_funcs();
 }
@@ -34,10 +48,15 @@ static void parse_args(int argc, char *argv[])
 		{"id", optional_argument, 0, 'i'},
 		{"op_mod", optional_argument, 0, 'o'},
 		{"bin", no_argument, 0, 'B'},
+		{"decode", no_argument, 0, 'D'},
+		{"fields", required_argument, 0, 'f'},
+		{"jobs", required_argument, 0, 'j'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
+	char layout[128];
 	int option_index = 0;
+	char *end;
 	int c;
 
 	obj_name = argv[1];
@@ -47,11 +66,17 @@ static void parse_args(int argc, char *argv[])
 		exit(1);
 	}
 
-	while ((c = getopt_long(argc, argv, "io:Bh", long_options, &option_index)) != -1)
+	while ((c = getopt_long(argc, argv, "io:BDf:j:h", long_options, &option_index)) != -1)
 	{
 		switch (c) {
 		case 'i':
-			obj_id = strtoul(optarg, NULL, 0);
+			obj_first = obj_last = strtoul(optarg, &end, 0);
+			if (*end == '-')
+				obj_last = strtoul(end + 1, &end, 0);
+			if (*end || obj_last < obj_first) {
+				fprintf(stderr, "Invalid id range %s\n", optarg);
+				exit(1);
+			}
 			break;
 		case 'o':
 			op_mod = strtoul(optarg, NULL, 0);
@@ -59,6 +84,24 @@ static void parse_args(int argc, char *argv[])
 		case 'B':
 			bin_format = 1;
 			break;
+		case 'D':
+		case 'f':
+			if (c == 'f')
+				fields = optarg;
+			snprintf(layout, sizeof(layout), "query_%s_out", obj_name);
+			decode_layout = ifc_layout_find(layout);
+			if (!decode_layout) {
+				fprintf(stderr, "No layout %s to decode\n", layout);
+				exit(1);
+			}
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1) {
+				fprintf(stderr, "Invalid jobs %s\n", optarg);
+				exit(1);
+			}
+			break;
 		case 'h':
 			help();
 			exit(0);
@@ -72,9 +115,10 @@ static void parse_args(int argc, char *argv[])
 }
 
 //typedef void *(*query_obj_func)(struct mlx5u_dev *, unsigned int, unsigned int *);
-typedef void (*query_obj_func)(void *, unsigned int *, unsigned int *);
+typedef void (*query_obj_func)(void *, unsigned int, unsigned int *, unsigned int *);
 #define QUERY_FUNC(name) \
-	static void query_##name(void *in, unsigned int *in_sz, unsigned int *out_sz)
+	static void query_##name(void *in, unsigned int obj_id, unsigned int *in_sz, \
+				 unsigned int *out_sz)
 
 QUERY_FUNC(eq)
 {
@@ -453,21 +497,33 @@ static query_obj_func get_query_func(char *obj_name)
 	return NULL;
 }
 
+static void print_out(unsigned int obj_id, void *out, unsigned int out_sz)
+{
+	if (json_output) {
+		json_rec_begin();
+		json_str("obj", obj_name);
+		json_uint("id", obj_id);
+	}
+	if (field_sel)
+		ifc_select_print(stdout, field_sel, out, out_sz);
+	else if (bin_format)
+		bindump(out, out_sz);
+	else if (decode_layout)
+		ifc_decode(stdout, decode_layout, out, out_sz);
+	else
+		hexdump(out, out_sz);
+	if (json_output)
+		json_rec_end();
+}
+
 static char in[4096] =	{}; /* big enough buffer to fit any query_xxx_in */
-int query_obj(struct mlx5u_dev *dev, int argc, char *argv[])
+static int query_one(struct mlx5u_dev *dev, query_obj_func fun, unsigned int obj_id)
 {
-	query_obj_func fun = get_query_func(argv[1]);
 	unsigned int out_sz, in_sz;
 	void *out;
 	int err;
 
-	parse_args(argc, argv);
-	if (!fun) {
-		fprintf(stderr, "Invalid obj name %s\n", obj_name);
-		return 1;
-	}
-
-	fun(in, &in_sz, &out_sz);
+	fun(in, obj_id, &in_sz, &out_sz);
 	out = malloc(out_sz);
 	if (!out) {
 		fprintf(stderr, "Failed to allocate %d bytes\n", out_sz);
@@ -487,10 +543,101 @@ int query_obj(struct mlx5u_dev *dev, int argc, char *argv[])
 		fprintf(stderr, "Warning: %s id=%d op_mod=0x%x returned %d\n",
 			obj_name, obj_id, op_mod, err);
 
-	if (bin_format)
-		fwrite(out, out_sz, 1, stdout);
-	else
-		hexdump(out, out_sz);
+	print_out(obj_id, out, out_sz);
 	free(out);
 	return 0;
 }
+
+/* A sweep over an id range, results are printed in id order */
+struct obj_sweep {
+	query_obj_func fun;
+	unsigned int out_sz;
+	u8 *status; /* per id, 0xff if the RPC itself failed */
+	u8 *out;    /* out_sz per id */
+};
+
+static int sweep_job(struct mlx5u_dev *ctx, int job, void *arg)
+{
+	struct obj_sweep *sw = arg;
+	void *out = sw->out + (size_t)job * sw->out_sz;
+	unsigned int in_sz, out_sz;
+	u8 job_in[sizeof(in)] = {};
+
+	sw->fun(job_in, obj_first + job, &in_sz, &out_sz);
+	if (mlx5u_transport_cmd(ctx, job_in, in_sz, out, out_sz)) {
+		dbg_msg(1, "%s id=%u: %s\n", obj_name, obj_first + job, strerror(errno));
+		sw->status[job] = 0xff;
+		return 0;
+	}
+	sw->status[job] = MLX5_GET(mbox_out, out, status);
+	return 0;
+}
+
+static int query_sweep(struct mlx5u_dev *dev, query_obj_func fun)
+{
+	unsigned int n = obj_last - obj_first + 1, found = 0;
+	struct obj_sweep sw = { .fun = fun };
+	struct mlx5u_pool *pool;
+	int prev_class, rpc_err = 0;
+	unsigned int in_sz;
+
+	fun(in, obj_first, &in_sz, &sw.out_sz);
+	sw.status = calloc(n, 1);
+	sw.out = calloc(n, sw.out_sz);
+	pool = mlx5u_pool_create(dev, jobs);
+	if (!sw.status || !sw.out || !pool) {
+		fprintf(stderr, "Failed to allocate %u %s results\n", n, obj_name);
+		goto out;
+	}
+
+	prev_class = mlx5u_sched_set_class(MLX5U_SCHED_BULK);
+	mlx5u_pool_run(pool, n, sweep_job, &sw);
+	mlx5u_sched_set_class(prev_class);
+
+	for (unsigned int i = 0; i < n; i++) {
+		u8 *out = sw.out + (size_t)i * sw.out_sz;
+
+		if (sw.status[i] == 0xff)
+			rpc_err++;
+		if (sw.status[i])
+			continue;
+		found++;
+		if (!bin_format && !json_output)
+			printf("%s id=%u:\n", obj_name, obj_first + i);
+		print_out(obj_first + i, out, sw.out_sz);
+	}
+	fprintf(stderr, "%u of %u %s ids found, %d contexts\n", found, n, obj_name,
+		mlx5u_pool_size(pool));
+	if (rpc_err)
+		fprintf(stderr, "Failed to query %d %s ids\n", rpc_err, obj_name);
+out:
+	mlx5u_pool_destroy(pool);
+	free(sw.out);
+	free(sw.status);
+	return !pool || rpc_err;
+}
+
+int query_obj(struct mlx5u_dev *dev, int argc, char *argv[])
+{
+	query_obj_func fun = get_query_func(argv[1]);
+	int err;
+
+	parse_args(argc, argv);
+	if (!fun) {
+		fprintf(stderr, "Invalid obj name %s\n", obj_name);
+		return 1;
+	}
+	if (fields) {
+		field_sel = ifc_select_parse(decode_layout, fields);
+		if (!field_sel)
+			return 1;
+	}
+
+	if (obj_first == obj_last)
+		err = query_one(dev, fun, obj_first);
+	else
+		err = query_sweep(dev, fun);
+	ifc_select_free(field_sel);
+	field_sel = NULL;
+	return err;
+}
@@ -0,0 +1,393 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Record and replay of FW RPCs.
+ *
+ * --record=<file> appends every FWCTL_RPC issued through mlx5u_cmd() and
+ * every FWCTL_INFO to <file>. Opening "replay:<file>" instead of a device
+ * answers commands from such a file, no device or kernel module needed, to
+ * benchmark and debug the decode and output paths with real payloads.
+ *
+ * Replay looks a command up by its exact input mailbox. A command recorded
+ * several times (e.g. polled counters) is answered with the recorded
+ * responses in order, wrapping around once they are exhausted.
+ * Set MLX5CTL_REPLAY_LATENCY=1 to also sleep for the recorded FW latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+#include "record.h"
+#include "transport.h"
+
+#include "uapi/fwctl/fwctl.h"
+#include "uapi/fwctl/mlx5.h"
+
+static int rec_fd = -1;
+
+int mlx5u_record_open(const char *path)
+{
+	struct mlx5u_rec_file_hdr fhdr = {
+		.magic = MLX5U_REC_MAGIC,
+		.version = MLX5U_REC_VERSION,
+	};
+
+	/* O_APPEND: forked per device workers share the fd, see mlx5u_record() */
+	rec_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (rec_fd == -1) {
+		err_msg("failed to open record file %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (write(rec_fd, &fhdr, sizeof(fhdr)) != sizeof(fhdr)) {
+		err_msg("failed to write record file %s: %s\n", path, strerror(errno));
+		close(rec_fd);
+		rec_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int mlx5u_recording(void)
+{
+	return rec_fd != -1;
+}
+
+void mlx5u_record(u16 type, const void *in, size_t inlen, const void *out,
+		  size_t outlen, int err, u64 lat_ns)
+{
+	struct mlx5u_rec_hdr hdr = {
+		.type = type,
+		.err = err,
+		.in_len = inlen,
+		.out_len = outlen,
+		.lat_ns = lat_ns,
+	};
+	size_t len = sizeof(hdr) + inlen + outlen;
+	char *buf;
+
+	if (rec_fd == -1)
+		return;
+
+	/* a single append per record keeps concurrent writers from interleaving */
+	buf = malloc(len);
+	if (!buf)
+		return;
+	memcpy(buf, &hdr, sizeof(hdr));
+	if (inlen)
+		memcpy(buf + sizeof(hdr), in, inlen);
+	if (outlen)
+		memcpy(buf + sizeof(hdr) + inlen, out, outlen);
+	if (write(rec_fd, buf, len) != len)
+		dbg_msg(1, "record write failed: %s\n", strerror(errno));
+	free(buf);
+}
+
+struct replay_rec {
+	const struct mlx5u_rec_hdr *hdr;
+	const u8 *in;
+	const u8 *out;
+	u32 hash;
+	int next;   /* next record with the same input, -1 terminated */
+	int cursor; /* head only: next record to answer with */
+};
+
+struct mlx5u_replay {
+	void *map;
+	size_t map_len;
+	struct replay_rec *recs;
+	int nrecs;
+	int *heads; /* hash -> first record with that input */
+	unsigned int heads_size;
+	const struct mlx5u_rec_hdr *info;
+	char devname[DEV_NAME_MAX]; /* of the recorded device */
+	char mdev[DEV_NAME_MAX];
+	int latency;
+	pthread_mutex_t lock; /* cursors, commands may come from async workers */
+};
+
+static u32 hash_buf(const void *buf, size_t len)
+{
+	const u8 *p = buf;
+	u32 h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int same_input(const struct replay_rec *rec, const void *in, size_t inlen)
+{
+	return rec->hdr->in_len == inlen && !memcmp(rec->in, in, inlen);
+}
+
+static int *find_head(struct mlx5u_replay *rp, const void *in, size_t inlen, u32 hash)
+{
+	unsigned int idx = hash & (rp->heads_size - 1);
+
+	for (; rp->heads[idx] != -1; idx = (idx + 1) & (rp->heads_size - 1)) {
+		struct replay_rec *rec = &rp->recs[rp->heads[idx]];
+
+		if (rec->hash == hash && same_input(rec, in, inlen))
+			break;
+	}
+	return &rp->heads[idx];
+}
+
+static int replay_index(struct mlx5u_replay *rp)
+{
+	const u8 *p = (u8 *)rp->map + sizeof(struct mlx5u_rec_file_hdr);
+	const u8 *end = (u8 *)rp->map + rp->map_len;
+	int *tails;
+	int n = 0;
+
+	/* first pass: count and validate */
+	for (const u8 *q = p; q < end; n++) {
+		const struct mlx5u_rec_hdr *hdr = (const void *)q;
+
+		if (end - q < sizeof(*hdr) ||
+		    end - q - sizeof(*hdr) < (u64)hdr->in_len + hdr->out_len) {
+			err_msg("replay: truncated record %d\n", n);
+			return -1;
+		}
+		q += sizeof(*hdr) + hdr->in_len + hdr->out_len;
+	}
+
+	rp->recs = calloc(n ? n : 1, sizeof(*rp->recs));
+	for (rp->heads_size = 16; rp->heads_size < 2 * n; rp->heads_size <<= 1)
+		;
+	rp->heads = malloc(rp->heads_size * sizeof(*rp->heads));
+	tails = malloc(rp->heads_size * sizeof(*tails));
+	if (!rp->recs || !rp->heads || !tails) {
+		free(tails);
+		return -1;
+	}
+	memset(rp->heads, 0xff, rp->heads_size * sizeof(*rp->heads));
+
+	for (int i = 0; i < n; i++) {
+		const struct mlx5u_rec_hdr *hdr = (const void *)p;
+		struct replay_rec *rec = &rp->recs[rp->nrecs];
+		int *head;
+
+		p += sizeof(*hdr) + hdr->in_len + hdr->out_len;
+		switch (hdr->type) {
+		case MLX5U_REC_DEV: {
+			const char *names = (const char *)(hdr + 1) + hdr->in_len;
+			size_t len = strnlen(names, hdr->out_len);
+
+			if (rp->devname[0])
+				continue; /* multi device recording, keep the first */
+			snprintf(rp->devname, sizeof(rp->devname), "%.*s", (int)len, names);
+			if (len + 1 < hdr->out_len)
+				snprintf(rp->mdev, sizeof(rp->mdev), "%.*s",
+					 (int)strnlen(names + len + 1, hdr->out_len - len - 1),
+					 names + len + 1);
+			continue;
+		}
+		case MLX5U_REC_INFO:
+			if (!rp->info)
+				rp->info = hdr;
+			continue;
+		case MLX5U_REC_RPC:
+			break;
+		default:
+			continue;
+		}
+
+		rec->hdr = hdr;
+		rec->in = (const u8 *)(hdr + 1);
+		rec->out = rec->in + hdr->in_len;
+		rec->hash = hash_buf(rec->in, hdr->in_len);
+		rec->next = -1;
+
+		head = find_head(rp, rec->in, hdr->in_len, rec->hash);
+		if (*head == -1) {
+			*head = rp->nrecs;
+			rec->cursor = rp->nrecs;
+			tails[head - rp->heads] = rp->nrecs;
+		} else {
+			rp->recs[tails[head - rp->heads]].next = rp->nrecs;
+			tails[head - rp->heads] = rp->nrecs;
+		}
+		rp->nrecs++;
+	}
+
+	free(tails);
+	return 0;
+}
+
+static void replay_free(struct mlx5u_replay *rp)
+{
+	pthread_mutex_destroy(&rp->lock);
+	munmap(rp->map, rp->map_len);
+	free(rp->recs);
+	free(rp->heads);
+	free(rp);
+}
+
+static struct mlx5u_replay *replay_open(const char *path)
+{
+	const struct mlx5u_rec_file_hdr *fhdr;
+	struct mlx5u_replay *rp;
+	const char *lat;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		err_msg("failed to open replay file %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size < sizeof(*fhdr)) {
+		err_msg("replay file %s is too short\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	rp = calloc(1, sizeof(*rp));
+	if (!rp) {
+		close(fd);
+		return NULL;
+	}
+	pthread_mutex_init(&rp->lock, NULL);
+	rp->map_len = st.st_size;
+	rp->map = mmap(NULL, rp->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (rp->map == MAP_FAILED) {
+		err_msg("failed to map replay file %s: %s\n", path, strerror(errno));
+		free(rp);
+		return NULL;
+	}
+
+	fhdr = rp->map;
+	if (memcmp(fhdr->magic, MLX5U_REC_MAGIC, sizeof(fhdr->magic)) ||
+	    fhdr->version != MLX5U_REC_VERSION) {
+		err_msg("%s is not a mlx5ctl record file\n", path);
+		goto err;
+	}
+	if (replay_index(rp))
+		goto err;
+
+	lat = getenv("MLX5CTL_REPLAY_LATENCY");
+	rp->latency = lat && atoi(lat);
+	dbg_msg(1, "replay: %d commands from %s, recorded on %s\n", rp->nrecs, path,
+		rp->devname[0] ? rp->devname : "unknown device");
+	return rp;
+
+err:
+	replay_free(rp);
+	return NULL;
+}
+
+static void replay_sleep(u64 ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ull,
+		.tv_nsec = ns % 1000000000ull,
+	};
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static int replay_cmd(struct mlx5u_dev *dev, void *in, size_t inlen,
+		      void *out, size_t outlen, u64 *lat_ns)
+{
+	struct mlx5u_replay *rp = dev->priv;
+	u32 hash = hash_buf(in, inlen);
+	const struct replay_rec *rec;
+	int *head;
+
+	head = find_head(rp, in, inlen, hash);
+	if (*head == -1) {
+		dbg_msg(1, "replay: no recorded response for opcode 0x%x op_mod 0x%x\n",
+			MLX5_GET(mbox_in, in, opcode), MLX5_GET(mbox_in, in, op_mod));
+		errno = ENOENT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&rp->lock);
+	rec = &rp->recs[rp->recs[*head].cursor];
+	rp->recs[*head].cursor = rec->next != -1 ? rec->next : *head;
+	pthread_mutex_unlock(&rp->lock);
+
+	*lat_ns = rec->hdr->lat_ns;
+	if (rp->latency)
+		replay_sleep(rec->hdr->lat_ns);
+	if (rec->hdr->err) {
+		errno = rec->hdr->err;
+		return -1;
+	}
+
+	memset(out, 0, outlen);
+	memcpy(out, rec->out, rec->hdr->out_len < outlen ? rec->hdr->out_len : outlen);
+	return 0;
+}
+
+static int replay_info(struct mlx5u_dev *dev, struct mlx5u_dev_info *info)
+{
+	struct mlx5u_replay *rp = dev->priv;
+	struct fwctl_info_mlx5 info_mlx5 = {};
+
+	if (!rp->info) {
+		errno = ENOENT;
+		return -1;
+	}
+	memcpy(&info_mlx5, (const u8 *)(rp->info + 1) + rp->info->in_len,
+	       rp->info->out_len < sizeof(info_mlx5) ? rp->info->out_len : sizeof(info_mlx5));
+	info->uid = info_mlx5.uid;
+	info->uctx_caps = info_mlx5.uctx_caps;
+	snprintf(info->desc.ctldev, sizeof(info->desc.ctldev), "%s", rp->devname);
+	snprintf(info->desc.mdev, sizeof(info->desc.mdev), "%s", rp->mdev);
+	return 0;
+}
+
+static int replay_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
+{
+	return -1;
+}
+
+static int replay_umem_unreg(struct mlx5u_dev *dev, u32 umem_id)
+{
+	return -1;
+}
+
+static void replay_close(struct mlx5u_dev *dev)
+{
+	replay_free(dev->priv);
+}
+
+static const struct mlx5u_transport_ops replay_ops = {
+	.name = "replay",
+	.cmd = replay_cmd,
+	.info = replay_info,
+	.umem_reg = replay_umem_reg,
+	.umem_unreg = replay_umem_unreg,
+	.close = replay_close,
+};
+
+int mlx5u_replay_transport_open(struct mlx5u_dev *dev, const char *path)
+{
+	struct mlx5u_replay *rp = replay_open(path);
+
+	if (!rp)
+		return -1;
+	dev->ops = &replay_ops;
+	dev->priv = rp;
+	snprintf(dev->devname, sizeof(dev->devname), "replay:%s", path);
+	snprintf(dev->mdev, sizeof(dev->mdev), "%s", rp->mdev);
+	return 0;
+}
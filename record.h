@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_RECORD_H__
+#define __MLX5CTL_RECORD_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ifcutil.h"
+
+/*
+ * Record file: a file header followed by records, each a rec_hdr followed by
+ * in_len bytes of command input and out_len bytes of output.
+ */
+#define MLX5U_REC_MAGIC "MLX5CREC"
+#define MLX5U_REC_VERSION 1
+
+enum {
+	MLX5U_REC_DEV = 1,  /* out: "ctldev\0mdev\0" of the recorded device */
+	MLX5U_REC_RPC = 2,  /* in: command mailbox, out: response mailbox */
+	MLX5U_REC_INFO = 3, /* out: struct fwctl_info_mlx5 */
+};
+
+struct mlx5u_rec_file_hdr {
+	char magic[8];
+	u32 version;
+	u32 reserved;
+};
+
+struct mlx5u_rec_hdr {
+	u16 type;
+	u16 reserved;
+	int32_t err; /* errno of a failed ioctl, 0 on success */
+	u32 in_len;
+	u32 out_len;
+	u64 lat_ns;
+};
+
+int mlx5u_record_open(const char *path);
+int mlx5u_recording(void);
+void mlx5u_record(u16 type, const void *in, size_t inlen, const void *out,
+		  size_t outlen, int err, u64 lat_ns);
+
+#endif /* __MLX5CTL_RECORD_H__ */
@@ -7,11 +7,16 @@
 #include <string.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "mlx5ctlu.h"
 #include "ifcutil.h"
 #include "mlx5_ifc.h"
 #include "reg.h"
+#include "sched.h"
+#include "ifc_schema.h"
+#include "hexdump.h"
+#include "json.h"
 
 enum {
 	MLX5_PTYS_IB = 1 << 0,
@@ -25,22 +30,32 @@ struct reg_info {
 	const char *str;
 	u32 size;
 	reg_pretty_print ppfun;
+	const char *layout; /* mlx5_ifc layout for --decode, NULL if none */
 };
 
-#define DEFINER_REG_ATTR(name, size, ppfun) \
-	{ MLX5_REG_ ## name, #name, size, ppfun }
+#define DEFINER_REG_ATTR(name, size, ppfun, layout) \
+	{ MLX5_REG_ ## name, #name, size, ppfun, layout }
 
 #define DEFINE_REG_SZ(name, lower_name) \
-	DEFINER_REG_ATTR(name, MLX5_ST_SZ_BYTES(lower_name ## _reg), NULL)
+	DEFINER_REG_ATTR(name, MLX5_ST_SZ_BYTES(lower_name ## _reg), NULL, #lower_name "_reg")
 
 #define DEFINE_REG_SZ_PP(name, lower_name) \
-	DEFINER_REG_ATTR(name, MLX5_ST_SZ_BYTES(lower_name ## _reg), print_reg_ ## lower_name)
+	DEFINER_REG_ATTR(name, MLX5_ST_SZ_BYTES(lower_name ## _reg), print_reg_ ## lower_name, \
+			 #lower_name "_reg")
 
 #define DEFINE_REG_PP(name, lower_name) \
-	DEFINER_REG_ATTR(name, MLX5_UN_SZ_BYTES(ports_control_registers_document), print_reg_ ## lower_name)
+	DEFINER_REG_ATTR(name, MLX5_UN_SZ_BYTES(ports_control_registers_document), \
+			 print_reg_ ## lower_name, NULL)
+
+#define DEFINE_REG_ST(name, lower_name) \
+	DEFINER_REG_ATTR(name, MLX5_ST_SZ_BYTES(lower_name), NULL, #lower_name)
+
+/* layout not in mlx5_ifc yet, length from the PRM */
+#define DEFINE_REG_LEN(name, len) \
+	DEFINER_REG_ATTR(name, len, NULL, NULL)
 
 #define DEFINE_REG_DEF(name) \
-	DEFINER_REG_ATTR(name, MLX5_UN_SZ_BYTES(ports_control_registers_document), NULL)
+	DEFINER_REG_ATTR(name, MLX5_UN_SZ_BYTES(ports_control_registers_document), NULL, NULL)
 
 /* pretty print functions implemented at the bottom of the file */
 static void print_reg_ptys(void *data);
@@ -93,24 +108,24 @@ static struct reg_info regs[] = {
 	DEFINE_REG_SZ(MIRC, mirc),
 	DEFINE_REG_SZ(SBCAM, sbcam),
 	DEFINE_REG_SZ(DCBX_PARAM, dcbx_param),
+	DEFINE_REG_SZ(QETCR, qetc),
+	DEFINE_REG_SZ(MTCAP, mtcap),
+	DEFINE_REG_SZ(MTMP, mtmp),
+	DEFINE_REG_SZ(MTPPS, mtpps),
+	DEFINE_REG_SZ(MTPPSE, mtppse),
+	DEFINE_REG_ST(MTRC_CAP, mtrc_cap),
+	DEFINE_REG_ST(MTRC_CONF, mtrc_conf),
+	DEFINE_REG_ST(MTRC_CTRL, mtrc_ctrl),
+	DEFINE_REG_ST(RESOURCE_DUMP, resource_dump),
+	DEFINE_REG_LEN(SBPR, 0x14),
+	DEFINE_REG_LEN(SBCM, 0x28),
 
 	/* missing in mlx5_ifc, add there and then use DEFINE_REG_SZ for better hex dump */
-	DEFINE_REG_DEF(SBPR),
-	DEFINE_REG_DEF(SBCM),
-	DEFINE_REG_DEF(QETCR),
 	DEFINE_REG_DEF(DCBX_APP),
 	DEFINE_REG_DEF(FPGA_CAP),
 	DEFINE_REG_DEF(FPGA_CTRL),
 	DEFINE_REG_DEF(HOST_ENDIANNESS),
-	DEFINE_REG_DEF(MTCAP),
-	DEFINE_REG_DEF(MTMP),
-	DEFINE_REG_DEF(MTRC_CAP),
-	DEFINE_REG_DEF(MTRC_CONF),
-	DEFINE_REG_DEF(MTRC_STDB),
-	DEFINE_REG_DEF(MTRC_CTRL),
-	DEFINE_REG_DEF(MTPPS),
-	DEFINE_REG_DEF(MTPPSE),
-	DEFINE_REG_DEF(RESOURCE_DUMP),
+	DEFINE_REG_DEF(MTRC_STDB), /* string_db_data[] runs past the struct */
 	DEFINE_REG_DEF(FPGA_ACCESS_REG),
 };
 
@@ -162,6 +177,15 @@ static int get_reg_id_from_str(char *reg_name)
 	return -1;
 }
 
+static const struct ifc_layout *get_reg_layout(u32 reg_id)
+{
+	for (int i = 0; i < sizeof(regs) / sizeof(struct reg_info); i++) {
+		if (regs[i].reg_id == reg_id && regs[i].layout)
+			return ifc_layout_find(regs[i].layout);
+	}
+	return NULL;
+}
+
 // Function to get the pretty print function for a register id
 static reg_pretty_print get_print_func_for_reg(u32 reg_id)
 {
@@ -172,58 +196,69 @@ static reg_pretty_print get_print_func_for_reg(u32 reg_id)
 	return NULL;
 }
 
-int
-mlx5_access_reg(struct mlx5u_dev *dev, void *data_in, int size_in, void *data_out, int size_out,
-		u16 reg_id, int arg, int write)
+void *mlx5_reg_in(struct mlx5u_dev *dev, u16 reg_id, int arg, int write, size_t size,
+		  void **data_out)
 {
-	int outlen = MLX5_ST_SZ_BYTES(access_register_out) + size_out;
-	int inlen = MLX5_ST_SZ_BYTES(access_register_in) + size_in;
-	int err = -ENOMEM;
-	u32 *out = NULL;
-	u32 *in = NULL;
-	void *data;
-
-	in = malloc(inlen);
-	out = malloc(outlen);
-	if (!in || !out)
-		goto out;
-
-	memset(in, 0, inlen);
-	memset(out, 0, outlen);
-
-	if (size_in) {
-		data = MLX5_ADDR_OF(access_register_in, in, register_data);
-		memcpy(data, data_in, size_in);
-	}
+	size_t outlen = MLX5_ST_SZ_BYTES(access_register_out) + size;
+	size_t inlen = MLX5_ST_SZ_BYTES(access_register_in) + size;
+	void *in, *out;
+
+	in = mlx5u_mbox_get(dev, inlen, outlen, &out);
+	if (!in)
+		return NULL;
 
 	MLX5_SET(access_register_in, in, opcode, MLX5_CMD_OP_ACCESS_REG);
 	MLX5_SET(access_register_in, in, op_mod, !write);
 	MLX5_SET(access_register_in, in, argument, arg);
 	MLX5_SET(access_register_in, in, register_id, reg_id);
 
-        dbg_msg(1, "accessing register %s 0x%x argumet 0x%x\n", reg2str(reg_id), reg_id, arg);
-	err = mlx5u_cmd(dev, in, inlen, out, outlen);
+	dbg_msg(1, "accessing register %s 0x%x argumet 0x%x\n", reg2str(reg_id), reg_id, arg);
+	*data_out = MLX5_ADDR_OF(access_register_out, out, register_data);
+	return MLX5_ADDR_OF(access_register_in, in, register_data);
+}
+
+int mlx5_reg_exec(struct mlx5u_dev *dev)
+{
+	return mlx5u_mbox_exec(dev);
+}
+
+int
+mlx5_access_reg(struct mlx5u_dev *dev, void *data_in, int size_in, void *data_out, int size_out,
+		u16 reg_id, int arg, int write)
+{
+	int size = size_in > size_out ? size_in : size_out;
+	void *in, *out;
+	int err;
+
+	in = mlx5_reg_in(dev, reg_id, arg, write, size, &out);
+	if (!in)
+		return -ENOMEM;
+	if (size_in)
+		memcpy(in, data_in, size_in);
+
+	err = mlx5_reg_exec(dev);
 	if (err)
-		goto out;
+		return err;
 
-	data = MLX5_ADDR_OF(access_register_out, out, register_data);
-	memcpy(data_out, data, size_out);
-out:
-	free(out);
-	free(in);
-	return err;
+	memcpy(data_out, out, size_out);
+	return 0;
 }
 
 enum pr_format {
 	PR_HEX = 'H',
 	PR_BIN = 'B',
 	PR_PRETTY = 'P',
+	PR_DECODE = 'D',
 };
 
 static int reg_id = -1;
 static int port;
 static int argument;
 static int pr_format = PR_HEX;
+static int count = 1;
+static int interval_ms = 1000;
+static const char *fields;
+static struct ifc_select *field_sel;
 
 static void help() {
 	fprintf(stdout, "mlx5ctl <device> reg --id=<reg_id> [--port=port] [--argument=argument]\n");
@@ -233,6 +268,10 @@ static void help() {
 	fprintf(stdout, "\t--bin - print register in binary format\n");
 	fprintf(stdout, "\t--hex - print register in hex format\n");
 	fprintf(stdout, "\t--pretty - print register in pretty format\n");
+	fprintf(stdout, "\t--decode - print every field of the register layout\n");
+	fprintf(stdout, "\t--fields=<f1,f2.sub,..> - print only these fields of the register\n");
+	fprintf(stdout, "\t--count=<n> - read the register n times, 0 until interrupted, default 1\n");
+	fprintf(stdout, "\t--interval=<ms> - time between reads with --count, default 1000\n");
 	fprintf(stdout, "\t--help - print this help\n");
 	fprintf(stdout, "Known Registers:\n");
 	print_reg_names_ids();
@@ -247,13 +286,17 @@ static void parse_args(int argc, char *argv[])
 		{"bin", no_argument, 0, 'B'},
 		{"hex", no_argument, 0, 'H'},
 		{"pretty", no_argument, 0, 'P'},
+		{"decode", no_argument, 0, 'D'},
+		{"fields", required_argument, 0, 'f'},
+		{"count", required_argument, 0, 'c'},
+		{"interval", required_argument, 0, 't'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 	int option_index = 0;
 	int c;
 
-	while ((c = getopt_long(argc, argv, "i:p:a:BHPh", long_options, &option_index)) != -1)
+	while ((c = getopt_long(argc, argv, "i:p:a:BHPDf:c:t:h", long_options, &option_index)) != -1)
 	{
 		switch (c) {
 		case 'i':
@@ -270,8 +313,18 @@ static void parse_args(int argc, char *argv[])
 		case 'B':
 		case 'H':
 		case 'P':
+		case 'D':
 			pr_format = c;
 			break;
+		case 'f':
+			fields = optarg;
+			break;
+		case 'c':
+			count = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			interval_ms = strtol(optarg, NULL, 0);
+			break;
 		case 'h':
 			help();
 			exit(0);
@@ -287,6 +340,10 @@ static void parse_args(int argc, char *argv[])
 		help();
 		exit(1);
 	}
+	if (count < 0 || interval_ms < 0) {
+		fprintf(stderr, "Invalid --count or --interval\n");
+		exit(1);
+	}
 }
 
 struct mlx5_ifc_local_port_reg_bits {
@@ -294,20 +351,14 @@ struct mlx5_ifc_local_port_reg_bits {
 	u8         local_port[0x8];
 };
 
-static int mlx5_reg_dump(struct mlx5u_dev *dev, u32 reg_id, u32 port, u32 argument)
+static void mlx5_reg_print(u32 reg_id, void *out, unsigned int reg_size)
 {
-	u32 out[MLX5_UN_SZ_DW(ports_control_registers_document)]  = {};
-	u32 data[MLX5_UN_SZ_DW(ports_control_registers_document)] = {};
-	unsigned int reg_size = get_reg_size(reg_id);
+	const struct ifc_layout *layout;
 	reg_pretty_print print_fn = NULL;
-	int err;
 
-	MLX5_SET(local_port_reg, data, local_port, port);
-	err = mlx5_access_reg(dev, data, sizeof(data), out, sizeof(out),
-			      reg_id, argument, 0);
-	if (err) {
-		err_msg("Failed to access register, err %d errno(%d)\n", err, errno);
-		return err;
+	if (field_sel) {
+		ifc_select_print(stdout, field_sel, out, reg_size);
+		return;
 	}
 
 	switch (pr_format) {
@@ -316,37 +367,129 @@ static int mlx5_reg_dump(struct mlx5u_dev *dev, u32 reg_id, u32 port, u32 argume
 		print_fn = get_print_func_for_reg(reg_id);
 		if (print_fn) {
 			info_msg("\n%s 0x%x fields:\n", reg2str(reg_id), reg_id);
+			if (json_output)
+				json_obj_begin("fields");
 			print_fn(out);
+			if (json_output)
+				json_obj_end();
+			break;
+		}
+		fallthrough;
+	case PR_DECODE:
+		layout = get_reg_layout(reg_id);
+		if (layout) {
+			ifc_decode(stdout, layout, out, reg_size);
 			break;
 		}
-		err_msg("No pretty print function for register %s 0x%x\n", reg2str(reg_id), reg_id);
+		err_msg("No layout to decode register %s 0x%x\n", reg2str(reg_id), reg_id);
 		fallthrough;
 	case PR_HEX:
 		hexdump(out, reg_size);
 		break;
 	case PR_BIN:
-		fwrite(out, reg_size, 1, stdout);
+		bindump(out, reg_size);
 		break;
 	default:
 		break;
 	}
+}
+
+static void sleep_until(struct timespec *next, int ms)
+{
+	next->tv_sec += ms / 1000;
+	next->tv_nsec += (ms % 1000) * 1000000L;
+	if (next->tv_nsec >= 1000000000L) {
+		next->tv_sec++;
+		next->tv_nsec -= 1000000000L;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR)
+		;
+}
+
+/*
+ * Reads go through the in-place register API, the mailboxes are sized to the
+ * register once and reused for every sample.
+ */
+static int mlx5_reg_dump(struct mlx5u_dev *dev, u32 reg_id, u32 port, u32 argument)
+{
+	unsigned int reg_size = get_reg_size(reg_id);
+	struct timespec next;
+	void *data, *out;
+	int err;
+
+	if (count != 1)
+		mlx5u_sched_set_class(MLX5U_SCHED_POLL);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (int i = 0; !count || i < count; i++) {
+		if (i)
+			sleep_until(&next, interval_ms);
+
+		data = mlx5_reg_in(dev, reg_id, argument, 0, reg_size, &out);
+		if (!data)
+			return -ENOMEM;
+		MLX5_SET(local_port_reg, data, local_port, port);
+		err = mlx5_reg_exec(dev);
+		if (err) {
+			err_msg("Failed to access register, err %d errno(%d)\n", err, errno);
+			return err;
+		}
+
+		if (json_output) {
+			json_rec_begin();
+			json_str("reg", reg2str(reg_id));
+			json_uint("id", reg_id);
+			json_uint("port", port);
+			if (count != 1)
+				json_uint("sample", i);
+		} else if (count != 1 && pr_format != PR_BIN) {
+			info_msg("sample %d:\n", i);
+		}
+		mlx5_reg_print(reg_id, out, reg_size);
+		if (json_output)
+			json_rec_end();
+		if (count != 1) {
+			fflush(stdout);
+			json_flush();
+		}
+	}
 
 	return 0;
 }
 
 int do_reg(struct mlx5u_dev *dev, int argc, char *argv[])
 {
+	const struct ifc_layout *layout;
+	int err;
 
 	parse_args(argc, argv);
+	if (fields) {
+		layout = get_reg_layout(reg_id);
+		if (!layout) {
+			err_msg("No layout for the fields of register %s 0x%x\n",
+				reg2str(reg_id), reg_id);
+			return 1;
+		}
+		field_sel = ifc_select_parse(layout, fields);
+		if (!field_sel)
+			return 1;
+	}
 
-	return mlx5_reg_dump(dev, reg_id, port, argument);
+	err = mlx5_reg_dump(dev, reg_id, port, argument);
+	ifc_select_free(field_sel);
+	field_sel = NULL;
+	return err;
 }
 
 /* ==================================================================== */
 /* Selected registers PRETTY PRINT FUNCTIONs */
 
 #define print_reg_field(__out, __reg, __field) \
-	printf("\t%s: %x\n", #__field, MLX5_GET(__reg, __out, __field))
+	do { \
+		if (json_output) \
+			json_uint(#__field, MLX5_GET(__reg, __out, __field)); \
+		else \
+			printf("\t%s: %x\n", #__field, MLX5_GET(__reg, __out, __field)); \
+	} while (0)
 
 static void print_reg_ptys(void *out)
 {
@@ -365,9 +508,18 @@ static void print_reg_ptys(void *out)
 static void print_reg_dtor(void *out)
 {
 #define dtor_reg_field(__out, __reg, __field) \
-        printf("\t%s: val %d mult %d\n", #__field, \
-               MLX5_GET(__reg, __out, __field.to_value),\
-               MLX5_GET(__reg, __out, __field.to_multiplier))
+	do { \
+		if (json_output) { \
+			json_obj_begin(#__field); \
+			json_uint("val", MLX5_GET(__reg, __out, __field.to_value)); \
+			json_uint("mult", MLX5_GET(__reg, __out, __field.to_multiplier)); \
+			json_obj_end(); \
+		} else { \
+			printf("\t%s: val %d mult %d\n", #__field, \
+			       MLX5_GET(__reg, __out, __field.to_value), \
+			       MLX5_GET(__reg, __out, __field.to_multiplier)); \
+		} \
+	} while (0)
 #undef prprint
 #define prprint(__field) dtor_reg_field(out, dtor_reg, __field)
 
@@ -384,7 +536,13 @@ static void print_reg_dtor(void *out)
 
 static void print_reg_mcam(void *out)
 {
-#define print_fld(fld) printf("\t%s %d\n", #fld, MLX5_GET(mcam_reg, out, fld))
+#define print_fld(fld) \
+	do { \
+		if (json_output) \
+			json_uint(#fld, MLX5_GET(mcam_reg, out, fld)); \
+		else \
+			printf("\t%s %d\n", #fld, MLX5_GET(mcam_reg, out, fld)); \
+	} while (0)
 	print_fld(feature_group);
 	print_fld(access_reg_group);
 	print_fld(mng_access_reg_cap_mask.access_regs.mcqs);
@@ -414,7 +572,11 @@ static void print_reg_mcam(void *out)
 
 static void print_reg_node_desc(void *out)
 {
-	printf("Node description: %s\n", (char *)out);
+	if (json_output)
+		json_strn("node_description", out,
+			  MLX5_FLD_SZ_BYTES(set_node_in, node_description));
+	else
+		printf("Node description: %s\n", (char *)out);
 }
 
 /* sevirity bitmask:
@@ -432,27 +594,39 @@ Severity codes are listed below:
 7: Debug: debug-level messages
 */
 
+static const char *const rcr_severities[] = {
+	"Emergency: system is unusable",
+	"Alert: action must be taken immediately",
+	"Critical: critical conditions",
+	"Error: error conditions",
+	"Warning: warning conditions",
+	"Notice: normal but significant condition",
+	"Informational: informational messages",
+	"Debug: debug-level messages",
+};
+
 static void print_reg_rcr(void *out)
 {
 	u8 servirity_bit_mask = 0;
 
 	servirity_bit_mask = MLX5_GET(rcr_reg, out, health_severity_bitmask);
-	printf("Health severity bitmask: 0x%x valid %d\n", servirity_bit_mask,
-	       MLX5_GET(rcr_reg, out, health_severity_bitmask_valid));
-	if (servirity_bit_mask & 0x1)
-		printf("\t\tEmergency: system is unusable\n");
-	if (servirity_bit_mask & 0x2)
-		printf("\t\tAlert: action must be taken immediately\n");
-	if (servirity_bit_mask & 0x4)
-		printf("\t\tCritical: critical conditions\n");
-	if (servirity_bit_mask & 0x8)
-		printf("\t\tError: error conditions\n");
-	if (servirity_bit_mask & 0x10)
-		printf("\t\tWarning: warning conditions\n");
-	if (servirity_bit_mask & 0x20)
-		printf("\t\tNotice: normal but significant condition\n");
-	if (servirity_bit_mask & 0x40)
-		printf("\t\tInformational: informational messages\n");
-	if (servirity_bit_mask & 0x80)
-		printf("\t\tDebug: debug-level messages\n");
+	if (json_output) {
+		json_uint("health_severity_bitmask", servirity_bit_mask);
+		json_uint("health_severity_bitmask_valid",
+			  MLX5_GET(rcr_reg, out, health_severity_bitmask_valid));
+		json_arr_begin("severities");
+	} else {
+		printf("Health severity bitmask: 0x%x valid %d\n", servirity_bit_mask,
+		       MLX5_GET(rcr_reg, out, health_severity_bitmask_valid));
+	}
+	for (int i = 0; i < 8; i++) {
+		if (!(servirity_bit_mask & (1 << i)))
+			continue;
+		if (json_output)
+			json_str(NULL, rcr_severities[i]);
+		else
+			printf("\t\t%s\n", rcr_severities[i]);
+	}
+	if (json_output)
+		json_arr_end();
 }
@@ -70,6 +70,32 @@ enum mlx5_reg_ids {
 	MLX5_REG_LAST_ENUM,
 };
 
+/* RESOURCE_DUMP register segment types */
+enum mlx5_rsc_sgmt_type {
+	/* resource segments range 0x0000 to 0xfeff */
+	MLX5_RSC_SGMT_TYPE_DEVICE_DUMP = 0x1000,
+
+	/* end resource segment range */
+	MLX5_RSC_SGMT_TYPE_NOTICE = 0xfff9,
+	MLX5_RSC_SGMT_TYPE_CMD = 0xfffa,
+	MLX5_RSC_SGMT_TYPE_TERMINATE = 0xfffb,
+	MLX5_RSC_SGMT_TYPE_ERROR = 0xfffc,
+	MLX5_RSC_SGMT_TYPE_REFERENCE = 0xfffd,
+	MLX5_RSC_SGMT_TYPE_INFO = 0xfffe,
+	MLX5_RSC_SGMT_TYPE_MENU = 0xffff,
+};
+
+/*
+ * In-place register access on the device mailbox arena, see mlx5u_mbox_get():
+ * mlx5_reg_in() returns the zeroed register inside access_register_in to build
+ * and points data_out at the register inside access_register_out, which holds
+ * the FW reply after mlx5_reg_exec(). size is the register size, no copies.
+ */
+void *mlx5_reg_in(struct mlx5u_dev *dev, u16 reg_id, int arg, int write, size_t size,
+		  void **data_out);
+int mlx5_reg_exec(struct mlx5u_dev *dev);
+
+/* Copying wrapper of the above */
 int mlx5_access_reg(struct mlx5u_dev *dev, void *data_in, int size_in, void *data_out, int size_out,
 		    u16 reg_id, int arg, int write);
 
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * Single producer, single consumer ring, see ring.h.
+ *
+ * head and tail are free running indices, each written by one side only
+ * and read by the other with acquire/release ordering, on cache lines of
+ * their own so the two sides don't bounce a line per slot. A consumer with
+ * nothing to do sleeps on an eventfd; it raises waiting first and the
+ * producer only writes the eventfd when it sees it raised, so a busy
+ * consumer costs the producer no system calls.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "mlx5ctlu.h"
+#include "ring.h"
+
+#define RING_CACHELINE 64
+
+struct mlx5u_ring {
+	u8 *slots;
+	size_t slot_size;
+	u32 mask;
+	int efd;
+
+	/* producer */
+	u32 head __attribute__((aligned(RING_CACHELINE)));
+	u64 committed;
+	u64 full;
+	u32 max_used;
+	u64 sum_used;
+
+	/* consumer */
+	u32 tail __attribute__((aligned(RING_CACHELINE)));
+
+	/* shared */
+	int waiting __attribute__((aligned(RING_CACHELINE)));
+	int closed;
+};
+
+struct mlx5u_ring *mlx5u_ring_create(u32 nslots, size_t slot_size)
+{
+	struct mlx5u_ring *r;
+	u32 n = 1;
+
+	while (n < nslots)
+		n <<= 1;
+	slot_size = (slot_size + RING_CACHELINE - 1) & ~(size_t)(RING_CACHELINE - 1);
+
+	r = aligned_alloc(RING_CACHELINE, sizeof(*r));
+	if (!r)
+		return NULL;
+	memset(r, 0, sizeof(*r));
+	r->slots = aligned_alloc(RING_CACHELINE, n * slot_size);
+	r->efd = eventfd(0, EFD_CLOEXEC);
+	if (!r->slots || r->efd < 0) {
+		err_msg("ring: failed to allocate %u slots of %zu bytes: %s\n",
+			n, slot_size, strerror(errno));
+		mlx5u_ring_free(r);
+		return NULL;
+	}
+	r->slot_size = slot_size;
+	r->mask = n - 1;
+	return r;
+}
+
+void mlx5u_ring_free(struct mlx5u_ring *r)
+{
+	if (!r)
+		return;
+	if (r->efd >= 0)
+		close(r->efd);
+	free(r->slots);
+	free(r);
+}
+
+static void *slot(struct mlx5u_ring *r, u32 i)
+{
+	return r->slots + (size_t)(i & r->mask) * r->slot_size;
+}
+
+static void wake(struct mlx5u_ring *r)
+{
+	u64 one = 1;
+
+	if (write(r->efd, &one, sizeof(one)) != sizeof(one))
+		dbg_msg(1, "ring: eventfd write failed: %s\n", strerror(errno));
+}
+
+void *mlx5u_ring_reserve(struct mlx5u_ring *r)
+{
+	u32 tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (r->head - tail > r->mask) {
+		r->full++;
+		return NULL;
+	}
+	return slot(r, r->head);
+}
+
+void mlx5u_ring_commit(struct mlx5u_ring *r)
+{
+	u32 used = r->head + 1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+	r->committed++;
+	r->sum_used += used;
+	if (used > r->max_used)
+		r->max_used = used;
+
+	/* pairs with the fence in mlx5u_ring_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->waiting, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&r->waiting, 0, __ATOMIC_RELAXED))
+		wake(r);
+}
+
+void mlx5u_ring_close(struct mlx5u_ring *r)
+{
+	__atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+	wake(r);
+}
+
+void *mlx5u_ring_peek(struct mlx5u_ring *r)
+{
+	u32 head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	return head != r->tail ? slot(r, r->tail) : NULL;
+}
+
+void *mlx5u_ring_wait(struct mlx5u_ring *r)
+{
+	void *s;
+	u64 cnt;
+
+	for (;;) {
+		s = mlx5u_ring_peek(r);
+		if (s)
+			return s;
+		if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE))
+			return mlx5u_ring_peek(r);
+
+		__atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (mlx5u_ring_peek(r) || __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		/* a stale wakeup only makes another round */
+		if (read(r->efd, &cnt, sizeof(cnt)) < 0 && errno != EINTR) {
+			err_msg("ring: eventfd read failed: %s\n", strerror(errno));
+			return NULL;
+		}
+	}
+}
+
+void mlx5u_ring_release(struct mlx5u_ring *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+u32 mlx5u_ring_used(struct mlx5u_ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+void mlx5u_ring_get_stats(struct mlx5u_ring *r, struct mlx5u_ring_stats *st)
+{
+	st->committed = r->committed;
+	st->full = r->full;
+	st->nslots = r->mask + 1;
+	st->max_used = r->max_used;
+	st->sum_used = r->sum_used;
+}
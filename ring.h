@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_RING_H__
+#define __MLX5CTL_RING_H__
+
+#include <stddef.h>
+#include "ifcutil.h"
+
+/*
+ * Single producer, single consumer ring of fixed size slots.
+ *
+ * The slots are allocated once and filled in place: the producer reserves
+ * the next free slot, e.g. as the output mailbox of a FW command, and
+ * commits it, the consumer takes the oldest committed slot and releases it
+ * back when done. Neither side takes a lock, a full ring fails the reserve
+ * instead of blocking the producer. The consumer may block until there is
+ * a slot or the producer closed the ring.
+ */
+
+struct mlx5u_ring;
+
+struct mlx5u_ring_stats {
+	u64 committed;
+	u64 full;     /* reserves that failed on a full ring */
+	u32 nslots;
+	u32 max_used; /* highest occupancy seen at a commit */
+	u64 sum_used; /* occupancy summed over the commits, for the mean */
+};
+
+/* nslots is rounded up to a power of 2 */
+struct mlx5u_ring *mlx5u_ring_create(u32 nslots, size_t slot_size);
+void mlx5u_ring_free(struct mlx5u_ring *r);
+
+/* Producer: the slot to fill, NULL when the ring is full */
+void *mlx5u_ring_reserve(struct mlx5u_ring *r);
+void mlx5u_ring_commit(struct mlx5u_ring *r);
+/* No more commits, a waiting consumer returns once the ring is empty */
+void mlx5u_ring_close(struct mlx5u_ring *r);
+
+/* Consumer: the oldest committed slot, NULL when empty */
+void *mlx5u_ring_peek(struct mlx5u_ring *r);
+/* Blocks for a slot, NULL once the ring is closed and empty */
+void *mlx5u_ring_wait(struct mlx5u_ring *r);
+void mlx5u_ring_release(struct mlx5u_ring *r);
+
+u32 mlx5u_ring_used(struct mlx5u_ring *r);
+void mlx5u_ring_get_stats(struct mlx5u_ring *r, struct mlx5u_ring_stats *st);
+
+#endif /* __MLX5CTL_RING_H__ */
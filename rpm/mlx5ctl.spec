@@ -9,6 +9,7 @@ Source0: mlx5ctl-%{APP_VERSION}.tar.gz
 
 BuildRequires: binutils
 BuildRequires: cmake >= 3.18
+BuildRequires: python3
 
 # Ninja was introduced in FC23
 BuildRequires: ninja-build
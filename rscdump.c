@@ -13,12 +13,17 @@
 #include "mlx5_ifc.h"
 #include "reg.h"
 #include "mlx5lib.h"
+#include "sched.h"
+#include "hexdump.h"
+#include "json.h"
 
 static void print_rsc_dump_reg(void *rscdmp)
 {
-#define print_fld(fld) printf("\t%s %d\n", #fld, MLX5_GET(resource_dump, rscdmp, fld))
-#define print_fldx(fld) printf("\t%s %x\n", #fld, MLX5_GET(resource_dump, rscdmp, fld))
-#define print_fld64(fld) printf("\t%s 0x%lx\n", #fld, MLX5_GET64(resource_dump, rscdmp, fld))
+	/* debug output, next to dbg_msg() */
+	FILE *f = json_output ? stderr : stdout;
+#define print_fld(fld) fprintf(f, "\t%s %d\n", #fld, MLX5_GET(resource_dump, rscdmp, fld))
+#define print_fldx(fld) fprintf(f, "\t%s %x\n", #fld, MLX5_GET(resource_dump, rscdmp, fld))
+#define print_fld64(fld) fprintf(f, "\t%s 0x%lx\n", #fld, MLX5_GET64(resource_dump, rscdmp, fld))
 	print_fldx(segment_type);
 	print_fld(seq_num);
 	print_fld(more_dump);
@@ -181,7 +186,8 @@ static void *rscdump_collect_umem(struct mlx5u_dev *dev, Args args,
 			 iter_size, remain, umem_buff->size - remain, err > 0);
 
 		// copy from data into temp buffer
-		hexdump(umem_buff->buff, iter_size);
+		if (!json_output) /* the parsed segments carry the same bytes */
+			hexdump(umem_buff->buff, iter_size);
 		memcpy(temp_buffer + total, umem_buff->buff, iter_size);
 		total = total + iter_size;
 		if (remain == 0)
@@ -191,20 +197,6 @@ static void *rscdump_collect_umem(struct mlx5u_dev *dev, Args args,
 	return temp_buffer;
 }
 
-enum mlx5_rsc_sgmt_type {
-	/* resource segments range 0x0000 to 0xfeff */
-	MLX5_RSC_SGMT_TYPE_DEVICE_DUMP = 0x1000,
-
-	/* end resource segment range */
-	MLX5_RSC_SGMT_TYPE_NOTICE = 0xfff9,
-	MLX5_RSC_SGMT_TYPE_CMD = 0xfffa,
-	MLX5_RSC_SGMT_TYPE_TERMINATE = 0xfffb,
-	MLX5_RSC_SGMT_TYPE_ERROR = 0xfffc,
-	MLX5_RSC_SGMT_TYPE_REFERENCE = 0xfffd,
-	MLX5_RSC_SGMT_TYPE_INFO = 0xfffe,
-	MLX5_RSC_SGMT_TYPE_MENU = 0xffff,
-};
-
 static const char *sgmt_type2str(enum mlx5_rsc_sgmt_type sgmt_type)
 {
 	switch (sgmt_type) {
@@ -236,10 +228,45 @@ static int mlx5_rsc_sgmt_type_by_name(char *name)
 	return -1; /* Not implemented */
 }
 
+static void print_menu_record_json(void *record)
+{
+#define json_fld(fld) json_uint(#fld, MLX5_GET(resource_dump_menu_record, record, fld))
+#define json_name(fld) \
+	json_strn(#fld, MLX5_ADDR_OF(resource_dump_menu_record, record, fld[0]), \
+		  MLX5_FLD_SZ_BYTES(resource_dump_menu_record, fld))
+	json_obj_begin(NULL);
+	json_fld(segment_type);
+	json_str("segment_type_name",
+		 sgmt_type2str(MLX5_GET(resource_dump_menu_record, record, segment_type)));
+	json_fld(support_index1);
+	json_fld(must_have_index1);
+	json_fld(support_index2);
+	json_fld(must_have_index2);
+	json_fld(support_num_of_obj1);
+	json_fld(must_have_num_of_obj1);
+	json_fld(support_num_of_obj2);
+	json_fld(must_have_num_of_obj2);
+	json_fld(num_of_obj1_supports_all);
+	json_fld(num_of_obj1_supports_active);
+	json_fld(num_of_obj2_supports_all);
+	json_fld(num_of_obj2_supports_active);
+	json_name(segment_name);
+	json_name(index1_name);
+	json_name(index2_name);
+	json_obj_end();
+#undef json_name
+#undef json_fld
+}
+
 static void print_menu_record(void *record)
 {
 	int seg_type = MLX5_GET(resource_dump_menu_record, record, segment_type);
 
+	if (json_output) {
+		print_menu_record_json(record);
+		return;
+	}
+
 #define print_fld(fld) printf("\t%s: %d\n", #fld, MLX5_GET(resource_dump_menu_record, record, fld))
 //#define print_fldx(fld) printf("\t%s: 0x%x\n", #fld, MLX5_GET(resource_dump_menu_record, record, fld))
 
@@ -273,12 +300,17 @@ static void parse_menu_segment(void *menu)
 	info_msg("Resource dump menu size %d num of records %d\n", size, num_records);
 
 	records = MLX5_ADDR_OF(resource_dump_menu_segment, menu, record[0]);
+	if (json_output)
+		json_arr_begin("records");
 	for (int i = 0; i < num_records; i++) {
 		void *record = records + i * MLX5_ST_SZ_BYTES(resource_dump_menu_record);
 
-		printf("Menu Record %d\n", i);
+		if (!json_output)
+			printf("Menu Record %d\n", i);
 		print_menu_record(record);
 	}
+	if (json_output)
+		json_arr_end();
 }
 
 struct sgmnt_hdr {
@@ -298,6 +330,11 @@ static void parse_err_segment(void *segment)
 
 	memcpy(str, MLX5_ADDR_OF(resource_dump_error_segment, segment, error),
 		MLX5_FLD_SZ_BYTES(resource_dump_error_segment, error));
+	if (json_output) {
+		json_uint("syndrome", MLX5_GET(resource_dump_error_segment, segment, syndrome_id));
+		json_str("error", str);
+		return;
+	}
 	printf("\terror: syndrome 0x%x, %s\n",
 		MLX5_GET(resource_dump_error_segment, segment, syndrome_id),
 		str);
@@ -309,6 +346,11 @@ static void parse_notice_segment(void *segment)
 
 	memcpy(str, MLX5_ADDR_OF(resource_dump_notice_segment, segment, notice),
 		MLX5_FLD_SZ_BYTES(resource_dump_notice_segment, notice));
+	if (json_output) {
+		json_uint("syndrome", MLX5_GET(resource_dump_notice_segment, segment, syndrome_id));
+		json_str("notice", str);
+		return;
+	}
 	printf("\tnotice: syndrome 0x%x, %s\n",
 		MLX5_GET(resource_dump_notice_segment, segment, syndrome_id),
 		str);
@@ -316,6 +358,16 @@ static void parse_notice_segment(void *segment)
 
 static void parse_reference_segment(void *segment)
 {
+	if (json_output) {
+#define json_fld(fld) json_uint(#fld, MLX5_GET(resource_dump_reference_segment, segment, fld))
+		json_fld(reference_segment);
+		json_fld(index1);
+		json_fld(index2);
+		json_fld(num_of_obj1);
+		json_fld(num_of_obj2);
+#undef json_fld
+		return;
+	}
 	printf("\treference_segment: 0x%x, index1 0x%x, index2 0x%x, num_of_obj1 %d, num_of_obj2 %d\n",
 		MLX5_GET(resource_dump_reference_segment, segment, reference_segment),
 		MLX5_GET(resource_dump_reference_segment, segment, index1),
@@ -329,17 +381,38 @@ static void print_sgmt_header(void *hdr)
 	struct sgmnt_hdr sgmnt_hdr = {};
 
 	get_sgmnt_hdr(hdr, &sgmnt_hdr);
+	if (json_output) {
+		/* a record per segment, the rest of the segment adds to it */
+		json_rec_begin();
+		json_str("segment", sgmt_type2str(sgmnt_hdr.segment_type));
+		json_uint("type", sgmnt_hdr.segment_type);
+		json_uint("length", sgmnt_hdr.len);
+		return;
+	}
 	info_msg("%s Segment: type 0x%x, length %d\n",
 		 sgmt_type2str(sgmnt_hdr.segment_type),
 		 sgmnt_hdr.segment_type,
 		 sgmnt_hdr.len);
 }
 
+static int parse_segment_body(void *segment, struct sgmnt_hdr *hdr);
+
 static int parse_segment(void *segment) {
 	struct sgmnt_hdr sgmnt_hdr = {};
+	int ret;
 
 	get_sgmnt_hdr(segment, &sgmnt_hdr);
 	print_sgmt_header(segment);
+	ret = parse_segment_body(segment, &sgmnt_hdr);
+	if (json_output)
+		json_rec_end();
+	return ret;
+}
+
+static int parse_segment_body(void *segment, struct sgmnt_hdr *hdr)
+{
+	struct sgmnt_hdr sgmnt_hdr = *hdr;
+
 	switch (sgmnt_hdr.segment_type) {
 		case MLX5_RSC_SGMT_TYPE_TERMINATE:
 			info_msg("end: %s\n", sgmt_type2str(sgmnt_hdr.segment_type));
@@ -363,9 +436,14 @@ static int parse_segment(void *segment) {
 	if (sgmnt_hdr.segment_type > 0xfeff) /* Not a  resource segment */
 			return 0;
 
-	info_msg("\tindex1 0x%x, index2 0x%x\n",
-		MLX5_GET(resource_dump_resource_segment, segment, index1),
-		MLX5_GET(resource_dump_resource_segment, segment, index2));
+	if (json_output) {
+		json_uint("index1", MLX5_GET(resource_dump_resource_segment, segment, index1));
+		json_uint("index2", MLX5_GET(resource_dump_resource_segment, segment, index2));
+	} else {
+		info_msg("\tindex1 0x%x, index2 0x%x\n",
+			 MLX5_GET(resource_dump_resource_segment, segment, index1),
+			 MLX5_GET(resource_dump_resource_segment, segment, index2));
+	}
 	hexdump(MLX5_ADDR_OF(resource_dump_resource_segment, segment, payload),
 		sgmnt_hdr.len - MLX5_ST_SZ_BYTES(resource_dump_resource_segment));
 	return 0;
@@ -377,20 +455,41 @@ static void parse_resource_dump(void *data, int size)
 
 	info_msg("Resource dump size %d\n", size);
 	print_sgmt_header(info);
-	printf("\tdump_version %d, hw_version %d, fw_version 0%x\n",
-		 MLX5_GET(resource_dump_info_segment, info, dump_version),
-		 MLX5_GET(resource_dump_info_segment, info, hw_version),
-		 MLX5_GET(resource_dump_info_segment, info, fw_version));
+	if (json_output) {
+#define json_fld(fld) json_uint(#fld, MLX5_GET(resource_dump_info_segment, info, fld))
+		json_fld(dump_version);
+		json_fld(hw_version);
+		json_fld(fw_version);
+#undef json_fld
+		json_rec_end();
+	} else {
+		printf("\tdump_version %d, hw_version %d, fw_version 0%x\n",
+		       MLX5_GET(resource_dump_info_segment, info, dump_version),
+		       MLX5_GET(resource_dump_info_segment, info, hw_version),
+		       MLX5_GET(resource_dump_info_segment, info, fw_version));
+	}
 
 	void *cmd = MLX5_ADDR_OF(resource_dump_response, data, cmd);
 	print_sgmt_header(cmd);
-	printf("\tsegment_called 0x%x, vhca_id 0x%x, index1 0x%x, index2 0x%x, num_of_obj1 %d, num_of_obj2 %d\n",
-		 MLX5_GET(resource_dump_command_segment, cmd, segment_called),
-		 MLX5_GET(resource_dump_command_segment, cmd, vhca_id),
-		 MLX5_GET(resource_dump_command_segment, cmd, index1),
-		 MLX5_GET(resource_dump_command_segment, cmd, index2),
-		 MLX5_GET(resource_dump_command_segment, cmd, num_of_obj1),
-		 MLX5_GET(resource_dump_command_segment, cmd, num_of_obj2));
+	if (json_output) {
+#define json_fld(fld) json_uint(#fld, MLX5_GET(resource_dump_command_segment, cmd, fld))
+		json_fld(segment_called);
+		json_fld(vhca_id);
+		json_fld(index1);
+		json_fld(index2);
+		json_fld(num_of_obj1);
+		json_fld(num_of_obj2);
+#undef json_fld
+		json_rec_end();
+	} else {
+		printf("\tsegment_called 0x%x, vhca_id 0x%x, index1 0x%x, index2 0x%x, num_of_obj1 %d, num_of_obj2 %d\n",
+		       MLX5_GET(resource_dump_command_segment, cmd, segment_called),
+		       MLX5_GET(resource_dump_command_segment, cmd, vhca_id),
+		       MLX5_GET(resource_dump_command_segment, cmd, index1),
+		       MLX5_GET(resource_dump_command_segment, cmd, index2),
+		       MLX5_GET(resource_dump_command_segment, cmd, num_of_obj1),
+		       MLX5_GET(resource_dump_command_segment, cmd, num_of_obj2));
+	}
 
 	if (size < MLX5_ST_SZ_BYTES(resource_dump_response) + MLX5_ST_SZ_BYTES(resource_dump_terminate_segment))
 		return;
@@ -496,8 +595,9 @@ int do_rscdump(struct mlx5u_dev *dev, int argc, char *argv[])
 	if (args.type < 0)
 		args.type = MLX5_RSC_SGMT_TYPE_MENU;
 
-	printf("umem %d, type 0x%x, index1 0x%x, index2 0x%x, vhca_id=0x%x\n",
-	       args.umem, args.type, args.index1, args.index2, args.vhca_id);
+	if (!json_output)
+		printf("umem %d, type 0x%x, index1 0x%x, index2 0x%x, vhca_id=0x%x\n",
+		       args.umem, args.type, args.index1, args.index2, args.vhca_id);
 
 	if (args.umem) {
 		size_t umem_buff_size = args.umem * 1024;
@@ -514,6 +614,8 @@ int do_rscdump(struct mlx5u_dev *dev, int argc, char *argv[])
 		}
 	}
 
+	/* chunked dumps yield to interactive queries and polling */
+	mlx5u_sched_set_class(MLX5U_SCHED_BULK);
 	if (!strcmp(argv[0], "rscdump"))
 		mlx5_rsc_dump(dev, args);
 	else if (!strcmp(argv[0], "coredump"))
@@ -552,7 +654,15 @@ static void mlx5_core_dump(struct mlx5u_dev *dev)
 		err_msg("Failed to access core dump err %d\n", err);
 		return;
 	}
+	if (json_output) {
+		json_rec_begin();
+		json_uint("core_dump_size", MLX5_GET(core_dump_reg, out, size));
+		json_uint("cookie", MLX5_GET64(core_dump_reg, out, cookie));
+		json_uint("more_dump", MLX5_GET(core_dump_reg, out, more_dump));
+	}
 	hexdump(umem_buff->buff, MLX5_GET(core_dump_reg, out, size));
+	if (json_output)
+		json_rec_end();
 	info_msg("Core dump done\n");
 	info_msg("Core dump size %d\n", MLX5_GET(core_dump_reg, out, size));
 	info_msg("Core dump address 0x%lx\n", MLX5_GET64(core_dump_reg, out, address));
@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * FW command scheduler, see sched.h.
+ *
+ * One struct sched_shm per device, mapped from <runtime dir>/mlx5ctl-sched-
+ * <fwctl name>.<uid> (anonymous for the simulator, still shared with forked
+ * mlx5ctld workers). A robust process shared mutex guards it, a process that
+ * dies holding it doesn't wedge the others. In-flight and waiting commands
+ * are counted per pid so the ones of a dead process can be dropped.
+ *
+ * Each process keeps its --sched policy in its slot, the one in effect is
+ * the strictest of the live ones: a process asking for more doesn't lift the
+ * budget of the others, and the budget eases again when the strict one
+ * exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "cmdstats.h"
+#include "transport.h"
+#include "sched.h"
+
+#define SCHED_MAGIC 0x6d6c7873 /* "mlxs" */
+#define SCHED_VERSION 2
+#define SCHED_PIDS 64
+/* waiters for in-flight slots also look for dead processes this often */
+#define SCHED_RECHECK_NS (10 * 1000000ull)
+
+struct sched_shm {
+	u32 magic;
+	u32 version;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* the strictest policy of the processes attached */
+	u32 rate;
+	u32 burst;
+	u32 inflight_max;
+	double tokens;
+	u64 last_ns;
+	struct sched_proc {
+		pid_t pid;
+		u32 inflight;
+		u32 waiting[MLX5U_SCHED_CLASSES];
+		/* its policy */
+		u32 rate;
+		u32 burst;
+		u32 inflight_max;
+	} procs[SCHED_PIDS];
+};
+
+struct mlx5u_sched {
+	struct sched_shm *shm;
+	pid_t pid;
+	int proc; /* our procs[] slot, -1 if none */
+};
+
+struct class_stats {
+	u64 admitted;
+	u64 throttled;
+	u64 rejected;
+	u64 wait_ns;
+	u64 max_wait_ns;
+};
+
+static const char *class_names[MLX5U_SCHED_CLASSES] = {
+	[MLX5U_SCHED_INTERACTIVE] = "interactive",
+	[MLX5U_SCHED_POLL] = "poll",
+	[MLX5U_SCHED_BULK] = "bulk",
+};
+
+static struct {
+	u32 rate;
+	u32 burst;
+	u32 inflight;
+	u32 max_wait_ms;
+} policy;
+static int enabled;
+static __thread int cur_class;
+
+static pthread_mutex_t attach_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct class_stats stats[MLX5U_SCHED_CLASSES];
+
+int mlx5u_sched_config(const char *opts)
+{
+	char *str, *tok, *save = NULL;
+	int err = 0;
+
+	str = strdup(opts);
+	if (!str)
+		return -1;
+	for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *val = strchr(tok, '=');
+		unsigned long v;
+		char *end;
+
+		if (!val) {
+			err = -1;
+			break;
+		}
+		*val++ = '\0';
+		v = strtoul(val, &end, 0);
+		if (*end || end == val || v > UINT32_MAX) {
+			err = -1;
+			break;
+		}
+		if (!strcmp(tok, "rate"))
+			policy.rate = v;
+		else if (!strcmp(tok, "burst"))
+			policy.burst = v;
+		else if (!strcmp(tok, "inflight"))
+			policy.inflight = v;
+		else if (!strcmp(tok, "max_wait"))
+			policy.max_wait_ms = v;
+		else {
+			err = -1;
+			break;
+		}
+	}
+	if (err)
+		err_msg("sched: invalid option \"%s\", expected rate=<rps>,burst=<n>,inflight=<n>,max_wait=<ms>\n",
+			tok);
+	free(str);
+	if (err)
+		return err;
+
+	/* a tenth of a second worth of commands unless told otherwise */
+	if (!policy.burst)
+		policy.burst = policy.rate / 10 ? : 1;
+	enabled = 1;
+	return 0;
+}
+
+int mlx5u_sched_enabled(void)
+{
+	return enabled;
+}
+
+int mlx5u_sched_set_class(int cls)
+{
+	int prev = cur_class;
+
+	if (cls >= 0 && cls < MLX5U_SCHED_CLASSES)
+		cur_class = cls;
+	return prev;
+}
+
+int mlx5u_sched_get_class(void)
+{
+	return cur_class;
+}
+
+static void shm_lock(struct sched_shm *s)
+{
+	if (pthread_mutex_lock(&s->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&s->lock);
+}
+
+static void shm_init(struct sched_shm *s)
+{
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+
+	memset(s, 0, sizeof(*s));
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&s->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	s->version = SCHED_VERSION;
+	s->magic = SCHED_MAGIC;
+}
+
+static struct sched_shm *shm_map(struct mlx5u_dev *dev)
+{
+	const char *name = strrchr(dev->devname, '/');
+	struct sched_shm *s;
+	char path[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	if (dev->fd < 0) {
+		s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (s == MAP_FAILED)
+			return NULL;
+		shm_init(s);
+		return s;
+	}
+
+	snprintf(path, sizeof(path), "%s/mlx5ctl-sched-%s.%u", mlx5u_cache_dir(),
+		 name ? name + 1 : dev->devname, (unsigned int)getuid());
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		err_msg("sched: can't open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	/* serializes the first initialization, the mutex doesn't exist yet */
+	flock(fd, LOCK_EX);
+	s = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_uid == getuid() &&
+	    (st.st_size >= sizeof(*s) || !ftruncate(fd, sizeof(*s))))
+		s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (s != MAP_FAILED && (s->magic != SCHED_MAGIC || s->version != SCHED_VERSION))
+		shm_init(s);
+	flock(fd, LOCK_UN);
+	close(fd);
+	if (s == MAP_FAILED) {
+		err_msg("sched: can't map %s\n", path);
+		return NULL;
+	}
+	dbg_msg(1, "sched: %s attached to %s\n", dev->devname, path);
+	return s;
+}
+
+static struct sched_proc *proc_get(struct mlx5u_sched *sc);
+static u32 sched_load(struct sched_shm *s, int cls, int reap, int *higher);
+
+/* 0 is unlimited, the smallest limit wins */
+static u32 stricter(u32 a, u32 b)
+{
+	if (!a || !b)
+		return a ? a : b;
+	return a < b ? a : b;
+}
+
+/* The strictest policy of the processes in procs[], shm locked */
+static void policy_update(struct sched_shm *s)
+{
+	u32 rate = 0, burst = 0, inflight = 0;
+	int n = 0;
+
+	for (int i = 0; i < SCHED_PIDS; i++) {
+		struct sched_proc *p = &s->procs[i];
+
+		if (!p->pid)
+			continue;
+		rate = stricter(rate, p->rate);
+		burst = stricter(burst, p->burst);
+		inflight = stricter(inflight, p->inflight_max);
+		n++;
+	}
+	if (!n)
+		return;
+	s->rate = rate;
+	s->burst = burst;
+	s->inflight_max = inflight;
+	if (s->tokens > s->burst)
+		s->tokens = s->burst;
+}
+
+static struct mlx5u_sched *sched_get(struct mlx5u_dev *dev)
+{
+	struct mlx5u_sched *sc;
+	struct sched_shm *s;
+	int higher;
+
+	pthread_mutex_lock(&attach_lock);
+	sc = dev->sched;
+	if (sc)
+		goto out;
+	s = shm_map(dev);
+	if (!s)
+		goto out;
+	sc = calloc(1, sizeof(*sc));
+	if (!sc) {
+		munmap(s, sizeof(*s));
+		goto out;
+	}
+	sc->shm = s;
+	sc->proc = -1;
+
+	shm_lock(s);
+	/* the policy of a process that died doesn't count */
+	sched_load(s, 0, 1, &higher);
+	if (!proc_get(sc)) {
+		/* not tracked, at least as strict as asked for */
+		s->rate = stricter(s->rate, policy.rate);
+		s->burst = stricter(s->burst, policy.burst);
+		s->inflight_max = stricter(s->inflight_max, policy.inflight);
+	}
+	if (s->rate != policy.rate || s->burst != policy.burst ||
+	    s->inflight_max != policy.inflight)
+		info_msg("sched: %s: another process set a stricter policy, rate %u/s burst %u inflight %u in effect\n",
+			 dev->devname, s->rate, s->burst, s->inflight_max);
+	pthread_mutex_unlock(&s->lock);
+	dev->sched = sc;
+out:
+	pthread_mutex_unlock(&attach_lock);
+	return sc;
+}
+
+static int pid_alive(pid_t pid)
+{
+	return !kill(pid, 0) || errno != ESRCH;
+}
+
+static void proc_reset(struct sched_proc *p, pid_t pid)
+{
+	memset(p, 0, sizeof(*p));
+	p->pid = pid;
+}
+
+/* Our counters, shm locked. Forked children get a slot of their own. */
+static struct sched_proc *proc_get(struct mlx5u_sched *sc)
+{
+	struct sched_shm *s = sc->shm;
+	pid_t pid = getpid();
+	int free_slot = -1;
+
+	if (sc->pid == pid && sc->proc >= 0 && s->procs[sc->proc].pid == pid)
+		return &s->procs[sc->proc];
+
+	for (int i = 0; i < SCHED_PIDS; i++) {
+		if (s->procs[i].pid == pid) {
+			free_slot = i;
+			break;
+		}
+		if (free_slot < 0 && (!s->procs[i].pid || !pid_alive(s->procs[i].pid)))
+			free_slot = i;
+	}
+	if (free_slot < 0)
+		return NULL; /* not tracked, the others can't see us */
+	if (s->procs[free_slot].pid != pid) {
+		struct sched_proc *p = &s->procs[free_slot];
+
+		proc_reset(p, pid);
+		p->rate = policy.rate;
+		p->burst = policy.burst;
+		p->inflight_max = policy.inflight;
+		policy_update(s);
+	}
+	sc->pid = pid;
+	sc->proc = free_slot;
+	return &s->procs[free_slot];
+}
+
+/*
+ * In flight commands in total and whether a more important class is waiting.
+ * reap drops processes that died with commands outstanding.
+ */
+static u32 sched_load(struct sched_shm *s, int cls, int reap, int *higher)
+{
+	int reaped = 0;
+	u32 n = 0;
+
+	*higher = 0;
+	for (int i = 0; i < SCHED_PIDS; i++) {
+		struct sched_proc *p = &s->procs[i];
+
+		if (!p->pid)
+			continue;
+		if (reap && !pid_alive(p->pid)) {
+			proc_reset(p, 0);
+			reaped = 1;
+			continue;
+		}
+		n += p->inflight;
+		for (int c = 0; c < cls; c++)
+			*higher |= p->waiting[c] != 0;
+	}
+	/* a strict process that died no longer holds the others back */
+	if (reaped)
+		policy_update(s);
+	return n;
+}
+
+static void refill(struct sched_shm *s, u64 now)
+{
+	if (!s->rate)
+		return;
+	/* first user, or a mapping that outlived a reboot */
+	if (!s->last_ns || now < s->last_ns) {
+		s->tokens = s->burst;
+		s->last_ns = now;
+		return;
+	}
+	s->tokens += (double)(now - s->last_ns) * s->rate / 1e9;
+	if (s->tokens > s->burst)
+		s->tokens = s->burst;
+	s->last_ns = now;
+}
+
+static void cond_wait_ns(struct sched_shm *s, u64 now, u64 wait)
+{
+	struct timespec ts;
+	u64 t = now + wait;
+
+	ts.tv_sec = t / 1000000000ull;
+	ts.tv_nsec = t % 1000000000ull;
+	if (pthread_cond_timedwait(&s->cond, &s->lock, &ts) == EOWNERDEAD)
+		pthread_mutex_consistent(&s->lock);
+}
+
+static void account(int cls, int throttled, int rejected, u64 wait_ns)
+{
+	struct class_stats *st = &stats[cls];
+
+	pthread_mutex_lock(&stats_lock);
+	if (rejected)
+		st->rejected++;
+	else
+		st->admitted++;
+	st->throttled += throttled;
+	st->wait_ns += wait_ns;
+	if (wait_ns > st->max_wait_ns)
+		st->max_wait_ns = wait_ns;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+int mlx5u_sched_acquire(struct mlx5u_dev *dev)
+{
+	struct mlx5u_sched *sc = sched_get(dev);
+	int cls = cur_class, throttled = 0, err = 0;
+	u64 start, now, deadline = 0;
+	struct sched_proc *me;
+	struct sched_shm *s;
+
+	if (!sc)
+		return 0; /* no shared state, don't hold up the command */
+	s = sc->shm;
+
+	start = now = mlx5u_stats_now_ns();
+	if (policy.max_wait_ms)
+		deadline = start + policy.max_wait_ms * 1000000ull;
+
+	shm_lock(s);
+	me = proc_get(sc);
+	if (me)
+		me->waiting[cls]++;
+	for (;;) {
+		u64 wait = SCHED_RECHECK_NS;
+		int higher;
+		u32 inflight;
+
+		refill(s, now);
+		inflight = sched_load(s, cls, throttled, &higher);
+		if (!higher && (!s->rate || s->tokens >= 1.0) &&
+		    (!s->inflight_max || inflight < s->inflight_max))
+			break;
+		if (deadline && now >= deadline) {
+			err = EBUSY;
+			break;
+		}
+		throttled = 1;
+		if (s->rate && s->tokens < 1.0)
+			wait = (1.0 - s->tokens) * 1e9 / s->rate + 1;
+		if (deadline && now + wait > deadline)
+			wait = deadline - now;
+		cond_wait_ns(s, now, wait);
+		now = mlx5u_stats_now_ns();
+	}
+	if (me)
+		me->waiting[cls]--;
+	if (!err && s->rate)
+		s->tokens -= 1.0;
+	if (!err && me)
+		me->inflight++;
+	/* lower classes may be next */
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+
+	account(cls, throttled, err, now - start);
+	if (err) {
+		dbg_msg(1, "sched: %s command rejected after %llu us\n", class_names[cls],
+			(unsigned long long)(now - start) / 1000);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void mlx5u_sched_release(struct mlx5u_dev *dev)
+{
+	struct mlx5u_sched *sc = dev->sched;
+	struct sched_proc *me;
+	struct sched_shm *s;
+
+	if (!sc)
+		return;
+	s = sc->shm;
+	shm_lock(s);
+	me = proc_get(sc);
+	if (me && me->inflight)
+		me->inflight--;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void mlx5u_sched_free(struct mlx5u_dev *dev)
+{
+	struct mlx5u_sched *sc = dev->sched;
+	struct sched_shm *s;
+
+	if (!sc)
+		return;
+	s = sc->shm;
+	shm_lock(s);
+	if (sc->proc >= 0 && s->procs[sc->proc].pid == getpid() &&
+	    !s->procs[sc->proc].inflight)
+		proc_reset(&s->procs[sc->proc], 0);
+	policy_update(s);
+	pthread_mutex_unlock(&s->lock);
+	munmap(s, sizeof(*s));
+	free(sc);
+	dev->sched = NULL;
+}
+
+void mlx5u_sched_dump(FILE *f)
+{
+	struct class_stats snap[MLX5U_SCHED_CLASSES];
+
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&stats_lock);
+	memcpy(snap, stats, sizeof(snap));
+	pthread_mutex_unlock(&stats_lock);
+
+	fprintf(f, "FW command scheduler: rate %u/s burst %u inflight %u max_wait %u ms (0: unlimited)\n",
+		policy.rate, policy.burst, policy.inflight, policy.max_wait_ms);
+	fprintf(f, "%-12s %10s %10s %10s %12s %12s\n", "class", "admitted", "throttled",
+		"rejected", "avg_wait_us", "max_wait_us");
+	for (int c = 0; c < MLX5U_SCHED_CLASSES; c++) {
+		struct class_stats *st = &snap[c];
+		u64 n = st->admitted + st->rejected;
+
+		if (!n)
+			continue;
+		fprintf(f, "%-12s %10llu %10llu %10llu %12.1f %12.1f\n", class_names[c],
+			(unsigned long long)st->admitted, (unsigned long long)st->throttled,
+			(unsigned long long)st->rejected,
+			st->wait_ns / 1000.0 / n, st->max_wait_ns / 1000.0);
+	}
+}
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_SCHED_H__
+#define __MLX5CTL_SCHED_H__
+
+#include <stdio.h>
+#include "ifcutil.h"
+
+/*
+ * FW command scheduler.
+ *
+ * With --sched (or $MLX5CTL_SCHED) every FW command of a device goes through
+ * a token bucket of rate commands per second with a burst allowance, and at
+ * most inflight commands are outstanding. The state lives in a shared mapping
+ * under the runtime dir, so all mlx5ctl processes on a device (monitors,
+ * mlx5ctld workers) draw from the same budget.
+ *
+ * Waiting commands are served by class, a class only runs when no command of
+ * a more important class is waiting. With max_wait a command that can't be
+ * admitted in time fails with EBUSY instead of queueing behind the others.
+ */
+
+enum mlx5u_sched_class {
+	MLX5U_SCHED_INTERACTIVE, /* default: one shot queries */
+	MLX5U_SCHED_POLL,        /* periodic sampling */
+	MLX5U_SCHED_BULK,        /* rscdump/coredump chunks, object sweeps */
+	MLX5U_SCHED_CLASSES
+};
+
+struct mlx5u_dev;
+
+/* "rate=<rps>,burst=<n>,inflight=<n>,max_wait=<ms>", 0 is unlimited */
+int mlx5u_sched_config(const char *opts);
+int mlx5u_sched_enabled(void);
+
+/* Class of the commands the calling thread issues, returns the previous one */
+int mlx5u_sched_set_class(int cls);
+int mlx5u_sched_get_class(void);
+
+/* Around every FW command, acquire fails with errno EBUSY past max_wait */
+int mlx5u_sched_acquire(struct mlx5u_dev *dev);
+void mlx5u_sched_release(struct mlx5u_dev *dev);
+void mlx5u_sched_free(struct mlx5u_dev *dev);
+
+/* Per class admission counters of this process */
+void mlx5u_sched_dump(FILE *f);
+
+#endif /* __MLX5CTL_SCHED_H__ */
@@ -0,0 +1,314 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+
+"""Generate ifc_schema.c, the field schema of every mlx5_ifc_*_bits layout.
+
+Usage: gen_ifc_schema.py <mlx5_ifc.h> <ifc_schema.c>
+
+Each struct/union becomes a struct ifc_layout with its fields (name, bit
+offset, element width, array count and nested layout), see ifc_schema.h.
+Reserved fields are dropped. Inline unions/structs become layouts named
+"<parent>.<member>". A perfect hash maps (layout, field name) to the field
+for --fields lookups. The output also carries _Static_asserts of every layout
+size and field offset against the C definitions, so a construct this parser
+gets wrong fails the build instead of decoding garbage.
+"""
+
+import re
+import sys
+
+TOKEN = re.compile(r'[A-Za-z_]\w*|0[xX][0-9a-fA-F]+|\d+|[{}\[\];()+\-*/<>]|\S')
+
+
+class Layout:
+    def __init__(self, name, union, tag=None):
+        self.name = name
+        self.union = union
+        self.tag = tag  # C tag, None for inline layouts
+        self.fields = []  # (name, bit_off, elem_bits, count, layout or None)
+        self.size = 0
+
+
+def layout_name(tag):
+    """mlx5_ifc_<name>_bits, a few helper structs lack the _bits"""
+    return re.sub(r'^mlx5_ifc_|_bits$', '', tag)
+
+
+def strip_comments(text):
+    text = re.sub(r'/\*.*?\*/', ' ', text, flags=re.S)
+    text = re.sub(r'//[^\n]*', ' ', text)
+    return text.replace('\\\n', ' ')
+
+
+def read_defines(text):
+    defines = {}
+    for m in re.finditer(r'^\s*#\s*define\s+(\w+)\s+(.+?)\s*$', text, re.M):
+        defines[m.group(1)] = m.group(2)
+    return defines
+
+
+class Parser:
+    def __init__(self, text):
+        self.defines = read_defines(text)
+        body = re.sub(r'^\s*#.*$', ' ', text, flags=re.M)
+        self.tok = TOKEN.findall(body)
+        self.pos = 0
+        self.layouts = {}
+        self.order = []
+
+    def peek(self, n=0):
+        i = self.pos + n
+        return self.tok[i] if i < len(self.tok) else None
+
+    def next(self):
+        t = self.peek()
+        self.pos += 1
+        return t
+
+    def expect(self, t):
+        got = self.next()
+        if got != t:
+            raise SyntaxError('expected %r got %r near token %d' % (t, got, self.pos))
+
+    def eval_expr(self, toks, depth=0):
+        expr = []
+        for t in toks:
+            if re.match(r'[A-Za-z_]', t):
+                if t not in self.defines or depth > 8:
+                    raise SyntaxError('can not evaluate %r' % ' '.join(toks))
+                t = str(self.eval_expr(TOKEN.findall(self.defines[t]), depth + 1))
+            expr.append(t)
+        return int(eval(' '.join(expr), {'__builtins__': {}}))
+
+    def dims(self):
+        dims = []
+        while self.peek() == '[':
+            self.next()
+            toks = []
+            while self.peek() != ']':
+                toks.append(self.next())
+            self.next()
+            dims.append(self.eval_expr(toks) if toks else 0)
+        return dims
+
+    def add(self, layout):
+        if layout.name in self.layouts:
+            raise SyntaxError('%s defined twice' % layout.name)
+        self.layouts[layout.name] = layout
+        self.order.append(layout)
+
+    def body(self, layout):
+        off = 0
+        self.expect('{')
+        while self.peek() != '}':
+            kind = self.next()
+            if kind == 'u8':
+                name = self.next()
+                dims = self.dims()
+                self.expect(';')
+                width, count = dims[-1], 1
+                if len(dims) == 2:
+                    count = dims[0]
+                elif len(dims) != 1:
+                    raise SyntaxError('%s.%s: unsupported dims' % (layout.name, name))
+                sub = None
+            elif kind in ('struct', 'union'):
+                if self.peek() == '{':
+                    sub = Layout(None, kind == 'union')
+                    self.body(sub)
+                    name = self.next() if self.peek() not in (';', '[') else ''
+                    sub.name = '%s.%s' % (layout.name, name or '%d' % len(layout.fields))
+                    self.add(sub)
+                else:
+                    tname = self.next()
+                    sub = self.layouts.get(layout_name(tname))
+                    if sub is None:
+                        raise SyntaxError('%s: %s used before defined' % (layout.name, tname))
+                    name = self.next()
+                dims = self.dims()
+                self.expect(';')
+                width = sub.size
+                count = dims[0] if dims else 1
+                if len(dims) > 1:
+                    raise SyntaxError('%s.%s: unsupported dims' % (layout.name, name))
+            else:
+                raise SyntaxError('%s: unexpected %r' % (layout.name, kind))
+
+            if layout.union:
+                layout.size = max(layout.size, width * count)
+                foff = 0
+            else:
+                foff = off
+                off += width * count
+                layout.size = off
+            if not name.startswith('reserved'):
+                layout.fields.append((name, foff, width, count, sub))
+        self.expect('}')
+
+    def parse(self):
+        while self.peek() is not None:
+            t = self.next()
+            if t not in ('struct', 'union') or self.peek(1) != '{':
+                continue
+            tag = self.peek() or ''
+            if not tag.startswith('mlx5_ifc_'):
+                continue
+            self.next()
+            layout = Layout(layout_name(tag), t == 'union', tag)
+            self.body(layout)
+            self.expect(';')
+            self.add(layout)
+
+
+class StrTab:
+    def __init__(self):
+        self.off = {'': 0}
+        self.strs = ['']
+        self.size = 1
+
+    def add(self, s):
+        if s not in self.off:
+            self.off[s] = self.size
+            self.strs.append(s)
+            self.size += len(s) + 1
+        return self.off[s]
+
+
+FNV_BASIS = 0x811c9dc5
+FNV_PRIME = 0x01000193
+
+
+def fnv_hash(seed, layout, name):
+    """Same as ifc_hash() in ifc_decode.c"""
+    h = FNV_BASIS ^ seed
+    for b in (layout & 0xff, layout >> 8) + tuple(name.encode()):
+        h = ((h ^ b) * FNV_PRIME) & 0xffffffff
+    return h
+
+
+def perfect_hash(keys):
+    """Hash and displace: slot = hash(disp[hash(0, key) % nbuckets], key) % nslots"""
+    nbuckets = max(1, len(keys) // 4)
+    nslots = len(keys) + len(keys) // 8 + 1
+    buckets = [[] for _ in range(nbuckets)]
+    for i, key in enumerate(keys):
+        buckets[fnv_hash(0, *key) % nbuckets].append(i)
+
+    disp = [0] * nbuckets
+    slots = [None] * nslots
+    for b in sorted(range(nbuckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        for d in range(1, 0x10000):
+            pos = [fnv_hash(d, *keys[i]) % nslots for i in buckets[b]]
+            if len(set(pos)) == len(pos) and all(slots[p] is None for p in pos):
+                break
+        else:
+            raise SystemExit('no perfect hash displacement for bucket %d' % b)
+        disp[b] = d
+        for i, p in zip(buckets[b], pos):
+            slots[p] = i
+    return disp, slots
+
+
+def c_type(layout):
+    return '%s %s' % ('union' if layout.union else 'struct', layout.tag)
+
+
+def generate(parser, out):
+    layouts = sorted(parser.order, key=lambda l: l.name)
+    index = {l.name: i for i, l in enumerate(layouts)}
+    strtab = StrTab()
+    fields = []
+    rows = []
+
+    for l in layouts:
+        first = len(fields)
+        for name, off, width, count, sub in l.fields:
+            fields.append((strtab.add(name), off, width, count,
+                           index[sub.name] if sub else 'IFC_SCALAR', name, l))
+        rows.append((strtab.add(l.name), l.size, first, len(l.fields),
+                     'IFC_UNION' if l.union else 0, l.name))
+
+    if len(fields) > 0xffffffff or len(layouts) >= 0xffff:
+        raise SystemExit('schema too large')
+
+    w = out.write
+    w('// SPDX-License-Identifier: BSD-3-Clause\n')
+    w('/* Generated by scripts/gen_ifc_schema.py from mlx5_ifc.h, do not edit */\n\n')
+    w('#include <stddef.h>\n\n')
+    w('#include "ifcutil.h"\n#include "mlx5_ifc.h"\n#include "ifc_schema.h"\n\n')
+
+    w('const char ifc_strtab[] =\n')
+    line = '\t"\\0'  # offset 0 is ""
+    for s in strtab.strs[1:]:
+        piece = s + '\\0'
+        if len(line) + len(piece) > 76:
+            w(line + '"\n')
+            line = '\t"'
+        line += piece
+    w(line + '";\n\n')
+
+    w('const struct ifc_field ifc_fields[] = {\n')
+    for name, off, width, count, sub, fname, l in fields:
+        w('\t{ %d, 0x%x, 0x%x, %d, %s }, /* %s.%s */\n' %
+          (name, off, width, count, sub, l.name, fname))
+    w('};\n\n')
+
+    w('const struct ifc_layout ifc_layouts[] = {\n')
+    for name, size, first, n, flags, lname in rows:
+        w('\t{ %d, 0x%x, %d, %d, %s }, /* %s */\n' % (name, size, first, n, flags, lname))
+    w('};\n\n')
+    w('const unsigned int ifc_nlayouts = %d;\n\n' % len(rows))
+
+    # (layout, field name) -> field, anonymous union members are found by
+    # walking into them
+    keys, key_field = [], []
+    for li, l in enumerate(layouts):
+        seen = set()
+        for fi in range(rows[li][2], rows[li][2] + rows[li][3]):
+            fname = fields[fi][5]
+            if fname and fname not in seen:
+                seen.add(fname)
+                keys.append((li, fname))
+                key_field.append(fi)
+    disp, slots = perfect_hash(keys)
+    w('const u16 ifc_hash_disp[] = {\n')
+    for i in range(0, len(disp), 12):
+        w('\t%s,\n' % ', '.join('%d' % d for d in disp[i:i + 12]))
+    w('};\n\n')
+    w('const u32 ifc_hash_slot[] = {\n')
+    for i in range(0, len(slots), 8):
+        w('\t%s,\n' % ', '.join('%d' % key_field[k] if k is not None else 'IFC_NO_FIELD'
+                              for k in slots[i:i + 8]))
+    w('};\n\n')
+    w('const unsigned int ifc_hash_nbuckets = %d;\n' % len(disp))
+    w('const unsigned int ifc_hash_nslots = %d;\n\n' % len(slots))
+
+    # the C compiler checks the parser's arithmetic
+    for l in parser.order:
+        if not l.tag:
+            continue
+        w('_Static_assert(sizeof(%s) == 0x%x, "%s");\n' % (c_type(l), l.size, l.name))
+        if l.union:
+            continue
+        for name, off, width, count, sub in l.fields:
+            if not name:
+                continue
+            w('_Static_assert(offsetof(%s, %s) == 0x%x, "%s.%s");\n' %
+              (c_type(l), name, off, l.name, name))
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as f:
+        parser = Parser(strip_comments(f.read()))
+    parser.parse()
+    with open(sys.argv[2], 'w') as out:
+        generate(parser, out)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,1189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+/*
+ * In-process mlx5 FW simulator, opened as "sim:[opt=val,...]".
+ *
+ * Answers the commands mlx5ctl issues with PRM shaped responses so the tool
+ * can be benchmarked and the large dump paths exercised on machines without
+ * a NIC or the fwctl module:
+ *
+ *   QUERY_HCA_CAP          every cap type, GENERAL and DEBUG with sane values
+ *   ACCESS_REG             any register, deterministic content, writes stick
+ *   RESOURCE_DUMP reg      menu and resource segments, inline or to umem,
+ *                          chunked with seq_num/more_dump/device_opaque
+ *   CORE_DUMP reg          to umem, continued through the cookie
+ *   QUERY/SET_DIAGNOSTIC_* sampling runs on the wall clock once enabled
+ *   query_* objects        object ids below objs= exist
+ *   ALLOC_PD, CREATE_MKEY  and their destroy counterparts, for the umem paths
+ *
+ * Options, comma separated after "sim:" or in MLX5CTL_SIM (the name wins):
+ *
+ *   lat=<us>          FW latency added to every command, default 0
+ *   jitter=<us>       uniformly random extra latency
+ *   err=<percent>     fail this share of commands
+ *   err_status=<n>    FW status of injected failures, default 0x1
+ *   err_errno=<n>     fail the RPC itself with this errno instead
+ *   err_op=<opcode>   only inject failures into this opcode
+ *   rsc_size=<bytes>  resource segment bytes per resource dump, default 64K
+ *   core_size=<bytes> core dump size, default 1M
+ *   counters=<n>      number of diagnostic counters, default 16
+ *   objs=<n>          number of objects of each query_* type, default 1024
+ *   diag=<log period> start sampling all counters at open, repetitive, with
+ *                     the max number of samples; the sim has no state across
+ *                     processes for a separate "diagcnt set" to leave behind
+ *   seed=<n>          seed for content, jitter and error injection
+ *
+ * Sizes take a K, M or G suffix. Responses only depend on the seed and the
+ * command input, except for diagnostic counter samples which follow time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+#include "mlx5_ifc.h"
+#include "reg.h"
+#include "diag_cnt.h"
+#include "transport.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define SIM_MAX_UMEM 64
+#define SIM_MAX_MKEY 64
+#define SIM_MAX_REGS 64
+#define SIM_MAX_COUNTERS 1024
+#define SIM_REG_DATA_SZ MLX5_UN_SZ_BYTES(ports_control_registers_document)
+#define SIM_RSC_SEG_PAYLOAD 4096
+#define SIM_DEV_FREQ_KHZ 1000000
+#define SIM_LOG_MAX_SAMPLES 12
+#define SIM_LOG_MIN_SAMPLE_PERIOD 8
+
+/* PRM command status */
+enum {
+	SIM_STAT_OK = 0x0,
+	SIM_STAT_INT_ERR = 0x1,
+	SIM_STAT_BAD_OP = 0x2,
+	SIM_STAT_BAD_PARAM = 0x3,
+	SIM_STAT_BAD_SYS_STATE = 0x4,
+	SIM_STAT_BAD_RES = 0x5,
+	SIM_STAT_NO_RES = 0xf,
+	SIM_STAT_BAD_INP_LEN = 0x10,
+	SIM_STAT_BAD_OUTP_LEN = 0x11,
+};
+
+struct sim_opts {
+	u64 lat_ns;
+	u64 jitter_ns;
+	double err_rate; /* 0..1 */
+	int err_status;
+	int err_errno;
+	int err_op; /* -1: any */
+	u64 rsc_size;
+	u64 core_size;
+	int counters;
+	u32 objs;
+	int diag_log_period; /* 0: sampling off until SET_DIAGNOSTIC_PARAMS */
+	u64 seed;
+};
+
+struct sim_umem {
+	u32 id; /* 0: free slot */
+	u8 *addr;
+	size_t len;
+};
+
+struct sim_mkey {
+	u32 index; /* 0: free slot */
+	u64 start;
+	u64 len;
+};
+
+struct sim_reg {
+	u16 reg_id;
+	u32 argument;
+	u32 key; /* first data dword, the port/index selector of most registers */
+	u8 data[SIM_REG_DATA_SZ];
+};
+
+struct mlx5u_sim {
+	pthread_mutex_t lock;
+	struct sim_opts o;
+	u64 rng;
+	u32 next_pd;
+	u32 next_umem;
+	u32 next_mkey;
+	struct sim_umem umems[SIM_MAX_UMEM];
+	struct sim_mkey mkeys[SIM_MAX_MKEY];
+	struct sim_reg *regs;
+	int nregs;
+
+	/* resource dump in progress, device_opaque is gen << 32 | offset */
+	u8 *dump;
+	u32 dump_len;
+	u32 dump_gen;
+	u64 core_off;
+
+	/* diagnostic counters */
+	int diag_enabled;
+	int diag_single;
+	int diag_log_samples;
+	int diag_log_period;
+	int diag_ncounters;
+	u16 diag_counters[SIM_MAX_COUNTERS];
+	u64 diag_start_ns;
+};
+
+typedef int (*sim_handler)(struct mlx5u_sim *sim, void *in, size_t inlen,
+			   void *out, size_t outlen);
+
+static u64 sim_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sim_sleep(u64 ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ull,
+		.tv_nsec = ns % 1000000000ull,
+	};
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static u64 xorshift64(u64 *s)
+{
+	u64 x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+static u64 mix64(u64 x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Deterministic filler: the same key always produces the same bytes */
+static void sim_fill(void *buf, size_t len, u64 key)
+{
+	u64 s = mix64(key) | 1;
+	u8 *p = buf;
+
+	while (len >= 8) {
+		u64 v = xorshift64(&s);
+
+		memcpy(p, &v, 8);
+		p += 8;
+		len -= 8;
+	}
+	if (len) {
+		u64 v = xorshift64(&s);
+
+		memcpy(p, &v, len);
+	}
+}
+
+static u64 sim_key(struct mlx5u_sim *sim, u64 a, u64 b)
+{
+	return mix64(sim->o.seed ^ mix64(a) ^ (b * 0x9e3779b97f4a7c15ull));
+}
+
+/* ------------------------------------------------------------------ */
+/* QUERY_HCA_CAP */
+
+enum {
+	SIM_CAP_GENERAL = 0x0,
+	SIM_CAP_DEBUG = 0xd,
+};
+
+static void sim_cap_general(struct mlx5u_sim *sim, void *cap)
+{
+	MLX5_SET(cmd_hca_cap, cap, vhca_id, 0);
+	MLX5_SET(cmd_hca_cap, cap, log_max_qp, 17);
+	MLX5_SET(cmd_hca_cap, cap, log_max_cq, 24);
+	MLX5_SET(cmd_hca_cap, cap, log_max_eq, 7);
+	MLX5_SET(cmd_hca_cap, cap, log_max_mkey, 24);
+	MLX5_SET(cmd_hca_cap, cap, log_max_pd, 23);
+	MLX5_SET(cmd_hca_cap, cap, log_max_msg, 30);
+	MLX5_SET(cmd_hca_cap, cap, max_num_eqs, 1024);
+	MLX5_SET(cmd_hca_cap, cap, log_pg_sz, 12);
+	MLX5_SET(cmd_hca_cap, cap, port_type, 1); /* ethernet */
+	MLX5_SET(cmd_hca_cap, cap, num_ports, 1);
+	MLX5_SET(cmd_hca_cap, cap, eth_net_offloads, 1);
+	MLX5_SET(cmd_hca_cap, cap, roce, 1);
+	MLX5_SET(cmd_hca_cap, cap, pcam_reg, 1);
+	MLX5_SET(cmd_hca_cap, cap, mcam_reg, 1);
+	MLX5_SET(cmd_hca_cap, cap, qcam_reg, 1);
+	MLX5_SET(cmd_hca_cap, cap, debug, 1);
+	MLX5_SET(cmd_hca_cap, cap, num_of_diagnostic_counters, sim->o.counters);
+	MLX5_SET(cmd_hca_cap, cap, device_frequency_khz, SIM_DEV_FREQ_KHZ);
+}
+
+static u16 sim_counter_id(int i)
+{
+	return i + 1;
+}
+
+static void sim_cap_debug(struct mlx5u_sim *sim, void *cap, size_t len)
+{
+	size_t cntr_sz = MLX5_ST_SZ_BYTES(diagnostic_cntr_layout);
+	size_t off = MLX5_BYTE_OFF(debug_capX, diagnostic_counter);
+
+	MLX5_SET(debug_capX, cap, core_dump_general, 1);
+	MLX5_SET(debug_capX, cap, resource_dump, 1);
+	MLX5_SET(debug_capX, cap, log_max_samples, SIM_LOG_MAX_SAMPLES);
+	MLX5_SET(debug_capX, cap, single, 1);
+	MLX5_SET(debug_capX, cap, repetitive, 1);
+	MLX5_SET(debug_capX, cap, log_min_sample_period, SIM_LOG_MIN_SAMPLE_PERIOD);
+
+	/* the counter list runs past the cap layout, as far as the caller asked */
+	for (int i = 0; i < sim->o.counters && off + (i + 1) * cntr_sz <= len; i++) {
+		void *cntr = MLX5_ADDR_OF(debug_capX, cap, diagnostic_counter[i]);
+
+		MLX5_SET(diagnostic_cntr_layout, cntr, counter_id, sim_counter_id(i));
+		MLX5_SET(diagnostic_cntr_layout, cntr, sync, i & 1);
+	}
+}
+
+static int sim_query_hca_cap(struct mlx5u_sim *sim, void *in, size_t inlen,
+			     void *out, size_t outlen)
+{
+	size_t hdr = MLX5_BYTE_OFF(query_hca_cap_out, capability);
+	u16 op_mod = MLX5_GET(query_hca_cap_in, in, op_mod);
+	void *cap = MLX5_ADDR_OF(query_hca_cap_out, out, capability);
+	size_t len = outlen - hdr;
+
+	if (inlen < MLX5_ST_SZ_BYTES(query_hca_cap_in))
+		return SIM_STAT_BAD_INP_LEN;
+	if (outlen < MLX5_ST_SZ_BYTES(query_hca_cap_out))
+		return SIM_STAT_BAD_OUTP_LEN;
+
+	switch (op_mod >> 1) {
+	case SIM_CAP_GENERAL:
+		sim_cap_general(sim, cap);
+		break;
+	case SIM_CAP_DEBUG:
+		sim_cap_debug(sim, cap, len);
+		break;
+	default:
+		/* max and cur look the same, the type is what tells caps apart */
+		sim_fill(cap, MLX5_UN_SZ_BYTES(hca_cap_union),
+			 sim_key(sim, MLX5_CMD_OP_QUERY_HCA_CAP, op_mod >> 1));
+		break;
+	}
+	return SIM_STAT_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Resource dump */
+
+static const struct {
+	u16 type;
+	const char *name;
+	const char *index1;
+	const char *index2;
+} sim_rsc_menu[] = {
+	{ MLX5_RSC_SGMT_TYPE_DEVICE_DUMP, "DEV_DUMP", "", "" },
+	{ 0x1100, "QPC", "QPN", "" },
+	{ 0x1101, "CQC", "CQN", "" },
+	{ 0x1102, "EQC", "EQN", "" },
+	{ 0x1103, "MKEY", "MKEY_IDX", "" },
+	{ 0x1104, "SQ_WQE", "SQN", "WQE_IDX" },
+};
+
+static void sim_rsc_seg_hdr(void *seg, u16 type, u32 len)
+{
+	MLX5_SET(resource_dump_segment_header, seg, segment_type, type);
+	MLX5_SET(resource_dump_segment_header, seg, length_dw, len / 4);
+}
+
+static int sim_rsc_known(u16 type)
+{
+	if (type == MLX5_RSC_SGMT_TYPE_MENU)
+		return 1;
+	for (int i = 0; i < ARRAY_SIZE(sim_rsc_menu); i++)
+		if (sim_rsc_menu[i].type == type)
+			return 1;
+	return 0;
+}
+
+static u32 sim_rsc_body_len(struct mlx5u_sim *sim, u16 type)
+{
+	u32 seg = MLX5_ST_SZ_BYTES(resource_dump_resource_segment);
+	u32 nsegs;
+
+	if (type == MLX5_RSC_SGMT_TYPE_MENU)
+		return MLX5_ST_SZ_BYTES(resource_dump_menu_segment) +
+		       ARRAY_SIZE(sim_rsc_menu) * MLX5_ST_SZ_BYTES(resource_dump_menu_record);
+	if (!sim_rsc_known(type))
+		return MLX5_ST_SZ_BYTES(resource_dump_error_segment);
+
+	nsegs = (sim->o.rsc_size + SIM_RSC_SEG_PAYLOAD - 1) / SIM_RSC_SEG_PAYLOAD;
+	return nsegs * seg + (sim->o.rsc_size + 3) / 4 * 4;
+}
+
+static void sim_rsc_menu_fill(void *seg)
+{
+	u32 len = MLX5_ST_SZ_BYTES(resource_dump_menu_segment) +
+		  ARRAY_SIZE(sim_rsc_menu) * MLX5_ST_SZ_BYTES(resource_dump_menu_record);
+
+	sim_rsc_seg_hdr(seg, MLX5_RSC_SGMT_TYPE_MENU, len);
+	MLX5_SET(resource_dump_menu_segment, seg, num_of_records, ARRAY_SIZE(sim_rsc_menu));
+	for (int i = 0; i < ARRAY_SIZE(sim_rsc_menu); i++) {
+		void *rec = MLX5_ADDR_OF(resource_dump_menu_segment, seg, record[i]);
+		int has_idx2 = sim_rsc_menu[i].index2[0] != '\0';
+
+		MLX5_SET(resource_dump_menu_record, rec, segment_type, sim_rsc_menu[i].type);
+		MLX5_SET(resource_dump_menu_record, rec, support_index1,
+			 sim_rsc_menu[i].index1[0] != '\0');
+		MLX5_SET(resource_dump_menu_record, rec, support_index2, has_idx2);
+		MLX5_SET(resource_dump_menu_record, rec, support_num_of_obj1, 1);
+		MLX5_SET(resource_dump_menu_record, rec, num_of_obj1_supports_all, 1);
+		/* names are NUL padded strings, not big endian dwords */
+		strncpy(MLX5_ADDR_OF(resource_dump_menu_record, rec, segment_name[0]),
+			sim_rsc_menu[i].name, MLX5_FLD_SZ_BYTES(resource_dump_menu_record, segment_name) - 1);
+		strncpy(MLX5_ADDR_OF(resource_dump_menu_record, rec, index1_name[0]),
+			sim_rsc_menu[i].index1, MLX5_FLD_SZ_BYTES(resource_dump_menu_record, index1_name) - 1);
+		strncpy(MLX5_ADDR_OF(resource_dump_menu_record, rec, index2_name[0]),
+			sim_rsc_menu[i].index2, MLX5_FLD_SZ_BYTES(resource_dump_menu_record, index2_name) - 1);
+	}
+}
+
+/* info, command, body, terminate - the whole answer, handed out in chunks */
+static int sim_rsc_build(struct mlx5u_sim *sim, void *reg)
+{
+	u16 type = MLX5_GET(resource_dump, reg, segment_type);
+	u32 index1 = MLX5_GET(resource_dump, reg, index1);
+	u32 index2 = MLX5_GET(resource_dump, reg, index2);
+	u32 body = sim_rsc_body_len(sim, type);
+	u32 len = MLX5_ST_SZ_BYTES(resource_dump_response) + body +
+		  MLX5_ST_SZ_BYTES(resource_dump_terminate_segment);
+	void *info, *cmd;
+	u8 *p;
+
+	free(sim->dump);
+	sim->dump = calloc(1, len);
+	if (!sim->dump)
+		return -1;
+	sim->dump_len = len;
+	sim->dump_gen++;
+
+	info = MLX5_ADDR_OF(resource_dump_response, sim->dump, info);
+	sim_rsc_seg_hdr(info, MLX5_RSC_SGMT_TYPE_INFO,
+			MLX5_ST_SZ_BYTES(resource_dump_info_segment));
+	MLX5_SET(resource_dump_info_segment, info, dump_version, 1);
+	MLX5_SET(resource_dump_info_segment, info, hw_version, 0x21d);
+	MLX5_SET(resource_dump_info_segment, info, fw_version, 0x1a2b0000);
+
+	cmd = MLX5_ADDR_OF(resource_dump_response, sim->dump, cmd);
+	sim_rsc_seg_hdr(cmd, MLX5_RSC_SGMT_TYPE_CMD,
+			MLX5_ST_SZ_BYTES(resource_dump_command_segment));
+	MLX5_SET(resource_dump_command_segment, cmd, segment_called, type);
+	MLX5_SET(resource_dump_command_segment, cmd, vhca_id,
+		 MLX5_GET(resource_dump, reg, vhca_id));
+	MLX5_SET(resource_dump_command_segment, cmd, index1, index1);
+	MLX5_SET(resource_dump_command_segment, cmd, index2, index2);
+	MLX5_SET(resource_dump_command_segment, cmd, num_of_obj1,
+		 MLX5_GET(resource_dump, reg, num_of_obj1));
+	MLX5_SET(resource_dump_command_segment, cmd, num_of_obj2,
+		 MLX5_GET(resource_dump, reg, num_of_obj2));
+
+	p = MLX5_ADDR_OF(resource_dump_response, sim->dump, segment[0]);
+	if (type == MLX5_RSC_SGMT_TYPE_MENU) {
+		sim_rsc_menu_fill(p);
+	} else if (!sim_rsc_known(type)) {
+		sim_rsc_seg_hdr(p, MLX5_RSC_SGMT_TYPE_ERROR, body);
+		MLX5_SET(resource_dump_error_segment, p, syndrome_id, 0x1);
+		strncpy(MLX5_ADDR_OF(resource_dump_error_segment, p, error[0]),
+			"unknown segment type",
+			MLX5_FLD_SZ_BYTES(resource_dump_error_segment, error) - 1);
+	} else {
+		u32 seg = MLX5_ST_SZ_BYTES(resource_dump_resource_segment);
+		u64 left = sim->o.rsc_size;
+
+		for (u32 i = 0; left; i++) {
+			u32 payload = left < SIM_RSC_SEG_PAYLOAD ? left : SIM_RSC_SEG_PAYLOAD;
+			u32 padded = (payload + 3) / 4 * 4;
+
+			sim_rsc_seg_hdr(p, type, seg + padded);
+			MLX5_SET(resource_dump_resource_segment, p, index1, index1 + i);
+			MLX5_SET(resource_dump_resource_segment, p, index2, index2);
+			sim_fill(p + seg, payload, sim_key(sim, type, (u64)(index1 + i) << 32 | index2));
+			p += seg + padded;
+			left -= payload;
+		}
+	}
+	p = sim->dump + len - MLX5_ST_SZ_BYTES(resource_dump_terminate_segment);
+	sim_rsc_seg_hdr(p, MLX5_RSC_SGMT_TYPE_TERMINATE,
+			MLX5_ST_SZ_BYTES(resource_dump_terminate_segment));
+	return 0;
+}
+
+/* Resolve an mkey + address range to process memory, NULL if not covered */
+static void *sim_mkey_va(struct mlx5u_sim *sim, u32 mkey, u64 addr, u64 len)
+{
+	u32 index = mkey >> 8;
+
+	for (int i = 0; i < SIM_MAX_MKEY; i++) {
+		struct sim_mkey *mk = &sim->mkeys[i];
+
+		if (!mk->index || mk->index != index)
+			continue;
+		if (addr < mk->start || addr + len > mk->start + mk->len)
+			return NULL;
+		/* in-process: the mkey start address is a VA of a registered umem */
+		return (void *)(uintptr_t)addr;
+	}
+	return NULL;
+}
+
+static int sim_reg_resource_dump(struct mlx5u_sim *sim, void *reg_in, void *reg_out)
+{
+	size_t inline_max = MLX5_FLD_SZ_BYTES(resource_dump, inline_data);
+	u32 in_seq = MLX5_GET(resource_dump, reg_in, seq_num);
+	u64 opaque = MLX5_GET64(resource_dump, reg_in, device_opaque);
+	int inline_dump = MLX5_GET(resource_dump, reg_in, inline_dump);
+	u32 off, chunk;
+	void *dst;
+
+	if (!MLX5_GET(resource_dump, reg_in, more_dump)) {
+		if (sim_rsc_build(sim, reg_in))
+			return SIM_STAT_NO_RES;
+		off = 0;
+	} else {
+		/* a continuation must hand back what the previous chunk returned */
+		if (!sim->dump || opaque >> 32 != sim->dump_gen)
+			return SIM_STAT_BAD_PARAM;
+		off = (u32)opaque;
+		if (off >= sim->dump_len)
+			return SIM_STAT_BAD_PARAM;
+	}
+
+	chunk = sim->dump_len - off;
+	if (inline_dump) {
+		if (chunk > inline_max)
+			chunk = inline_max;
+		dst = MLX5_ADDR_OF(resource_dump, reg_out, inline_data);
+	} else {
+		u32 size = MLX5_GET(resource_dump, reg_in, size);
+
+		if (!size)
+			return SIM_STAT_BAD_PARAM;
+		if (chunk > size)
+			chunk = size;
+		dst = sim_mkey_va(sim, MLX5_GET(resource_dump, reg_in, mkey),
+				  MLX5_GET64(resource_dump, reg_in, address), chunk);
+		if (!dst)
+			return SIM_STAT_BAD_RES;
+	}
+	memcpy(dst, sim->dump + off, chunk);
+	off += chunk;
+
+	/* everything the caller must echo back on the next call */
+	MLX5_SET(resource_dump, reg_out, segment_type, MLX5_GET(resource_dump, reg_in, segment_type));
+	MLX5_SET(resource_dump, reg_out, vhca_id, MLX5_GET(resource_dump, reg_in, vhca_id));
+	MLX5_SET(resource_dump, reg_out, index1, MLX5_GET(resource_dump, reg_in, index1));
+	MLX5_SET(resource_dump, reg_out, index2, MLX5_GET(resource_dump, reg_in, index2));
+	MLX5_SET(resource_dump, reg_out, num_of_obj1, MLX5_GET(resource_dump, reg_in, num_of_obj1));
+	MLX5_SET(resource_dump, reg_out, num_of_obj2, MLX5_GET(resource_dump, reg_in, num_of_obj2));
+	MLX5_SET(resource_dump, reg_out, inline_dump, inline_dump);
+	MLX5_SET(resource_dump, reg_out, mkey, MLX5_GET(resource_dump, reg_in, mkey));
+	MLX5_SET64(resource_dump, reg_out, address, MLX5_GET64(resource_dump, reg_in, address));
+	MLX5_SET(resource_dump, reg_out, seq_num, (in_seq + 1) & 0xf);
+	MLX5_SET(resource_dump, reg_out, size, chunk);
+	MLX5_SET(resource_dump, reg_out, more_dump, off < sim->dump_len);
+	MLX5_SET64(resource_dump, reg_out, device_opaque, (u64)sim->dump_gen << 32 | off);
+
+	if (off == sim->dump_len) {
+		free(sim->dump);
+		sim->dump = NULL;
+	}
+	return SIM_STAT_OK;
+}
+
+static int sim_reg_core_dump(struct mlx5u_sim *sim, void *reg_in, void *reg_out)
+{
+	u32 size = MLX5_GET(core_dump_reg, reg_in, size);
+	u64 addr = MLX5_GET64(core_dump_reg, reg_in, address);
+	u64 cookie = MLX5_GET64(core_dump_reg, reg_in, cookie);
+	u64 off = cookie ? sim->core_off : 0;
+	u64 chunk = sim->o.core_size - off;
+	void *dst;
+
+	if (MLX5_GET(core_dump_reg, reg_in, core_dump_type) !=
+	    MLX5_CORE_DUMP_REG_CORE_DUMP_TYPE_CR_DUMP_TO_MEM)
+		return SIM_STAT_BAD_PARAM;
+	if (!size || off > sim->o.core_size)
+		return SIM_STAT_BAD_PARAM;
+	if (chunk > size)
+		chunk = size;
+
+	dst = sim_mkey_va(sim, MLX5_GET(core_dump_reg, reg_in, mkey), addr, chunk);
+	if (!dst)
+		return SIM_STAT_BAD_RES;
+	/* CR space is addressed by offset, fill in 4K pages keyed by offset */
+	for (u64 done = 0; done < chunk; ) {
+		u64 page = off + done;
+		u64 n = chunk - done < 4096 ? chunk - done : 4096;
+
+		sim_fill((u8 *)dst + done, n, sim_key(sim, MLX5_REG_CORE_DUMP, page));
+		done += n;
+	}
+	off += chunk;
+	sim->core_off = off;
+
+	MLX5_SET(core_dump_reg, reg_out, core_dump_type,
+		 MLX5_CORE_DUMP_REG_CORE_DUMP_TYPE_CR_DUMP_TO_MEM);
+	MLX5_SET(core_dump_reg, reg_out, mkey, MLX5_GET(core_dump_reg, reg_in, mkey));
+	MLX5_SET64(core_dump_reg, reg_out, address, addr);
+	MLX5_SET(core_dump_reg, reg_out, size, chunk);
+	MLX5_SET(core_dump_reg, reg_out, more_dump, off < sim->o.core_size);
+	MLX5_SET64(core_dump_reg, reg_out, cookie, off < sim->o.core_size ? off : 0);
+	return SIM_STAT_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* ACCESS_REG */
+
+static struct sim_reg *sim_reg_find(struct mlx5u_sim *sim, u16 reg_id, u32 arg, u32 key)
+{
+	for (int i = 0; i < sim->nregs; i++)
+		if (sim->regs[i].reg_id == reg_id && sim->regs[i].argument == arg &&
+		    sim->regs[i].key == key)
+			return &sim->regs[i];
+	return NULL;
+}
+
+static int sim_access_reg(struct mlx5u_sim *sim, void *in, size_t inlen,
+			  void *out, size_t outlen)
+{
+	size_t in_hdr = MLX5_ST_SZ_BYTES(access_register_in);
+	size_t out_hdr = MLX5_ST_SZ_BYTES(access_register_out);
+	u16 reg_id = MLX5_GET(access_register_in, in, register_id);
+	u32 arg = MLX5_GET(access_register_in, in, argument);
+	int read = MLX5_GET(access_register_in, in, op_mod);
+	void *data_in = MLX5_ADDR_OF(access_register_in, in, register_data);
+	void *data_out = MLX5_ADDR_OF(access_register_out, out, register_data);
+	size_t in_sz, out_sz;
+	struct sim_reg *reg;
+	u32 key = 0;
+
+	if (inlen < in_hdr)
+		return SIM_STAT_BAD_INP_LEN;
+	if (outlen < out_hdr)
+		return SIM_STAT_BAD_OUTP_LEN;
+	in_sz = inlen - in_hdr;
+	out_sz = outlen - out_hdr;
+	if (in_sz >= 4)
+		key = *(u32 *)data_in;
+
+	switch (reg_id) {
+	case MLX5_REG_RESOURCE_DUMP:
+		if (in_sz < MLX5_ST_SZ_BYTES(resource_dump) ||
+		    out_sz < MLX5_ST_SZ_BYTES(resource_dump))
+			return SIM_STAT_BAD_PARAM;
+		return sim_reg_resource_dump(sim, data_in, data_out);
+	case MLX5_REG_CORE_DUMP:
+		if (in_sz < MLX5_ST_SZ_BYTES(core_dump_reg) ||
+		    out_sz < MLX5_ST_SZ_BYTES(core_dump_reg))
+			return SIM_STAT_BAD_PARAM;
+		return sim_reg_core_dump(sim, data_in, data_out);
+	default:
+		break;
+	}
+
+	reg = sim_reg_find(sim, reg_id, arg, key);
+	if (!read) {
+		if (!reg) {
+			if (sim->nregs == SIM_MAX_REGS)
+				return SIM_STAT_NO_RES;
+			if (!sim->regs) {
+				sim->regs = calloc(SIM_MAX_REGS, sizeof(*sim->regs));
+				if (!sim->regs)
+					return SIM_STAT_NO_RES;
+			}
+			reg = &sim->regs[sim->nregs++];
+			reg->reg_id = reg_id;
+			reg->argument = arg;
+			reg->key = key;
+		}
+		memset(reg->data, 0, sizeof(reg->data));
+		memcpy(reg->data, data_in, in_sz < sizeof(reg->data) ? in_sz : sizeof(reg->data));
+	}
+
+	if (reg) {
+		memcpy(data_out, reg->data, out_sz < sizeof(reg->data) ? out_sz : sizeof(reg->data));
+		return SIM_STAT_OK;
+	}
+
+	/* never written: content keyed by the register and its selector */
+	sim_fill(data_out, out_sz, sim_key(sim, reg_id, (u64)arg << 32 | key));
+	if (out_sz >= 4)
+		*(u32 *)data_out = key;
+	return SIM_STAT_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Diagnostic counters */
+
+static int sim_set_diag_params(struct mlx5u_sim *sim, void *in, size_t inlen,
+			       void *out, size_t outlen)
+{
+	void *ctx = MLX5_ADDR_OF(set_diagnostic_params_in, in, diagnostic_params_context);
+	size_t hdr = MLX5_ST_SZ_BYTES(set_diagnostic_params_in);
+	int n, log_samples, log_period;
+
+	if (inlen < hdr)
+		return SIM_STAT_BAD_INP_LEN;
+
+	if (MLX5_GET(diagnostic_params_context, ctx, clear))
+		sim->diag_start_ns = sim_now_ns();
+	if (!MLX5_GET(diagnostic_params_context, ctx, enable)) {
+		sim->diag_enabled = 0;
+		return SIM_STAT_OK;
+	}
+
+	n = MLX5_GET(diagnostic_params_context, ctx, num_of_counters);
+	log_samples = MLX5_GET(diagnostic_params_context, ctx, log_num_of_samples);
+	log_period = MLX5_GET(diagnostic_params_context, ctx, log_sample_period);
+	if (!n || n > sim->o.counters ||
+	    inlen < hdr + n * MLX5_ST_SZ_BYTES(counter_id))
+		return SIM_STAT_BAD_PARAM;
+	if (log_samples > SIM_LOG_MAX_SAMPLES || log_period < SIM_LOG_MIN_SAMPLE_PERIOD ||
+	    log_period > 40)
+		return SIM_STAT_BAD_PARAM;
+
+	for (int i = 0; i < n; i++) {
+		void *cid = MLX5_ADDR_OF(diagnostic_params_context, ctx, counter_id[i]);
+		u16 id = MLX5_GET(counter_id, cid, counter_id);
+
+		if (!id || id > sim->o.counters)
+			return SIM_STAT_BAD_PARAM;
+		sim->diag_counters[i] = id;
+	}
+	sim->diag_ncounters = n;
+	sim->diag_log_samples = log_samples;
+	sim->diag_log_period = log_period;
+	sim->diag_single = MLX5_GET(diagnostic_params_context, ctx, single);
+	sim->diag_start_ns = sim_now_ns();
+	sim->diag_enabled = 1;
+	return SIM_STAT_OK;
+}
+
+static int sim_query_diag_params(struct mlx5u_sim *sim, void *in, size_t inlen,
+				 void *out, size_t outlen)
+{
+	void *ctx = MLX5_ADDR_OF(query_diagnostic_params_out, out, diagnostic_params_context);
+	size_t hdr = MLX5_ST_SZ_BYTES(query_diagnostic_params_out);
+
+	if (outlen < hdr)
+		return SIM_STAT_BAD_OUTP_LEN;
+
+	MLX5_SET(diagnostic_params_context, ctx, enable, sim->diag_enabled);
+	if (!sim->diag_ncounters)
+		return SIM_STAT_OK;
+	MLX5_SET(diagnostic_params_context, ctx, num_of_counters, sim->diag_ncounters);
+	MLX5_SET(diagnostic_params_context, ctx, log_num_of_samples, sim->diag_log_samples);
+	MLX5_SET(diagnostic_params_context, ctx, log_sample_period, sim->diag_log_period);
+	MLX5_SET(diagnostic_params_context, ctx, single, sim->diag_single);
+	MLX5_SET(diagnostic_params_context, ctx, repetitive, !sim->diag_single);
+	for (int i = 0; i < sim->diag_ncounters &&
+	     hdr + (i + 1) * MLX5_ST_SZ_BYTES(counter_id) <= outlen; i++) {
+		void *cid = MLX5_ADDR_OF(diagnostic_params_context, ctx, counter_id[i]);
+
+		MLX5_SET(counter_id, cid, counter_id, sim->diag_counters[i]);
+	}
+	return SIM_STAT_OK;
+}
+
+/* Counters cross 32 bits early so both halves of the value get exercised */
+static u64 sim_counter_value(u16 id, u64 sample)
+{
+	return ((u64)id << 32) + sample * (id * 1000ull + 1);
+}
+
+static int sim_query_diag_counters(struct mlx5u_sim *sim, void *in, size_t inlen,
+				   void *out, size_t outlen)
+{
+	size_t hdr = MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_out);
+	size_t entry = MLX5_ST_SZ_BYTES(diagnostic_cntr_struct);
+	u32 num = MLX5_GET(query_diagnostic_cntrs_in, in, num_of_samples);
+	u32 index = MLX5_GET(query_diagnostic_cntrs_in, in, sample_index);
+	u64 period_ns, produced, nsamples, buf_sz;
+
+	if (inlen < MLX5_ST_SZ_BYTES(query_diagnostic_cntrs_in))
+		return SIM_STAT_BAD_INP_LEN;
+	if (outlen < hdr + num * entry)
+		return SIM_STAT_BAD_OUTP_LEN;
+	if (!sim->diag_ncounters)
+		return SIM_STAT_BAD_SYS_STATE;
+
+	nsamples = 1ull << sim->diag_log_samples;
+	buf_sz = nsamples * sim->diag_ncounters;
+	if (index >= buf_sz || num > buf_sz)
+		return SIM_STAT_BAD_PARAM;
+
+	/* the buffer holds one row of all counters per sample, as a ring */
+	period_ns = ((1ull << sim->diag_log_period) * 1000000ull) / SIM_DEV_FREQ_KHZ;
+	if (!period_ns)
+		period_ns = 1;
+	produced = sim->diag_enabled ?
+		   (sim_now_ns() - sim->diag_start_ns) / period_ns + 1 : 0;
+	if (sim->diag_single && produced > nsamples)
+		produced = nsamples;
+
+	for (u32 i = 0; i < num; i++) {
+		void *cnt = MLX5_ADDR_OF(query_diagnostic_cntrs_out, out, diag_counter[i]);
+		u64 slot = (index + i) % buf_sz;
+		u64 row = slot / sim->diag_ncounters;
+		u16 id = sim->diag_counters[slot % sim->diag_ncounters];
+		u64 sample, value;
+
+		if (row >= produced)
+			continue; /* not sampled yet */
+		sample = row + (produced - 1 - row) / nsamples * nsamples;
+		value = sim_counter_value(id, sample);
+		MLX5_SET(diagnostic_cntr_struct, cnt, counter_id, id);
+		MLX5_SET(diagnostic_cntr_struct, cnt, sample_id, sample & 0xffff);
+		MLX5_SET(diagnostic_cntr_struct, cnt, time_stamp_31_0,
+			 (u32)(sample << sim->diag_log_period));
+		MLX5_SET(diagnostic_cntr_struct, cnt, counter_value_h, value >> 32);
+		MLX5_SET(diagnostic_cntr_struct, cnt, counter_value_l, (u32)value);
+	}
+	return SIM_STAT_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* PD, mkey and query_* objects */
+
+static int sim_alloc_pd(struct mlx5u_sim *sim, void *in, size_t inlen,
+			void *out, size_t outlen)
+{
+	if (outlen < MLX5_ST_SZ_BYTES(alloc_pd_out))
+		return SIM_STAT_BAD_OUTP_LEN;
+	MLX5_SET(alloc_pd_out, out, pd, ++sim->next_pd);
+	return SIM_STAT_OK;
+}
+
+static int sim_nop(struct mlx5u_sim *sim, void *in, size_t inlen,
+		   void *out, size_t outlen)
+{
+	return SIM_STAT_OK;
+}
+
+static int sim_create_mkey(struct mlx5u_sim *sim, void *in, size_t inlen,
+			   void *out, size_t outlen)
+{
+	void *mkc = MLX5_ADDR_OF(create_mkey_in, in, memory_key_mkey_entry);
+	u32 umem_id = MLX5_GET(create_mkey_in, in, mkey_umem_id);
+	u64 start = MLX5_GET64(mkc, mkc, start_addr);
+	u64 len = MLX5_GET64(mkc, mkc, len);
+	struct sim_umem *umem = NULL;
+
+	if (inlen < MLX5_ST_SZ_BYTES(create_mkey_in))
+		return SIM_STAT_BAD_INP_LEN;
+	if (outlen < MLX5_ST_SZ_BYTES(create_mkey_out))
+		return SIM_STAT_BAD_OUTP_LEN;
+
+	if (MLX5_GET(create_mkey_in, in, mkey_umem_valid)) {
+		for (int i = 0; i < SIM_MAX_UMEM; i++)
+			if (sim->umems[i].id && sim->umems[i].id == umem_id)
+				umem = &sim->umems[i];
+		if (!umem || start < (uintptr_t)umem->addr ||
+		    start + len > (uintptr_t)umem->addr + umem->len)
+			return SIM_STAT_BAD_PARAM;
+	}
+
+	for (int i = 0; i < SIM_MAX_MKEY; i++) {
+		struct sim_mkey *mk = &sim->mkeys[i];
+
+		if (mk->index)
+			continue;
+		/* only umem backed mkeys can be the target of a dump */
+		mk->index = ++sim->next_mkey;
+		mk->start = umem ? start : 0;
+		mk->len = umem ? len : 0;
+		MLX5_SET(create_mkey_out, out, mkey_index, mk->index);
+		return SIM_STAT_OK;
+	}
+	return SIM_STAT_NO_RES;
+}
+
+static int sim_destroy_mkey(struct mlx5u_sim *sim, void *in, size_t inlen,
+			    void *out, size_t outlen)
+{
+	u32 index = MLX5_GET(destroy_mkey_in, in, mkey_index);
+
+	for (int i = 0; i < SIM_MAX_MKEY; i++) {
+		if (sim->mkeys[i].index && sim->mkeys[i].index == index) {
+			memset(&sim->mkeys[i], 0, sizeof(sim->mkeys[i]));
+			return SIM_STAT_OK;
+		}
+	}
+	return SIM_STAT_BAD_RES;
+}
+
+/*
+ * Objects are addressed by the 24 bit number in dword 2 for every query
+ * mlx5ctl issues (qpn, cqn, eq_number, ...). Those without one query 0.
+ */
+static int sim_query_obj(struct mlx5u_sim *sim, void *in, size_t inlen,
+			 void *out, size_t outlen)
+{
+	u16 opcode = MLX5_GET(mbox_in, in, opcode);
+	u32 obj_id = 0;
+
+	if (inlen >= 12)
+		obj_id = be32_to_cpu(((__be32 *)in)[2]) & 0xffffff;
+	if (obj_id >= sim->o.objs)
+		return SIM_STAT_BAD_RES;
+
+	sim_fill((u8 *)out + MLX5_ST_SZ_BYTES(mbox_out), outlen - MLX5_ST_SZ_BYTES(mbox_out),
+		 sim_key(sim, opcode, obj_id));
+	return SIM_STAT_OK;
+}
+
+static const struct {
+	u16 opcode;
+	sim_handler handler;
+} sim_cmds[] = {
+	{ MLX5_CMD_OP_QUERY_HCA_CAP, sim_query_hca_cap },
+	{ MLX5_CMD_OP_ACCESS_REG, sim_access_reg },
+	{ MLX5_CMD_OP_QUERY_DIAGNOSTIC_PARAMS, sim_query_diag_params },
+	{ MLX5_CMD_OP_SET_DIAGNOSTIC_PARAMS, sim_set_diag_params },
+	{ MLX5_CMD_OP_QUERY_DIAGNOSTIC_COUNTERS, sim_query_diag_counters },
+	{ MLX5_CMD_OP_ALLOC_PD, sim_alloc_pd },
+	{ MLX5_CMD_OP_DEALLOC_PD, sim_nop },
+	{ MLX5_CMD_OP_CREATE_MKEY, sim_create_mkey },
+	{ MLX5_CMD_OP_DESTROY_MKEY, sim_destroy_mkey },
+	{ MLX5_CMD_OP_QUERY_ADAPTER, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_CONG_PARAMS, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_CONG_STATISTICS, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_CONG_STATUS, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_CQ, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_DCT, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_EQ, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_ESW_FUNCTIONS, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_ESW_VPORT_CONTEXT, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_ISSI, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_L2_TABLE_ENTRY, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_LAG, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_MAD_DEMUX, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_MKEY, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_MODIFY_HEADER_CONTEXT, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_PACKET_REFORMAT_CONTEXT, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_PAGES, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_QP, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_Q_COUNTER, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_RMP, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_RQ, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_RQT, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_SPECIAL_CONTEXTS, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_SQ, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_SRQ, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_TIR, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_TIS, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_VHCA_MIGRATION_STATE, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_VNIC_ENV, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_VPORT_COUNTER, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_VPORT_STATE, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_WOL_ROL, sim_query_obj },
+	{ MLX5_CMD_OP_QUERY_XRC_SRQ, sim_query_obj },
+};
+
+static sim_handler sim_find_handler(u16 opcode)
+{
+	for (int i = 0; i < ARRAY_SIZE(sim_cmds); i++)
+		if (sim_cmds[i].opcode == opcode)
+			return sim_cmds[i].handler;
+	return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Transport */
+
+static int sim_cmd(struct mlx5u_dev *dev, void *in, size_t inlen, void *out,
+		   size_t outlen, u64 *lat_ns)
+{
+	struct mlx5u_sim *sim = dev->priv;
+	u16 opcode, op_mod;
+	sim_handler handler;
+	u64 delay;
+	int status;
+
+	if (inlen < MLX5_ST_SZ_BYTES(mbox_in) || outlen < MLX5_ST_SZ_BYTES(mbox_out)) {
+		errno = EINVAL;
+		return -1;
+	}
+	opcode = MLX5_GET(mbox_in, in, opcode);
+	op_mod = MLX5_GET(mbox_in, in, op_mod);
+	memset(out, 0, outlen);
+
+	pthread_mutex_lock(&sim->lock);
+	delay = sim->o.lat_ns;
+	if (sim->o.jitter_ns)
+		delay += xorshift64(&sim->rng) % sim->o.jitter_ns;
+
+	if (sim->o.err_rate > 0 && (sim->o.err_op < 0 || sim->o.err_op == opcode) &&
+	    (xorshift64(&sim->rng) >> 11) * (1.0 / (1ull << 53)) < sim->o.err_rate) {
+		pthread_mutex_unlock(&sim->lock);
+		dbg_msg(2, "sim: injecting failure into opcode 0x%x op_mod 0x%x\n",
+			opcode, op_mod);
+		if (delay)
+			sim_sleep(delay);
+		if (sim->o.err_errno) {
+			errno = sim->o.err_errno;
+			return -1;
+		}
+		MLX5_SET(mbox_out, out, status, sim->o.err_status);
+		MLX5_SET(mbox_out, out, syndrome, 0x5e000000 | opcode);
+		return 0;
+	}
+
+	handler = sim_find_handler(opcode);
+	status = handler ? handler(sim, in, inlen, out, outlen) : SIM_STAT_BAD_OP;
+	pthread_mutex_unlock(&sim->lock);
+
+	if (delay)
+		sim_sleep(delay);
+	if (status) {
+		dbg_msg(2, "sim: opcode 0x%x op_mod 0x%x status 0x%x\n", opcode, op_mod, status);
+		memset(out, 0, outlen);
+		MLX5_SET(mbox_out, out, status, status);
+		MLX5_SET(mbox_out, out, syndrome, (u32)sim_key(sim, opcode, status));
+	}
+	return 0;
+}
+
+static int sim_info(struct mlx5u_dev *dev, struct mlx5u_dev_info *info)
+{
+	info->uid = 1;
+	info->uctx_caps = 0x3;
+	snprintf(info->desc.ctldev, sizeof(info->desc.ctldev), "sim");
+	snprintf(info->desc.mdev, sizeof(info->desc.mdev), "%s", dev->mdev);
+	info->desc.numa_node = -1;
+	return 0;
+}
+
+static int sim_umem_reg(struct mlx5u_dev *dev, void *addr, size_t len)
+{
+	struct mlx5u_sim *sim = dev->priv;
+	int id = -1;
+
+	pthread_mutex_lock(&sim->lock);
+	for (int i = 0; i < SIM_MAX_UMEM; i++) {
+		if (sim->umems[i].id)
+			continue;
+		sim->umems[i].id = ++sim->next_umem;
+		sim->umems[i].addr = addr;
+		sim->umems[i].len = len;
+		id = sim->umems[i].id;
+		break;
+	}
+	pthread_mutex_unlock(&sim->lock);
+	if (id < 0)
+		errno = ENOSPC;
+	return id;
+}
+
+static int sim_umem_unreg(struct mlx5u_dev *dev, u32 umem_id)
+{
+	struct mlx5u_sim *sim = dev->priv;
+	int ret = -1;
+
+	pthread_mutex_lock(&sim->lock);
+	for (int i = 0; i < SIM_MAX_UMEM; i++) {
+		if (sim->umems[i].id && sim->umems[i].id == umem_id) {
+			memset(&sim->umems[i], 0, sizeof(sim->umems[i]));
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim->lock);
+	if (ret)
+		errno = ENOENT;
+	return ret;
+}
+
+static void sim_close(struct mlx5u_dev *dev)
+{
+	struct mlx5u_sim *sim = dev->priv;
+
+	pthread_mutex_destroy(&sim->lock);
+	free(sim->dump);
+	free(sim->regs);
+	free(sim);
+}
+
+static const struct mlx5u_transport_ops sim_ops = {
+	.name = "sim",
+	.scheduled = 1,
+	.cmd = sim_cmd,
+	.info = sim_info,
+	.umem_reg = sim_umem_reg,
+	.umem_unreg = sim_umem_unreg,
+	.close = sim_close,
+};
+
+static int parse_size(const char *str, u64 *val)
+{
+	char *end;
+
+	*val = strtoull(str, &end, 0);
+	switch (*end) {
+	case 'G': case 'g':
+		*val <<= 10;
+		/* fallthrough */
+	case 'M': case 'm':
+		*val <<= 10;
+		/* fallthrough */
+	case 'K': case 'k':
+		*val <<= 10;
+		end++;
+		break;
+	default:
+		break;
+	}
+	return end == str || *end ? -1 : 0;
+}
+
+static int sim_parse_opts(struct sim_opts *o, const char *str)
+{
+	char *opts, *save = NULL;
+	int err = 0;
+
+	if (!str || !str[0])
+		return 0;
+	opts = strdup(str);
+	if (!opts)
+		return -1;
+
+	for (char *tok = strtok_r(opts, ",", &save); tok && !err;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *val = strchr(tok, '=');
+		u64 v = 0;
+
+		if (!val) {
+			err_msg("sim: option \"%s\" needs a value\n", tok);
+			err = -1;
+			break;
+		}
+		*val++ = '\0';
+
+		if (!strcmp(tok, "err")) {
+			o->err_rate = strtod(val, NULL) / 100.0;
+			continue;
+		}
+		if (parse_size(val, &v)) {
+			err_msg("sim: bad value \"%s\" for %s\n", val, tok);
+			err = -1;
+		} else if (!strcmp(tok, "lat")) {
+			o->lat_ns = v * 1000;
+		} else if (!strcmp(tok, "jitter")) {
+			o->jitter_ns = v * 1000;
+		} else if (!strcmp(tok, "err_status")) {
+			o->err_status = v;
+		} else if (!strcmp(tok, "err_errno")) {
+			o->err_errno = v;
+		} else if (!strcmp(tok, "err_op")) {
+			o->err_op = v;
+		} else if (!strcmp(tok, "rsc_size")) {
+			o->rsc_size = v;
+		} else if (!strcmp(tok, "core_size")) {
+			o->core_size = v;
+		} else if (!strcmp(tok, "counters")) {
+			o->counters = v;
+		} else if (!strcmp(tok, "objs")) {
+			o->objs = v;
+		} else if (!strcmp(tok, "diag")) {
+			o->diag_log_period = v;
+		} else if (!strcmp(tok, "seed")) {
+			o->seed = v;
+		} else {
+			err_msg("sim: unknown option \"%s\"\n", tok);
+			err = -1;
+		}
+	}
+	free(opts);
+
+	if (!err && o->diag_log_period &&
+	    (o->diag_log_period < SIM_LOG_MIN_SAMPLE_PERIOD || o->diag_log_period > 40)) {
+		err_msg("sim: diag sample period must be %d..40\n", SIM_LOG_MIN_SAMPLE_PERIOD);
+		err = -1;
+	}
+	if (!err && (o->counters < 1 || o->counters > SIM_MAX_COUNTERS)) {
+		err_msg("sim: counters must be 1..%d\n", SIM_MAX_COUNTERS);
+		err = -1;
+	}
+	/* the dump length and offsets travel in 32 bit fields */
+	if (!err && (o->rsc_size > (1ull << 30) || o->core_size > (1ull << 31))) {
+		err_msg("sim: rsc_size is limited to 1G and core_size to 2G\n");
+		err = -1;
+	}
+	return err;
+}
+
+int mlx5u_sim_transport_open(struct mlx5u_dev *dev, const char *arg)
+{
+	struct mlx5u_sim *sim;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return -1;
+
+	sim->o = (struct sim_opts) {
+		.err_status = SIM_STAT_INT_ERR,
+		.err_op = -1,
+		.rsc_size = 64 << 10,
+		.core_size = 1 << 20,
+		.counters = 16,
+		.objs = 1024,
+		.seed = 1,
+	};
+	if (sim_parse_opts(&sim->o, getenv("MLX5CTL_SIM")) ||
+	    sim_parse_opts(&sim->o, arg)) {
+		free(sim);
+		errno = EINVAL;
+		return -1;
+	}
+	sim->rng = mix64(sim->o.seed) | 1;
+	pthread_mutex_init(&sim->lock, NULL);
+	if (sim->o.diag_log_period) {
+		sim->diag_ncounters = sim->o.counters;
+		for (int i = 0; i < sim->diag_ncounters; i++)
+			sim->diag_counters[i] = sim_counter_id(i);
+		sim->diag_log_samples = SIM_LOG_MAX_SAMPLES;
+		sim->diag_log_period = sim->o.diag_log_period;
+		sim->diag_start_ns = sim_now_ns();
+		sim->diag_enabled = 1;
+	}
+
+	dev->ops = &sim_ops;
+	dev->priv = sim;
+	snprintf(dev->devname, sizeof(dev->devname), "sim:%s", arg);
+	snprintf(dev->mdev, sizeof(dev->mdev), "sim");
+	dbg_msg(1, "sim: lat %lluus jitter %lluus err %.2f%% rsc_size %llu core_size %llu counters %d\n",
+		(unsigned long long)sim->o.lat_ns / 1000,
+		(unsigned long long)sim->o.jitter_ns / 1000, sim->o.err_rate * 100,
+		(unsigned long long)sim->o.rsc_size, (unsigned long long)sim->o.core_size,
+		sim->o.counters);
+	return 0;
+}
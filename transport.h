@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024, NVIDIA CORPORATION & AFFILIATES. All rights reserved. */
+
+#ifndef __MLX5CTL_TRANSPORT_H__
+#define __MLX5CTL_TRANSPORT_H__
+
+#include <stddef.h>
+#include "mlx5ctlu.h"
+#include "ifcutil.h"
+
+/*
+ * A transport carries FW commands for a struct mlx5u_dev: the kernel fwctl
+ * ioctl, a replay file, the FW simulator or a daemon socket. mlx5u_open()
+ * picks one by the "<prefix>:" of the device name, fwctl by default.
+ */
+
+struct mlx5u_dev_info {
+	u32 uid;
+	u32 uctx_caps;
+	struct mlx5ctl_dev desc; /* whatever the transport knows, may be empty */
+};
+
+struct mlx5u_transport_ops {
+	const char *name;
+	int scheduled; /* commands reach the FW (or sim) here, see sched.h */
+	/*
+	 * Same contract as the FWCTL_RPC ioctl: 0 and the FW response in out,
+	 * or -1 with errno set. A transport that knows the FW latency better
+	 * than the caller's wall clock (replay, daemon) reports it in lat_ns.
+	 */
+	int (*cmd)(struct mlx5u_dev *dev, void *in, size_t inlen, void *out,
+		   size_t outlen, u64 *lat_ns);
+	int (*info)(struct mlx5u_dev *dev, struct mlx5u_dev_info *info);
+	int (*umem_reg)(struct mlx5u_dev *dev, void *addr, size_t len);
+	int (*umem_unreg)(struct mlx5u_dev *dev, u32 umem_id);
+	void (*close)(struct mlx5u_dev *dev);
+	/*
+	 * Optional: open another independent context of dev into ctx, e.g. a
+	 * new fwctl fd with its own FW UID. Without it pool contexts share
+	 * dev's transport, see pool.h.
+	 */
+	int (*dup)(struct mlx5u_dev *dev, struct mlx5u_dev *ctx);
+};
+
+/* Command buffers reused across calls, see mlx5u_mbox_get() */
+struct mlx5u_mbox {
+	void *in;
+	void *out;
+	size_t in_cap;
+	size_t out_cap;
+	size_t inlen;  /* of the command currently built */
+	size_t outlen;
+};
+
+struct mlx5u_dev {
+	char devname[DEV_NAME_MAX];
+	char mdev[DEV_NAME_MAX]; /* parent device, empty if unknown */
+	const struct mlx5u_transport_ops *ops;
+	int fd;     /* fwctl char device, -1 for other transports */
+	void *priv; /* transport private */
+	struct mlx5u_mbox mbox;
+	struct mlx5u_capcache *caps; /* see capcache.h */
+	struct mlx5u_sched *sched;   /* see sched.h */
+	struct mlx5u_dev *base;      /* pool context sharing base's transport */
+};
+
+struct mlx5u_transport {
+	const char *prefix;
+	/* fill in dev->ops, devname and priv from the name after the prefix */
+	int (*open)(struct mlx5u_dev *dev, const char *arg);
+};
+
+/* Name selects a transport other than fwctl, e.g. "sim:lat=10,err=1" */
+int mlx5u_transport_name(const char *name);
+
+/* Raw command through the transport, no status checks or error prints */
+int mlx5u_transport_cmd(struct mlx5u_dev *dev, void *in, size_t inlen,
+			void *out, size_t outlen);
+int mlx5u_transport_info(struct mlx5u_dev *dev, struct mlx5u_dev_info *info);
+
+int mlx5u_replay_transport_open(struct mlx5u_dev *dev, const char *path);
+int mlx5u_daemon_transport_open(struct mlx5u_dev *dev, const char *arg);
+int mlx5u_sim_transport_open(struct mlx5u_dev *dev, const char *arg);
+
+#endif /* __MLX5CTL_TRANSPORT_H__ */